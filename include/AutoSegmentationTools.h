@@ -46,13 +46,44 @@ namespace CCCoreLib
 			\param sixConnexity indicates if the CC's 3D connexity should be 6 (26 otherwise)
 			\param progressCb the client application can get some notification of the process progress through this callback mechanism (see GenericProgressCallback)
 			\param inputOctree the cloud octree if it has already been computed
+			\param multiThread whether to use the parallel labeling algorithm (see DgmOctree::extractCCsMT)
 			\return the number of components (>= 0) or an error code (< 0 - see DgmOctree::extractCCs)
 		**/
 		static int labelConnectedComponents(GenericIndexedCloudPersist* theCloud,
 											unsigned char level,
 											bool sixConnexity = false,
 											GenericProgressCallback* progressCb = nullptr,
-											DgmOctree* inputOctree = nullptr);
+											DgmOctree* inputOctree = nullptr,
+											bool multiThread = false);
+
+		//! Labels the Euclidean clusters of a point cloud
+		/** Contrary to labelConnectedComponents (where connectivity is defined at the octree
+			cell level), two points belong to the same cluster if they are linked by a chain of
+			points that are all less than 'maxDistance' apart. The octree is used at the finest
+			level where the cell size is still larger than 'maxDistance', and each cell is only
+			compared to its 'preceding' half-neighbourhood (13 cells). Clusters are merged with
+			a lock-free union-find structure (so that cells can be processed in parallel).
+			The labels (starting from 1) are stored in the active scalar field. Points belonging
+			to discarded clusters (see 'minClusterSize' and 'maxClusterSize') are set to NAN_VALUE.
+			\param theCloud the point cloud to label
+			\param maxDistance maximum distance between two neighbouring points of a same cluster
+			\param minClusterSize minimum number of points per cluster (smaller clusters are discarded)
+			\param maxClusterSize maximum number of points per cluster (bigger clusters are discarded - 0 = no limit)
+			\param progressCb the client application can get some notification of the process progress through this callback mechanism (see GenericProgressCallback)
+			\param inputOctree the cloud octree if it has already been computed
+			\param multiThread whether to use parallel processing or not
+			\return the number of clusters (>= 0) or an error code:
+				- '-1' = invalid input
+				- '-2' = not enough memory
+				- '-3' = process canceled by user
+		**/
+		static int labelEuclideanClusters(	GenericIndexedCloudPersist* theCloud,
+											PointCoordinateType maxDistance,
+											unsigned minClusterSize = 1,
+											unsigned maxClusterSize = 0,
+											GenericProgressCallback* progressCb = nullptr,
+											DgmOctree* inputOctree = nullptr,
+											bool multiThread = true);
 
 		//! Extracts connected components from a point cloud
 		/** This method shloud only be called after the connected components have been
@@ -60,11 +91,40 @@ namespace CCCoreLib
 			implementation of the algorithm assumes that the CCs labels are stored for
 			each point in the associated scalar field.
 			Warning: be sure to set the labels S.F. as OUTPUT (reading)
+			The labels are read only once (counting pass) so that each component is allocated
+			only once, and then filled in parallel.
 			\param theCloud the point cloud to segment
 			\param ccc the extracted connected compenents (as a list of subsets of points)
+			\param sortBySize whether to sort the components by decreasing size (empty components are discarded) or to keep the labels order
+			\param multiThread whether to use parallel processing or not
 			\return success
 		**/
-		static bool extractConnectedComponents(GenericIndexedCloudPersist* theCloud, ReferenceCloudContainer& ccc);
+		static bool extractConnectedComponents(	GenericIndexedCloudPersist* theCloud,
+												ReferenceCloudContainer& ccc,
+												bool sortBySize = false,
+												bool multiThread = true);
+
+		//! Extracts the Euclidean clusters of a point cloud
+		/** Same algorithm as labelEuclideanClusters, but the clusters are directly output
+			(sorted by decreasing size) without using the scalar field.
+			\param theCloud the point cloud to segment
+			\param maxDistance maximum distance between two neighbouring points of a same cluster
+			\param clusters the extracted clusters (as a list of subsets of points)
+			\param minClusterSize minimum number of points per cluster (smaller clusters are discarded)
+			\param maxClusterSize maximum number of points per cluster (bigger clusters are discarded - 0 = no limit)
+			\param progressCb the client application can get some notification of the process progress through this callback mechanism (see GenericProgressCallback)
+			\param inputOctree the cloud octree if it has already been computed
+			\param multiThread whether to use parallel processing or not
+			\return the number of clusters (>= 0) or an error code (see labelEuclideanClusters)
+		**/
+		static int extractEuclideanClusters(GenericIndexedCloudPersist* theCloud,
+											PointCoordinateType maxDistance,
+											ReferenceCloudContainer& clusters,
+											unsigned minClusterSize = 1,
+											unsigned maxClusterSize = 0,
+											GenericProgressCallback* progressCb = nullptr,
+											DgmOctree* inputOctree = nullptr,
+											bool multiThread = true);
 
 		//! Segment a point cloud by propagating fronts constrained by values of the point cloud associated scalar field
 		/** The algorithm is described in Daniel Girardeau-Montaut's PhD manuscript
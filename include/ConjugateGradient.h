@@ -5,7 +5,11 @@
 
 //Local
 #include "MathTools.h"
-#include "SquareMatrix.h"
+#include "SquareMatrixN.h"
+
+//system
+#include <cstring>
+#include <vector>
 
 
 namespace CCCoreLib
@@ -24,7 +28,6 @@ namespace CCCoreLib
 
 		//! Default constructor
 		ConjugateGradient()
-			: cg_A(N)
 		{
 			memset(cg_Gn, 0, sizeof(Scalar)*N);
 			memset(cg_Hn, 0, sizeof(Scalar)*N);
@@ -36,7 +39,7 @@ namespace CCCoreLib
 		virtual ~ConjugateGradient() = default;
 
 		//! Returns A matrix
-		inline SquareMatrixTpl<Scalar>& A() { return cg_A; }
+		inline SquareMatrixN<N, Scalar>& A() { return cg_A; }
 
 		//! Returns b vector
 		inline Scalar* b() { return cg_b; }
@@ -48,7 +51,7 @@ namespace CCCoreLib
 		{
 			//we init the Gn (residuals) and Hn vectors
 			//H0 = G0 = A.X0-b
-			cg_A.apply(X0,cg_Gn);
+			apply(X0, cg_Gn);
 			for (unsigned k=0; k<N; ++k)
 				cg_Hn[k] = (cg_Gn[k] -= cg_b[k]);
 		}
@@ -61,7 +64,7 @@ namespace CCCoreLib
 		Scalar iterConjugateGradient(Scalar* Xn)
 		{
 			//we compute Xn+1
-			cg_A.apply(cg_Hn,cg_u);		//u = A.Hn
+			apply(cg_Hn, cg_u);		//u = A.Hn
 
 			unsigned k;
 			Scalar d = 0, e = 0, f = 0;
@@ -78,7 +81,7 @@ namespace CCCoreLib
 				Xn[k] -= cg_Hn[k]*d;
 
 			//we compute Gn+1
-			cg_A.apply(Xn,cg_u);           // u = A.Xn+1
+			apply(Xn, cg_u);           // u = A.Xn+1
 			for (k=0; k<N; ++k)
 				cg_Gn[k] = cg_u[k]-cg_b[k];	//Gn+1 = A.Xn+1-b
 
@@ -97,27 +100,306 @@ namespace CCCoreLib
 
 	protected:
 
+		//! Matrix-vector product (result = A.vec)
+		/** Same computation as SquareMatrixTpl::apply (accumulated in double precision),
+			but with a compile-time size so that the compiler can unroll and vectorize it.
+		**/
+		inline void apply(const Scalar* vec, Scalar* result) const
+		{
+			for (unsigned r = 0; r < N; ++r)
+			{
+				double sum = 0;
+				for (unsigned k = 0; k < N; ++k)
+					sum += cg_A.m_values[r][k] * static_cast<double>(vec[k]);
+				result[r] = static_cast<Scalar>(sum);
+			}
+		}
+
 		//! Residuals vector
-		Scalar cg_Gn[N];
+		alignas(16) Scalar cg_Gn[N];
 
 		//! 'Hn' vector
 		/** Intermediary computation result
 		**/
-		Scalar cg_Hn[N];
+		alignas(16) Scalar cg_Hn[N];
 
 		//! 'u' vector
 		/** Intermediary computation result
 		**/
-		Scalar cg_u[N];
+		alignas(16) Scalar cg_u[N];
 
 		//! 'b' vector
 		/** Equation solved: "A.X=b"
 		**/
-		Scalar cg_b[N];
+		alignas(16) Scalar cg_b[N];
 
 		//! 'A' matrix
 		/** Equation solved: "A.X=b"
 		**/
-		SquareMatrixTpl<Scalar> cg_A;
+		alignas(16) SquareMatrixN<N, Scalar> cg_A;
+	};
+
+	//! A class to perform many independent conjugate gradient optimizations at once
+	/** Each system "A*X=b" (of dimension N) is solved exactly as ConjugateGradient
+		would do it: initConjugateGradient, then iterConjugateGradient until the
+		mean square error falls below the system's convergence threshold (or the
+		max number of iterations is reached).
+
+		The systems are stored by blocks of 'LaneCount' systems, in a "structure of
+		arrays" layout (i.e. the same coefficient of all the systems of a block is
+		stored contiguously). This way, all the operations are performed on the
+		whole block at once, in loops that the compiler can vectorize. The default
+		number of lanes (4) fits in the vector registers of most targets.
+
+		Warning: the results are only identical to ConjugateGradient's ones if the
+		compiler doesn't contract the floating-point operations (e.g. into FMA
+		instructions, which GCC does by default with -mfma). The library itself is
+		built with -ffp-contract=off for this reason.
+
+		Usage:
+		- init the solver with the number of systems (see init)
+		- set each system (see setSystem - the systems that are not set are ignored)
+		- solve the systems (see solve or solveBlock - blocks are independent and can be solved concurrently)
+		- get the solutions (see getSolution)
+	**/
+	template <int N, class Scalar, unsigned LaneCount = 4> class ConjugateGradientBatch : MathTools
+	{
+	public:
+
+		//! Initializes the solver for a given number of systems
+		/** All the systems are reset.
+			\param systemCount number of systems
+			\return false if not enough memory
+		**/
+		bool init(std::size_t systemCount)
+		{
+			m_systemCount = systemCount;
+			try
+			{
+				m_blocks.clear();
+				m_blocks.resize((systemCount + LaneCount - 1) / LaneCount);
+			}
+			catch (const std::bad_alloc&)
+			{
+				//not enough memory
+				m_systemCount = 0;
+				return false;
+			}
+
+			//all the systems are inactive by default (so that the empty lanes of the last block are ignored)
+			for (Block& block : m_blocks)
+			{
+				block.reset();
+			}
+
+			return true;
+		}
+
+		//! Returns the number of systems
+		inline std::size_t size() const { return m_systemCount; }
+
+		//! Returns the number of blocks
+		inline std::size_t blockCount() const { return m_blocks.size(); }
+
+		//! Sets a system
+		/** \param index system index
+			\param A 'A' matrix (Equation solved: "A.X=b")
+			\param b 'b' vector (size N)
+			\param X0 the initial state (size N)
+			\param convergenceThreshold the iterations stop as soon as the mean square error is below this threshold
+		**/
+		void setSystem(	std::size_t index,
+						const SquareMatrixN<N, Scalar>& A,
+						const Scalar* b,
+						const Scalar* X0,
+						Scalar convergenceThreshold)
+		{
+			assert(index < m_systemCount);
+			Block& block = m_blocks[index / LaneCount];
+			unsigned l = static_cast<unsigned>(index % LaneCount);
+
+			for (unsigned r = 0; r < N; ++r)
+			{
+				for (unsigned c = 0; c < N; ++c)
+					block.A[r][c][l] = A.m_values[r][c];
+				block.b[r][l] = b[r];
+				block.X[r][l] = X0[r];
+			}
+			block.threshold[l] = convergenceThreshold;
+			block.active[l] = true;
+		}
+
+		//! Returns the solution of a given system
+		/** \param index system index
+			\param X output solution (size N)
+		**/
+		void getSolution(std::size_t index, Scalar* X) const
+		{
+			assert(index < m_systemCount);
+			const Block& block = m_blocks[index / LaneCount];
+			unsigned l = static_cast<unsigned>(index % LaneCount);
+
+			for (unsigned r = 0; r < N; ++r)
+				X[r] = block.X[r][l];
+		}
+
+		//! Solves the systems of a given block
+		/** \param blockIndex block index (< blockCount())
+			\param maxIterationCount max number of iterations
+		**/
+		void solveBlock(std::size_t blockIndex, unsigned maxIterationCount)
+		{
+			assert(blockIndex < m_blocks.size());
+			m_blocks[blockIndex].solve(maxIterationCount);
+		}
+
+		//! Solves all the systems (sequentially)
+		/** \param maxIterationCount max number of iterations
+		**/
+		void solve(unsigned maxIterationCount)
+		{
+			for (Block& block : m_blocks)
+			{
+				block.solve(maxIterationCount);
+			}
+		}
+
+	protected:
+
+		//! A block of 'LaneCount' systems
+		struct Block
+		{
+			//! 'A' matrices
+			Scalar A[N][N][LaneCount];
+			//! 'b' vectors
+			Scalar b[N][LaneCount];
+			//! Current solutions
+			Scalar X[N][LaneCount];
+			//! Residuals vectors
+			Scalar G[N][LaneCount];
+			//! 'Hn' vectors
+			Scalar H[N][LaneCount];
+			//! 'u' vectors
+			Scalar u[N][LaneCount];
+			//! Convergence thresholds
+			Scalar threshold[LaneCount];
+			//! Whether each system is still iterated
+			bool active[LaneCount];
+
+			//! Resets the block
+			void reset()
+			{
+				memset(this, 0, sizeof(Block));
+			}
+
+			//! Matrix-vector product (result = A.vec) for all the lanes
+			/** Same computation (and same order) as ConjugateGradient::apply.
+			**/
+			inline void apply(const Scalar (&vec)[N][LaneCount], Scalar (&result)[N][LaneCount]) const
+			{
+				for (unsigned r = 0; r < N; ++r)
+				{
+					double sum[LaneCount];
+					for (unsigned l = 0; l < LaneCount; ++l)
+						sum[l] = 0;
+					for (unsigned k = 0; k < N; ++k)
+						for (unsigned l = 0; l < LaneCount; ++l)
+							sum[l] += A[r][k][l] * static_cast<double>(vec[k][l]);
+					for (unsigned l = 0; l < LaneCount; ++l)
+						result[r][l] = static_cast<Scalar>(sum[l]);
+				}
+			}
+
+			//! Solves the (active) systems of the block
+			void solve(unsigned maxIterationCount)
+			{
+				unsigned activeCount = 0;
+				for (unsigned l = 0; l < LaneCount; ++l)
+					if (active[l])
+						++activeCount;
+
+				if (activeCount == 0)
+				{
+					return;
+				}
+
+				//H0 = G0 = A.X0-b (see ConjugateGradient::initConjugateGradient)
+				apply(X, G);
+				for (unsigned k = 0; k < N; ++k)
+					for (unsigned l = 0; l < LaneCount; ++l)
+						H[k][l] = (G[k][l] -= b[k][l]);
+
+				//same information as 'active', but with the same type as the values (so that the selections can be vectorized)
+				Scalar running[LaneCount];
+				for (unsigned l = 0; l < LaneCount; ++l)
+					running[l] = (active[l] ? 1 : 0);
+
+				//see ConjugateGradient::iterConjugateGradient
+				//(the inactive lanes are computed as well, but their state is left untouched)
+				for (unsigned it = 0; it < maxIterationCount && activeCount != 0; ++it)
+				{
+					apply(H, u); //u = A.Hn
+
+					Scalar d[LaneCount];
+					Scalar e[LaneCount];
+					Scalar f[LaneCount];
+					for (unsigned l = 0; l < LaneCount; ++l)
+						d[l] = e[l] = f[l] = 0;
+					for (unsigned k = 0; k < N; ++k)
+					{
+						for (unsigned l = 0; l < LaneCount; ++l)
+						{
+							d[l] += H[k][l] * G[k][l];	// t^Hn.Gn
+							e[l] += H[k][l] * u[k][l];	// t^Hn.A.Hn
+							f[l] += G[k][l] * G[k][l];	// t^Gn.Gn
+						}
+					}
+
+					//Xn+1 = Xn - Hn*(t^Hn.Gn)/(t^Hn.A.Hn)
+					for (unsigned l = 0; l < LaneCount; ++l)
+						d[l] /= e[l];
+					for (unsigned k = 0; k < N; ++k)
+						for (unsigned l = 0; l < LaneCount; ++l)
+							X[k][l] = (running[l] != 0 ? X[k][l] - H[k][l] * d[l] : X[k][l]);
+
+					//Gn+1 = A.Xn+1-b
+					apply(X, u);
+					for (unsigned k = 0; k < N; ++k)
+						for (unsigned l = 0; l < LaneCount; ++l)
+							G[k][l] = u[k][l] - b[k][l];
+
+					//sum of square errors
+					for (unsigned l = 0; l < LaneCount; ++l)
+						e[l] = G[0][l] * G[0][l];
+					for (unsigned k = 1; k < N; ++k)
+						for (unsigned l = 0; l < LaneCount; ++l)
+							e[l] += G[k][l] * G[k][l];	//t^Gn+1.Gn+1
+
+					//Hn+1 = Gn+1 + Hn.(t^Gn+1.Gn+1)/(t^Gn.Gn)
+					for (unsigned l = 0; l < LaneCount; ++l)
+						d[l] = e[l] / f[l];
+					for (unsigned k = 0; k < N; ++k)
+						for (unsigned l = 0; l < LaneCount; ++l)
+							H[k][l] = G[k][l] + H[k][l] * d[l];
+
+					//convergence test
+					for (unsigned l = 0; l < LaneCount; ++l)
+					{
+						if (active[l] && e[l] / N < threshold[l])
+						{
+							active[l] = false;
+							running[l] = 0;
+							--activeCount;
+						}
+					}
+				}
+			}
+		};
+
+		//! Blocks of systems
+		std::vector<Block> m_blocks;
+
+		//! Number of systems
+		std::size_t m_systemCount = 0;
 	};
 }
@@ -987,6 +987,7 @@ namespace CCCoreLib
 			\param level the level of subdivision at which to perform the algorithm
 			\param sixConnexity indicates if the CC's 3D connexity should be 6 (26 otherwise)
 			\param progressCb the client application can get some notification of the process progress through this callback mechanism (see GenericProgressCallback)
+			\param multiThread whether to use the parallel labeling algorithm (see extractCCsMT)
 			\return error code:
 				- '>= 0' = number of components
 				- '-1' = no cells (input)
@@ -996,7 +997,8 @@ namespace CCCoreLib
 		int extractCCs(	const cellCodesContainer& cellCodes,
 						unsigned char level,
 						bool sixConnexity,
-						GenericProgressCallback* progressCb = nullptr) const;
+						GenericProgressCallback* progressCb = nullptr,
+						bool multiThread = false) const;
 
 		//! Computes the connected components (considering the octree cells only) for a given level of subdivision (complete)
 		/** The octree is seen as a regular 3D grid, and each cell of this grid is either set to 0
@@ -1006,6 +1008,7 @@ namespace CCCoreLib
 			\param level the level of subdivision at which to perform the algorithm
 			\param sixConnexity indicates if the CC's 3D connexity should be 6 (26 otherwise)
 			\param progressCb the client application can get some notification of the process progress through this callback mechanism (see GenericProgressCallback)
+			\param multiThread whether to use the parallel labeling algorithm (see extractCCsMT)
 			\return error code:
 				- '>= 0' = number of components
 				- '-1' = no cells (input)
@@ -1014,7 +1017,25 @@ namespace CCCoreLib
 		**/
 		int extractCCs(	unsigned char level,
 						bool sixConnexity,
-						GenericProgressCallback* progressCb = nullptr) const;
+						GenericProgressCallback* progressCb = nullptr,
+						bool multiThread = false) const;
+
+		//! Computes the connected components (considering the octree cells only) with a parallel algorithm
+		/** Same output as extractCCs, but the cells are labeled with a lock-free union-find
+			structure: each cell is merged with its existing 'preceding' neighbors (found by binary
+			search in the sorted cell codes) in parallel. No dense slice buffer is required, so
+			that it scales to high levels of subdivision (10 to 12 and more).
+			Components are numbered (starting from 1) by increasing cell code of their first cell.
+			\param cellCodes the cell codes to consider for the CC computation
+			\param level the level of subdivision at which to perform the algorithm
+			\param sixConnexity indicates if the CC's 3D connexity should be 6 (26 otherwise)
+			\param progressCb the client application can get some notification of the process progress through this callback mechanism (see GenericProgressCallback)
+			\return error code (see extractCCs)
+		**/
+		int extractCCsMT(	const cellCodesContainer& cellCodes,
+							unsigned char level,
+							bool sixConnexity,
+							GenericProgressCallback* progressCb = nullptr) const;
 
 		/**** OCTREE VISITOR ****/
 
@@ -20,6 +20,7 @@ namespace CCCoreLib
 	class ReferenceCloud;
 	class PointCloud;
 	class Polyline;
+	class PolylineSegmentIndex;
 	class GenericProgressCallback;
 	class ScalarField;
 	class SaitoSquaredDistanceTransform;
@@ -405,7 +406,9 @@ namespace CCCoreLib
 											double* rms = nullptr);
 
 		//! Computes the distance between each point in a cloud and a polyline
-		/** \param[in]  cloud		a 3D point cloud
+		/** The closing segment of closed polylines is ignored. A temporary PolylineSegmentIndex
+			is built: use the other version to measure several clouds to the same polyline.
+			\param[in]  cloud		a 3D point cloud
 			\param[in]  polyline	the polyline to measure to
 			\param[out] rms			will be set with the Root Mean Square (RMS) distance between a cloud and a plane (optional)
 
@@ -415,6 +418,25 @@ namespace CCCoreLib
 													const Polyline* polyline,
 													double* rms = nullptr);
 
+		//! Computes the distance between each point in a cloud and an (already indexed) polyline
+		/** \param[in]  cloud					a 3D point cloud
+			\param[in]  polylineIndex			the index of the polyline to measure to (see PolylineSegmentIndex::build)
+			\param[out] nearestSegmentIndexes	the index of the nearest segment of each point (optional, should be of size 'cloud->size()')
+			\param[out] curvilinearAbscissas	the curvilinear abscissa of the projection of each point on the polyline (optional, should be of size 'cloud->size()')
+			\param[out] rms						will be set with the Root Mean Square (RMS) distance between a cloud and the polyline (optional)
+			\param[in]  multiThread				whether to process the points in parallel (if supported) or not
+			\param[in]  maxThreadCount			the maximum number of threads to use (0 = all)
+
+			\return negative error code or a positive value in case of success
+		**/
+		static int computeCloud2PolylineEquation(	GenericIndexedCloudPersist* cloud,
+													const PolylineSegmentIndex& polylineIndex,
+													unsigned* nearestSegmentIndexes = nullptr,
+													double* curvilinearAbscissas = nullptr,
+													double* rms = nullptr,
+													bool multiThread = true,
+													int maxThreadCount = 0);
+
 		//! Error estimators
 		enum ERROR_MEASURES
 		{
@@ -614,5 +636,17 @@ namespace CCCoreLib
 		static bool computeCellHausdorffDistanceWithLocalModel(	const DgmOctree::octreeCell& cell,
 																void** additionalParameters,
 																NormalizedProgress* nProgress = nullptr);
+
+		//! Computes the "nearest neighbor distance" with quadric local models for all points of an octree cell
+		/** Same as computeCellHausdorffDistanceWithLocalModel, dedicated to QUADRIC models when the
+			models are not reused: as they are independent, the quadrics are fitted by batches (see
+			ConjugateGradientBatch).
+			\param cell structure describing the cell on which processing is applied
+			\param additionalParameters see computeCellHausdorffDistanceWithLocalModel
+			\param nProgress optional (normalized) progress notification (per-point)
+		**/
+		static bool computeCellHausdorffDistanceWithQuadrics(	const DgmOctree::octreeCell& cell,
+																void** additionalParameters,
+																NormalizedProgress* nProgress = nullptr);
 	};
 }
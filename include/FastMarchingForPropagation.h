@@ -78,6 +78,7 @@ namespace CCCoreLib
 
 		//inherited methods (see FastMarching)
 		int propagate() override;
+		void cleanLastPropagation() override;
 
 	protected:
 
@@ -105,6 +106,30 @@ namespace CCCoreLib
 		float computeTCoefApprox(Cell* currentCell, Cell* neighbourCell) const override;
 		int step() override;
 		bool instantiateGrid(unsigned size) override { return instantiateGridTpl<PropagationCell>(size); }
+		void addTrialCell(unsigned index) override;
+		unsigned getNearestTrialCell() override;
+
+		//! Updates the front arrival time of a TRIAL cell
+		void updateTrialCell(unsigned index, float T);
+
+		//! TRIAL cells priority queue entry
+		struct TrialCellEntry
+		{
+			//! Front arrival time (when the entry was pushed)
+			float T;
+			//! Cell index
+			unsigned index;
+
+			//! Comparison operator (for a 'min' heap)
+			inline bool operator > (const TrialCellEntry& other) const { return T > other.T; }
+		};
+
+		//! TRIAL cells priority queue (binary min-heap with lazy deletion)
+		/** Outdated entries (i.e. cells that are not TRIAL anymore or whose arrival time
+			has been updated since) are simply skipped when they reach the top of the heap.
+			The TRIAL cells list (m_trialCells) is only used to reset the touched cells.
+		**/
+		std::vector<TrialCellEntry> m_trialHeap;
 
 		//! Accceleration exageration factor
 		float m_jumpCoef;
@@ -60,6 +60,21 @@ namespace CCCoreLib
 		**/
 		virtual double computePfromZero(ScalarType x) const = 0;
 
+		//! Computes the cumulative probabilities between 0 and several values at once
+		/** Equivalent to calling computePfromZero for each value (default behavior),
+			but distributions can override it with a faster (batched) version.
+			\param x the upper boundaries
+			\param count the number of values
+			\param[out] p the cumulative probabilities (should be of size 'count')
+		**/
+		virtual void computeCumulativeProbabilities(const ScalarType* x, std::size_t count, double* p) const
+		{
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				p[i] = computePfromZero(x[i]);
+			}
+		}
+
 		//! Computes the cumulative probability between x1 and x2
 		/** x1 should be lower than x2
 			\param x1 the lower boundary
@@ -219,6 +219,18 @@ namespace CCCoreLib
 		static bool ComputeGeomCharacteristicAtLevel(	const DgmOctree::octreeCell& cell,
 														void** additionalParameters,
 														NormalizedProgress* nProgress = nullptr);
+
+		//! Computes geom characteristics that only depend on the eigen decomposition of the covariance matrix inside a cell
+		/**	Same as ComputeGeomCharacteristicAtLevel (for features and the 'normal change rate' curvature)
+			but the eigen decompositions are performed by batches.
+			\param cell structure describing the cell on which processing is applied
+			\param additionalParameters see method description
+			\param nProgress optional (normalized) progress notification (per-point)
+		**/
+		static bool ComputeEigenCharacteristicAtLevel(	const DgmOctree::octreeCell& cell,
+														void** additionalParameters,
+														NormalizedProgress* nProgress = nullptr);
+
 		//! Computes approximate point density inside a cell
 		/**	\param cell structure describing the cell on which processing is applied
 			\param additionalParameters see method description
@@ -4,7 +4,11 @@
 #pragma once
 
 //Local
-#include "SquareMatrix.h"
+#include "SquareMatrixN.h"
+
+//System
+#include <algorithm>
+#include <cstddef>
 
 namespace CCCoreLib
 {
@@ -202,7 +206,6 @@ namespace CCCoreLib
 			}
 			
 			unsigned n = matrix.size();
-			unsigned matrixSquareSize = n * n;
 			
 			//output eigen vectors matrix
 			eigenVectors = SquareMatrix(n);
@@ -224,13 +227,269 @@ namespace CCCoreLib
 				//not enough memory
 				return false;
 			}
-			Scalar* d = eigenValues.data();
+			
+			return Decompose(matrix.m_values, eigenVectors.m_values, n, eigenValues.data(), b.data(), z.data(), absoluteValues, maxIterationCount);
+		}
+		
+		//! Computes eigen vectors (and values) of a fixed-size matrix with the Jacobian method
+		/** Same as the dynamic version, without any memory allocation.
+			\warning Contrarily to the dynamic version, the input matrix is left untouched.
+			\param[in] matrix input square matrix
+			\param[out] eigenVectors eigenvectors (as a square matrix)
+			\param[out] eigenValues eigenvalues
+			\param[in] absoluteValues whether to return the absolute eigenvalues
+			\param[in] maxIterationCount max number of iteration (optional)
+			\return success
+		**/
+		template <unsigned N> static bool ComputeEigenValuesAndVectors(	const SquareMatrixN<N, Scalar>& matrix,
+																		SquareMatrixN<N, Scalar>& eigenVectors,
+																		Scalar (&eigenValues)[N],
+																		bool absoluteValues = true,
+																		unsigned maxIterationCount = 50)
+		{
+			//duplicate the input matrix (as it is modified by the decomposition)
+			SquareMatrixN<N, Scalar> a(matrix);
+			eigenVectors.toIdentity();
+			
+			Scalar b[N];
+			Scalar z[N];
+			
+			return Decompose(a.m_values, eigenVectors.m_values, N, eigenValues, b, z, absoluteValues, maxIterationCount);
+		}
+		
+		//! Sorts the eigenvectors in the decreasing order of their associated eigenvalues
+		/** \param eigenVectors eigenvectors (as a square matrix)
+		\param eigenValues eigenvalues
+		\return success
+		**/
+		static bool SortEigenValuesAndVectors(SquareMatrix& eigenVectors, EigenValues& eigenValues)
+		{
+			if (!eigenVectors.isValid()
+					|| eigenVectors.size() < 2
+					|| eigenVectors.size() != eigenValues.size())
+			{
+				assert(false);
+				return false;
+			}
+			
+			unsigned n = eigenVectors.size();
+			for (unsigned i = 0; i < n - 1; i++)
+			{
+				unsigned maxValIndex = i;
+				for (unsigned j = i + 1; j<n; j++)
+					if (eigenValues[j] > eigenValues[maxValIndex])
+						maxValIndex = j;
+				
+				if (maxValIndex != i)
+				{
+					std::swap(eigenValues[i], eigenValues[maxValIndex]);
+					for (unsigned j = 0; j < n; ++j)
+						std::swap(eigenVectors.m_values[j][i], eigenVectors.m_values[j][maxValIndex]);
+				}
+			}
+			
+			return true;
+		}
+		
+		//! Returns the given eigenvector
+		/** \param eigenVectors eigenvectors (as a square matrix)
+		\param index requested eigenvector index (< eigenvectors matrix size)
+		\param eigenVector output vector (size = matrix size)
+		\return success
+		**/
+		static bool GetEigenVector(const SquareMatrix& eigenVectors, unsigned index, Scalar eigenVector[])
+		{
+			if (eigenVector && index < eigenVectors.size())
+			{
+				for (unsigned i = 0; i < eigenVectors.size(); ++i)
+				{
+					eigenVector[i] = eigenVectors.m_values[i][index];
+				}
+				return true;
+			}
+			else
+			{
+				assert(false);
+				return false;
+			}
+		}
+		
+		//! Returns the biggest eigenvalue and its associated eigenvector
+		/** \param eigenVectors eigenvectors (as a square matrix)
+		\param eigenValues eigenvalues
+		\param maxEigenValue biggest eigenvalue
+		\param maxEigenVector eigenvector vector corresponding to the biggest eigenvalue
+		\return success
+		**/
+		static bool GetMaxEigenValueAndVector(const SquareMatrix& eigenVectors, const EigenValues& eigenValues, Scalar& maxEigenValue, Scalar maxEigenVector[])
+		{
+			if (!eigenVectors.isValid()
+					|| eigenVectors.size() < 2
+					|| eigenVectors.size() != eigenValues.size())
+			{
+				assert(false);
+				return false;
+			}
+			
+			unsigned maxIndex = 0;
+			for (unsigned i = 1; i<eigenVectors.size(); ++i)
+				if (eigenValues[i] > eigenValues[maxIndex])
+					maxIndex = i;
+			
+			maxEigenValue = eigenValues[maxIndex];
+			return GetEigenVector(eigenVectors, maxIndex, maxEigenVector);
+		}
+		
+		//! Returns the smallest eigenvalue and its associated eigenvector
+		/** \param eigenVectors eigenvectors (as a square matrix)
+		\param eigenValues eigenvalues
+		\param minEigenValue smallest eigenvalue
+		\param minEigenVector eigenvector vector corresponding to the smallest eigenvalue
+		\return success
+		**/
+		static bool GetMinEigenValueAndVector(const SquareMatrix& eigenVectors, const EigenValues& eigenValues, Scalar& minEigenValue, Scalar minEigenVector[])
+		{
+			if (!eigenVectors.isValid()
+					|| eigenVectors.size() < 2
+					|| eigenVectors.size() != eigenValues.size())
+			{
+				assert(false);
+				return false;
+			}
+			
+			unsigned minIndex = 0;
+			for (unsigned i = 1; i < eigenVectors.size(); ++i)
+				if (eigenValues[i] < eigenValues[minIndex])
+					minIndex = i;
+			
+			minEigenValue = eigenValues[minIndex];
+			return GetEigenVector(eigenVectors, minIndex, minEigenVector);
+		}
+		
+		//! Sorts the eigenvectors in the decreasing order of their associated eigenvalues (fixed-size version)
+		template <unsigned N> static void SortEigenValuesAndVectors(SquareMatrixN<N, Scalar>& eigenVectors, Scalar (&eigenValues)[N])
+		{
+			for (unsigned i = 0; i + 1 < N; i++)
+			{
+				unsigned maxValIndex = i;
+				for (unsigned j = i + 1; j < N; j++)
+					if (eigenValues[j] > eigenValues[maxValIndex])
+						maxValIndex = j;
+				
+				if (maxValIndex != i)
+				{
+					std::swap(eigenValues[i], eigenValues[maxValIndex]);
+					for (unsigned j = 0; j < N; ++j)
+						std::swap(eigenVectors.m_values[j][i], eigenVectors.m_values[j][maxValIndex]);
+				}
+			}
+		}
+		
+		//! Returns the given eigenvector (fixed-size version)
+		template <unsigned N> static void GetEigenVector(const SquareMatrixN<N, Scalar>& eigenVectors, unsigned index, Scalar eigenVector[])
+		{
+			assert(eigenVector && index < N);
+			for (unsigned i = 0; i < N; ++i)
+			{
+				eigenVector[i] = eigenVectors.m_values[i][index];
+			}
+		}
+		
+		//! Returns the biggest eigenvalue and its associated eigenvector (fixed-size version)
+		template <unsigned N> static void GetMaxEigenValueAndVector(const SquareMatrixN<N, Scalar>& eigenVectors, const Scalar (&eigenValues)[N], Scalar& maxEigenValue, Scalar maxEigenVector[])
+		{
+			unsigned maxIndex = 0;
+			for (unsigned i = 1; i < N; ++i)
+				if (eigenValues[i] > eigenValues[maxIndex])
+					maxIndex = i;
+			
+			maxEigenValue = eigenValues[maxIndex];
+			GetEigenVector(eigenVectors, maxIndex, maxEigenVector);
+		}
+		
+		//! Returns the smallest eigenvalue and its associated eigenvector (fixed-size version)
+		template <unsigned N> static void GetMinEigenValueAndVector(const SquareMatrixN<N, Scalar>& eigenVectors, const Scalar (&eigenValues)[N], Scalar& minEigenValue, Scalar minEigenVector[])
+		{
+			unsigned minIndex = 0;
+			for (unsigned i = 1; i < N; ++i)
+				if (eigenValues[i] < eigenValues[minIndex])
+					minIndex = i;
+			
+			minEigenValue = eigenValues[minIndex];
+			GetEigenVector(eigenVectors, minIndex, minEigenVector);
+		}
+
+		//! Computes eigen vectors (and values) of a batch of 3x3 symmetric matrices with the Jacobian method
+		/** Gives the same results as the fixed-size version called on each matrix, but
+			'LaneCount' matrices are decomposed simultaneously (in a branch-free way, so that
+			the compiler can process them with SIMD instructions). No memory allocation.
+			\param[in] packedMatrices input symmetric matrices (6 values per matrix: m00, m11, m22, m01, m02, m12)
+			\param[in] count number of matrices
+			\param[out] eigenValues eigenvalues (3 values per matrix)
+			\param[out] eigenVectors eigenvectors (9 values per matrix, with the same layout as SquareMatrix3::m_values, i.e. one eigenvector per column)
+			\param[out] success whether each decomposition succeeded (optional, one value per matrix)
+			\param[in] absoluteValues whether to return the absolute eigenvalues
+			\param[in] maxIterationCount max number of iteration (optional)
+			\return the number of successful decompositions
+		**/
+		template <unsigned LaneCount = 8> static std::size_t ComputeEigenValuesAndVectors3(	const Scalar* packedMatrices,
+																							std::size_t count,
+																							Scalar* eigenValues,
+																							Scalar* eigenVectors,
+																							bool* success = nullptr,
+																							bool absoluteValues = true,
+																							unsigned maxIterationCount = 50)
+		{
+			static_assert(LaneCount != 0, "Invalid lane count");
+			assert(packedMatrices || count == 0);
+			assert(eigenValues && eigenVectors);
+
+			std::size_t successCount = 0;
+			for (std::size_t first = 0; first < count; first += LaneCount)
+			{
+				unsigned laneCount = static_cast<unsigned>(std::min<std::size_t>(LaneCount, count - first));
+				successCount += DecomposeBlock3<LaneCount>(	packedMatrices + 6 * first,
+															laneCount,
+															eigenValues + 3 * first,
+															eigenVectors + 9 * first,
+															success ? success + first : nullptr,
+															absoluteValues,
+															maxIterationCount);
+			}
+
+			return successCount;
+		}
+
+	protected:
+		
+		//! Jacobi decomposition core (see ComputeEigenValuesAndVectors)
+		/** Works on both the dynamic (Scalar**) and fixed-size (Scalar(*)[N]) matrix rows.
+			\param matrix input matrix rows (modified)
+			\param eigenVectors output eigenvectors rows (must be initialized to identity)
+			\param n matrix size
+			\param d output eigenvalues (size n)
+			\param b working buffer (size n)
+			\param z working buffer (size n)
+			\param absoluteValues whether to return the absolute eigenvalues
+			\param maxIterationCount max number of iteration
+			\return success
+		**/
+		template <typename Rows> static bool Decompose(	Rows matrix,
+														Rows eigenVectors,
+														unsigned n,
+														Scalar* d,
+														Scalar* b,
+														Scalar* z,
+														bool absoluteValues,
+														unsigned maxIterationCount)
+		{
+			unsigned matrixSquareSize = n * n;
 			
 			//init
 			{
 				for (unsigned ip = 0; ip < n; ip++)
 				{
-					b[ip] = d[ip] = matrix.m_values[ip][ip]; //Initialize b and d to the diagonal of a.
+					b[ip] = d[ip] = matrix[ip][ip]; //Initialize b and d to the diagonal of a.
 					z[ip] = 0; //This vector will accumulate terms of the form tapq as in equation (11.1.14)
 				}
 			}
@@ -243,7 +502,7 @@ namespace CCCoreLib
 					for (unsigned ip = 0; ip < n - 1; ip++)
 					{
 						for (unsigned iq = ip + 1; iq < n; iq++)
-							sm += std::abs(matrix.m_values[ip][iq]);
+							sm += std::abs(matrix[ip][iq]);
 					}
 				}
 				
@@ -269,25 +528,25 @@ namespace CCCoreLib
 				{
 					for (unsigned iq = ip + 1; iq < n; iq++)
 					{
-						Scalar pq = std::abs(matrix.m_values[ip][iq]) * 100;
+						Scalar pq = std::abs(matrix[ip][iq]) * 100;
 						//After four sweeps, skip the rotation if the off-diagonal element is small.
 						if (i > 4
 								&& static_cast<float>(std::abs(d[ip]) + pq) == static_cast<float>(std::abs(d[ip]))
 								&& static_cast<float>(std::abs(d[iq]) + pq) == static_cast<float>(std::abs(d[iq])))
 						{
-							matrix.m_values[ip][iq] = 0;
+							matrix[ip][iq] = 0;
 						}
-						else if (std::abs(matrix.m_values[ip][iq]) > tresh)
+						else if (std::abs(matrix[ip][iq]) > tresh)
 						{
 							Scalar h = d[iq] - d[ip];
 							Scalar t = 0;
 							if (static_cast<float>(std::abs(h) + pq) == static_cast<float>(std::abs(h)))
 							{
-								t = matrix.m_values[ip][iq] / h;
+								t = matrix[ip][iq] / h;
 							}
 							else
 							{
-								Scalar theta = h / (2 * matrix.m_values[ip][iq]); //Equation (11.1.10).
+								Scalar theta = h / (2 * matrix[ip][iq]); //Equation (11.1.10).
 								t = 1 / (std::abs(theta) + sqrt(1 + theta*theta));
 								if (theta < 0)
 									t = -t;
@@ -296,32 +555,32 @@ namespace CCCoreLib
 							Scalar c = 1 / sqrt(t*t + 1);
 							Scalar s = t*c;
 							Scalar tau = s / (1 + c);
-							h = t * matrix.m_values[ip][iq];
+							h = t * matrix[ip][iq];
 							z[ip] -= h;
 							z[iq] += h;
 							d[ip] -= h;
 							d[iq] += h;
-							matrix.m_values[ip][iq] = 0;
+							matrix[ip][iq] = 0;
 							
 							//Case of rotations 1 <= j < p
 							{
 								for (unsigned j = 0; j + 1 <= ip; j++)
-									ROTATE(matrix.m_values, j, ip, j, iq)
+									ROTATE(matrix, j, ip, j, iq)
 							}
 							//Case of rotations p < j < q
 							{
 								for (unsigned j = ip + 1; j + 1 <= iq; j++)
-									ROTATE(matrix.m_values, ip, j, j, iq)
+									ROTATE(matrix, ip, j, j, iq)
 							}
 							//Case of rotations q < j <= n
 							{
 								for (unsigned j = iq + 1; j < n; j++)
-									ROTATE(matrix.m_values, ip, j, iq, j)
+									ROTATE(matrix, ip, j, iq, j)
 							}
 							//Last case
 							{
 								for (unsigned j = 0; j < n; j++)
-									ROTATE(eigenVectors.m_values, j, ip, j, iq)
+									ROTATE(eigenVectors, j, ip, j, iq)
 							}
 						}
 					}
@@ -341,114 +600,205 @@ namespace CCCoreLib
 			//Too many iterations!
 			return false;
 		}
-		
-		//! Sorts the eigenvectors in the decreasing order of their associated eigenvalues
-		/** \param eigenVectors eigenvectors (as a square matrix)
-		\param eigenValues eigenvalues
-		\return success
+
+		//! Block of L 3x3 symmetric matrices being decomposed at once (see DecomposeBlock3)
+		/** Only the off-diagonal terms are stored as the diagonal is only read at init time.
+			The last index is always the lane index.
 		**/
-		static bool SortEigenValuesAndVectors(SquareMatrix& eigenVectors, EigenValues& eigenValues)
+		template <unsigned L> struct Block3
 		{
-			if (!eigenVectors.isValid()
-					|| eigenVectors.size() < 2
-					|| eigenVectors.size() != eigenValues.size())
-			{
-				assert(false);
-				return false;
-			}
-			
-			unsigned n = eigenVectors.size();
-			for (unsigned i = 0; i < n - 1; i++)
+			//! Off-diagonal terms (a01, a02 and a12)
+			Scalar a[3][L];
+			//! Eigenvectors (one per column)
+			Scalar v[3][3][L];
+			//! Eigenvalues
+			Scalar d[3][L];
+			//! Working buffers (see Decompose)
+			Scalar b[3][L];
+			Scalar z[3][L];
+			//! Rotation threshold for the current sweep
+			Scalar tresh[L];
+			//! Whether each lane is still iterating (1) or has converged (0)
+			Scalar active[L];
+		};
+
+		//! Applies the Jacobi rotation (ip, iq) to all the lanes of a block
+		/** Same as the inner loop of Decompose (for n = 3), with selects instead of branches.
+			\tparam ip first row
+			\tparam iq second row
+			\tparam k index of the (ip, iq) off-diagonal term
+			\tparam kg index of the first off-diagonal term affected by the rotation
+			\tparam kh index of the second off-diagonal term affected by the rotation
+		**/
+		template <unsigned L, unsigned ip, unsigned iq, unsigned k, unsigned kg, unsigned kh>
+		static inline void RotateBlock3(Block3<L>& block, bool afterFourSweeps)
+		{
+			for (unsigned l = 0; l < L; ++l)
 			{
-				unsigned maxValIndex = i;
-				for (unsigned j = i + 1; j<n; j++)
-					if (eigenValues[j] > eigenValues[maxValIndex])
-						maxValIndex = j;
-				
-				if (maxValIndex != i)
-				{
-					std::swap(eigenValues[i], eigenValues[maxValIndex]);
-					for (unsigned j = 0; j < n; ++j)
-						std::swap(eigenVectors.m_values[j][i], eigenVectors.m_values[j][maxValIndex]);
-				}
+				const Scalar apq = block.a[k][l];
+				const Scalar dp = block.d[ip][l];
+				const Scalar dq = block.d[iq][l];
+				const Scalar pq = std::abs(apq) * 100;
+				//After four sweeps, skip the rotation if the off-diagonal element is small.
+				const bool skip = (	afterFourSweeps
+									& (static_cast<float>(std::abs(dp) + pq) == static_cast<float>(std::abs(dp)))
+									& (static_cast<float>(std::abs(dq) + pq) == static_cast<float>(std::abs(dq))));
+				const bool active = (block.active[l] != 0);
+				const bool rotate = (active & !skip & (std::abs(apq) > block.tresh[l]));
+
+				Scalar h = dq - dp;
+				Scalar theta = h / (2 * apq); //Equation (11.1.10).
+				Scalar t = 1 / (std::abs(theta) + sqrt(1 + theta*theta));
+				t = (theta < 0 ? -t : t);
+				t = (static_cast<float>(std::abs(h) + pq) == static_cast<float>(std::abs(h)) ? apq / h : t);
+
+				Scalar c = 1 / sqrt(t*t + 1);
+				Scalar s = t*c;
+				Scalar tau = s / (1 + c);
+				h = t * apq;
+
+				//all the values are read first and written at the end (so that the compiler
+				//can replace the selects by blend instructions instead of conditional stores)
+				const Scalar zp = block.z[ip][l];
+				const Scalar zq = block.z[iq][l];
+				Scalar ag = block.a[kg][l];
+				Scalar ah = block.a[kh][l];
+				Scalar v0p = block.v[0][ip][l];
+				Scalar v0q = block.v[0][iq][l];
+				Scalar v1p = block.v[1][ip][l];
+				Scalar v1q = block.v[1][iq][l];
+				Scalar v2p = block.v[2][ip][l];
+				Scalar v2q = block.v[2][iq][l];
+
+				//rotation of the two other off-diagonal terms
+				Rotate(ag, ah, s, tau, rotate);
+				//rotation of the eigenvectors
+				Rotate(v0p, v0q, s, tau, rotate);
+				Rotate(v1p, v1q, s, tau, rotate);
+				Rotate(v2p, v2q, s, tau, rotate);
+
+				const Scalar newZp = (rotate ? zp - h : zp);
+				const Scalar newZq = (rotate ? zq + h : zq);
+				const Scalar newDp = (rotate ? dp - h : dp);
+				const Scalar newDq = (rotate ? dq + h : dq);
+				const Scalar newApq = ((rotate | (skip & active)) ? 0 : apq);
+
+				block.z[ip][l] = newZp;
+				block.z[iq][l] = newZq;
+				block.d[ip][l] = newDp;
+				block.d[iq][l] = newDq;
+				block.a[k][l] = newApq;
+				block.a[kg][l] = ag;
+				block.a[kh][l] = ah;
+				block.v[0][ip][l] = v0p;
+				block.v[0][iq][l] = v0q;
+				block.v[1][ip][l] = v1p;
+				block.v[1][iq][l] = v1q;
+				block.v[2][ip][l] = v2p;
+				block.v[2][iq][l] = v2q;
 			}
-			
-			return true;
 		}
-		
-		//! Returns the given eigenvector
-		/** \param eigenVectors eigenvectors (as a square matrix)
-		\param index requested eigenvector index (< eigenvectors matrix size)
-		\param eigenVector output vector (size = matrix size)
-		\return success
+
+		//! Branch-free version of the ROTATE macro
+		static inline void Rotate(Scalar& g, Scalar& h, Scalar s, Scalar tau, bool rotate)
+		{
+			const Scalar g0 = g;
+			const Scalar h0 = h;
+			g = (rotate ? g0 - s*(h0 + g0*tau) : g0);
+			h = (rotate ? h0 + s*(g0 - h0*tau) : h0);
+		}
+
+		//! Jacobi decomposition of (at most) L 3x3 symmetric matrices at once (see ComputeEigenValuesAndVectors3)
+		/** \return the number of successful decompositions
 		**/
-		static bool GetEigenVector(const SquareMatrix& eigenVectors, unsigned index, Scalar eigenVector[])
+		template <unsigned L> static unsigned DecomposeBlock3(	const Scalar* packedMatrices,
+																unsigned laneCount,
+																Scalar* eigenValues,
+																Scalar* eigenVectors,
+																bool* success,
+																bool absoluteValues,
+																unsigned maxIterationCount)
 		{
-			if (eigenVector && index < eigenVectors.size())
+			assert(laneCount != 0 && laneCount <= L);
+
+			Block3<L> block;
+
+			//init (the unused lanes are filled with a null matrix, which converges immediately)
+			for (unsigned l = 0; l < L; ++l)
 			{
-				for (unsigned i = 0; i < eigenVectors.size(); ++i)
+				const Scalar* m = (l < laneCount ? packedMatrices + 6 * l : nullptr);
+				for (unsigned ip = 0; ip < 3; ++ip)
 				{
-					eigenVector[i] = eigenVectors.m_values[i][index];
+					block.b[ip][l] = block.d[ip][l] = (m ? m[ip] : 0);
+					block.a[ip][l] = (m ? m[3 + ip] : 0);
+					block.z[ip][l] = 0;
+					for (unsigned j = 0; j < 3; ++j)
+					{
+						block.v[ip][j][l] = (ip == j ? 1 : 0);
+					}
 				}
-				return true;
-			}
-			else
-			{
-				assert(false);
-				return false;
+				block.active[l] = 1;
 			}
-		}
-		
-		//! Returns the biggest eigenvalue and its associated eigenvector
-		/** \param eigenVectors eigenvectors (as a square matrix)
-		\param eigenValues eigenvalues
-		\param maxEigenValue biggest eigenvalue
-		\param maxEigenVector eigenvector vector corresponding to the biggest eigenvalue
-		\return success
-		**/
-		static bool GetMaxEigenValueAndVector(const SquareMatrix& eigenVectors, const EigenValues& eigenValues, Scalar& maxEigenValue, Scalar maxEigenVector[])
-		{
-			if (!eigenVectors.isValid()
-					|| eigenVectors.size() < 2
-					|| eigenVectors.size() != eigenValues.size())
+
+			for (unsigned i = 1; i <= maxIterationCount; i++)
 			{
-				assert(false);
-				return false;
+				//Sum off-diagonal elements
+				Scalar activeCount = 0;
+				for (unsigned l = 0; l < L; ++l)
+				{
+					Scalar sm = std::abs(block.a[0][l]) + std::abs(block.a[1][l]) + std::abs(block.a[2][l]);
+					block.active[l] = (sm == 0 ? 0 : block.active[l]); //The normal return, which relies on quadratic convergence to machine underflow.
+					block.tresh[l] = (i < 4 ? sm / static_cast<Scalar>(5 * 9) : 0); //...on the first three sweeps.
+					activeCount += block.active[l];
+				}
+
+				if (activeCount == 0)
+				{
+					break;
+				}
+
+				//same order as Decompose
+				RotateBlock3<L, 0, 1, 0, 1, 2>(block, i > 4);
+				RotateBlock3<L, 0, 2, 1, 0, 2>(block, i > 4);
+				RotateBlock3<L, 1, 2, 2, 0, 1>(block, i > 4);
+
+				//update b, d and z
+				for (unsigned ip = 0; ip < 3; ip++)
+				{
+					for (unsigned l = 0; l < L; ++l)
+					{
+						const bool active = (block.active[l] != 0);
+						block.b[ip][l] = (active ? block.b[ip][l] + block.z[ip][l] : block.b[ip][l]);
+						block.d[ip][l] = (active ? block.b[ip][l] : block.d[ip][l]);
+						block.z[ip][l] = 0;
+					}
+				}
 			}
-			
-			unsigned maxIndex = 0;
-			for (unsigned i = 1; i<eigenVectors.size(); ++i)
-				if (eigenValues[i] > eigenValues[maxIndex])
-					maxIndex = i;
-			
-			maxEigenValue = eigenValues[maxIndex];
-			return GetEigenVector(eigenVectors, maxIndex, maxEigenVector);
-		}
-		
-		//! Returns the smallest eigenvalue and its associated eigenvector
-		/** \param eigenVectors eigenvectors (as a square matrix)
-		\param eigenValues eigenvalues
-		\param minEigenValue smallest eigenvalue
-		\param minEigenVector eigenvector vector corresponding to the smallest eigenvalue
-		\return success
-		**/
-		static bool GetMinEigenValueAndVector(const SquareMatrix& eigenVectors, const EigenValues& eigenValues, Scalar& minEigenValue, Scalar minEigenVector[])
-		{
-			if (!eigenVectors.isValid()
-					|| eigenVectors.size() < 2
-					|| eigenVectors.size() != eigenValues.size())
+
+			//output
+			unsigned successCount = 0;
+			for (unsigned l = 0; l < laneCount; ++l)
 			{
-				assert(false);
-				return false;
+				const bool converged = (block.active[l] == 0);
+				for (unsigned ip = 0; ip < 3; ++ip)
+				{
+					eigenValues[3 * l + ip] = (absoluteValues && converged ? std::abs(block.d[ip][l]) : block.d[ip][l]);
+					for (unsigned j = 0; j < 3; ++j)
+					{
+						eigenVectors[9 * l + 3 * ip + j] = block.v[ip][j][l];
+					}
+				}
+				if (success)
+				{
+					success[l] = converged;
+				}
+				if (converged)
+				{
+					++successCount;
+				}
 			}
-			
-			unsigned minIndex = 0;
-			for (unsigned i = 1; i < eigenVectors.size(); ++i)
-				if (eigenValues[i] < eigenValues[minIndex])
-					minIndex = i;
-			
-			minEigenValue = eigenValues[minIndex];
-			return GetEigenVector(eigenVectors, minIndex, minEigenVector);
+
+			return successCount;
 		}
 	};
 }
@@ -12,6 +12,10 @@ namespace CCCoreLib
 	class GenericProgressCallback;
 
 	//! A Kd Tree Class which implements functions related to point to point distance
+	/** The nodes are stored in a single contiguous array (in depth-first order: the left
+		child of a node is always the next node, only the right child index is stored) and
+		the points are stored contiguously (with their coordinates) in the leaves order.
+	**/
 	class CC_CORE_LIB_API KDTree
 	{
 	public:
@@ -25,9 +29,11 @@ namespace CCCoreLib
 		//! Builds the KD-tree
 		/** \param cloud the point cloud from which to buil the KDtree
 			\param progressCb the client method can get some notification of the process progress through this callback mechanism (see GenericProgressCallback)
+			\param multiThread whether to build the sub-trees in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
 			\return success
 		**/
-		bool buildFromCloud(GenericIndexedCloud* cloud, GenericProgressCallback* progressCb = nullptr);
+		bool buildFromCloud(GenericIndexedCloud* cloud, GenericProgressCallback* progressCb = nullptr, bool multiThread = true, int maxThreadCount = 0);
 
 		//! Gets the point cloud from which the tree has been build
 		/** \return associated cloud
@@ -38,174 +44,202 @@ namespace CCCoreLib
 		/** \param queryPoint coordinates of the query point from which we want the nearest point in the tree
 			\param nearestPointIndex [out] index of the point that lies the nearest from query Point. Corresponding coordinates can be retrieved using getAssociatedCloud()->getPoint(nearestPointIndex)
 			\param maxDist distance above which the function doesn't consider points
-			\return true if it finds a point p such that ||p-queryPoint||<=maxDist. False otherwise
+			\return true if it finds a point p such that ||p-queryPoint||<maxDist. False otherwise
 		**/
 		bool findNearestNeighbour(	const PointCoordinateType* queryPoint,
 									unsigned& nearestPointIndex,
-									ScalarType maxDist);
+									ScalarType maxDist) const;
 
 
 		//! Optimized version of findNearestNeighbour with a maximum distance
-		/** Only checks if there is a point p into the tree such that ||p-queryPoint||<=maxDist (see FindNearestNeighbour())
+		/** Only checks if there is a point p into the tree such that ||p-queryPoint||<maxDist (see FindNearestNeighbour())
 		**/
 		bool findNearestNeighbourWithMaxDist(	const PointCoordinateType* queryPoint,
-												ScalarType maxDist);
+												ScalarType maxDist) const;
 
 
 		//! Searches for the points that lie at a given distance (+/-tolerance) from a query point
 		/** \param queryPoint query point coordinates
 			\param distance distance wished between the query point and resulting points
 			\param tolerance distance tolerance: p is selected if distance-tolerance<=||p-queryPoint||<=distance+tolerance
-			\param[out] pointndexes array of point indexes
-			\return the number of matching points
+			\param[out] pointndexes array of point indexes (the matching points are appended)
+			\return the number of point indexes in the array
 		**/
 		unsigned radiusSearch(	const PointCoordinateType* queryPoint,
 								ScalarType distance,
 								ScalarType tolerance,
-								std::vector<unsigned>& pointndexes);
+								std::vector<unsigned>& pointndexes) const;
+
+		//! K nearest neighbours search
+		/** The neighbours are sorted by increasing distance. No memory is allocated.
+			\param queryPoint query point coordinates
+			\param k the number of neighbours to find
+			\param[out] neighbourIndexes the neighbours indexes (should be of size 'k' at least)
+			\param[out] squareDistances the neighbours squared distances (should be of size 'k' at least)
+			\param maxDist distance above which points are ignored (negative = no limit)
+			\return the number of neighbours actually found (<= k)
+		**/
+		unsigned findKNearestNeighbours(	const PointCoordinateType* queryPoint,
+											unsigned k,
+											unsigned* neighbourIndexes,
+											ScalarType* squareDistances,
+											ScalarType maxDist = -1) const;
+
+		//! Nearest point search for a batch of query points
+		/** The query points are processed in parallel.
+			\param queryPoints the query points
+			\param count the number of query points
+			\param maxDist distance above which the function doesn't consider points (negative = no limit, contrary to findNearestNeighbour)
+			\param[out] nearestPointIndexes the index of the nearest point of each query point, or -1 if there's none (should be of size 'count')
+			\param[out] squareDistances [optional] the squared distance to the nearest point of each query point (should be of size 'count')
+			\param multiThread whether to process the query points in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return the number of query points which have a neighbour
+		**/
+		unsigned findNearestNeighbours(	const CCVector3* queryPoints,
+										unsigned count,
+										ScalarType maxDist,
+										int* nearestPointIndexes,
+										ScalarType* squareDistances = nullptr,
+										bool multiThread = true,
+										int maxThreadCount = 0) const;
+
+		//! Checks for a batch of query points whether there's a point in the tree closer than a given distance
+		/** The query points are processed in parallel (see findNearestNeighbourWithMaxDist).
+			\param queryPoints the query points
+			\param count the number of query points
+			\param maxDist the max distance
+			\param[out] found [optional] whether each query point has a neighbour (1) or not (0) (should be of size 'count')
+			\param multiThread whether to process the query points in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return the number of query points which have a neighbour
+		**/
+		unsigned findNearestNeighboursWithMaxDist(	const CCVector3* queryPoints,
+													unsigned count,
+													ScalarType maxDist,
+													unsigned char* found = nullptr,
+													bool multiThread = true,
+													int maxThreadCount = 0) const;
+
+		//! K nearest neighbours search for a batch of query points
+		/** The query points are processed in parallel. The results are stored in flat arrays
+			('k' slots per query point, sorted by increasing distance).
+			\param queryPoints the query points
+			\param count the number of query points
+			\param k the number of neighbours to find per query point
+			\param[out] neighbourIndexes the neighbours indexes (should be of size 'count * k')
+			\param[out] squareDistances [optional] the neighbours squared distances (should be of size 'count * k')
+			\param[out] neighbourCounts [optional] the number of neighbours actually found for each query point (should be of size 'count')
+			\param maxDist distance above which points are ignored (negative = no limit)
+			\param multiThread whether to process the query points in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return success (false if not enough memory)
+		**/
+		bool findKNearestNeighbours(	const CCVector3* queryPoints,
+										unsigned count,
+										unsigned k,
+										unsigned* neighbourIndexes,
+										ScalarType* squareDistances = nullptr,
+										unsigned* neighbourCounts = nullptr,
+										ScalarType maxDist = -1,
+										bool multiThread = true,
+										int maxThreadCount = 0) const;
+
+		//! Returns the number of nodes
+		inline unsigned getNodeCount() const { return static_cast<unsigned>(m_nodes.size()); }
 
 	protected:
 
-		//! A KDTre cell struct
-		struct KdCell
-		{
-			KdCell()
-				: cuttingDim(0)
-				, cuttingCoordinate(0)
-				, leSon(nullptr)
-				, gSon(nullptr)
-				, father(nullptr)
-				, startingPointIndex(0)
-				, nbPoints(0)
-				, boundsMask(0)
-			{}
-
-			//Warning: put the non aligned members (< 4 bytes) at the end to avoid too much alignment padding!
+		//! Maximum number of points per leaf
+		static const unsigned MAX_POINTS_PER_LEAF = 8;
 
-			//! Inside bounding box max point
-			/** The inside bounding box is the smallest cube containing all the points in the cell
-			**/
-			CCVector3 inbbmax;																			//12 bytes
+		//! A KD-tree node
+		struct KdNode
+		{
 			//! Inside bounding box min point
-			/** The inside bounding box is the smallest cube containing all the points in the cell
+			/** The inside bounding box is the smallest box containing all the points in the node
 			**/
-			CCVector3 inbbmin;																			//12 bytes
-			//! Outside bounding box min point
-			/** The outside bounding box is the bigest cube contained inside the cutting planes that lead to the cell
-			**/
-			CCVector3 outbbmin;																			//12 bytes
-			//! Outside bounding box max point
-			/** The outside bounding box is the bigest cube contained inside the cutting planes that lead to the cell
+			CCVector3 bbMin;																			//12 bytes
+			//! Inside bounding box max point
+			CCVector3 bbMax;																			//12 bytes
+			//! Place where the space is cut into two sub-spaces (children)
+			/** Each point p which lies in the left child is such as p[cuttingDim] <= cuttingCoordinate,
+				and each point p which lies in the right child is such as p[cuttingDim] >= cuttingCoordinate
 			**/
-			CCVector3 outbbmax;																			//12 bytes
-
+			PointCoordinateType cuttingCoordinate;														//4 bytes
+			//! Index of the right child (the left child is always the next node) or 0 for leaves
+			unsigned rightChild;																		//4 bytes
+			//! Index of the first point of this node
+			unsigned firstPoint;																		//4 bytes
+			//! Number of points in this node
+			unsigned pointCount;																		//4 bytes
 			//! Dimension (0, 1 or 2 for x, y or z) which is used to separate the two children
 			unsigned cuttingDim;																		//4 bytes
-			//! Place where the space is cut into two sub-spaces (children)
-			PointCoordinateType cuttingCoordinate;														//4 bytes
-			//! Each point p which lie in leSon is such as p[cuttingDim] <= cuttingCoordinate
-			struct KdCell* leSon;																		//8 bytes
-			//! Each point p which lie in gSon is such as p[cuttingDim] > cuttingCoordinate
-			struct KdCell* gSon;																		//8 bytes
-			//! To go up in the tree
-			struct KdCell* father;																		//8 bytes
-			//! Index of the first element that belongs to this cell
-			unsigned startingPointIndex;																//4 bytes
-			//! Number of elements in this cell
-			unsigned nbPoints;																			//4 bytes
-
-			//! Mask to know if the outside box is bounded for a given dimmension
-			/** if boundsMask & (2^d) then outbbmin.u[d] is bounded (else the box is opened in outmin.u[d] - i.e. outbbmin.u[d] = -infinite)
-			if boundsmask & (2^(3+d)) then outbbmax.u[d] is bounded (else the box is opened in outmax.u[d] - i.e. outbbmax.u[d] = infinite)
-			**/
-			unsigned char boundsMask;																	//1 byte (+ 3 for alignment)
 
-			//Total																						//92 bytes
+			//! Returns whether the node is a leaf or not
+			inline bool isLeaf() const { return rightChild == 0; }
+
+			//Total																						//44 bytes
+		};
+
+		//! A point stored in the tree
+		struct KdPoint
+		{
+			//! Point coordinates
+			CCVector3 P;
+			//! Point index (in the associated cloud)
+			unsigned index;
+		};
+
+		//! A sub-tree to build
+		struct BuildTask
+		{
+			//! Index of the sub-tree root node
+			unsigned nodeIndex;
+			//! Index of the first point of the sub-tree
+			unsigned firstPoint;
+			//! Number of points of the sub-tree
+			unsigned pointCount;
 		};
 
 		/*** Protected attributes ***/
 
-		//! Tree root
-		KdCell* m_root;
-		//! Point indexes
-		std::vector<unsigned> m_indexes;
+		//! Nodes (the first one is the root)
+		std::vector<KdNode> m_nodes;
+		//! Points (in the leaves order)
+		std::vector<KdPoint> m_points;
 		//! Associated cloud
 		GenericIndexedCloud* m_associatedCloud;
-		//! Number of cells
-		unsigned m_cellCount;
 
 
 		/*** Protected methods ***/
 
-		//! Builds a sub tree
-		/** \param first first index
-			\param last last index
-			\param father father cell
-			\param nbBuildCell nbBuildCell
-			\param progressCb the client method can get some notification of the process progress through this callback mechanism (see GenericProgressCallback)
-			\return sub tree (cell)
-		**/
-		KdCell* buildSubTree(unsigned first, unsigned last, KdCell* father, unsigned& nbBuildCell, GenericProgressCallback* progressCb = nullptr);
-
-		//! Deletes a sub tree
-		void deleteSubTree(KdCell* cell);
-
-		//! Computes a cell inside bounding box using the sons ones. The sons bounding boxes have to be up to date considering the points they contain.
-		void updateInsideBoundingBox(KdCell* cell);
-
-		//! Computes a cell outside bounding box using the father one and the cutting plane.
-		void updateOutsideBoundingBox(KdCell* cell);
-
-		//! Computes the distance between a point and a cell inside bounding box
-		/** \param queryPoint queryPoint coordinates
-			\param cell the cell from which we want to compute the distance
-			\return 0 if the point is inside the cell, the suare of the distance between the two elements if the point is outside
+		//! Returns the number of nodes of a sub-tree
+		/** \param pointCount number of points of the sub-tree
+			\return number of nodes
 		**/
-		ScalarType pointToCellSquareDistance(const PointCoordinateType* queryPoint, KdCell* cell);
+		static unsigned ComputeNodeCount(unsigned pointCount);
 
-		//! Computes the distance between a point and the outside bounding box of the cell in which it lies.
-		/** \param queryPoint the query point coordinates
-			\param cell the cell containting the query point
-			\return the distance between the point and the cell border. If this value is negative, it means that the cell has no border.
-		**/
-		ScalarType insidePointToCellDistance(const PointCoordinateType* queryPoint, KdCell* cell);
-
-		//! Computes the distances (min & max) between a point and a cell inside bounding box
-		/** \param queryPoint the query point coordinates
-			\param cell the cell from which we want to compute the distance
-			\param min [out] the minimal distance between the query point and the inside bounding box of cell
-			\param max [out] the maximal distance between the query point and the inside bounding box of cell
+		//! Builds a sub tree
+		/** \param task the sub-tree to build
+			\param splitLevels number of levels to build before deferring the remaining sub-trees (if 'deferredTasks' is not null)
+			\param deferredTasks [optional] the sub-trees that remain to be built
 		**/
-		void pointToCellDistances(const PointCoordinateType* queryPoint, KdCell* cell, ScalarType& min, ScalarType& max);
+		void buildSubTree(const BuildTask& task, unsigned splitLevels = 0, std::vector<BuildTask>* deferredTasks = nullptr);
 
-		//! Checks if there is a point in KdCell that is closer than 'minDist' from the query point, starting from the input cell
-		/** \param queryPoint the query Point coordinates
-			\param maxSqrDist square of the maximal distance from querypoint
-			\param cell kdtree-cell from which to start the research
-			\return -1 if there is no nearer point from querypoint. The nearest point index found in cell if there is one that is at most maxdist apart from querypoint
-		**/
-		int checkClosestPointInSubTree(const PointCoordinateType* queryPoint, ScalarType& maxSqrDist, KdCell* cell);
-
-		//! Checks if there is a point in KdCell that is less than minDist-apart from the query point, starting from cell cell
-		/** Optimiszed version of CheckNearerPointInSubTree since we don't want to find the nearest point, but only check if there is a point that is close enough
-			\param queryPoint the query Point coordinates
-			\param maxSqrDist square of the maximal distance from querypoint
-			\param cell kdtree-cell from which to start the research
-			\return true if there is a point in the subtree starting at cell that is close enough from the query point
+		//! Computes the squared distance between a point and a node inside bounding box
+		/** \param queryPoint queryPoint coordinates
+			\param node the node from which we want to compute the distance
+			\return 0 if the point is inside the node, the square of the distance between the two elements if the point is outside
 		**/
-		bool checkDistantPointInSubTree(const PointCoordinateType* queryPoint, ScalarType& maxSqrDist, KdCell* cell);
+		static ScalarType PointToNodeSquareDistance(const PointCoordinateType* queryPoint, const KdNode& node);
 
-		//! Recursive function which store every point lying at a given distance from the query point (+/- tolerance)
+		//! Computes the distances (min & max) between a point and a node inside bounding box
 		/** \param queryPoint the query point coordinates
-			\param distance the wished distance from the query point
-			\param tolerance distance tolerance: p is selected if ||p-queryPoint||<=tolerance
-			\param cell current cell to explore (used for recursion)
-			\param[out] pointIndexes array of point indexes
+			\param node the node from which we want to compute the distance
+			\param min [out] the minimal distance between the query point and the inside bounding box of node
+			\param max [out] the maximal distance between the query point and the inside bounding box of node
 		**/
-		void distanceScanTree(	const PointCoordinateType* queryPoint,
-								ScalarType distance,
-								ScalarType tolerance,
-								KdCell* cell,
-								std::vector<unsigned>& pointIndexes);
+		static void PointToNodeDistances(const PointCoordinateType* queryPoint, const KdNode& node, ScalarType& min, ScalarType& max);
 	};
 }
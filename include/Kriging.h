@@ -62,10 +62,11 @@ public:
 };
 
 class CholeskyDecomposition;
+struct KrigeContext;
 struct OrdinaryKrigeContext;
 struct SimpleKrigeContext;
 
-//! Simple and Ordinary Kriging
+//! Simple, Ordinary and Universal Kriging
 /** Inspired by https://github.com/ByteShark/Kriging/
 **/
 class CC_CORE_LIB_API Kriging
@@ -81,6 +82,14 @@ class CC_CORE_LIB_API Kriging
 			Invalid
 		};
 
+		//! Drift (trend) model of universal kriging
+		enum Drift
+		{
+			ConstantDrift = 0,	//!< unknown constant mean (= ordinary kriging)
+			LinearDrift,		//!< unknown linear trend (1, x, y)
+			QuadraticDrift		//!< unknown quadratic trend (1, x, y, x^2, x.y, y^2)
+		};
+
 		//! Vector type
 		using Vector = std::vector<double>;
 		//! Matrix type
@@ -110,32 +119,135 @@ class CC_CORE_LIB_API Kriging
 			double range;
 		};
 
+		//! Empirical (binned) semi-variogram
+		struct EmpiricalVariogram
+		{
+			//! Average distance of the pairs of each bin
+			Vector lagDistances;
+			//! Average semi-variance of the pairs of each bin
+			Vector semiVariances;
+			//! Number of pairs in each bin
+			std::vector<size_t> pairCounts;
+		};
+
+		//! Computes a binned empirical semi-variogram
+		/** All the pairs of data points closer than 'maxLag' are enumerated with a regular grid
+			(if there are more than 'maxSampleCount' data points, a random but reproducible subset
+			is used). Duplicate points are ignored.
+			\param maxLag maximum distance between two points
+			\param binCount number of (regular) bins between 0 and maxLag
+			\param variogram output variogram
+			\param maxSampleCount maximum number of data points to consider
+			\param multiThread whether to accumulate the bins in parallel (if supported) or not
+			\return success
+		**/
+		bool computeEmpiricalVariogram(	double maxLag,
+										unsigned binCount,
+										EmpiricalVariogram& variogram,
+										size_t maxSampleCount = 10000,
+										bool multiThread = true) const;
+
+		//! Fits a variogram model on an empirical variogram
+		/** Weighted least squares fit of the nugget, sill and range (the weight of each bin
+			is its pair count divided by its squared lag distance).
+			\param variogram empirical variogram
+			\param model model to fit (if 'Invalid', the best fitting model among Spherical,
+			Exponential and Gaussian is returned)
+			\return the fitted parameters (the model is 'Invalid' if the fit failed)
+		**/
+		static KrigeParams FitVariogramModel(const EmpiricalVariogram& variogram, Model model = Invalid);
+
 		//! Computes default parameters
-		KrigeParams computeDefaultParameters() const;
+		/** Fits a model on the empirical variogram of the data points (up to half the
+			diagonal of their bounding-box).
+		**/
+		KrigeParams computeDefaultParameters(bool multiThread = true) const;
 
 		// Ordinary Kriging (all cells at once, returns a grid)
+		/** The raster is processed by tiles. Each worker has its own context (all
+			contexts share the same kd-tree) and writes directly in the output grid.
+			\param params kriging parameters
+			\param knn number of nearest neighbors used for each cell
+			\param output output grid (width * height points, the cell (i, j) is stored at i * height + j)
+			\param multiThread whether to process the tiles in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return success
+		**/
 		bool ordinaryKrige(	const KrigeParams& params,
 							unsigned knn,
-							std::vector<DataPoint>& output);
+							std::vector<DataPoint>& output,
+							bool multiThread = false,
+							int maxThreadCount = 0);
+
+		// Simple Kriging (all cells at once, returns a grid)
+		/** Simple kriging assumes that the mean of the values is known. The (covariance)
+			matrix of the system is then positive definite and is solved with a Cholesky
+			decomposition, which makes it roughly twice as fast as ordinary kriging.
+			\param params kriging parameters
+			\param mean known mean of the values
+			\param knn number of nearest neighbors used for each cell
+			\param output output grid (same layout as ordinaryKrige)
+			\param multiThread whether to process the tiles in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return success
+		**/
+		bool simpleKrige(	const KrigeParams& params,
+							double mean,
+							unsigned knn,
+							std::vector<DataPoint>& output,
+							bool multiThread = false,
+							int maxThreadCount = 0);
+
+		// Universal Kriging (all cells at once, returns a grid)
+		/** Universal kriging assumes that the values follow an unknown (local) trend.
+			\warning 'knn' must be at least equal to the number of drift terms (and should be much larger)
+			\param params kriging parameters
+			\param drift drift model (ConstantDrift is equivalent to ordinary kriging)
+			\param knn number of nearest neighbors used for each cell
+			\param output output grid (same layout as ordinaryKrige)
+			\param multiThread whether to process the tiles in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return success
+		**/
+		bool universalKrige(const KrigeParams& params,
+							Drift drift,
+							unsigned knn,
+							std::vector<DataPoint>& output,
+							bool multiThread = false,
+							int maxThreadCount = 0);
 
-		// Ordinary Kriging (cell by cell, with a 'context' object)
+		// Ordinary (or universal) Kriging (cell by cell, with a 'context' object)
 		double ordinaryKrigeSingleCell(	const KrigeParams& params,
 										unsigned row,
 										unsigned col,
 										OrdinaryKrigeContext* context,
 										bool alreadyHaveCandidates = false);
 
+		// Simple Kriging (cell by cell, with a 'context' object)
+		double simpleKrigeSingleCell(	const KrigeParams& params,
+										unsigned row,
+										unsigned col,
+										SimpleKrigeContext* context,
+										bool alreadyHaveCandidates = false);
+
 		// context management
-		OrdinaryKrigeContext* createOrdinaryKrigeContext(int knn);
+		/** \param knn number of nearest neighbors
+			\param reuseFactorization whether to reuse the factorization of the kriging system
+			when the set of candidates is the same as for the previous cell (only the
+			covariograms of the new cell are computed then)
+			\param drift drift model (a context with a non-constant drift performs universal kriging)
+		**/
+		OrdinaryKrigeContext* createOrdinaryKrigeContext(int knn, bool reuseFactorization = true, Drift drift = ConstantDrift);
 		void releaseOrdinaryKrigeContext(OrdinaryKrigeContext*& context);
 
-protected:
-
-		//! Fills a matrix of covariograms over all point distances
-		Matrix calculateCovariogramMatrix(const std::vector<DataPoint>& dataPointCandidates, const KrigeParams& params, bool lagrangeMultiplier) const;
+		/** \param knn number of nearest neighbors
+			\param mean known mean of the values
+			\param reuseFactorization see createOrdinaryKrigeContext
+		**/
+		SimpleKrigeContext* createSimpleKrigeContext(int knn, double mean, bool reuseFactorization = true);
+		void releaseSimpleKrigeContext(SimpleKrigeContext*& context);
 
-		//! Fills a vector of covariograms over all distances from a given point
-		Vector calculateCovariogramVector(const std::vector<DataPoint>& dataPointCandidates, const CCVector2d& point, const KrigeParams& params, bool lagrangeMultiplier) const;
+protected:
 
 		//! Association of a point index and a (squared) distance
 		struct SquareDistanceAndIndex
@@ -153,14 +265,40 @@ protected:
 		//! Calculates the covariogram
 		double calculateCovariogram(const KrigeParams& params, double distance) const;
 
-		//! Simple linear regression
-		/** \return slope and intercept
+		//! Kriging of all the cells (by tiles)
+		/** The raster is processed by tiles. Each worker has its own context (all
+			contexts share the kd-tree and the settings of the main context) and writes
+			directly in the output grid.
+		**/
+		bool krigeGrid(	const KrigeParams& params,
+						KrigeContext& mainContext,
+						std::vector<DataPoint>& output,
+						bool multiThread,
+						int maxThreadCount);
+
+		//! Kriging of all the cells of a given tile
+		void krigeTile(	const KrigeParams& params,
+						unsigned tileIndex,
+						KrigeContext* context,
+						std::vector<DataPoint>& output);
+
+		//! Kriging of a single cell
+		double krigeSingleCell(	const KrigeParams& params,
+								unsigned row,
+								unsigned col,
+								KrigeContext* context,
+								bool alreadyHaveCandidates = false);
+
+		//! Computes and factorizes the kriging system of the current candidates
+		/** \return false if the system is singular
 		**/
-		std::pair<double, double> linearRegression(const Vector& X, const Vector& Y) const;
+		bool factorizeKrigeSystem(const KrigeParams& params, KrigeContext& context) const;
 
-		//! Ordinary Kringing for an individual point
-		double ordinaryKrigeForPoint(const CCVector2d& point, const KrigeParams& params,
-			                         const std::vector<DataPoint>& dataPointCandidates);
+		//! Kringing for an individual point
+		/** Relies on the candidates and the scratch buffers of the context (no memory allocation).
+		**/
+		double krigeForPoint(const CCVector2d& point, const KrigeParams& params,
+			                 KrigeContext& context) const;
 
 	protected: // members
 
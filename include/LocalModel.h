@@ -25,6 +25,20 @@ namespace CCCoreLib
 								const CCVector3 &center,
 								PointCoordinateType squaredRadius);
 
+		//! Factory for an already computed quadric model
+		/** See Neighbourhood::getQuadric.
+			\param eq quadric equation
+			\param dims quadric dimensions
+			\param gravityCenter gravity center of the points from which the quadric has been computed
+			\param center model "center"
+			\param squaredRadius model max radius (squared)
+		**/
+		static LocalModel* NewQuadric(	const PointCoordinateType eq[6],
+										const Tuple3ub& dims,
+										const CCVector3& gravityCenter,
+										const CCVector3& center,
+										PointCoordinateType squaredRadius);
+
 		//! Destructor
 		virtual ~LocalModel() = default;
 
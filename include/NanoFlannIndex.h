@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: LGPL-2.0-or-later
+// Copyright © CloudCompare Project
+
+#pragma once
+
+//Local
+#include "CCGeom.h"
+
+//system
+#include <vector>
+
+namespace CCCoreLib
+{
+	class GenericIndexedCloud;
+
+	//! 3D KD-tree index of a cloud (based on nanoflann)
+	/** Complementary to the DgmOctree: the tree is fast to build and well suited to
+		k-nearest neighbours queries and to radius queries at arbitrary locations.
+		All the queries are const and can be called concurrently.
+
+		\note This is a public API only: the library algorithms still rely on the DgmOctree
+		for their own neighbour searches.
+	**/
+	class CC_CORE_LIB_API NanoFlannIndex
+	{
+	public:
+
+		//! Default constructor
+		NanoFlannIndex();
+
+		//! Destructor
+		virtual ~NanoFlannIndex();
+
+		//! Builds the index
+		/** \param cloud the cloud to index (must stay valid as long as the index is used)
+			\param packedCopy whether the points are copied in a packed array (faster queries,
+			12 more bytes per point) or read through GenericIndexedCloud::getPoint (no copy)
+			\param maxLeafSize maximum number of points per leaf
+			\return success
+		**/
+		bool build(GenericIndexedCloud* cloud, bool packedCopy = true, unsigned maxLeafSize = 10);
+
+		//! Releases the index
+		void clear();
+
+		//! Returns whether the index is built
+		inline bool isBuilt() const { return m_index != nullptr; }
+
+		//! Returns the indexed cloud
+		inline GenericIndexedCloud* getAssociatedCloud() const { return m_associatedCloud; }
+
+		//! K nearest neighbours search
+		/** The neighbours are sorted by increasing distance. No memory is allocated.
+			\param queryPoint query point coordinates
+			\param k the number of neighbours to find
+			\param[out] neighbourIndexes the neighbours indexes (should be of size 'k' at least)
+			\param[out] squareDistances the neighbours squared distances (should be of size 'k' at least)
+			\param maxDist distance above which points are ignored (negative = no limit)
+			\return the number of neighbours actually found (<= k)
+		**/
+		unsigned findKNearestNeighbours(	const CCVector3& queryPoint,
+											unsigned k,
+											unsigned* neighbourIndexes,
+											ScalarType* squareDistances,
+											ScalarType maxDist = -1) const;
+
+		//! Searches for the points closer than a given radius
+		/** The points are appended to the output arrays.
+			\param queryPoint query point coordinates
+			\param radius search radius
+			\param[out] neighbourIndexes the neighbours indexes
+			\param[out] squareDistances [optional] the neighbours squared distances
+			\param sortByDistance whether to sort the neighbours by increasing distance or not
+			\return the number of neighbours found
+		**/
+		unsigned findPointsInRadius(	const CCVector3& queryPoint,
+										PointCoordinateType radius,
+										std::vector<unsigned>& neighbourIndexes,
+										std::vector<ScalarType>* squareDistances = nullptr,
+										bool sortByDistance = false) const;
+
+		//! K nearest neighbours search for a batch of query points
+		/** The query points are processed in parallel. The results are stored in flat arrays
+			('k' slots per query point, sorted by increasing distance).
+			\param queryPoints the query points
+			\param count the number of query points
+			\param k the number of neighbours to find per query point
+			\param[out] neighbourIndexes the neighbours indexes (should be of size 'count * k')
+			\param[out] squareDistances [optional] the neighbours squared distances (should be of size 'count * k')
+			\param[out] neighbourCounts [optional] the number of neighbours actually found for each query point (should be of size 'count')
+			\param maxDist distance above which points are ignored (negative = no limit)
+			\param multiThread whether to process the query points in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return success (false if the index is not built or not enough memory)
+		**/
+		bool findKNearestNeighbours(	const CCVector3* queryPoints,
+										unsigned count,
+										unsigned k,
+										unsigned* neighbourIndexes,
+										ScalarType* squareDistances = nullptr,
+										unsigned* neighbourCounts = nullptr,
+										ScalarType maxDist = -1,
+										bool multiThread = true,
+										int maxThreadCount = 0) const;
+
+		//! Radius search for a batch of query points
+		/** The query points are processed in parallel. The neighbours of the i-th query point
+			are neighbourIndexes[neighbourOffsets[i]] to neighbourIndexes[neighbourOffsets[i + 1] - 1].
+			\param queryPoints the query points
+			\param count the number of query points
+			\param radius search radius
+			\param[out] neighbourIndexes the neighbours indexes of all the query points (resized)
+			\param[out] neighbourOffsets the position of the first neighbour of each query point (resized to 'count + 1')
+			\param[out] squareDistances [optional] the neighbours squared distances (resized)
+			\param sortByDistance whether to sort the neighbours of each query point by increasing distance or not
+			\param multiThread whether to process the query points in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return success (false if the index is not built or not enough memory)
+		**/
+		bool findPointsInRadius(	const CCVector3* queryPoints,
+									unsigned count,
+									PointCoordinateType radius,
+									std::vector<unsigned>& neighbourIndexes,
+									std::vector<unsigned>& neighbourOffsets,
+									std::vector<ScalarType>* squareDistances = nullptr,
+									bool sortByDistance = false,
+									bool multiThread = true,
+									int maxThreadCount = 0) const;
+
+	protected:
+
+		//! Internal structure (nanoflann index and adaptor)
+		struct Index;
+
+		//! Internal index
+		Index* m_index;
+
+		//! Indexed cloud
+		GenericIndexedCloud* m_associatedCloud;
+
+	private:
+
+		//! Copy is not allowed
+		NanoFlannIndex(const NanoFlannIndex&) = delete;
+		//! Assignment is not allowed
+		NanoFlannIndex& operator=(const NanoFlannIndex&) = delete;
+	};
+}
@@ -8,7 +8,7 @@
 //Local
 #include "CCMiscTools.h"
 #include "GenericIndexedCloudPersist.h"
-#include "SquareMatrix.h"
+#include "SquareMatrixN.h"
 
 
 namespace CCCoreLib
@@ -188,6 +188,16 @@ namespace CCCoreLib
 		**/
 		double computeFeature(GeomFeature feature);
 
+		//! Computes the given feature from the eigen decomposition of the covariance matrix of a set of point
+		/** Useful to process several neighbourhoods at once (see computePackedCovarianceMatrix
+			and Jacobi::ComputeEigenValuesAndVectors3).
+			\param feature feature
+			\param eigVectors eigenvectors (will be sorted in the decreasing order of their associated eigenvalues)
+			\param eigValues absolute eigenvalues (will be sorted in decreasing order)
+			\return feature value
+		**/
+		static double ComputeFeature(GeomFeature feature, SquareMatrix3d& eigVectors, double (&eigValues)[3]);
+
 		//! Computes the 1st order moment of a set of point (based on the eigenvalues)
 		/** \return 1st order moment at a given position P
 			DGM: The article states that the result should be between 0 and 1,
@@ -209,6 +219,12 @@ namespace CCCoreLib
 		**/
 		ScalarType computeCurvature(const CCVector3& P, CurvatureType cType);
 
+		//! Computes the 'normal change rate' curvature from the (absolute) eigenvalues of the covariance matrix of a set of point
+		/** See computeCurvature(NORMAL_CHANGE_RATE).
+			\return curvature value or CCCoreLib::NAN_VALUE if the computation failed
+		**/
+		static ScalarType ComputeNormalChangeRate(const double eigValues[3]);
+
 		/**** GETTERS ****/
 
 		//! Returns gravity center
@@ -266,6 +282,40 @@ namespace CCCoreLib
 		**/
 		const PointCoordinateType* getQuadric(Tuple3ub* dims = nullptr);
 
+		//! Least-square system solved (with a conjugate gradient) to compute the 2.5D quadric
+		/** See getQuadric. The system is "tA.A.X = tA.b".
+		**/
+		struct QuadricSystem
+		{
+			//! tA.A matrix
+			SquareMatrixN<6, double> tAA;
+			//! tA.b vector
+			double tAb[6];
+			//! Initial state (deduced from the LS plane)
+			double X0[6];
+			//! Convergence threshold (max. mean square error)
+			double convergenceThreshold;
+			//! Quadric dimensions (see getQuadric)
+			Tuple3ub dims;
+		};
+
+		//! Max number of conjugate gradient iterations to solve the 2.5D quadric system
+		static constexpr unsigned QUADRIC_MAX_ITERATION_COUNT = 1500;
+
+		//! Builds the least-square system to solve to compute the 2.5D quadric
+		/** Meant to solve many systems at once (see ConjugateGradientBatch).
+			The solution can then be set with setQuadric.
+			\param[out] system least-square system
+			\return false if the neighbourhood is too small or if the LS plane can't be computed
+		**/
+		bool buildQuadricSystem(QuadricSystem& system);
+
+		//! Sets the 2.5D quadric (see buildQuadricSystem)
+		/** \param X solution of the least-square system (i.e. quadric equation)
+			\param dims quadric dimensions
+		**/
+		void setQuadric(const double X[6], const Tuple3ub& dims);
+
 		//! Computes the best interpolating quadric (Least-square)
 		/** \param[out] quadricEquation an array of 10 coefficients [a,b,c,d,e,f,g,l,m,n] such as
 						 a.x^2+b.y^2+c.z^2+2e.x.y+2f.y.z+2g.z.x+2l.x+2m.y+2n.z+d = 0
@@ -276,6 +326,19 @@ namespace CCCoreLib
 		//! Computes the covariance matrix
 		SquareMatrixd computeCovarianceMatrix();
 
+		//! Computes the covariance matrix (fixed-size version)
+		/** \param[out] covMat covariance matrix
+			\return false if the neighbourhood is empty
+		**/
+		bool computeCovarianceMatrix(SquareMatrix3d& covMat);
+
+		//! Computes the covariance matrix (packed version)
+		/** Same layout as the input of Jacobi::ComputeEigenValuesAndVectors3.
+			\param[out] packedCovMat covariance matrix terms (m00, m11, m22, m01, m02, m12)
+			\return false if the neighbourhood is empty
+		**/
+		bool computePackedCovarianceMatrix(double packedCovMat[6]);
+
 		//! Returns the set 'radius' (i.e. the distance between the gravity center and the its farthest point)
 		PointCoordinateType computeLargestRadius();
 
@@ -8,6 +8,8 @@
 
 namespace CCCoreLib
 {
+	class ScalarField;
+
 	//! The Normal/Gaussian statistical distribution
 	/** Implements the GenericDistribution interface.
 	**/
@@ -30,6 +32,7 @@ namespace CCCoreLib
 		bool computeParameters(const ScalarContainer& values) override;
 		double computeP(ScalarType x) const override;
 		double computePfromZero(ScalarType x) const override;
+		void computeCumulativeProbabilities(const ScalarType* x, std::size_t count, double* p) const override;
 		double computeP(ScalarType x1, ScalarType x2) const override;
 		double computeChi2Dist(const GenericCloud* Yk, unsigned numberOfClasses, int* histo = nullptr) override;
 		const char* getName() const override { return "Gauss"; }
@@ -57,6 +60,67 @@ namespace CCCoreLib
 		//! Computes the distribution parameters from a point cloud (with scalar values)
 		bool computeParameters(const GenericCloud* cloud);
 
+		//! Mergeable sufficient statistics of a set of values
+		/** Statistics computed separately on several chunks of values can be merged
+			(see Chan et al.), so that the distribution parameters can be computed in a
+			streaming or parallel fashion without ever gathering the values.
+		**/
+		struct Moments
+		{
+			//! Number of values
+			std::size_t count = 0;
+			//! Mean of the values
+			double mean = 0.0;
+			//! Sum of the squared deviations to the mean
+			double m2 = 0.0;
+
+			//! Adds a single value (Welford's update)
+			inline void add(double v)
+			{
+				++count;
+				double delta = v - mean;
+				mean += delta / count;
+				m2 += delta * (v - mean);
+			}
+
+			//! Merges the statistics of another set of values
+			void merge(const Moments& other);
+
+			//! Returns the (population) variance
+			inline double variance() const { return count != 0 ? m2 / count : 0.0; }
+		};
+
+		//! Computes the statistics of an array of scalar values
+		/** Invalid (NaN) values are ignored.
+			\param values the scalar values
+			\param count the number of values
+			\param center the filtering interval center (only used if maxDeviation > 0)
+			\param maxDeviation only the values such as |v - center| < maxDeviation are considered (ignored if negative)
+			\param multiThread whether to process the values in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return the (mergeable) statistics of the values
+		**/
+		static Moments ComputeMoments(	const ScalarType* values,
+										std::size_t count,
+										ScalarType center = 0,
+										double maxDeviation = -1.0,
+										bool multiThread = true,
+										int maxThreadCount = 0);
+
+		//! Sets the distribution parameters from the statistics of a set of values
+		/** \return the validity of the parameters (i.e. false if there is no value)
+		**/
+		bool computeParameters(const Moments& moments);
+
+		//! Computes the distribution parameters directly from a scalar field
+		/** The values are not copied and can be processed in parallel.
+			\param sf the scalar field
+			\param multiThread whether to process the values in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return the validity of the computed parameters
+		**/
+		bool computeParameters(const ScalarField& sf, bool multiThread = true, int maxThreadCount = 0);
+
 		//! Computes robust parameters for the distribution from an array of scalar values
 		/** Specific method to compute the parameters directly from an array
 			(vector) of scalar values, without associated points. After a first pass,
@@ -68,6 +132,17 @@ namespace CCCoreLib
 		**/
 		bool computeRobustParameters(const ScalarContainer& values, double nSigma);
 
+		//! Computes robust parameters for the distribution directly from a scalar field
+		/** Same as the ScalarContainer version, but the values are not copied and both
+			passes can be processed in parallel.
+			\param sf the scalar field
+			\param nSigma the values filtering interval size ([mu -nSigma * stddev : mu + nSigma * stddev])
+			\param multiThread whether to process the values in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return the validity of the computed parameters
+		**/
+		bool computeRobustParameters(const ScalarField& sf, double nSigma, bool multiThread = true, int maxThreadCount = 0);
+
 	protected:
 
 		//! Compute each Chi2 class limits
@@ -328,6 +328,11 @@ namespace CCCoreLib
 		**/
 		virtual void invalidateBoundingBox() { m_bbox.setValidity(false); }
 
+		//! Sets the bounding-box (when it is already known, e.g. after a transformation)
+		/** \warning No check is done: the bounding-box must match the points
+		**/
+		inline void setBoundingBox(const BoundingBox& bbox) { m_bbox = bbox; }
+
 		/*** scalar fields management ***/
 
 		//! Returns the number of associated (and active) scalar fields
@@ -12,6 +12,7 @@
 //System
 #include <list>
 #include <string>
+#include <vector>
 
 namespace CCCoreLib
 {
@@ -92,6 +93,91 @@ namespace CCCoreLib
 												const CCVector3& center,
 												GenericProgressCallback* progressCb = nullptr);
 
+		//! Develops a cylinder-shaped point cloud around its main axis (in place)
+		/** Same output as the GenericCloud version, but the points are processed in parallel
+			and the longitude is computed with a vectorizable approximation of atan2 (max. error:
+			3e-7 rad in single precision, i.e. the precision of the standard function, and 1e-8 rad
+			in double precision). The bounding-box is updated on the fly. No memory is allocated.
+			\warning the normals (if any) are left untouched
+			\param cloud the point cloud to be developed
+			\param radius the cylinder radius
+			\param dim the dimension along which the cylinder axis is aligned (X=0, Y=1, Z=2)
+			\param center a 3D point belonging to the cylinder axis
+			\param multiThread whether to process the points in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+		**/
+		static void developCloudOnCylinder(	PointCloud& cloud,
+											PointCoordinateType radius,
+											unsigned char dim,
+											const CCVector3& center,
+											bool multiThread = true,
+											int maxThreadCount = 0);
+
+		//! Develops a cylinder-shaped point cloud around its main axis and stores the result in another cloud
+		/** See the in place version. The output cloud is resized (without normals). No memory is
+			allocated if it has already enough capacity (i.e. it can be reused from one call to another).
+			\warning the output cloud must not be the input cloud (or the cloud it refers to)
+			\param cloud the point cloud to be developed
+			\param radius the cylinder radius
+			\param dim the dimension along which the cylinder axis is aligned (X=0, Y=1, Z=2)
+			\param center a 3D point belonging to the cylinder axis
+			\param output the "developed" cloud (the previous content is replaced, scalar fields are not handled)
+			\param multiThread whether to process the points in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return false if not enough memory
+		**/
+		static bool developCloudOnCylinder(	const GenericIndexedCloud& cloud,
+											PointCoordinateType radius,
+											unsigned char dim,
+											const CCVector3& center,
+											PointCloud& output,
+											bool multiThread = true,
+											int maxThreadCount = 0);
+
+		//! Develops a cone-shaped point cloud around its main axis (in place)
+		/** Same output as the GenericCloud version, but the points are processed in parallel
+			and the longitude is computed with a vectorizable approximation of atan2 (see
+			developCloudOnCylinder). The bounding-box is updated on the fly. No memory is allocated.
+			\warning the normals (if any) are left untouched
+			\param cloud the point cloud to be developed
+			\param dim the dimension along which the cone axis is aligned (X=0, Y=1, Z=2)
+			\param baseRadius the radius of the base of the cone
+			\param alpha the angle of the cone "opening"
+			\param center the 3D point corresponding to the intersection between the cone axis and its base
+			\param multiThread whether to process the points in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+		**/
+		static void developCloudOnCone(	PointCloud& cloud,
+										unsigned char dim,
+										PointCoordinateType baseRadius,
+										float alpha,
+										const CCVector3& center,
+										bool multiThread = true,
+										int maxThreadCount = 0);
+
+		//! Develops a cone-shaped point cloud around its main axis and stores the result in another cloud
+		/** See the in place version. The output cloud is resized (without normals). No memory is
+			allocated if it has already enough capacity (i.e. it can be reused from one call to another).
+			\warning the output cloud must not be the input cloud (or the cloud it refers to)
+			\param cloud the point cloud to be developed
+			\param dim the dimension along which the cone axis is aligned (X=0, Y=1, Z=2)
+			\param baseRadius the radius of the base of the cone
+			\param alpha the angle of the cone "opening"
+			\param center the 3D point corresponding to the intersection between the cone axis and its base
+			\param output the "developed" cloud (the previous content is replaced, scalar fields are not handled)
+			\param multiThread whether to process the points in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return false if not enough memory
+		**/
+		static bool developCloudOnCone(	const GenericIndexedCloud& cloud,
+										unsigned char dim,
+										PointCoordinateType baseRadius,
+										float alpha,
+										const CCVector3& center,
+										PointCloud& output,
+										bool multiThread = true,
+										int maxThreadCount = 0);
+
 		//! Applies a geometrical transformation to a point cloud
 		/** \param cloud the point cloud to be "transformed"
 			\param trans the geometrical transformation
@@ -112,6 +198,37 @@ namespace CCCoreLib
 												Transformation& trans,
 												GenericProgressCallback* progressCb = nullptr);
 
+		//! Applies a geometrical transformation to a point cloud in place
+		/** The points are transformed in parallel, as well as the normals (if any).
+			The bounding-box is updated on the fly. No memory is allocated.
+			\param cloud the point cloud to be "transformed"
+			\param trans the geometrical transformation
+			\param multiThread whether to process the points in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+		**/
+		static void applyTransformation(	PointCloud& cloud,
+											const Transformation& trans,
+											bool multiThread = true,
+											int maxThreadCount = 0);
+
+		//! Applies a geometrical transformation to an indexed point cloud and stores the result in another cloud
+		/** The points are transformed in parallel, as well as the normals (if any).
+			The output cloud is resized, and its bounding-box is updated on the fly. No memory
+			is allocated if it has already enough capacity (i.e. it can be reused from one call to another).
+			\warning the output cloud must not be the input cloud (or the cloud it refers to)
+			\param cloud the point cloud to be "transformed"
+			\param trans the geometrical transformation
+			\param output the "transformed" cloud (the previous content is replaced, scalar fields are not handled)
+			\param multiThread whether to process the points in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return false if not enough memory
+		**/
+		static bool applyTransformation(	const GenericIndexedCloud& cloud,
+											const Transformation& trans,
+											PointCloud& output,
+											bool multiThread = true,
+											int maxThreadCount = 0);
+
 		//! Computes a 2.5D Delaunay triangulation
 		/** The triangulation can be either computed on the points projected
 			in the XY plane (by default), or projected on the best least-square
@@ -152,27 +269,53 @@ namespace CCCoreLib
 		};
 
 		//! Determines the convex hull of a set of points
-		/** Returns a list of points on the convex hull in counter-clockwise order.
+		/** Returns the points on the convex hull in counter-clockwise order.
 			Implementation of Andrew's monotone chain 2D convex hull algorithm.
 			Asymptotic complexity: O(n log n).
 			(retrieved from http://en.wikibooks.org/wiki/Algorithm_Implementation/Geometry/Convex_hull/Monotone_chain)
-			WARNING: the input 'points' set will be sorted!
+			The points that can't be on the hull (i.e. inside the polygon formed by the extreme
+			points in 8 directions) are discarded beforehand, in parallel.
+			The input 'points' set is not modified (the output points belong to it).
 			\param points input set of points
 			\param hullPoints output points (on the convex hull)
+			\param multiThread whether to filter the points in parallel (if supported) or not
 			\return success
 		**/
+		static bool extractConvexHull2D(std::vector<IndexedCCVector2>& points,
+										std::vector<IndexedCCVector2*>& hullPoints,
+										bool multiThread = true);
+
+		//! Determines the convex hull of a set of points
+		/** Same as the vector version, with the output points appended to a list.
+		**/
 		static bool extractConvexHull2D(std::vector<IndexedCCVector2>& points,
 										std::list<IndexedCCVector2*>& hullPoints);
 
 		//! Determines the 'concave' hull of a set of points
 		/** Inspired from JIN-SEO PARK AND SE-JONG OH, "A New Concave Hull Algorithm
 			and Concaveness Measure for n-dimensional Datasets", 2012
-			Calls extractConvexHull2D (see associated warnings).
+			Calls extractConvexHull2D (see associated remarks).
+			The points and the hull segments are indexed in a 2D grid, so that the nearest
+			candidate of each edge and the intersections with the hull are found locally.
+			Warning: hull segments that are aligned with a new segment but far from it are
+			not tested anymore. The former exhaustive test could (wrongly) consider them as
+			intersecting, due to rounding errors in segmentIntersect. Therefore, with points
+			on a regular grid (i.e. with many aligned points), the hull may differ from the
+			one computed by the former implementation. Otherwise it is the same.
 			\param points input set of points
-			\param hullPoints output points (on the convex hull)
+			\param hullPoints output points (on the concave hull, in counter-clockwise order)
 			\param maxSquareLength maximum square length (ignored if <= 0, in which case the method simply returns the convex hull!)
+			\param multiThread whether to compute the convex hull in parallel (if supported) or not
 			\return success
 		**/
+		static bool extractConcaveHull2D(	std::vector<IndexedCCVector2>& points,
+											std::vector<IndexedCCVector2*>& hullPoints,
+											PointCoordinateType maxSquareLength = 0,
+											bool multiThread = true);
+
+		//! Determines the 'concave' hull of a set of points
+		/** Same as the vector version, with the output points appended to a list.
+		**/
 		static bool extractConcaveHull2D(	std::vector<IndexedCCVector2>& points,
 											std::list<IndexedCCVector2*>& hullPoints,
 											PointCoordinateType maxSquareLength = 0);
@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: LGPL-2.0-or-later
+// Copyright © CloudCompare Project
+
+#pragma once
+
+//Local
+#include "CCGeom.h"
+
+//system
+#include <algorithm>
+#include <vector>
+
+namespace CCCoreLib
+{
+	class GenericIndexedCloud;
+	class Polyline;
+
+	//! Bounding-box tree of the segments of a polyline (for nearest segment queries)
+	/** The tree is built once (in O(n.log(n))) and then each query is logarithmic
+		instead of linear in the number of segments. The vertices are copied, so the
+		index doesn't depend on the polyline anymore once built (but it won't reflect
+		its subsequent modifications). All the queries are const and can be called
+		concurrently.
+	**/
+	class CC_CORE_LIB_API PolylineSegmentIndex
+	{
+	public:
+
+		//! Default constructor
+		PolylineSegmentIndex();
+
+		//! Destructor
+		virtual ~PolylineSegmentIndex() = default;
+
+		//! Builds the index
+		/** Segment #i links the vertices #i and #i+1 of the polyline. If the polyline is closed
+			and 'useClosingSegment' is true, the last segment links the last vertex to the first one.
+			\param polyline the polyline to index
+			\param useClosingSegment whether to index the closing segment of closed polylines
+			\param maxLeafSize maximum number of segments per leaf
+			\return success (false if the polyline has less than 2 vertices or not enough memory)
+		**/
+		bool build(const Polyline& polyline, bool useClosingSegment = true, unsigned maxLeafSize = 4);
+
+		//! Releases the index
+		void clear();
+
+		//! Returns whether the index is built
+		inline bool isBuilt() const { return !m_nodes.empty(); }
+
+		//! Returns the number of indexed segments
+		inline unsigned segmentCount() const { return m_vertices.size() < 2 ? 0 : static_cast<unsigned>(m_vertices.size() - 1); }
+
+		//! Returns the total length of the indexed segments
+		inline double getLength() const { return m_abscissas.empty() ? 0.0 : m_abscissas.back(); }
+
+		//! Nearest segment search
+		/** \param queryPoint query point coordinates
+			\param[out] squareDistance the squared distance between the query point and the nearest segment
+			(same value as DistanceComputationTools::computePoint2LineSegmentDistSquared)
+			\param[out] segmentIndex the index of the nearest segment (optional)
+			\param[out] curvilinearAbscissa the curvilinear abscissa of the projection of the query point
+			on the polyline, i.e. the length of the polyline from its first vertex (optional)
+			\return false if the index is not built
+		**/
+		bool findNearestSegment(	const CCVector3& queryPoint,
+									ScalarType& squareDistance,
+									unsigned* segmentIndex = nullptr,
+									double* curvilinearAbscissa = nullptr) const;
+
+		//! Nearest segment search for all the points of a cloud
+		/** The points are processed in parallel. No memory is allocated.
+			\param cloud the query points
+			\param[out] squareDistances the squared distances between each point and its nearest segment (should be of size 'cloud.size()')
+			\param[out] segmentIndexes [optional] the index of the nearest segment of each point (should be of size 'cloud.size()')
+			\param[out] curvilinearAbscissas [optional] the curvilinear abscissa of the projection of each point (should be of size 'cloud.size()')
+			\param multiThread whether to process the points in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return false if the index is not built
+		**/
+		bool findNearestSegments(	const GenericIndexedCloud& cloud,
+									ScalarType* squareDistances,
+									unsigned* segmentIndexes = nullptr,
+									double* curvilinearAbscissas = nullptr,
+									bool multiThread = true,
+									int maxThreadCount = 0) const;
+
+	protected:
+
+		//! Tree node
+		/** The left child of an inner node is always stored right after it.
+		**/
+		struct Node
+		{
+			//! Bounding-box (min corner)
+			CCVector3 bbMin;
+			//! Bounding-box (max corner)
+			CCVector3 bbMax;
+			//! Index of the right child (inner node) or of the first segment in 'm_segmentIndexes' (leaf)
+			unsigned rightOrFirst;
+			//! Number of segments (0 for inner nodes)
+			unsigned count;
+		};
+
+		//! Recursively builds the tree for the segments [begin ; end[ of 'm_segmentIndexes'
+		/** \return the index of the created node
+		**/
+		unsigned buildNode(unsigned begin, unsigned end, const std::vector<CCVector3>& centers, unsigned maxLeafSize);
+
+		//! Returns the squared distance between a point and the bounding-box of a node
+		static inline PointCoordinateType SquareDistToNode(const CCVector3& P, const Node& node)
+		{
+			PointCoordinateType squareDist = 0;
+			for (unsigned char d = 0; d < 3; ++d)
+			{
+				PointCoordinateType delta = std::max(std::max(node.bbMin.u[d] - P.u[d], P.u[d] - node.bbMax.u[d]), static_cast<PointCoordinateType>(0));
+				squareDist += delta * delta;
+			}
+			return squareDist;
+		}
+
+		//! Polyline vertices (the first one is duplicated at the end for the closing segment)
+		std::vector<CCVector3> m_vertices;
+
+		//! Curvilinear abscissa of each vertex
+		std::vector<double> m_abscissas;
+
+		//! Tree nodes (the first one is the root)
+		std::vector<Node> m_nodes;
+
+		//! Segment indexes (sorted by leaf)
+		std::vector<unsigned> m_segmentIndexes;
+
+	private:
+
+		//! Copy is not allowed
+		PolylineSegmentIndex(const PolylineSegmentIndex&) = delete;
+		//! Assignment is not allowed
+		PolylineSegmentIndex& operator=(const PolylineSegmentIndex&) = delete;
+	};
+}
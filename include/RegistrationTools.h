@@ -308,6 +308,8 @@ namespace CCCoreLib
 			\param dataToModel transformation that, applied to data points, register model and data clouds
 			\param delta tolerance above which data points are not counted (if a point is less than delta-apart from the model cloud, then it is counted)
 			\return the number of data points which are distance-apart from the model cloud
+			\note The transformed points are checked by blocks with KDTree::findNearestNeighboursWithMaxDist (in parallel).
+			If there isn't enough memory for the blocks, smaller blocks are processed sequentially.
 		**/
 		static unsigned ComputeRegistrationScore(	KDTree *modelTree,
 													GenericIndexedCloud *dataCloud,
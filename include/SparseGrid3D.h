@@ -0,0 +1,481 @@
+// SPDX-License-Identifier: LGPL-2.0-or-later
+// Copyright © CloudCompare Project
+
+#pragma once
+
+//Local
+#include "CCGeom.h"
+#include "GenericCloud.h"
+#include "GenericProgressCallback.h"
+
+//System
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+namespace CCCoreLib
+{
+	//! Block-sparse 3D grid structure
+	/** Same interface as Grid3D (init / getValue / setValue / computeCellPos) but the
+		cells are stored in cubic tiles of (2^BlockBits)^3 cells that are only allocated
+		on the first write. Unallocated tiles implicitly contain the background value
+		(i.e. the default cell value passed to 'init').
+
+		Well suited to thin or sparse geometry (distance maps at fine resolution, etc.)
+		where most of the cells keep their default value.
+
+		\warning Non-const accessors returning a reference (getValue) allocate the
+		corresponding tile. Use the const version (or 'isAllocated') to read a cell
+		without any memory overhead.
+
+		\note Only the cloud version of 'intersectWith' is available (no mesh rasterization).
+		The library algorithms still rely on Grid3D: this class is a standalone container.
+	**/
+	template< class Type, unsigned BlockBits = 3 > class SparseGrid3D
+	{
+	public:
+
+		//! Cell type
+		using GridElement = Type;
+
+		//! Tile size along each dimension (in cells)
+		static constexpr unsigned BlockSize = (1 << BlockBits);
+		//! Tile mask
+		static constexpr unsigned BlockMask = BlockSize - 1;
+		//! Number of cells per tile
+		static constexpr unsigned BlockCellCount = BlockSize * BlockSize * BlockSize;
+
+		//! Tile (block of contiguous cells, stored in X, then Y, then Z order)
+		using Block = std::array<GridElement, BlockCellCount>;
+
+		//! Default constructor
+		SparseGrid3D()
+			: m_innerSize      (0, 0, 0)
+			, m_margin         (0)
+			, m_blockCount     (0, 0, 0)
+			, m_innerCellCount (0)
+			, m_totalCellCount (0)
+			, m_background     ()
+		{}
+
+		//! Returns the grid dimensions
+		inline const Tuple3ui& size() const { return m_innerSize; }
+
+		//! Returns whether the grid has been initialized or not
+		inline bool isInitialized() const { return m_totalCellCount != 0; }
+
+		//! Clears the grid
+		/** \warning If Type is a pointer type, memory should be released first
+		**/
+		void clear()
+		{
+			m_innerSize			= Tuple3ui(0, 0, 0);
+			m_margin			=  0;
+			m_blockCount		= Tuple3ui(0, 0, 0);
+			m_innerCellCount	=  0;
+			m_totalCellCount	=  0;
+			m_background		= GridElement();
+
+			m_blockIndexes.clear();
+			m_blocks.clear();
+		}
+
+		//! Initializes the grid
+		/** The grid must be explicitelty initialized prior to any action.
+			No cell is allocated at this stage (only the tile index table).
+			\param di grid size along the X dimension
+			\param dj grid size along the Y dimension
+			\param dk grid size along the Z dimension
+			\param margin grid margin
+			\param defaultCellValue default (background) cell value
+			\return true if the initialization succeeded
+		**/
+		bool init(unsigned di, unsigned dj, unsigned dk, unsigned margin, GridElement defaultCellValue = 0)
+		{
+			clear();
+
+			m_innerSize			= Tuple3ui(di, dj, dk);
+			m_margin			= margin;
+			m_innerCellCount	= static_cast<std::size_t>(m_innerSize.x) * m_innerSize.y * m_innerSize.z;
+			m_totalCellCount	= static_cast<std::size_t>(m_innerSize.x + 2 * m_margin)
+								* static_cast<std::size_t>(m_innerSize.y + 2 * m_margin)
+								* static_cast<std::size_t>(m_innerSize.z + 2 * m_margin);
+			m_background		= defaultCellValue;
+
+			if (m_totalCellCount == 0)
+			{
+				assert(false);
+				return false;
+			}
+
+			for (unsigned d = 0; d < 3; ++d)
+			{
+				m_blockCount.u[d] = (m_innerSize.u[d] + 2 * m_margin + BlockMask) >> BlockBits;
+			}
+
+			//tile index table initialization
+			try
+			{
+				m_blockIndexes.resize(static_cast<std::size_t>(m_blockCount.x) * m_blockCount.y * m_blockCount.z, InvalidBlock);
+			}
+			catch (const std::bad_alloc&)
+			{
+				//not enough memory
+				clear();
+				return false;
+			}
+
+			return true;
+		}
+
+		//! Returns the background (default) cell value
+		inline const GridElement& backgroundValue() const { return m_background; }
+
+		//! Computes the (grid) cell position that contains a given point
+		inline Tuple3i computeCellPos(const CCVector3& P, const CCVector3& gridMinCorner, PointCoordinateType cellSize) const
+		{
+			assert(cellSize > 0);
+
+			//DGM: if we admit that cellLength > 0, then the 'floor' operator is useless (int cast = truncation)
+			Tuple3i cellPos(static_cast<int>(/*floor*/(P.x - gridMinCorner.x) / cellSize),
+							static_cast<int>(/*floor*/(P.y - gridMinCorner.y) / cellSize),
+							static_cast<int>(/*floor*/(P.z - gridMinCorner.z) / cellSize));
+
+			return cellPos;
+		}
+
+		//! Intersects this grid with a cloud
+		bool intersectWith(	GenericCloud* cloud,
+							PointCoordinateType cellLength,
+							const CCVector3& gridMinCorner,
+							GridElement intersectValue = 0,
+							GenericProgressCallback* progressCb = nullptr)
+		{
+			if (!cloud || !isInitialized())
+			{
+				assert(false);
+				return false;
+			}
+
+			//number of points
+			unsigned numberOfPoints = cloud->size();
+
+			//progress notification
+			NormalizedProgress nProgress(progressCb, numberOfPoints);
+			if (progressCb)
+			{
+				if (progressCb->textCanBeEdited())
+				{
+					char buffer[32];
+					snprintf(buffer, 32, "Points: %u", numberOfPoints);
+					progressCb->setInfo(buffer);
+					progressCb->setMethodTitle("Intersect Grid/Cloud");
+				}
+				progressCb->update(0);
+				progressCb->start();
+			}
+
+			//for each point: look for the intersecting cell
+			cloud->placeIteratorAtBeginning();
+			for (unsigned n = 0; n < numberOfPoints; ++n)
+			{
+				Tuple3i cellPos = computeCellPos(*cloud->getNextPoint(), gridMinCorner, cellLength);
+
+				if (	(cellPos.x >= 0 && cellPos.x < static_cast<int>(size().x)) &&
+						(cellPos.y >= 0 && cellPos.y < static_cast<int>(size().y)) &&
+						(cellPos.z >= 0 && cellPos.z < static_cast<int>(size().z)))
+				{
+					if (!setValue(cellPos, intersectValue))
+					{
+						//not enough memory
+						return false;
+					}
+				}
+
+				if (progressCb && !nProgress.oneStep())
+				{
+					//cancel by user
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		//! Sets the value of a given cell
+		/** The corresponding tile is allocated if necessary (unless the value is
+			the background value, in which case nothing is allocated).
+			\param i the cell coordinate along the X dimension
+			\param j the cell coordinate along the Y dimension
+			\param k the cell coordinate along the Z dimension
+			\param value new cell value
+			\return false if the tile couldn't be allocated (not enough memory)
+		**/
+		inline bool setValue(int i, int j, int k, GridElement value)
+		{
+			std::size_t blockIndex = pos2blockIndex(i, j, k);
+			unsigned& storageIndex = m_blockIndexes[blockIndex];
+			if (storageIndex == InvalidBlock)
+			{
+				if (value == m_background)
+				{
+					//nothing to do
+					return true;
+				}
+				if (!allocateBlock(storageIndex))
+				{
+					return false;
+				}
+			}
+			m_blocks[storageIndex][pos2cellIndex(i, j, k)] = value;
+			return true;
+		}
+
+		//! Sets the value of a given cell
+		/** \param cellPos the cell position
+			\param value new cell value
+			\return false if the tile couldn't be allocated (not enough memory)
+		**/
+		inline bool setValue(const Tuple3i& cellPos, GridElement value)
+		{
+			return setValue(cellPos.x, cellPos.y, cellPos.z, value);
+		}
+
+		//! Returns the value of a given cell (const version)
+		/** Never allocates memory: the background value is returned for unallocated tiles.
+			\param i the cell coordinate along the X dimension
+			\param j the cell coordinate along the Y dimension
+			\param k the cell coordinate along the Z dimension
+			\return the cell value
+		**/
+		inline const GridElement& getValue(int i, int j, int k) const
+		{
+			unsigned storageIndex = m_blockIndexes[pos2blockIndex(i, j, k)];
+			return (storageIndex == InvalidBlock ? m_background : m_blocks[storageIndex][pos2cellIndex(i, j, k)]);
+		}
+
+		//! Returns the value of a given cell
+		/** \warning The corresponding tile is allocated if necessary.
+			Throws std::bad_alloc if there's not enough memory.
+			\param i the cell coordinate along the X dimension
+			\param j the cell coordinate along the Y dimension
+			\param k the cell coordinate along the Z dimension
+			\return the cell value
+		**/
+		inline GridElement& getValue(int i, int j, int k)
+		{
+			unsigned& storageIndex = m_blockIndexes[pos2blockIndex(i, j, k)];
+			if (storageIndex == InvalidBlock && !allocateBlock(storageIndex))
+			{
+				throw std::bad_alloc();
+			}
+			return m_blocks[storageIndex][pos2cellIndex(i, j, k)];
+		}
+
+		//! Returns the value of a given cell (const version)
+		/** \param cellPos the cell position
+			\return the cell value
+		**/
+		inline const GridElement& getValue(const Tuple3i& cellPos) const
+		{
+			return getValue(cellPos.x, cellPos.y, cellPos.z);
+		}
+
+		//! Returns the value of a given cell
+		/** \warning The corresponding tile is allocated if necessary.
+			\param cellPos the cell position
+			\return the cell value
+		**/
+		inline GridElement& getValue(const Tuple3i& cellPos)
+		{
+			return getValue(cellPos.x, cellPos.y, cellPos.z);
+		}
+
+		//! Returns whether the tile containing a given cell is allocated
+		inline bool isAllocated(int i, int j, int k) const
+		{
+			return m_blockIndexes[pos2blockIndex(i, j, k)] != InvalidBlock;
+		}
+
+		//! Returns the number of cell count (whithout margin)
+		inline std::size_t innerCellCount() const { return m_innerCellCount; }
+		//! Returns the total number of cell count (with margin)
+		inline std::size_t totalCellCount() const { return m_totalCellCount; }
+
+		//! Returns the number of tiles (along each dimension)
+		inline const Tuple3ui& blockCount() const { return m_blockCount; }
+		//! Returns the number of allocated tiles
+		inline std::size_t allocatedBlockCount() const { return m_blocks.size(); }
+		//! Returns the (approximate) memory used by the grid (in bytes)
+		inline std::size_t memoryUsage() const
+		{
+			return m_blockIndexes.capacity() * sizeof(unsigned) + m_blocks.size() * sizeof(Block);
+		}
+
+		//! Generic function applied to each cell of an allocated tile (see forEachAllocatedCell)
+		/** Parameters: cell position (same convention as getValue, i.e. margin cells
+			have negative coordinates) and cell value.
+		**/
+		template <typename Func> void forEachAllocatedCell(Func func)
+		{
+			iterateAllocatedCells<GridElement&>(*this, func);
+		}
+
+		//! Generic function applied to each cell of an allocated tile (const version)
+		template <typename Func> void forEachAllocatedCell(Func func) const
+		{
+			iterateAllocatedCells<const GridElement&>(*this, func);
+		}
+
+		//! Generic function applied to each allocated tile
+		/** Tiles are visited in memory (Z, Y, X) order. Parameters: position of the
+			tile first cell (same convention as getValue) and tile data. Cells inside
+			a tile are stored in X, then Y, then Z order (see Block).
+			\warning Tiles on the grid border may extend beyond the grid limits.
+		**/
+		template <typename Func> void forEachAllocatedBlock(Func func)
+		{
+			iterateAllocatedBlocks<Block&>(*this, func);
+		}
+
+		//! Generic function applied to each allocated tile (const version)
+		template <typename Func> void forEachAllocatedBlock(Func func) const
+		{
+			iterateAllocatedBlocks<const Block&>(*this, func);
+		}
+
+	protected:
+
+		//! Invalid tile index (i.e. the tile is not allocated)
+		static constexpr unsigned InvalidBlock = static_cast<unsigned>(-1);
+
+		//! Allocates a new tile (filled with the background value)
+		bool allocateBlock(unsigned& storageIndex)
+		{
+			try
+			{
+				m_blocks.emplace_back();
+			}
+			catch (const std::bad_alloc&)
+			{
+				//not enough memory
+				return false;
+			}
+			m_blocks.back().fill(m_background);
+			storageIndex = static_cast<unsigned>(m_blocks.size() - 1);
+			return true;
+		}
+
+		//! Converts a 3D position to a tile index
+		inline std::size_t pos2blockIndex(int i, int j, int k) const
+		{
+			unsigned ui = static_cast<unsigned>(i + static_cast<int>(m_margin));
+			unsigned uj = static_cast<unsigned>(j + static_cast<int>(m_margin));
+			unsigned uk = static_cast<unsigned>(k + static_cast<int>(m_margin));
+			assert(ui < m_innerSize.x + 2 * m_margin && uj < m_innerSize.y + 2 * m_margin && uk < m_innerSize.z + 2 * m_margin);
+
+			return	static_cast<std::size_t>(ui >> BlockBits)
+				+	static_cast<std::size_t>(uj >> BlockBits) * m_blockCount.x
+				+	static_cast<std::size_t>(uk >> BlockBits) * m_blockCount.x * m_blockCount.y;
+		}
+
+		//! Converts a 3D position to the cell index inside its tile
+		inline unsigned pos2cellIndex(int i, int j, int k) const
+		{
+			unsigned ui = static_cast<unsigned>(i + static_cast<int>(m_margin)) & BlockMask;
+			unsigned uj = static_cast<unsigned>(j + static_cast<int>(m_margin)) & BlockMask;
+			unsigned uk = static_cast<unsigned>(k + static_cast<int>(m_margin)) & BlockMask;
+
+			return ui + (uj << BlockBits) + (uk << (2 * BlockBits));
+		}
+
+		//! Tile iteration (shared by the const and non-const versions)
+		template <typename BlockRef, typename Grid, typename Func> static void iterateAllocatedBlocks(Grid& grid, Func& func)
+		{
+			std::size_t blockIndex = 0;
+			for (unsigned bk = 0; bk < grid.m_blockCount.z; ++bk)
+			{
+				for (unsigned bj = 0; bj < grid.m_blockCount.y; ++bj)
+				{
+					for (unsigned bi = 0; bi < grid.m_blockCount.x; ++bi, ++blockIndex)
+					{
+						unsigned storageIndex = grid.m_blockIndexes[blockIndex];
+						if (storageIndex == InvalidBlock)
+						{
+							continue;
+						}
+
+						Tuple3i firstCellPos(	static_cast<int>(bi << BlockBits) - static_cast<int>(grid.m_margin),
+												static_cast<int>(bj << BlockBits) - static_cast<int>(grid.m_margin),
+												static_cast<int>(bk << BlockBits) - static_cast<int>(grid.m_margin));
+
+						BlockRef block = grid.m_blocks[storageIndex];
+						func(firstCellPos, block);
+					}
+				}
+			}
+		}
+
+		//! Cell iteration (shared by the const and non-const versions)
+		template <typename CellRef, typename Grid, typename Func> static void iterateAllocatedCells(Grid& grid, Func& func)
+		{
+			//upper limits (with margin)
+			const int maxPos[3] = {	static_cast<int>(grid.m_innerSize.x + grid.m_margin),
+									static_cast<int>(grid.m_innerSize.y + grid.m_margin),
+									static_cast<int>(grid.m_innerSize.z + grid.m_margin) };
+
+			auto processBlock = [&](const Tuple3i& firstCellPos, auto& block)
+			{
+				const int kMax = std::min(firstCellPos.z + static_cast<int>(BlockSize), maxPos[2]);
+				const int jMax = std::min(firstCellPos.y + static_cast<int>(BlockSize), maxPos[1]);
+				const int iMax = std::min(firstCellPos.x + static_cast<int>(BlockSize), maxPos[0]);
+
+				Tuple3i cellPos;
+				for (cellPos.z = firstCellPos.z; cellPos.z < kMax; ++cellPos.z)
+				{
+					for (cellPos.y = firstCellPos.y; cellPos.y < jMax; ++cellPos.y)
+					{
+						unsigned cellIndex = (static_cast<unsigned>(cellPos.z - firstCellPos.z) << (2 * BlockBits))
+											+ (static_cast<unsigned>(cellPos.y - firstCellPos.y) << BlockBits);
+						for (cellPos.x = firstCellPos.x; cellPos.x < iMax; ++cellPos.x, ++cellIndex)
+						{
+							CellRef value = block[cellIndex];
+							func(cellPos, value);
+						}
+					}
+				}
+			};
+
+			iterateAllocatedBlocks<decltype(grid.m_blocks[0])&>(grid, processBlock);
+		}
+
+	protected:
+
+		//! Tile index table (InvalidBlock for unallocated tiles)
+		std::vector<unsigned> m_blockIndexes;
+		//! Allocated tiles (a deque so that references stay valid when new tiles are allocated)
+		std::deque<Block> m_blocks;
+
+		//! Dimensions of the grid (without margin)
+		Tuple3ui m_innerSize;
+		//! Margin
+		unsigned m_margin;
+		//! Number of tiles along each dimension (with margin)
+		Tuple3ui m_blockCount;
+		//! 3D grid size without margin
+		std::size_t m_innerCellCount;
+		//! 3D grid size with margin
+		std::size_t m_totalCellCount;
+		//! Background value (for unallocated cells)
+		GridElement m_background;
+	};
+
+	//constexpr static members definition (C++14)
+	template< class Type, unsigned BlockBits > constexpr unsigned SparseGrid3D<Type, BlockBits>::BlockSize;
+	template< class Type, unsigned BlockBits > constexpr unsigned SparseGrid3D<Type, BlockBits>::BlockMask;
+	template< class Type, unsigned BlockBits > constexpr unsigned SparseGrid3D<Type, BlockBits>::BlockCellCount;
+	template< class Type, unsigned BlockBits > constexpr unsigned SparseGrid3D<Type, BlockBits>::InvalidBlock;
+}
@@ -0,0 +1,614 @@
+// SPDX-License-Identifier: LGPL-2.0-or-later
+// Copyright © CloudCompare Project
+
+#pragma once
+
+//local
+#include "SquareMatrix.h"
+
+//system
+#include <cmath>
+#include <utility>
+
+namespace CCCoreLib
+{
+	template <unsigned N, typename Scalar> class SquareMatrixN;
+
+	//! Fixed-size matrix operations (determinant and inverse)
+	/** The general version relies on Gaussian elimination with partial pivoting.
+		The 2x2, 3x3 and 4x4 versions are unrolled (cofactors).
+	**/
+	template <unsigned N, typename Scalar> struct SquareMatrixNOps
+	{
+		using Values = Scalar[N][N];
+
+		static double Det(const Values& m)
+		{
+			double a[N][N];
+			for (unsigned r = 0; r < N; ++r)
+				for (unsigned c = 0; c < N; ++c)
+					a[r][c] = static_cast<double>(m[r][c]);
+
+			double det = 1.0;
+			for (unsigned i = 0; i < N; ++i)
+			{
+				unsigned pivot = i;
+				for (unsigned r = i + 1; r < N; ++r)
+					if (std::abs(a[r][i]) > std::abs(a[pivot][i]))
+						pivot = r;
+				if (a[pivot][i] == 0)
+					return 0.0;
+				if (pivot != i)
+				{
+					for (unsigned c = i; c < N; ++c)
+						std::swap(a[i][c], a[pivot][c]);
+					det = -det;
+				}
+				det *= a[i][i];
+				for (unsigned r = i + 1; r < N; ++r)
+				{
+					double coef = a[r][i] / a[i][i];
+					for (unsigned c = i + 1; c < N; ++c)
+						a[r][c] -= coef * a[i][c];
+				}
+			}
+			return det;
+		}
+
+		static bool Inv(const Values& m, Values& result)
+		{
+			//Gauss-Jordan elimination on the n by 2n matrix, composed of this matrix and the identity
+			Scalar a[N][2 * N];
+			for (unsigned r = 0; r < N; ++r)
+			{
+				for (unsigned c = 0; c < N; ++c)
+				{
+					a[r][c] = m[r][c];
+					a[r][c + N] = (r == c ? 1 : 0);
+				}
+			}
+
+			for (unsigned i = 0; i < N; ++i)
+			{
+				unsigned pivot = i;
+				for (unsigned r = i + 1; r < N; ++r)
+					if (std::abs(a[r][i]) > std::abs(a[pivot][i]))
+						pivot = r;
+				if (a[pivot][i] == 0)
+				{
+					//non inversible matrix!
+					return false;
+				}
+				if (pivot != i)
+					for (unsigned c = i; c < 2 * N; ++c)
+						std::swap(a[i][c], a[pivot][c]);
+
+				Scalar pivotValue = a[i][i];
+				for (unsigned c = i; c < 2 * N; ++c)
+					a[i][c] /= pivotValue;
+
+				for (unsigned r = 0; r < N; ++r)
+				{
+					if (r != i && a[r][i] != 0)
+					{
+						Scalar coef = a[r][i];
+						for (unsigned c = i; c < 2 * N; ++c)
+							a[r][c] -= coef * a[i][c];
+					}
+				}
+			}
+
+			for (unsigned r = 0; r < N; ++r)
+				for (unsigned c = 0; c < N; ++c)
+					result[r][c] = a[r][c + N];
+
+			return true;
+		}
+	};
+
+	//! Fixed-size matrix operations (1x1 version)
+	template <typename Scalar> struct SquareMatrixNOps<1, Scalar>
+	{
+		using Values = Scalar[1][1];
+
+		static double Det(const Values& m)
+		{
+			return static_cast<double>(m[0][0]);
+		}
+
+		static bool Inv(const Values& m, Values& result)
+		{
+			if (m[0][0] == 0)
+				return false;
+			result[0][0] = 1 / m[0][0];
+			return true;
+		}
+	};
+
+	//! Fixed-size matrix operations (2x2 version)
+	template <typename Scalar> struct SquareMatrixNOps<2, Scalar>
+	{
+		using Values = Scalar[2][2];
+
+		static double Det(const Values& m)
+		{
+			return static_cast<double>(m[0][0]) * m[1][1] - static_cast<double>(m[0][1]) * m[1][0];
+		}
+
+		static bool Inv(const Values& m, Values& result)
+		{
+			double det = Det(m);
+			if (det == 0)
+				return false;
+			double invDet = 1.0 / det;
+			Scalar m00 = m[0][0]; //in case 'm' and 'result' are the same
+			result[0][0] = static_cast<Scalar>( m[1][1] * invDet);
+			result[1][1] = static_cast<Scalar>( m00 * invDet);
+			result[0][1] = static_cast<Scalar>(-m[0][1] * invDet);
+			result[1][0] = static_cast<Scalar>(-m[1][0] * invDet);
+			return true;
+		}
+	};
+
+	//! Fixed-size matrix operations (3x3 version)
+	template <typename Scalar> struct SquareMatrixNOps<3, Scalar>
+	{
+		using Values = Scalar[3][3];
+
+		static double Det(const Values& m)
+		{
+			return	  static_cast<double>(m[0][0]) * (static_cast<double>(m[1][1]) * m[2][2] - static_cast<double>(m[1][2]) * m[2][1])
+					- static_cast<double>(m[0][1]) * (static_cast<double>(m[1][0]) * m[2][2] - static_cast<double>(m[1][2]) * m[2][0])
+					+ static_cast<double>(m[0][2]) * (static_cast<double>(m[1][0]) * m[2][1] - static_cast<double>(m[1][1]) * m[2][0]);
+		}
+
+		static bool Inv(const Values& m, Values& result)
+		{
+			//cofactors
+			double c00 = static_cast<double>(m[1][1]) * m[2][2] - static_cast<double>(m[1][2]) * m[2][1];
+			double c01 = static_cast<double>(m[1][2]) * m[2][0] - static_cast<double>(m[1][0]) * m[2][2];
+			double c02 = static_cast<double>(m[1][0]) * m[2][1] - static_cast<double>(m[1][1]) * m[2][0];
+
+			double det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+			if (det == 0)
+				return false;
+			double invDet = 1.0 / det;
+
+			double r[3][3];
+			r[0][0] = c00 * invDet;
+			r[1][0] = c01 * invDet;
+			r[2][0] = c02 * invDet;
+			r[0][1] = (static_cast<double>(m[0][2]) * m[2][1] - static_cast<double>(m[0][1]) * m[2][2]) * invDet;
+			r[1][1] = (static_cast<double>(m[0][0]) * m[2][2] - static_cast<double>(m[0][2]) * m[2][0]) * invDet;
+			r[2][1] = (static_cast<double>(m[0][1]) * m[2][0] - static_cast<double>(m[0][0]) * m[2][1]) * invDet;
+			r[0][2] = (static_cast<double>(m[0][1]) * m[1][2] - static_cast<double>(m[0][2]) * m[1][1]) * invDet;
+			r[1][2] = (static_cast<double>(m[0][2]) * m[1][0] - static_cast<double>(m[0][0]) * m[1][2]) * invDet;
+			r[2][2] = (static_cast<double>(m[0][0]) * m[1][1] - static_cast<double>(m[0][1]) * m[1][0]) * invDet;
+
+			for (unsigned i = 0; i < 3; ++i)
+				for (unsigned j = 0; j < 3; ++j)
+					result[i][j] = static_cast<Scalar>(r[i][j]);
+
+			return true;
+		}
+	};
+
+	//! Fixed-size matrix operations (4x4 version)
+	template <typename Scalar> struct SquareMatrixNOps<4, Scalar>
+	{
+		using Values = Scalar[4][4];
+
+		//! Computes the 2x2 minors of the two first and two last rows
+		static void Minors(const Values& m, double s[6], double c[6])
+		{
+			s[0] = static_cast<double>(m[0][0]) * m[1][1] - static_cast<double>(m[1][0]) * m[0][1];
+			s[1] = static_cast<double>(m[0][0]) * m[1][2] - static_cast<double>(m[1][0]) * m[0][2];
+			s[2] = static_cast<double>(m[0][0]) * m[1][3] - static_cast<double>(m[1][0]) * m[0][3];
+			s[3] = static_cast<double>(m[0][1]) * m[1][2] - static_cast<double>(m[1][1]) * m[0][2];
+			s[4] = static_cast<double>(m[0][1]) * m[1][3] - static_cast<double>(m[1][1]) * m[0][3];
+			s[5] = static_cast<double>(m[0][2]) * m[1][3] - static_cast<double>(m[1][2]) * m[0][3];
+
+			c[5] = static_cast<double>(m[2][2]) * m[3][3] - static_cast<double>(m[3][2]) * m[2][3];
+			c[4] = static_cast<double>(m[2][1]) * m[3][3] - static_cast<double>(m[3][1]) * m[2][3];
+			c[3] = static_cast<double>(m[2][1]) * m[3][2] - static_cast<double>(m[3][1]) * m[2][2];
+			c[2] = static_cast<double>(m[2][0]) * m[3][3] - static_cast<double>(m[3][0]) * m[2][3];
+			c[1] = static_cast<double>(m[2][0]) * m[3][2] - static_cast<double>(m[3][0]) * m[2][2];
+			c[0] = static_cast<double>(m[2][0]) * m[3][1] - static_cast<double>(m[3][0]) * m[2][1];
+		}
+
+		static double Det(const Values& m)
+		{
+			double s[6];
+			double c[6];
+			Minors(m, s, c);
+			return s[0] * c[5] - s[1] * c[4] + s[2] * c[3] + s[3] * c[2] - s[4] * c[1] + s[5] * c[0];
+		}
+
+		static bool Inv(const Values& m, Values& result)
+		{
+			double s[6];
+			double c[6];
+			Minors(m, s, c);
+
+			double det = s[0] * c[5] - s[1] * c[4] + s[2] * c[3] + s[3] * c[2] - s[4] * c[1] + s[5] * c[0];
+			if (det == 0)
+				return false;
+			double invDet = 1.0 / det;
+
+			double r[4][4];
+			r[0][0] = ( m[1][1] * c[5] - m[1][2] * c[4] + m[1][3] * c[3]) * invDet;
+			r[0][1] = (-m[0][1] * c[5] + m[0][2] * c[4] - m[0][3] * c[3]) * invDet;
+			r[0][2] = ( m[3][1] * s[5] - m[3][2] * s[4] + m[3][3] * s[3]) * invDet;
+			r[0][3] = (-m[2][1] * s[5] + m[2][2] * s[4] - m[2][3] * s[3]) * invDet;
+
+			r[1][0] = (-m[1][0] * c[5] + m[1][2] * c[2] - m[1][3] * c[1]) * invDet;
+			r[1][1] = ( m[0][0] * c[5] - m[0][2] * c[2] + m[0][3] * c[1]) * invDet;
+			r[1][2] = (-m[3][0] * s[5] + m[3][2] * s[2] - m[3][3] * s[1]) * invDet;
+			r[1][3] = ( m[2][0] * s[5] - m[2][2] * s[2] + m[2][3] * s[1]) * invDet;
+
+			r[2][0] = ( m[1][0] * c[4] - m[1][1] * c[2] + m[1][3] * c[0]) * invDet;
+			r[2][1] = (-m[0][0] * c[4] + m[0][1] * c[2] - m[0][3] * c[0]) * invDet;
+			r[2][2] = ( m[3][0] * s[4] - m[3][1] * s[2] + m[3][3] * s[0]) * invDet;
+			r[2][3] = (-m[2][0] * s[4] + m[2][1] * s[2] - m[2][3] * s[0]) * invDet;
+
+			r[3][0] = (-m[1][0] * c[3] + m[1][1] * c[1] - m[1][2] * c[0]) * invDet;
+			r[3][1] = ( m[0][0] * c[3] - m[0][1] * c[1] + m[0][2] * c[0]) * invDet;
+			r[3][2] = (-m[3][0] * s[3] + m[3][1] * s[1] - m[3][2] * s[0]) * invDet;
+			r[3][3] = ( m[2][0] * s[3] - m[2][1] * s[1] + m[2][2] * s[0]) * invDet;
+
+			for (unsigned i = 0; i < 4; ++i)
+				for (unsigned j = 0; j < 4; ++j)
+					result[i][j] = static_cast<Scalar>(r[i][j]);
+
+			return true;
+		}
+	};
+
+	//! Fixed-size square matrix
+	/** Row-major ordered matrix (i.e. elements are accessed with 'm_values[row][column]'),
+		stored in place (no dynamic allocation). Meant for the small matrices (3x3
+		covariance matrices, rotations, etc.) used in the inner loops, where the
+		dynamic SquareMatrixTpl allocations would be prohibitive. It has the same
+		interface as SquareMatrixTpl for the most common methods, and can be
+		converted to and from it.
+	**/
+	template <unsigned N, typename Scalar> class SquareMatrixN
+	{
+		static_assert(N != 0, "Invalid matrix size");
+
+	public:
+
+		//! Default constructor
+		/** All elements are set to 0.
+		**/
+		SquareMatrixN() { clear(); }
+
+		//! Constructor from another fixed-size matrix
+		template <typename T> explicit SquareMatrixN(const SquareMatrixN<N, T>& mat)
+		{
+			for (unsigned r = 0; r < N; r++)
+				for (unsigned c = 0; c < N; c++)
+					m_values[r][c] = static_cast<Scalar>(mat.m_values[r][c]);
+		}
+
+		//! Constructor from a dynamic matrix
+		/** The dynamic matrix should have the same size. If it is invalid, the matrix
+			is set to identity (as invalid matrices are equivalent to the identity when
+			they are applied to vectors).
+			\param mat matrix
+		**/
+		template <typename T> explicit SquareMatrixN(const SquareMatrixTpl<T>& mat)
+		{
+			if (!mat.isValid())
+			{
+				toIdentity();
+				return;
+			}
+
+			assert(mat.size() == N);
+			for (unsigned r = 0; r < N; r++)
+				for (unsigned c = 0; c < N; c++)
+					m_values[r][c] = static_cast<Scalar>(mat.m_values[r][c]);
+		}
+
+		//! Converts this matrix to a dynamic matrix
+		template <typename T = Scalar> SquareMatrixTpl<T> toSquareMatrix() const
+		{
+			SquareMatrixTpl<T> mat(N);
+			for (unsigned r = 0; r < N; r++)
+				for (unsigned c = 0; c < N; c++)
+					mat.m_values[r][c] = static_cast<T>(m_values[r][c]);
+
+			return mat;
+		}
+
+		//! Returns matrix size
+		static constexpr unsigned size() { return N; }
+
+		//! Returns matrix validity (always true)
+		inline bool isValid() const { return true; }
+
+		//! The matrix values
+		/** public for easy/fast access
+		**/
+		Scalar m_values[N][N];
+
+		//! Returns pointer to matrix row
+		inline Scalar* row(unsigned index) { return m_values[index]; }
+
+		//! Sets a particular matrix value
+		inline void setValue(unsigned row, unsigned column, Scalar value)
+		{
+			m_values[row][column] = value;
+		}
+
+		//! Returns a particular matrix value
+		inline Scalar getValue(unsigned row, unsigned column) const
+		{
+			return m_values[row][column];
+		}
+
+		//! Addition
+		inline SquareMatrixN operator + (const SquareMatrixN& B) const
+		{
+			SquareMatrixN C = *this;
+			C += B;
+
+			return C;
+		}
+
+		//! In-place addition
+		inline const SquareMatrixN& operator += (const SquareMatrixN& B)
+		{
+			for (unsigned r = 0; r < N; r++)
+				for (unsigned c = 0; c < N; c++)
+					m_values[r][c] += B.m_values[r][c];
+
+			return *this;
+		}
+
+		//! Subtraction
+		inline SquareMatrixN operator - (const SquareMatrixN& B) const
+		{
+			SquareMatrixN C = *this;
+			C -= B;
+
+			return C;
+		}
+
+		//! In-place subtraction
+		inline const SquareMatrixN& operator -= (const SquareMatrixN& B)
+		{
+			for (unsigned r = 0; r < N; r++)
+				for (unsigned c = 0; c < N; c++)
+					m_values[r][c] -= B.m_values[r][c];
+
+			return *this;
+		}
+
+		//! Multiplication (M = A*B)
+		inline SquareMatrixN operator * (const SquareMatrixN& B) const
+		{
+			SquareMatrixN C;
+
+			for (unsigned r = 0; r < N; r++)
+			{
+				for (unsigned c = 0; c < N; c++)
+				{
+					Scalar sum = 0;
+					for (unsigned k = 0; k < N; k++)
+						sum += m_values[r][k] * B.m_values[k][c];
+					C.m_values[r][c] = sum;
+				}
+			}
+
+			return C;
+		}
+
+		//! In-place multiplication
+		inline const SquareMatrixN& operator *= (const SquareMatrixN& B)
+		{
+			*this = (*this) * B;
+
+			return *this;
+		}
+
+		//! Multiplication by a vector (3x3 matrices only)
+		inline Vector3Tpl<Scalar> operator * (const CCVector3f& V) const
+		{
+			static_assert(N == 3, "Only for 3x3 matrices");
+
+			Vector3Tpl<Scalar> result;
+			apply(V.u, result.u);
+
+			return result;
+		}
+
+		//! Multiplication by a vector (3x3 matrices only)
+		inline CCVector3d operator * (const CCVector3d& V) const
+		{
+			static_assert(N == 3, "Only for 3x3 matrices");
+
+			CCVector3d result;
+			apply(V.u, result.u);
+
+			return result;
+		}
+
+		//! Multiplication by a float vector, outputs a float vector
+		/** Same computation as SquareMatrixTpl::apply (accumulated in double precision).
+			\param vec input vector (size N)
+			\param result output vector (= M * vec)
+		**/
+		inline void apply(const float vec[], float result[]) const
+		{
+			for (unsigned r = 0; r < N; r++)
+			{
+				double sum = 0;
+				for (unsigned k = 0; k < N; k++)
+					sum += m_values[r][k] * static_cast<double>(vec[k]);
+				result[r] = static_cast<float>(sum);
+			}
+		}
+
+		//! Multiplication by a float vector, outputs a double vector
+		/** \param vec input vector (size N)
+			\param result output vector (= M * vec)
+		**/
+		inline void apply(const float vec[], double result[]) const
+		{
+			for (unsigned r = 0; r < N; r++)
+			{
+				double sum = 0;
+				for (unsigned k = 0; k < N; k++)
+					sum += m_values[r][k] * static_cast<double>(vec[k]);
+				result[r] = sum;
+			}
+		}
+
+		//! Multiplication by a double vector
+		/** \param vec input vector (size N)
+			\param result output vector (= M * vec)
+		**/
+		inline void apply(const double vec[], double result[]) const
+		{
+			for (unsigned r = 0; r < N; r++)
+			{
+				double sum = 0;
+				for (unsigned k = 0; k < N; k++)
+					sum += m_values[r][k] * static_cast<double>(vec[k]);
+				result[r] = sum;
+			}
+		}
+
+		//! In-place transpose
+		inline void transpose()
+		{
+			for (unsigned r = 0; r + 1 < N; r++)
+				for (unsigned c = r + 1; c < N; c++)
+					std::swap(m_values[r][c], m_values[c][r]);
+		}
+
+		//! Returns the transposed version of this matrix
+		inline SquareMatrixN transposed() const
+		{
+			SquareMatrixN T(*this);
+			T.transpose();
+
+			return T;
+		}
+
+		//! Sets all elements to 0
+		inline void clear()
+		{
+			for (unsigned r = 0; r < N; r++)
+				for (unsigned c = 0; c < N; c++)
+					m_values[r][c] = 0;
+		}
+
+		//! Sets matrix to identity
+		inline void toIdentity()
+		{
+			clear();
+
+			for (unsigned r = 0; r < N; r++)
+				m_values[r][r] = 1;
+		}
+
+		//! Scales matrix (all elements are multiplied by the same coef.)
+		inline void scale(Scalar coef)
+		{
+			for (unsigned r = 0; r < N; r++)
+				for (unsigned c = 0; c < N; c++)
+					m_values[r][c] *= coef;
+		}
+
+		//! Returns trace
+		inline Scalar trace() const
+		{
+			Scalar trace = 0;
+
+			for (unsigned r = 0; r < N; r++)
+				trace += m_values[r][r];
+
+			return trace;
+		}
+
+		//! Returns determinant
+		inline double computeDet() const
+		{
+			return SquareMatrixNOps<N, Scalar>::Det(m_values);
+		}
+
+		//! Computes the inverse of this matrix
+		/** \param[out] result inverse matrix (can be this matrix)
+			\return false if the matrix is not inversible
+		**/
+		inline bool inv(SquareMatrixN& result) const
+		{
+			return SquareMatrixNOps<N, Scalar>::Inv(m_values, result.m_values);
+		}
+
+		//! Returns inverse
+		/** \warning Returns a null matrix if the matrix is not inversible
+		**/
+		inline SquareMatrixN inv() const
+		{
+			SquareMatrixN result;
+			if (!inv(result))
+			{
+				result.clear();
+			}
+
+			return result;
+		}
+
+		//! Creates a rotation matrix from a quaternion (3x3 matrices only)
+		/** Same as SquareMatrixTpl::initFromQuaternion.
+			\param q normalized quaternion (w,x,y,z)
+		**/
+		void initFromQuaternion(const double q[])
+		{
+			static_assert(N == 3, "Only for 3x3 matrices");
+
+			double q00 = q[0] * q[0];
+			double q11 = q[1] * q[1];
+			double q22 = q[2] * q[2];
+			double q33 = q[3] * q[3];
+			double q03 = q[0] * q[3];
+			double q13 = q[1] * q[3];
+			double q23 = q[2] * q[3];
+			double q02 = q[0] * q[2];
+			double q12 = q[1] * q[2];
+			double q01 = q[0] * q[1];
+
+			m_values[0][0] = static_cast<Scalar>(q00 + q11 - q22 - q33);
+			m_values[1][1] = static_cast<Scalar>(q00 - q11 + q22 - q33);
+			m_values[2][2] = static_cast<Scalar>(q00 - q11 - q22 + q33);
+			m_values[0][1] = static_cast<Scalar>(2.0*(q12 - q03));
+			m_values[1][0] = static_cast<Scalar>(2.0*(q12 + q03));
+			m_values[0][2] = static_cast<Scalar>(2.0*(q13 + q02));
+			m_values[2][0] = static_cast<Scalar>(2.0*(q13 - q02));
+			m_values[1][2] = static_cast<Scalar>(2.0*(q23 - q01));
+			m_values[2][1] = static_cast<Scalar>(2.0*(q23 + q01));
+		}
+	};
+
+	//! Default CC 3x3 matrix type (PointCoordinateType)
+	using SquareMatrix3 = SquareMatrixN<3, PointCoordinateType>;
+
+	//! Float 3x3 matrix type
+	using SquareMatrix3f = SquareMatrixN<3, float>;
+
+	//! Double 3x3 matrix type
+	using SquareMatrix3d = SquareMatrixN<3, double>;
+
+	//! Default CC 4x4 matrix type (PointCoordinateType)
+	using SquareMatrix4 = SquareMatrixN<4, PointCoordinateType>;
+
+	//! Float 4x4 matrix type
+	using SquareMatrix4f = SquareMatrixN<4, float>;
+
+	//! Double 4x4 matrix type
+	using SquareMatrix4d = SquareMatrixN<4, double>;
+}
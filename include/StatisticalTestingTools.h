@@ -14,6 +14,7 @@ namespace CCCoreLib
 	class GenericIndexedCloud;
 	class GenericIndexedCloudPersist;
 	class GenericProgressCallback;
+	class ScalarField;
 
 	//! Statistical testing algorithms (Chi2 distance computation, statistic filtering, etc.)
 	class CC_CORE_LIB_API StatisticalTestingTools : public CCToolbox
@@ -50,6 +51,37 @@ namespace CCCoreLib
 												unsigned* histoValues = nullptr,
 												double* npis = nullptr);
 
+		//! Computes the Chi2 distance on the values of a scalar field
+		/** Same as the GenericCloud version, but the values are read directly from the
+			scalar field storage and binned in parallel (each chunk of values has its own
+			histogram, and the histograms are merged afterwards). The cumulative probabilities
+			of all the class boundaries are computed in a single batch, and the classes
+			compression is only applied on the (small) histogram.
+			\param distrib a theoretical distribution
+			\param sf the scalar field
+			\param numberOfClasses initial number of classes for the empirical distribution (0 for automatic determination, >1 otherwise)
+			\param finalNumberOfClasses final number of classes of the empirical distribution
+			\param noClassCompression prevent the algorithm from performing classes compression (faster but less accurate)
+			\param histoMin [optional] minimum histogram value
+			\param histoMax [optional] maximum histogram value
+			\param[out] histoValues [optional] histogram array (its size should be equal to the initial number of classes)
+			\param[out] npis [optional] array containing the theoretical probabilities for each class (its size should be equal to the initial number of classes)
+			\param multiThread whether to process the values in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return the Chi2 distance (or -1.0 if an error occurred)
+		**/
+		static double computeAdaptativeChi2Dist(const GenericDistribution* distrib,
+												const ScalarField& sf,
+												unsigned numberOfClasses,
+												unsigned &finalNumberOfClasses,
+												bool noClassCompression = false,
+												const ScalarType* histoMin = nullptr,
+												const ScalarType* histoMax = nullptr,
+												unsigned* histoValues = nullptr,
+												double* npis = nullptr,
+												bool multiThread = true,
+												int maxThreadCount = 0);
+
 		//! Computes the Chi2 fractile
 		/** Returns the max Chi2 Distance for a given "confidence" probability and a given number of
 			"degrees of liberty" (equivalent to the number of classes-1).
@@ -87,6 +119,8 @@ namespace CCCoreLib
 			\param pTrust the Chi2 Test confidence probability
 			\param progressCb the client application can get some notification of the process progress through this callback mechanism (see GenericProgressCallback)
 			\param inputOctree the cloud octree if it has already be computed
+			\param multiThread whether to process the octree cells in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
 			\return the distance threshold for filtering (or -1 if someting went wrong during the process)
 		**/
 		static double testCloudWithStatisticalModel(const GenericDistribution* distrib,
@@ -94,7 +128,9 @@ namespace CCCoreLib
 													unsigned numberOfNeighbours,
 													double pTrust,
 													GenericProgressCallback* progressCb = nullptr,
-													DgmOctree* inputOctree = nullptr);
+													DgmOctree* inputOctree = nullptr,
+													bool multiThread = true,
+													int maxThreadCount = 0);
 
 	protected:
 
@@ -103,8 +139,9 @@ namespace CCCoreLib
 			- (GenericDistribution*) the theoretical noise distribution
 			- (int) the size of a neighbourhood for local analysis
 			- (int) the number of classes for the Chi2 distance computation
-			- (unsigned*) a pre-allocated array (of a size equal to the number of classes)for computation acceleration
-			- (bool) specifies whether negative values should be included in computation
+			- (const double*) the theoretical probabilities of the classes if the histogram boundaries are fixed (or nullptr)
+			- (ScalarType*) the histogram min value (or nullptr)
+			- (ScalarType*) the histogram max value (or nullptr)
 			\param cell structure describing the cell on which processing is applied
 			\param additionalParameters see method description
 			\param nProgress optional (normalized) progress notification (per-point)
@@ -5,14 +5,15 @@
 
 //Local
 #include "DistanceComputationTools.h"
+#include "GenericIndexedCloudPersist.h"
 #include "ReferenceCloud.h"
 
 //system
 #include <cstdint>
+#include <vector>
 
 namespace CCCoreLib
 {
-	class GenericIndexedCloudPersist;
 	class GenericProgressCallback;
 
 	//! KD-tree implementation to subdivide a 3D cloud based on a planarity criterion
@@ -30,86 +31,42 @@ namespace CCCoreLib
 		static const uint8_t NODE_TYPE = 0;
 		static const uint8_t LEAF_TYPE = 1;
 
-		//! Tree base node
-		class BaseNode
+		//! Tree node
+		/** The nodes are stored in a single array (see TrueKdTree::nodes), in depth-first order:
+			the left child of a node is always the next node in the array.
+		**/
+		struct Node
 		{
-		public:
-			explicit BaseNode(uint8_t nodeType) : parent(nullptr), type(nodeType) {}
-			virtual ~BaseNode() = default;
-
-			bool isNode() const { return type == NODE_TYPE; }
-			bool isLeaf() const { return type == LEAF_TYPE; }
-
-		public:
-
 			//Warning: put the non aligned members (< 4 bytes) at the end to avoid too much alignment padding!
-			BaseNode* parent;					//8 bytes
-
-		protected:
-			const uint8_t type;					//1 byte (+ 3 for alignment)
+			PointCoordinateType splitValue;		//4 bytes (inner nodes only)
+			unsigned parent;					//4 bytes (INVALID_INDEX for the root)
+			unsigned child;						//4 bytes (index of the right child for inner nodes, or leaf index for leaves)
+			uint8_t type;						//1 byte
+			uint8_t splitDim;					//1 byte (+ 2 bytes for alignment)
 
-			//Total								//12 bytes
-		};
-
-		//! Tree node
-		class Node : public BaseNode
-		{
-		public:
+			//Total								//16 bytes
 
-			//Warning: put the non aligned members (< 4 bytes) at the end to avoid too much alignment padding!
-			PointCoordinateType splitValue;		//4 bytes
-			BaseNode* leftChild;				//8 bytes
-			BaseNode* rightChild;				//8 bytes
-			uint8_t splitDim;					//1 byte (+ 3 bytes for alignment)
-
-			//Total								//24 bytes (+ 12 for father)
-
-			Node()
-				: BaseNode(NODE_TYPE)
-				, splitValue(0)
-				, leftChild(nullptr)
-				, rightChild(nullptr)
-				, splitDim(X_DIM)
-			{}
-
-			~Node() override
-			{
-				delete leftChild;
-				delete rightChild;
-			}
+			bool isNode() const { return type == NODE_TYPE; }
+			bool isLeaf() const { return type == LEAF_TYPE; }
 		};
 
 		//! Tree leaf
-		class Leaf : public BaseNode
+		/** The points of a leaf are referenced by a range of the tree point indexes (see TrueKdTree::getLeafPointIndexes)
+		**/
+		struct Leaf
 		{
-		public:
-
-			//Warning: put the non aligned members (< 4 bytes) at the end to avoid too much alignment padding!
-			ReferenceCloud* points;				// 8 bytes
+			unsigned firstIndex;				// 4 bytes
+			unsigned pointCount;				// 4 bytes
 			PointCoordinateType planeEq[4];		//16 bytes
 			ScalarType error;					// 4 bytes
 			int userData;						// 4 bytes
 
-			//Total								//32 bytes (+ 12 for father)
-
-			//! Constructor
-			/** The Leaf class takes ownership of its associated subset
-			**/
-			Leaf(ReferenceCloud* set, const PointCoordinateType planeEquation[], ScalarType _error)
-				: BaseNode(LEAF_TYPE)
-				, points(set)
-				, error(_error)
-				, userData(0)
-			{
-				memcpy(planeEq, planeEquation, sizeof(PointCoordinateType) * 4);
-			}
-
-			~Leaf() override
-			{
-				delete points;
-			}
+			//Total								//32 bytes
 		};
 
+		//! Invalid index (e.g. parent of the root node)
+		static const unsigned INVALID_INDEX = 0xFFFFFFFF;
+
 		//! A vector of leaves
 		using LeafVector = std::vector<Leaf *>;
 
@@ -128,12 +85,17 @@ namespace CCCoreLib
 			\param minPointCountPerCell minimum number of points per cell (can't be smaller than 3)
 			\param maxPointCountPerCell maximum number of points per cell (speed-up - ignored if < 6)
 			\param progressCb the client application can get some notification of the process progress through this callback mechanism (see GenericProgressCallback)
+			\param multiThread whether to build the sub-trees in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return false if not enough memory, or if no plane can be fitted to the whole cloud
 		**/
 		bool build(	double maxError,
 					DistanceComputationTools::ERROR_MEASURES errorMeasure = DistanceComputationTools::RMS,
 					unsigned minPointCountPerCell = 3,
 					unsigned maxPointCountPerCell = 0,
-					GenericProgressCallback* progressCb = nullptr);
+					GenericProgressCallback* progressCb = nullptr,
+					bool multiThread = true,
+					int maxThreadCount = 0);
 
 		//! Clears structure
 		void clear();
@@ -144,16 +106,84 @@ namespace CCCoreLib
 		//! Returns max error estimator used for planarity-based split strategy
 		inline DistanceComputationTools::ERROR_MEASURES getMaxErrorType() const { return m_errorMeasure; }
 
+		//! Returns the nodes (the first one is the root)
+		inline const std::vector<Node>& nodes() const { return m_nodes; }
+
+		//! Returns the leaves (in depth-first order)
+		inline std::vector<Leaf>& leaves() { return m_leaves; }
+		//! Returns the leaves (in depth-first order - const version)
+		inline const std::vector<Leaf>& leaves() const { return m_leaves; }
+
 		//! Returns all leaf nodes
+		/** The leaves can still be modified through the returned pointers (e.g. their 'userData').
+		**/
 		bool getLeaves(LeafVector& leaves) const;
 
+		//! Returns the (global) indexes of the points of a given leaf
+		/** The array has 'leaf.pointCount' elements, sorted in ascending order.
+		**/
+		inline const unsigned* getLeafPointIndexes(const Leaf& leaf) const { return m_pointIndexes.data() + leaf.firstIndex; }
+
+		//! Fills a ReferenceCloud with the points of a given leaf
+		/** \param leaf a leaf of this tree
+			\param subset output subset (cleared first)
+			\return false if not enough memory
+		**/
+		bool getLeafPoints(const Leaf& leaf, ReferenceCloud& subset) const;
+
+		//! Returns the index of the leaf whose cell contains a given position
+		/** \return the leaf index (see TrueKdTree::leaves) or INVALID_INDEX if the tree is not built
+		**/
+		unsigned findLeaf(const CCVector3& P) const;
+
+		//! Returns the index of the leaf containing a given point of the associated cloud
+		/** \return the leaf index (see TrueKdTree::leaves) or INVALID_INDEX if the tree is not built
+		**/
+		inline unsigned getPointLeafIndex(unsigned pointIndex) const { return findLeaf(*m_associatedCloud->getPointPersistentPtr(pointIndex)); }
+
+		//! Returns the leaf index of all the points of the associated cloud
+		/** \param pointLeafIndexes leaf index of each point (resized to the cloud size)
+			\return false if the tree is not built or not enough memory
+		**/
+		bool getPointLeafIndexes(std::vector<unsigned>& pointLeafIndexes) const;
+
 	protected:
 
+		//! Temporary structures shared by the split tasks (see build)
+		struct BuildContext;
+
+		//! Nodes and leaves of a (sub-)tree
+		struct SubTree
+		{
+			std::vector<Node> nodes;
+			std::vector<Leaf> leaves;
+		};
+
+		//! Split process result
+		enum SplitResult
+		{
+			SPLIT_OK,					/**< Sub-tree successfully built **/
+			SPLIT_INVALID_PLANE,		/**< No plane could be fitted to the points (nothing is added to the sub-tree) **/
+			SPLIT_NOT_ENOUGH_MEMORY,	/**< Not enough memory **/
+		};
+
 		//! Recursive split process
-		BaseNode* split(ReferenceCloud* subset);
+		/** Processes the points referenced by indexes [firstIndex ; firstIndex + count[ of the build index array
+			(which is partitioned in place), and appends the corresponding nodes and leaves to 'tree'.
+		**/
+		SplitResult split(BuildContext& context, SubTree& tree, unsigned firstIndex, unsigned count, unsigned depth) const;
+
+		//! Appends a leaf made of a range of the build index array
+		void addLeaf(BuildContext& context, SubTree& tree, unsigned firstIndex, unsigned count, const PointCoordinateType planeEquation[], ScalarType error) const;
+
+		//! Nodes (depth-first order)
+		std::vector<Node> m_nodes;
+
+		//! Leaves (depth-first order)
+		std::vector<Leaf> m_leaves;
 
-		//! Root node
-		BaseNode* m_root;
+		//! Point indexes (grouped by leaf)
+		std::vector<unsigned> m_pointIndexes;
 
 		//! Associated cloud
 		GenericIndexedCloudPersist* m_associatedCloud;
@@ -8,6 +8,8 @@
 
 namespace CCCoreLib
 {
+	class ScalarField;
+
 	//! The Weibull statistical parametric distribution
 	/** Implements the GenericDistribution interface.
 	**/
@@ -66,10 +68,31 @@ namespace CCCoreLib
 		bool computeParameters(const ScalarContainer& values) override;
 		double computeP(ScalarType x) const override;
 		double computePfromZero(ScalarType x) const override;
+		void computeCumulativeProbabilities(const ScalarType* x, std::size_t count, double* p) const override;
 		double computeP(ScalarType x1, ScalarType x2) const override;
 		double computeChi2Dist(const GenericCloud* cloud, unsigned numberOfClasses, int* histo = nullptr) override;
 		const char* getName() const override { return "Weibull"; }
 
+		//! Computes the distribution parameters directly from a scalar field
+		/** The values are not copied and each pass of the (iterative) maximum
+			likelihood estimation can be processed in parallel.
+			\param sf the scalar field
+			\param multiThread whether to process the values in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return the validity of the computed parameters
+		**/
+		bool computeParameters(const ScalarField& sf, bool multiThread = true, int maxThreadCount = 0);
+
+		//! Computes the distribution parameters from an array of scalar values
+		/** Invalid (NaN) values are ignored. The values can be processed in parallel.
+			\param values the scalar values
+			\param count the number of values
+			\param multiThread whether to process the values in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return the validity of the computed parameters
+		**/
+		bool computeParameters(const ScalarType* values, std::size_t count, bool multiThread = true, int maxThreadCount = 0);
+
 	protected:
 
 		//! Compute each Chi2 class limits
@@ -100,10 +123,11 @@ namespace CCCoreLib
 		ScalarType m_sigma2;
 
 		//! internal function for parameters evaluation from sample points
-		/** inverseVmax can be optionally specified for overflow-safe version
+		/** The partial sums are computed by chunks (in parallel if multiThread is true)
+			and merged in a fixed order.
 		**/
-		static double ComputeG(const ScalarContainer& values, double a, ScalarType valueShift, double valueRange);
+		static double ComputeG(const ScalarType* values, std::size_t count, double a, ScalarType valueShift, double valueRange, bool multiThread = false, int maxThreadCount = 0);
 		//! internal function for parameters evaluation from sample points
-		static double FindGRoot(const ScalarContainer& values, ScalarType valueShift, double valueRange);
+		static double FindGRoot(const ScalarType* values, std::size_t count, ScalarType valueShift, double valueRange, bool multiThread = false, int maxThreadCount = 0);
 	};
 }
@@ -9,9 +9,12 @@
 #include <ReferenceCloud.h>
 #include <ScalarField.h>
 #include <ScalarFieldTools.h>
+#include "ConcurrentUnionFind.h"
+#include "ParallelForHelper.h"
 
 //System
 #include <algorithm>
+#include <atomic>
 
 using namespace CCCoreLib;
 
@@ -19,7 +22,8 @@ int AutoSegmentationTools::labelConnectedComponents(GenericIndexedCloudPersist*
 													unsigned char level,
 													bool sixConnexity/*=false*/,
 													GenericProgressCallback* progressCb/*=nullptr*/,
-													DgmOctree* inputOctree/*=nullptr*/)
+													DgmOctree* inputOctree/*=nullptr*/,
+													bool multiThread/*=false*/)
 {
 	if (!theCloud)
 	{
@@ -45,7 +49,7 @@ int AutoSegmentationTools::labelConnectedComponents(GenericIndexedCloudPersist*
 		return -1;
 	}
 
-	int result = theOctree->extractCCs(level, sixConnexity, progressCb);
+	int result = theOctree->extractCCs(level, sixConnexity, progressCb, multiThread);
 
 	//remove octree if it was not provided as input
 	if (theOctree && !inputOctree)
@@ -56,72 +60,577 @@ int AutoSegmentationTools::labelConnectedComponents(GenericIndexedCloudPersist*
 	return result;
 }
 
-bool AutoSegmentationTools::extractConnectedComponents(GenericIndexedCloudPersist* theCloud, ReferenceCloudContainer& cc)
+//! Computes the Euclidean clusters of a cloud (see AutoSegmentationTools::labelEuclideanClusters)
+/** \param pointLabels output label of each point (starting from 1 - 0 = no cluster)
+	\return the number of clusters or an error code (see labelEuclideanClusters)
+**/
+static int ComputeEuclideanClusters(GenericIndexedCloudPersist* theCloud,
+									DgmOctree* theOctree,
+									PointCoordinateType maxDistance,
+									unsigned minClusterSize,
+									unsigned maxClusterSize,
+									GenericProgressCallback* progressCb,
+									bool multiThread,
+									std::vector<unsigned>& pointLabels)
 {
-	unsigned numberOfPoints = (theCloud ? theCloud->size() : 0);
-	if (numberOfPoints == 0)
+	//finest level at which the cell size is still larger than the max distance
+	//(so that the neighbours of a point are necessarily in the 27 surrounding cells)
+	unsigned char level = 0;
+	while (level < DgmOctree::MAX_OCTREE_LEVEL && theOctree->getCellSize(level + 1) >= maxDistance)
 	{
-		return false;
+		++level;
+	}
+	const PointCoordinateType cellSize = theOctree->getCellSize(level);
+	const PointCoordinateType squareMaxDist = maxDistance * maxDistance;
+	//if the cell diagonal is smaller than the max distance, all the points of a cell are connected
+	const bool cellsAreConnected = (3 * cellSize * cellSize <= squareMaxDist);
+
+	DgmOctree::cellsContainer cells;
+	ConcurrentUnionFind unionFind;
+	const DgmOctree::cellsContainer& octreePoints = theOctree->pointsAndTheirCellCodes();
+	const unsigned pointCount = static_cast<unsigned>(octreePoints.size());
+	if (!theOctree->getCellCodesAndIndexes(level, cells, true) || !unionFind.init(pointCount))
+	{
+		//not enough memory
+		return -2;
 	}
 
-	//components should have already been labeled and labels should have been stored in the active scalar field!
-	if (!theCloud->isScalarFieldEnabled())
+	//progress notification
+	if (progressCb)
 	{
-		return false;
+		if (progressCb->textCanBeEdited())
+		{
+			progressCb->setMethodTitle("Euclidean clustering");
+			char buffer[64];
+			snprintf(buffer, 64, "Octree level: %i\nCells: %u", level, static_cast<unsigned>(cells.size()));
+			progressCb->setInfo(buffer);
+		}
+		progressCb->update(0);
+		progressCb->start();
 	}
 
-	//empty the input vector if necessary
-	for (auto cloud : cc)
+	//'preceding' half-neighbourhood (13 cells)
+	Tuple3i neighborShifts[13];
+	unsigned char neighborCount = 0;
+	for (int k = -1; k <= 0; ++k)
 	{
-		delete cloud;
-	} 
-	cc.clear();
+		for (int j = -1; j <= 1; ++j)
+		{
+			for (int i = -1; i <= 1; ++i)
+			{
+				if (k < 0 || j < 0 || (j == 0 && i < 0))
+				{
+					neighborShifts[neighborCount++] = Tuple3i(i, j, k);
+				}
+			}
+		}
+	}
 
-	for (unsigned i = 0; i < numberOfPoints; ++i)
+	const int gridSize = (1 << level);
+	const unsigned cellCount = static_cast<unsigned>(cells.size());
+	std::atomic<bool> error(false);
+
+	//the union-find elements are the indexes in the octree structure (so that the points of a cell are contiguous)
+	ParallelForHelper::ForEachRange(cellCount, [&](std::size_t begin, std::size_t end)
 	{
-		ScalarType slabel = theCloud->getPointScalarValue(i);
-		if (slabel >= 1) //labels start from 1! (this test rejects NaN values as well)
+		//local buffers (to avoid repeated virtual calls to getPoint)
+		std::vector<CCVector3> cellPoints;
+		std::vector<CCVector3> neighborPoints;
+
+		auto fetchPoints = [&](unsigned cellIndex, std::vector<CCVector3>& points)
 		{
-			int ccLabel = static_cast<int>(theCloud->getPointScalarValue(i)) - 1;
+			unsigned first = cells[cellIndex].theIndex;
+			unsigned last = (cellIndex + 1 < cellCount ? cells[cellIndex + 1].theIndex : pointCount);
+			points.resize(last - first);
+			for (unsigned n = first; n < last; ++n)
+			{
+				points[n - first] = *theCloud->getPoint(octreePoints[n].theIndex);
+			}
+			return first;
+		};
 
-			//we fill the components vector with empty components until we reach the current label
-			//(they will be "used" later)
-			try
+		try
+		{
+			for (std::size_t c = begin; c < end; ++c)
 			{
-				while (static_cast<std::size_t>(ccLabel) >= cc.size())
+				const unsigned cellIndex = static_cast<unsigned>(c);
+				const unsigned first = fetchPoints(cellIndex, cellPoints);
+				const unsigned count = static_cast<unsigned>(cellPoints.size());
+
+				//inside the cell
+				if (cellsAreConnected)
 				{
-					cc.push_back(new ReferenceCloud(theCloud));
+					for (unsigned i = 1; i < count; ++i)
+					{
+						unionFind.unite(first, first + i);
+					}
 				}
+				else
+				{
+					for (unsigned i = 1; i < count; ++i)
+					{
+						for (unsigned j = 0; j < i; ++j)
+						{
+							if ((cellPoints[i] - cellPoints[j]).norm2() <= squareMaxDist)
+							{
+								unionFind.unite(first + i, first + j);
+							}
+						}
+					}
+				}
+
+				//with the (existing) preceding neighbours
+				Tuple3i cellPos;
+				theOctree->getCellPos(cells[cellIndex].theCode, level, cellPos, true);
+				for (unsigned char n = 0; n < neighborCount; ++n)
+				{
+					Tuple3i neighborPos = cellPos + neighborShifts[n];
+					if (	neighborPos.x < 0 || neighborPos.x >= gridSize
+						||	neighborPos.y < 0 || neighborPos.y >= gridSize
+						||	neighborPos.z < 0 || neighborPos.z >= gridSize)
+					{
+						continue;
+					}
+
+					DgmOctree::CellCode neighborCode = DgmOctree::GenerateTruncatedCellCode(neighborPos, level);
+					DgmOctree::cellsContainer::const_iterator it = std::lower_bound(cells.begin(), cells.end(), neighborCode,
+						[](const DgmOctree::IndexAndCode& cell, DgmOctree::CellCode code) { return cell.theCode < code; });
+					if (it == cells.end() || it->theCode != neighborCode)
+					{
+						continue;
+					}
+
+					const unsigned neighborIndex = static_cast<unsigned>(it - cells.begin());
+					const unsigned neighborFirst = fetchPoints(neighborIndex, neighborPoints);
+
+					CCVector3 neighborMin;
+					CCVector3 neighborMax;
+					theOctree->computeCellLimits(neighborCode, level, neighborMin, neighborMax, true);
+
+					for (unsigned i = 0; i < count; ++i)
+					{
+						const CCVector3& P = cellPoints[i];
+
+						//distance between the point and the neighbour cell
+						CCVector3 delta(std::max(std::max(neighborMin.x - P.x, P.x - neighborMax.x), static_cast<PointCoordinateType>(0)),
+										std::max(std::max(neighborMin.y - P.y, P.y - neighborMax.y), static_cast<PointCoordinateType>(0)),
+										std::max(std::max(neighborMin.z - P.z, P.z - neighborMax.z), static_cast<PointCoordinateType>(0)));
+						if (delta.norm2() > squareMaxDist)
+						{
+							continue;
+						}
+
+						for (unsigned j = 0; j < neighborPoints.size(); ++j)
+						{
+							if ((P - neighborPoints[j]).norm2() <= squareMaxDist)
+							{
+								unionFind.unite(first + i, neighborFirst + j);
+							}
+						}
+					}
+				}
+			}
+		}
+		catch (const std::bad_alloc&)
+		{
+			//not enough memory
+			error = true;
+		}
+	}, multiThread, 256);
+
+	if (error)
+	{
+		if (progressCb)
+		{
+			progressCb->stop();
+		}
+		return -2;
+	}
+
+	if (progressCb)
+	{
+		progressCb->update(50.0f);
+		if (progressCb->isCancelRequested())
+		{
+			progressCb->stop();
+			return -3;
+		}
+	}
+
+	//clusters size (stored by root) and labels (clusters are numbered by their first element in the octree)
+	std::vector<unsigned> labels;
+	try
+	{
+		labels.resize(pointCount, 0);
+		pointLabels.clear();
+		pointLabels.resize(theCloud->size(), 0); //points that are not projected in the octree (if any) won't be labeled
+	}
+	catch (const std::bad_alloc&)
+	{
+		if (progressCb)
+		{
+			progressCb->stop();
+		}
+		return -2;
+	}
+
+	for (unsigned i = 0; i < pointCount; ++i)
+	{
+		++labels[unionFind.root(i)];
+	}
+
+	int clusterCount = 0;
+	for (unsigned i = 0; i < pointCount; ++i)
+	{
+		unsigned root = unionFind.root(i);
+		if (root == i)
+		{
+			unsigned clusterSize = labels[i];
+			bool keep = (clusterSize >= minClusterSize && (maxClusterSize == 0 || clusterSize <= maxClusterSize));
+			labels[i] = (keep ? ++clusterCount : 0);
+		}
+		else
+		{
+			//the root is always the smallest element of the cluster (so it has already been processed)
+			assert(root < i);
+			labels[i] = labels[root];
+		}
+	}
+
+	ParallelForHelper::ForEachRange(pointCount, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			pointLabels[octreePoints[i].theIndex] = labels[i];
+		}
+	}, multiThread);
+
+	if (progressCb)
+	{
+		progressCb->update(100.0f);
+		progressCb->stop();
+	}
+
+	return clusterCount;
+}
+
+//! Builds the components from the points labels
+/** Counting pass + prefix sum: each component is allocated only once, and filled in parallel.
+	\param theCloud the labeled cloud
+	\param pointLabels the label of each point (starting from 1 - 0 = no component)
+	\param labelCount the number of labels (i.e. the highest label)
+	\param components the output components (component 'i' corresponds to label 'i+1', unless 'sortBySize' is true)
+	\param sortBySize whether to sort the components by decreasing size (and to discard the empty ones) or not
+	\param multiThread whether to use parallel processing or not
+	\return success
+**/
+static bool BuildComponents(GenericIndexedCloudPersist* theCloud,
+							const std::vector<unsigned>& pointLabels,
+							unsigned labelCount,
+							ReferenceCloudContainer& components,
+							bool sortBySize,
+							bool multiThread)
+{
+	const std::size_t pointCount = pointLabels.size();
+
+	//per chunk histograms (the number of chunks is limited so that they don't take more than 4 MB in total,
+	//hence a single histogram if there are too many labels)
+	std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(pointCount, 65536) : 1);
+	chunkCount = std::max<std::size_t>(1, std::min(chunkCount, (static_cast<std::size_t>(1) << 20) / (static_cast<std::size_t>(labelCount) + 1)));
+
+	std::vector<unsigned> chunkOffsets; //chunkCount x (labelCount + 1)
+	std::vector<unsigned> componentOffsets; //labelCount + 2
+	std::vector<unsigned> sortedIndexes;
+	try
+	{
+		chunkOffsets.resize(chunkCount * (labelCount + 1), 0);
+		componentOffsets.resize(static_cast<std::size_t>(labelCount) + 2, 0);
+		sortedIndexes.resize(pointCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return false;
+	}
+
+	//counting pass
+	ParallelForHelper::ForEachChunk(pointCount, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
+	{
+		unsigned* counts = chunkOffsets.data() + chunkIndex * (labelCount + 1);
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			++counts[pointLabels[i]];
+		}
+	}, multiThread);
+
+	//prefix sum (per label, then per chunk: so that the points remain sorted by index inside each component)
+	{
+		unsigned offset = 0;
+		for (unsigned label = 0; label <= labelCount; ++label)
+		{
+			componentOffsets[label] = offset;
+			for (std::size_t c = 0; c < chunkCount; ++c)
+			{
+				unsigned& count = chunkOffsets[c * (labelCount + 1) + label];
+				unsigned chunkOffset = offset;
+				offset += count;
+				count = chunkOffset;
 			}
-			catch (const std::bad_alloc&)
+		}
+		componentOffsets[labelCount + 1] = offset;
+	}
+
+	//scatter pass
+	ParallelForHelper::ForEachChunk(pointCount, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
+	{
+		unsigned* offsets = chunkOffsets.data() + chunkIndex * (labelCount + 1);
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			sortedIndexes[offsets[pointLabels[i]]++] = static_cast<unsigned>(i);
+		}
+	}, multiThread);
+
+	chunkOffsets.clear();
+	chunkOffsets.shrink_to_fit();
+
+	//components order
+	std::vector<unsigned> labels;
+	try
+	{
+		labels.reserve(labelCount);
+		for (unsigned label = 1; label <= labelCount; ++label)
+		{
+			if (!sortBySize || componentOffsets[label + 1] != componentOffsets[label])
 			{
-				//not enough memory
-				for (auto cloud : cc)
-				{
-					delete cloud;
-				} 
-				cc.clear();
-				return false;
+				labels.push_back(label);
 			}
+		}
+		components.resize(labels.size(), nullptr);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return false;
+	}
+
+	if (sortBySize)
+	{
+		std::stable_sort(labels.begin(), labels.end(), [&](unsigned a, unsigned b)
+		{
+			return componentOffsets[a + 1] - componentOffsets[a] > componentOffsets[b + 1] - componentOffsets[b];
+		});
+	}
 
-			//add the point to the current component
-			if (!cc[ccLabel]->addPointIndex(i))
+	//each component is allocated once and filled with its own (contiguous) range of indexes
+	std::atomic<bool> error(false);
+	ParallelForHelper::ForEachRange(labels.size(), [&](std::size_t begin, std::size_t end)
+	{
+		try
+		{
+			for (std::size_t i = begin; i < end; ++i)
 			{
-				//not enough memory
-				for (auto cloud : cc)
-				{
-					delete cloud;
-				} 
-				cc.clear();
+				const unsigned label = labels[i];
+				const unsigned first = componentOffsets[label];
+				const unsigned count = componentOffsets[label + 1] - first;
 
-				return false;
+				ReferenceCloud* component = new ReferenceCloud(theCloud);
+				components[i] = component;
+				if (!component->resize(count))
+				{
+					error = true;
+					return;
+				}
+				for (unsigned j = 0; j < count; ++j)
+				{
+					component->setPointIndex(j, sortedIndexes[first + j]);
+				}
 			}
 		}
+		catch (const std::bad_alloc&)
+		{
+			//not enough memory
+			error = true;
+		}
+	}, multiThread, 16);
+
+	if (error)
+	{
+		for (auto cloud : components)
+		{
+			delete cloud;
+		}
+		components.clear();
+		return false;
 	}
 
 	return true;
 }
 
+int AutoSegmentationTools::labelEuclideanClusters(	GenericIndexedCloudPersist* theCloud,
+													PointCoordinateType maxDistance,
+													unsigned minClusterSize/*=1*/,
+													unsigned maxClusterSize/*=0*/,
+													GenericProgressCallback* progressCb/*=nullptr*/,
+													DgmOctree* inputOctree/*=nullptr*/,
+													bool multiThread/*=true*/)
+{
+	if (!theCloud || theCloud->size() == 0 || maxDistance <= 0)
+	{
+		return -1;
+	}
+
+	//we use the default scalar field to store the clusters labels
+	if (!theCloud->enableScalarField())
+	{
+		//failed to enable a scalar field
+		return -1;
+	}
+
+	//compute octree if none was provided
+	DgmOctree* theOctree = inputOctree;
+	if (!theOctree)
+	{
+		theOctree = new DgmOctree(theCloud);
+		if (theOctree->build(progressCb) < 1)
+		{
+			delete theOctree;
+			return -1;
+		}
+	}
+
+	std::vector<unsigned> pointLabels;
+	int result = ComputeEuclideanClusters(theCloud, theOctree, maxDistance, minClusterSize, maxClusterSize, progressCb, multiThread, pointLabels);
+
+	if (result >= 0)
+	{
+		ParallelForHelper::ForEachRange(pointLabels.size(), [&](std::size_t begin, std::size_t end)
+		{
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				ScalarType label = (pointLabels[i] != 0 ? static_cast<ScalarType>(pointLabels[i]) : NAN_VALUE);
+				theCloud->setPointScalarValue(static_cast<unsigned>(i), label);
+			}
+		}, multiThread);
+	}
+
+	//remove octree if it was not provided as input
+	if (!inputOctree)
+	{
+		delete theOctree;
+	}
+
+	return result;
+}
+
+int AutoSegmentationTools::extractEuclideanClusters(GenericIndexedCloudPersist* theCloud,
+													PointCoordinateType maxDistance,
+													ReferenceCloudContainer& clusters,
+													unsigned minClusterSize/*=1*/,
+													unsigned maxClusterSize/*=0*/,
+													GenericProgressCallback* progressCb/*=nullptr*/,
+													DgmOctree* inputOctree/*=nullptr*/,
+													bool multiThread/*=true*/)
+{
+	//empty the input vector if necessary
+	for (auto cloud : clusters)
+	{
+		delete cloud;
+	}
+	clusters.clear();
+
+	if (!theCloud || theCloud->size() == 0 || maxDistance <= 0)
+	{
+		return -1;
+	}
+
+	//compute octree if none was provided
+	DgmOctree* theOctree = inputOctree;
+	if (!theOctree)
+	{
+		theOctree = new DgmOctree(theCloud);
+		if (theOctree->build(progressCb) < 1)
+		{
+			delete theOctree;
+			return -1;
+		}
+	}
+
+	std::vector<unsigned> pointLabels;
+	int result = ComputeEuclideanClusters(theCloud, theOctree, maxDistance, minClusterSize, maxClusterSize, progressCb, multiThread, pointLabels);
+
+	//remove octree if it was not provided as input
+	if (!inputOctree)
+	{
+		delete theOctree;
+	}
+
+	if (result > 0 && !BuildComponents(theCloud, pointLabels, static_cast<unsigned>(result), clusters, true, multiThread))
+	{
+		//not enough memory
+		return -2;
+	}
+
+	return result;
+}
+
+bool AutoSegmentationTools::extractConnectedComponents(GenericIndexedCloudPersist* theCloud, ReferenceCloudContainer& cc, bool sortBySize/*=false*/, bool multiThread/*=true*/)
+{
+	unsigned numberOfPoints = (theCloud ? theCloud->size() : 0);
+	if (numberOfPoints == 0)
+	{
+		return false;
+	}
+
+	//components should have already been labeled and labels should have been stored in the active scalar field!
+	if (!theCloud->isScalarFieldEnabled())
+	{
+		return false;
+	}
+
+	//empty the input vector if necessary
+	for (auto cloud : cc)
+	{
+		delete cloud;
+	} 
+	cc.clear();
+
+	//read the labels (only once)
+	std::vector<unsigned> pointLabels;
+	try
+	{
+		pointLabels.resize(numberOfPoints);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return false;
+	}
+
+	std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(numberOfPoints, 65536) : 1);
+	std::vector<unsigned> chunkMaxLabels(chunkCount, 0);
+	ParallelForHelper::ForEachChunk(numberOfPoints, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
+	{
+		unsigned maxLabel = 0;
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			ScalarType slabel = theCloud->getPointScalarValue(static_cast<unsigned>(i));
+			//labels start from 1! (this test rejects NaN values as well)
+			unsigned label = (slabel >= 1 ? static_cast<unsigned>(slabel) : 0);
+			pointLabels[i] = label;
+			maxLabel = std::max(maxLabel, label);
+		}
+		chunkMaxLabels[chunkIndex] = maxLabel;
+	}, multiThread);
+
+	unsigned labelCount = 0;
+	for (unsigned maxLabel : chunkMaxLabels)
+	{
+		labelCount = std::max(labelCount, maxLabel);
+	}
+
+	return BuildComponents(theCloud, pointLabels, labelCount, cc, sortBySize, multiThread);
+}
+
 bool AutoSegmentationTools::frontPropagationBasedSegmentation(	GenericIndexedCloudPersist* theCloud,
 																PointCoordinateType radius,
 																ScalarType minSeedDist,
@@ -199,67 +708,60 @@ bool AutoSegmentationTools::frontPropagationBasedSegmentation(	GenericIndexedClo
 		progressCb->start();
 	}
 
+	//backup of the (gradient) values, as the segmented points will be flagged with NAN_VALUE
 	ScalarField* theDists = new ScalarField("distances");
+	if (!theDists->resizeSafe(numberOfPoints))
 	{
-		ScalarType d = theCloud->getPointScalarValue(0);
-		if (!theDists->resizeSafe(numberOfPoints, true, d))
-		{
-			if (!inputOctree)
-				delete theOctree;
-			theDists->release();
-			return false;
-		}
+		if (!inputOctree)
+			delete theOctree;
+		theDists->release();
+		delete fm;
+		return false;
 	}
-
-	unsigned maxDistIndex = 0;
-	unsigned begin = 0;
-	CCVector3 startPoint;
-
-	while (true)
+	for (unsigned i = 0; i < numberOfPoints; ++i)
 	{
-		ScalarType maxDist = NAN_VALUE;
+		theDists->setValue(i, theCloud->getPointScalarValue(i));
+	}
 
-		//on cherche la premiere distance superieure ou egale a "minSeedDist"
-		while (begin<numberOfPoints)
+	//the seeds are taken by decreasing value: we sort the candidates once
+	//(instead of looking for the maximum value among the remaining points for each new seed)
+	std::vector<unsigned> seedCandidates;
+	try
+	{
+		seedCandidates.reserve(numberOfPoints);
+		for (unsigned i = 0; i < numberOfPoints; ++i)
 		{
-			const CCVector3 *thePoint = theCloud->getPoint(begin);
-			const ScalarType& theDistance = theDists->at(begin);
-			++begin;
-
-			//FIXME DGM: what happens if SF is negative?!
-			if (theCloud->getPointScalarValue(begin) >= 0 && theDistance >= minSeedDist)
+			//this test rejects NaN values as well
+			if (theDists->getValue(i) >= minSeedDist)
 			{
-				maxDist = theDistance;
-				startPoint = *thePoint;
-				maxDistIndex = begin;
-				break;
+				seedCandidates.push_back(i);
 			}
 		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		if (!inputOctree)
+			delete theOctree;
+		theDists->release();
+		delete fm;
+		return false;
+	}
+	std::stable_sort(seedCandidates.begin(), seedCandidates.end(), [&](unsigned a, unsigned b) { return theDists->getValue(a) > theDists->getValue(b); });
 
-		//il n'y a plus de point avec des distances suffisamment grandes !
-		if (maxDist < minSeedDist)
-		{
-			break;
-		}
-
-		//on finit la recherche du max
-		for (unsigned i = begin; i < numberOfPoints; ++i)
+	for (unsigned seedIndex : seedCandidates)
+	{
+		//FIXME DGM: what happens if SF is negative?!
+		//points that have already been segmented are flagged with NAN_VALUE
+		if (!(theCloud->getPointScalarValue(seedIndex) >= 0))
 		{
-			const CCVector3 *thePoint = theCloud->getPoint(i);
-			const ScalarType& theDistance = theDists->at(i);
-
-			if ((theCloud->getPointScalarValue(i) >= 0.0) && (theDistance > maxDist))
-			{
-				maxDist = theDistance;
-				startPoint = *thePoint;
-				maxDistIndex = i;
-			}
+			continue;
 		}
 
 		//set seed point
 		{
 			Tuple3i cellPos;
-			theOctree->getTheCellPosWhichIncludesThePoint(&startPoint, cellPos, octreeLevel);
+			theOctree->getTheCellPosWhichIncludesThePoint(theCloud->getPoint(seedIndex), cellPos, octreeLevel);
 			//clipping (important!)
 			cellPos.x = std::min(octreeLength, cellPos.x);
 			cellPos.y = std::min(octreeLength, cellPos.y);
@@ -292,16 +794,10 @@ bool AutoSegmentationTools::frontPropagationBasedSegmentation(	GenericIndexedClo
 			{
 				progressCb->update(static_cast<float>(numberOfSegmentedLists % 100));
 			}
-
-			fm->cleanLastPropagation();
-
-			//break;
 		}
 
-		if (maxDistIndex == begin)
-		{
-			++begin;
-		}
+		//only the cells touched by the last propagation are reset
+		fm->cleanLastPropagation();
 	}
 
 	if (progressCb)
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: LGPL-2.0-or-later
+// Copyright © CloudCompare Project
+
+#pragma once
+
+//system
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace CCCoreLib
+{
+	//! Lock-free union-find (disjoint sets) structure
+	/** Several threads can call 'unite' and 'find' concurrently. Roots are always
+		linked to the smaller root, so that once all the unions are done, the root
+		of each set is its smallest element (which makes the final labels independent
+		from the threads scheduling).
+	**/
+	class ConcurrentUnionFind
+	{
+	public:
+
+		//! Default constructor
+		ConcurrentUnionFind()
+			: m_count(0)
+		{}
+
+		//! Initializes the structure with 'count' singletons
+		/** \return false if not enough memory
+		**/
+		bool init(unsigned count)
+		{
+			m_parents.reset(new (std::nothrow) std::atomic<unsigned>[count]);
+			if (!m_parents && count != 0)
+			{
+				m_count = 0;
+				return false;
+			}
+			m_count = count;
+			for (unsigned i = 0; i < count; ++i)
+			{
+				m_parents[i].store(i, std::memory_order_relaxed);
+			}
+			return true;
+		}
+
+		//! Returns the number of elements
+		inline unsigned size() const { return m_count; }
+
+		//! Returns the root of the set containing a given element
+		/** Performs path halving on the way (safe with concurrent calls).
+		**/
+		inline unsigned find(unsigned i)
+		{
+			assert(i < m_count);
+			while (true)
+			{
+				unsigned parent = m_parents[i].load(std::memory_order_relaxed);
+				if (parent == i)
+				{
+					return i;
+				}
+				unsigned grandParent = m_parents[parent].load(std::memory_order_relaxed);
+				if (grandParent != parent)
+				{
+					//path halving (it doesn't matter if it fails)
+					m_parents[i].compare_exchange_weak(parent, grandParent, std::memory_order_relaxed);
+				}
+				i = grandParent;
+			}
+		}
+
+		//! Merges the sets containing two elements
+		inline void unite(unsigned a, unsigned b)
+		{
+			while (true)
+			{
+				a = find(a);
+				b = find(b);
+				if (a == b)
+				{
+					return;
+				}
+				//we always link the biggest root to the smallest
+				if (a < b)
+				{
+					std::swap(a, b);
+				}
+				unsigned expected = a;
+				if (m_parents[a].compare_exchange_strong(expected, b, std::memory_order_acq_rel))
+				{
+					return;
+				}
+				//otherwise 'a' is not a root anymore: try again
+			}
+		}
+
+		//! Returns the root of a given element (should only be called once all the unions are done)
+		inline unsigned root(unsigned i) const
+		{
+			unsigned parent = m_parents[i].load(std::memory_order_relaxed);
+			while (parent != i)
+			{
+				i = parent;
+				parent = m_parents[i].load(std::memory_order_relaxed);
+			}
+			return i;
+		}
+
+	protected:
+
+		//! Parent of each element
+		std::unique_ptr<std::atomic<unsigned>[]> m_parents;
+		//! Number of elements
+		unsigned m_count;
+	};
+}
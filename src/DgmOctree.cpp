@@ -10,8 +10,11 @@
 #include <RayAndBox.h>
 #include <ReferenceCloud.h>
 #include <ScalarField.h>
+#include "ConcurrentUnionFind.h"
+#include "ParallelForHelper.h"
 
 //system
+#include <algorithm>
 #include <cstdio>
 #include <utility>
 
@@ -2436,11 +2439,11 @@ bool DgmOctree::diff(unsigned char octreeLevel, const cellsContainer &codesA, co
 	return true;
 }
 
-int DgmOctree::extractCCs(unsigned char level, bool sixConnexity, GenericProgressCallback* progressCb) const
+int DgmOctree::extractCCs(unsigned char level, bool sixConnexity, GenericProgressCallback* progressCb, bool multiThread) const
 {
 	std::vector<CellCode> cellCodes;
 	getCellCodes(level,cellCodes);
-	return extractCCs(cellCodes, level, sixConnexity, progressCb);
+	return extractCCs(cellCodes, level, sixConnexity, progressCb, multiThread);
 }
 
 struct IndexAndCodeExt
@@ -2475,8 +2478,13 @@ struct IndexAndCodeExt
 
 };
 
-int DgmOctree::extractCCs(const cellCodesContainer& cellCodes, unsigned char level, bool sixConnexity, GenericProgressCallback* progressCb) const
+int DgmOctree::extractCCs(const cellCodesContainer& cellCodes, unsigned char level, bool sixConnexity, GenericProgressCallback* progressCb, bool multiThread) const
 {
+	if (multiThread)
+	{
+		return extractCCsMT(cellCodes, level, sixConnexity, progressCb);
+	}
+
 	std::size_t numberOfCells = cellCodes.size();
 	if (numberOfCells == 0) //no cells!
 		return -1;
@@ -2868,6 +2876,172 @@ int DgmOctree::extractCCs(const cellCodesContainer& cellCodes, unsigned char lev
 	return numberOfComponents;
 }
 
+int DgmOctree::extractCCsMT(const cellCodesContainer& cellCodes, unsigned char level, bool sixConnexity, GenericProgressCallback* progressCb) const
+{
+	if (cellCodes.empty()) //no cells!
+		return -1;
+
+	//binary shift for cell code truncation
+	const unsigned char bitShift = GET_BIT_SHIFT(level);
+
+	//we work directly on the (sorted and unique) truncated cell codes
+	cellCodesContainer codes;
+	try
+	{
+		codes.resize(cellCodes.size());
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return -2;
+	}
+	ParallelForHelper::ForEachRange(cellCodes.size(), [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			codes[i] = (cellCodes[i] >> bitShift);
+		}
+	});
+	ParallelSort(codes.begin(), codes.end());
+	codes.erase(std::unique(codes.begin(), codes.end()), codes.end());
+
+	const unsigned numberOfCells = static_cast<unsigned>(codes.size());
+
+	ConcurrentUnionFind unionFind;
+	std::vector<int> cellLabels;
+	try
+	{
+		cellLabels.resize(numberOfCells, 0);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return -2;
+	}
+	if (!unionFind.init(numberOfCells))
+	{
+		//not enough memory
+		return -2;
+	}
+
+	//relative neighbors positions (either 6 or 26 total - but we only need the 'preceding' half of them)
+	Tuple3i neighborShifts[13];
+	unsigned char neighborCount = 0;
+	if (sixConnexity) //6-connexity
+	{
+		neighborShifts[neighborCount++] = Tuple3i(-1,  0,  0);
+		neighborShifts[neighborCount++] = Tuple3i( 0, -1,  0);
+		neighborShifts[neighborCount++] = Tuple3i( 0,  0, -1);
+	}
+	else //26-connexity
+	{
+		for (int k = -1; k <= 0; ++k)
+		{
+			for (int j = -1; j <= 1; ++j)
+			{
+				for (int i = -1; i <= 1; ++i)
+				{
+					//we only keep the neighbors 'before' the cell (in k, j, i order)
+					if (k < 0 || j < 0 || (j == 0 && i < 0))
+					{
+						neighborShifts[neighborCount++] = Tuple3i(i, j, k);
+					}
+				}
+			}
+		}
+	}
+	assert(neighborCount <= 13);
+
+	//progress notification
+	if (progressCb)
+	{
+		if (progressCb->textCanBeEdited())
+		{
+			progressCb->setMethodTitle("Components Labeling");
+			char buffer[64];
+			snprintf(buffer, 64, "Cells: %u", numberOfCells);
+			progressCb->setInfo(buffer);
+		}
+		progressCb->update(0);
+		progressCb->start();
+	}
+
+	//labeling (each cell is merged with its existing 'preceding' neighbors)
+	const int gridSize = (1 << level);
+	ParallelForHelper::ForEachRange(numberOfCells, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			Tuple3i cellPos;
+			getCellPos(codes[i], level, cellPos, true);
+
+			for (unsigned char n = 0; n < neighborCount; ++n)
+			{
+				Tuple3i neighborPos = cellPos + neighborShifts[n];
+				if (	neighborPos.x < 0 || neighborPos.x >= gridSize
+					||	neighborPos.y < 0 || neighborPos.y >= gridSize
+					||	neighborPos.z < 0 || neighborPos.z >= gridSize)
+				{
+					continue;
+				}
+
+				//binary search in the sorted codes
+				CellCode neighborCode = GenerateTruncatedCellCode(neighborPos, level);
+				cellCodesContainer::const_iterator it = std::lower_bound(codes.begin(), codes.end(), neighborCode);
+				if (it != codes.end() && *it == neighborCode)
+				{
+					unionFind.unite(static_cast<unsigned>(i), static_cast<unsigned>(it - codes.begin()));
+				}
+			}
+		}
+	}, true, 4096);
+
+	if (progressCb)
+	{
+		progressCb->update(50.0f);
+	}
+
+	//the root of each component is its smallest cell index: components are numbered in cell code order (starting at 1)
+	int numberOfComponents = 0;
+	for (unsigned i = 0; i < numberOfCells; ++i)
+	{
+		unsigned root = unionFind.root(i);
+		cellLabels[i] = (root == i ? ++numberOfComponents : cellLabels[root]);
+	}
+
+	if (numberOfComponents == 0)
+	{
+		//No component found
+		if (progressCb)
+		{
+			progressCb->stop();
+		}
+		return -3;
+	}
+
+	//we flag each component's points with its label
+	ParallelForHelper::ForEachRange(numberOfCells, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			unsigned pointIndex = getCellIndex(codes[i], bitShift);
+			ScalarType d = static_cast<ScalarType>(cellLabels[i]);
+			for (; pointIndex < m_numberOfProjectedPoints && (m_thePointsAndTheirCellCodes[pointIndex].theCode >> bitShift) == codes[i]; ++pointIndex)
+			{
+				m_theAssociatedCloud->setPointScalarValue(m_thePointsAndTheirCellCodes[pointIndex].theIndex, d);
+			}
+		}
+	}, true, 4096);
+
+	if (progressCb)
+	{
+		progressCb->update(100.0f);
+		progressCb->stop();
+	}
+
+	return numberOfComponents;
+}
+
 /*** Octree-based cloud traversal mechanism ***/
 
 DgmOctree::octreeCell::octreeCell(const DgmOctree* _parentOctree)
@@ -4,11 +4,13 @@
 #include <DistanceComputationTools.h>
 
 //local
+#include <ConjugateGradient.h>
 #include <DgmOctreeReferenceCloud.h>
 #include <FastMarchingForPropagation.h>
 #include <LocalModel.h>
 #include <PointCloud.h>
 #include <Polyline.h>
+#include <PolylineSegmentIndex.h>
 #include <ReferenceCloud.h>
 #include <SaitoSquaredDistanceTransform.h>
 #include <ScalarField.h>
@@ -206,8 +208,19 @@ int DistanceComputationTools::computeCloud2CloudDistances(	GenericIndexedCloudPe
 		return DISTANCE_COMPUTATION_RESULTS::ERROR_NULL_COMPAREDOCTREE;
 	}
 
+	DgmOctree::octreeCellFunc cellFunction = computeCellHausdorffDistance;
+	if (params.localModel == QUADRIC && !params.reuseExistingLocalModels)
+	{
+		//the quadrics are independent: they can be fitted by batches
+		cellFunction = computeCellHausdorffDistanceWithQuadrics;
+	}
+	else if (params.localModel != NO_MODEL)
+	{
+		cellFunction = computeCellHausdorffDistanceWithLocalModel;
+	}
+
 	result = comparedOctree->executeFunctionForAllCellsAtLevel(params.octreeLevel,
-															   params.localModel == NO_MODEL ? computeCellHausdorffDistance : computeCellHausdorffDistanceWithLocalModel,
+															   cellFunction,
 															   additionalParameters,
 															   params.multiThread,
 															   progressCb,
@@ -470,6 +483,159 @@ bool DistanceComputationTools::computeCellHausdorffDistance(const DgmOctree::oct
 	return true;
 }
 
+//! Initializes the nearest neighbour search structures for a cell of the compared octree (see computeCellHausdorffDistanceWithLocalModel)
+/** \param nNSS structure for the nearest neighbour search (in the reference cloud)
+	\param nNSS_Model structure for the search of the neighbours of the nearest point (to compute the local models)
+**/
+static void InitLocalModelSearchStructs(	const DgmOctree::octreeCell& cell,
+											const DgmOctree& referenceOctree,
+											const DistanceComputationTools::Cloud2CloudDistancesComputationParams& params,
+											double maxSearchSquareDistd,
+											DgmOctree::NearestNeighboursSearchStruct& nNSS,
+											DgmOctree::NearestNeighboursSearchStruct& nNSS_Model)
+{
+	//structure for the nearest neighbor search
+	nNSS.level								= cell.level;
+	nNSS.alreadyVisitedNeighbourhoodSize	= 0;
+	nNSS.theNearestPointIndex				= 0;
+	nNSS.maxSearchSquareDistd				= maxSearchSquareDistd;
+	//we already compute the position of the 'equivalent' cell in the reference octree
+	referenceOctree.getCellPos(cell.truncatedCode,cell.level,nNSS.cellPos,true);
+	//and we deduce its center
+	referenceOctree.computeCellCenter(nNSS.cellPos,cell.level,nNSS.cellCenter);
+
+	//structures for determining the nearest neighbours of the 'nearest neighbour' (to compute the local model)
+	//either inside a sphere or the k nearest
+	nNSS_Model.level = cell.level;
+	if (!params.useSphericalSearchForLocalModel)
+	{
+		nNSS_Model.minNumberOfNeighbors = params.kNNForLocalModel;
+	}
+}
+
+//! Grabs the neighbours of the nearest point (to compute a local model)
+/** The neighbours are stored (sorted) in nNSS_Model.pointsInNeighbourhood.
+	\param[out] kNN the number of neighbours
+	\param[out] maxSquareDist the squared distance to the farthest neighbour (an approximation of the model 'size')
+	\return whether there are enough neighbours to compute a local model
+**/
+static bool GrabLocalModelNeighbours(	const DgmOctree& referenceOctree,
+										const DistanceComputationTools::Cloud2CloudDistancesComputationParams& params,
+										const CCVector3& nearestPoint,
+										DgmOctree::NearestNeighboursSearchStruct& nNSS_Model,
+										unsigned& kNN,
+										double& maxSquareDist)
+{
+	nNSS_Model.queryPoint = nearestPoint;
+
+	//update cell pos information (as the nearestPoint may not be inside the same cell as the actual query point!)
+	{
+		bool inbounds = false;
+		Tuple3i cellPos;
+		referenceOctree.getTheCellPosWhichIncludesThePoint(&nearestPoint, cellPos, nNSS_Model.level, inbounds);
+		//if the cell is different or the structure has not yet been initialized, we reset it!
+		if (	cellPos.x != nNSS_Model.cellPos.x
+				||	cellPos.y != nNSS_Model.cellPos.y
+				||	cellPos.z != nNSS_Model.cellPos.z)
+		{
+			nNSS_Model.cellPos = cellPos;
+			referenceOctree.computeCellCenter(nNSS_Model.cellPos, nNSS_Model.level, nNSS_Model.cellCenter);
+			assert(inbounds);
+			nNSS_Model.minimalCellsSetToVisit.clear();
+			nNSS_Model.pointsInNeighbourhood.clear();
+			nNSS_Model.alreadyVisitedNeighbourhoodSize = inbounds ? 0 : 1;
+			//nNSS_Model.theNearestPointIndex = 0;
+		}
+	}
+	//let's grab the nearest neighbours of the 'nearest point'
+	kNN = 0;
+	maxSquareDist = 0;
+	if (params.useSphericalSearchForLocalModel)
+	{
+		//we only need to sort neighbours if we want to use the 'reuseExistingLocalModels' optimization
+		//warning: there may be more points at the end of nNSS.pointsInNeighbourhood than the actual nearest neighbors (kNN)!
+		kNN = referenceOctree.findNeighborsInASphereStartingFromCell(	nNSS_Model,
+																		static_cast<PointCoordinateType>(params.radiusForLocalModel),
+																		params.reuseExistingLocalModels);
+	}
+	else
+	{
+		kNN = referenceOctree.findNearestNeighborsStartingFromCell(nNSS_Model);
+		kNN = std::min(kNN, params.kNNForLocalModel);
+	}
+
+	//if there's enough neighbours
+	if (kNN < CC_LOCAL_MODEL_MIN_SIZE[params.localModel])
+	{
+		return false;
+	}
+
+	//Neighbours are sorted, so the farthest is at the end. It also gives us
+	//an approximation of the model 'size'
+	maxSquareDist = nNSS_Model.pointsInNeighbourhood[kNN-1].squareDistd;
+	return (maxSquareDist > 0); //DGM: with duplicate points, all neighbors can be at the same place :(
+}
+
+//! Stores the distance of a point of the compared cell (see computeCellHausdorffDistanceWithLocalModel)
+/** \param i index of the point in the cell
+	\param queryPoint the point coordinates
+	\param distToNearestPoint distance to the nearest point (or NAN_VALUE)
+	\param nearestPoint the nearest point
+	\param lm local model around the nearest point (if any)
+	\param nearestPointIndex index of the nearest point (only if the point has been processed)
+**/
+static void SetCellPointDistance(	const DgmOctree::octreeCell& cell,
+									unsigned i,
+									DistanceComputationTools::Cloud2CloudDistancesComputationParams& params,
+									bool computeSplitDistances,
+									const CCVector3& queryPoint,
+									ScalarType distToNearestPoint,
+									CCVector3 nearestPoint,
+									const LocalModel* lm,
+									const unsigned* nearestPointIndex)
+{
+	//distance of the current point
+	ScalarType distPt = distToNearestPoint;
+
+	//if we have a local model
+	if (lm)
+	{
+		CCVector3 nearestModelPoint;
+		ScalarType distToModel = lm->computeDistanceFromModelToPoint(&queryPoint, computeSplitDistances ? &nearestModelPoint : nullptr);
+
+		//we take the best estimation between the nearest neighbor and the model!
+		//this way we only reduce any potential noise (that would be due to sampling)
+		//instead of 'adding' noise if the model is badly shaped
+		if (distToNearestPoint <= distToModel)
+		{
+			distPt = distToNearestPoint;
+		}
+		else
+		{
+			distPt = distToModel;
+			nearestPoint = nearestModelPoint;
+		}
+
+		if (computeSplitDistances)
+		{
+			unsigned index = cell.points->getPointGlobalIndex(i);
+			if (params.splitDistances[0])
+				params.splitDistances[0]->setValue(index, static_cast<ScalarType>(queryPoint.x - nearestPoint.x));
+			if (params.splitDistances[1])
+				params.splitDistances[1]->setValue(index, static_cast<ScalarType>(queryPoint.y - nearestPoint.y));
+			if (params.splitDistances[2])
+				params.splitDistances[2]->setValue(index, static_cast<ScalarType>(queryPoint.z - nearestPoint.z));
+		}
+	}
+
+	if (nearestPointIndex && params.CPSet)
+	{
+		params.CPSet->setPointIndex(cell.points->getPointGlobalIndex(i), *nearestPointIndex);
+	}
+
+	cell.points->setPointScalarValue(i, distPt);
+}
+
 //Description of expected 'additionalParameters'
 // [0] -> (GenericIndexedCloudPersist*) reference cloud
 // [1] -> (Octree*): reference cloud octree
@@ -488,25 +654,9 @@ bool DistanceComputationTools::computeCellHausdorffDistanceWithLocalModel(	const
 
 	assert(params && params->localModel != NO_MODEL);
 
-	//structure for the nearest neighbor search
 	DgmOctree::NearestNeighboursSearchStruct nNSS;
-	nNSS.level								= cell.level;
-	nNSS.alreadyVisitedNeighbourhoodSize	= 0;
-	nNSS.theNearestPointIndex				= 0;
-	nNSS.maxSearchSquareDistd				= *maxSearchSquareDistd;
-	//we already compute the position of the 'equivalent' cell in the reference octree
-	referenceOctree->getCellPos(cell.truncatedCode,cell.level,nNSS.cellPos,true);
-	//and we deduce its center
-	referenceOctree->computeCellCenter(nNSS.cellPos,cell.level,nNSS.cellCenter);
-
-	//structures for determining the nearest neighbours of the 'nearest neighbour' (to compute the local model)
-	//either inside a sphere or the k nearest
 	DgmOctree::NearestNeighboursSearchStruct nNSS_Model;
-	nNSS_Model.level = cell.level;
-	if (!params->useSphericalSearchForLocalModel)
-	{
-		nNSS_Model.minNumberOfNeighbors = params->kNNForLocalModel;
-	}
+	InitLocalModelSearchStructs(cell, *referenceOctree, *params, *maxSearchSquareDistd, nNSS, nNSS_Model);
 
 	//already computed models
 	std::vector<const LocalModel*> models;
@@ -515,9 +665,6 @@ bool DistanceComputationTools::computeCellHausdorffDistanceWithLocalModel(	const
 	unsigned pointCount = cell.points->size();
 	for (unsigned i = 0; i < pointCount; ++i)
 	{
-		//distance of the current point
-		ScalarType distPt = NAN_VALUE;
-
 		cell.points->getPoint(i,nNSS.queryPoint);
 		if (params->CPSet || referenceCloud->testVisibility(nNSS.queryPoint) == POINT_VISIBLE) //to build the closest point set up we must process the point whatever its visibility is!
 		{
@@ -529,17 +676,16 @@ bool DistanceComputationTools::computeCellHausdorffDistanceWithLocalModel(	const
 				return false;
 			}
 
+			ScalarType distToNearestPoint = NAN_VALUE;
+			CCVector3 nearestPoint;
+			const LocalModel* lm = nullptr;
+
 			//if it exists
 			if (squareDistToNearestPoint >= 0)
 			{
-				ScalarType distToNearestPoint = static_cast<ScalarType>(sqrt(squareDistToNearestPoint));
-
-				CCVector3 nearestPoint;
+				distToNearestPoint = static_cast<ScalarType>(sqrt(squareDistToNearestPoint));
 				referenceCloud->getPoint(nNSS.theNearestPointIndex, nearestPoint);
 
-				//local model for the 'nearest point'
-				const LocalModel* lm = nullptr;
-
 				if (params->reuseExistingLocalModels)
 				{
 					//we look if the nearest point is close to existing models
@@ -555,134 +701,53 @@ bool DistanceComputationTools::computeCellHausdorffDistanceWithLocalModel(	const
 				}
 
 				//create new local model
-				if (!lm)
+				unsigned kNN = 0;
+				double maxSquareDist = 0;
+				if (!lm && GrabLocalModelNeighbours(*referenceOctree, *params, nearestPoint, nNSS_Model, kNN, maxSquareDist))
 				{
-					nNSS_Model.queryPoint = nearestPoint;
+					DgmOctreeReferenceCloud neighboursCloud(&nNSS_Model.pointsInNeighbourhood,kNN);
+					Neighbourhood Z(&neighboursCloud);
 
-					//update cell pos information (as the nearestPoint may not be inside the same cell as the actual query point!)
+					lm = LocalModel::New(params->localModel, Z, nearestPoint, static_cast<PointCoordinateType>(maxSquareDist));
+					if (lm && params->reuseExistingLocalModels)
 					{
-						bool inbounds = false;
-						Tuple3i cellPos;
-						referenceOctree->getTheCellPosWhichIncludesThePoint(&nearestPoint, cellPos, cell.level, inbounds);
-						//if the cell is different or the structure has not yet been initialized, we reset it!
-						if (	cellPos.x != nNSS_Model.cellPos.x
-								||	cellPos.y != nNSS_Model.cellPos.y
-								||	cellPos.z != nNSS_Model.cellPos.z)
+						//we add the model to the 'existing models' list
+						try
 						{
-							nNSS_Model.cellPos = cellPos;
-							referenceOctree->computeCellCenter(nNSS_Model.cellPos, nNSS_Model.level, nNSS_Model.cellCenter);
-							assert(inbounds);
-							nNSS_Model.minimalCellsSetToVisit.clear();
-							nNSS_Model.pointsInNeighbourhood.clear();
-							nNSS_Model.alreadyVisitedNeighbourhoodSize = inbounds ? 0 : 1;
-							//nNSS_Model.theNearestPointIndex = 0;
+							models.push_back(lm);
 						}
-					}
-					//let's grab the nearest neighbours of the 'nearest point'
-					unsigned kNN = 0;
-					if (params->useSphericalSearchForLocalModel)
-					{
-						//we only need to sort neighbours if we want to use the 'reuseExistingLocalModels' optimization
-						//warning: there may be more points at the end of nNSS.pointsInNeighbourhood than the actual nearest neighbors (kNN)!
-						kNN = referenceOctree->findNeighborsInASphereStartingFromCell(	nNSS_Model,
-																						static_cast<PointCoordinateType>(params->radiusForLocalModel),
-																						params->reuseExistingLocalModels);
-					}
-					else
-					{
-						kNN = referenceOctree->findNearestNeighborsStartingFromCell(nNSS_Model);
-						kNN = std::min(kNN, params->kNNForLocalModel);
-					}
-
-					//if there's enough neighbours
-					if (kNN >= CC_LOCAL_MODEL_MIN_SIZE[params->localModel])
-					{
-						DgmOctreeReferenceCloud neighboursCloud(&nNSS_Model.pointsInNeighbourhood,kNN);
-						Neighbourhood Z(&neighboursCloud);
-
-						//Neighbours are sorted, so the farthest is at the end. It also gives us
-						//an approximation of the model 'size'
-						const double& maxSquareDist = nNSS_Model.pointsInNeighbourhood[kNN-1].squareDistd;
-						if (maxSquareDist > 0) //DGM: with duplicate points, all neighbors can be at the same place :(
+						catch (const std::bad_alloc&)
 						{
-							lm = LocalModel::New(params->localModel, Z, nearestPoint, static_cast<PointCoordinateType>(maxSquareDist));
-							if (lm && params->reuseExistingLocalModels)
+							//not enough memory!
+							delete lm;
+							while (!models.empty())
 							{
-								//we add the model to the 'existing models' list
-								try
-								{
-									models.push_back(lm);
-								}
-								catch (const std::bad_alloc&)
-								{
-									//not enough memory!
-									while (!models.empty())
-									{
-										delete models.back();
-										models.pop_back();
-									}
-									return false;
-								}
+								delete models.back();
+								models.pop_back();
 							}
+							return false;
 						}
-						//neighbours->clear();
-					}
-				}
-
-				//if we have a local model
-				if (lm)
-				{
-					CCVector3 nearestModelPoint;
-					ScalarType distToModel = lm->computeDistanceFromModelToPoint(&nNSS.queryPoint, computeSplitDistances ? &nearestModelPoint : nullptr);
-
-					//we take the best estimation between the nearest neighbor and the model!
-					//this way we only reduce any potential noise (that would be due to sampling)
-					//instead of 'adding' noise if the model is badly shaped
-					if (distToNearestPoint <= distToModel)
-					{
-						distPt = distToNearestPoint;
-					}
-					else
-					{
-						distPt = distToModel;
-						nearestPoint = nearestModelPoint;
-					}
-
-					if (!params->reuseExistingLocalModels)
-					{
-						//we don't need the local model anymore!
-						delete lm;
-						lm = nullptr;
-					}
-
-					if (computeSplitDistances)
-					{
-						unsigned index = cell.points->getPointGlobalIndex(i);
-						if (params->splitDistances[0])
-							params->splitDistances[0]->setValue(index, static_cast<ScalarType>(nNSS.queryPoint.x - nearestPoint.x));
-						if (params->splitDistances[1])
-							params->splitDistances[1]->setValue(index, static_cast<ScalarType>(nNSS.queryPoint.y - nearestPoint.y));
-						if (params->splitDistances[2])
-							params->splitDistances[2]->setValue(index, static_cast<ScalarType>(nNSS.queryPoint.z - nearestPoint.z));
 					}
 				}
-				else
-				{
-					distPt = distToNearestPoint;
-				}
 			}
 			else if (nNSS.maxSearchSquareDistd > 0)
 			{
-				distPt = static_cast<ScalarType>(sqrt(nNSS.maxSearchSquareDistd));
+				distToNearestPoint = static_cast<ScalarType>(sqrt(nNSS.maxSearchSquareDistd));
 			}
 
-			if (params->CPSet)
+			SetCellPointDistance(cell, i, *params, computeSplitDistances, nNSS.queryPoint, distToNearestPoint, nearestPoint, lm, &nNSS.theNearestPointIndex);
+
+			if (lm && !params->reuseExistingLocalModels)
 			{
-				params->CPSet->setPointIndex(cell.points->getPointGlobalIndex(i), nNSS.theNearestPointIndex);
+				//we don't need the local model anymore!
+				delete lm;
+				lm = nullptr;
 			}
 		}
-
-		cell.points->setPointScalarValue(i, distPt);
+		else
+		{
+			cell.points->setPointScalarValue(i, NAN_VALUE);
+		}
 
 		if (nProgress && !nProgress->oneStep())
 		{
@@ -700,6 +765,161 @@ bool DistanceComputationTools::computeCellHausdorffDistanceWithLocalModel(	const
 	return true;
 }
 
+bool DistanceComputationTools::computeCellHausdorffDistanceWithQuadrics(	const DgmOctree::octreeCell& cell,
+																		void** additionalParameters,
+																		NormalizedProgress* nProgress/*=nullptr*/)
+{
+	//additional parameters
+	GenericIndexedCloudPersist* referenceCloud		= reinterpret_cast<GenericIndexedCloudPersist*>(additionalParameters[0]);
+	const DgmOctree* referenceOctree				= reinterpret_cast<DgmOctree*>(additionalParameters[1]);
+	Cloud2CloudDistancesComputationParams* params	= reinterpret_cast<Cloud2CloudDistancesComputationParams*>(additionalParameters[2]);
+	const double* maxSearchSquareDistd				= reinterpret_cast<double*>(additionalParameters[3]);
+	bool computeSplitDistances						= *reinterpret_cast<bool*>(additionalParameters[4]);
+
+	assert(params && params->localModel == QUADRIC && !params->reuseExistingLocalModels);
+
+	DgmOctree::NearestNeighboursSearchStruct nNSS;
+	DgmOctree::NearestNeighboursSearchStruct nNSS_Model;
+	InitLocalModelSearchStructs(cell, *referenceOctree, *params, *maxSearchSquareDistd, nNSS, nNSS_Model);
+
+	//per-point information (see the first step below)
+	struct PointQuery
+	{
+		CCVector3 queryPoint;
+		CCVector3 nearestPoint;
+		CCVector3 gravityCenter;
+		PointCoordinateType squaredRadius = 0;
+		ScalarType distance = NAN_VALUE;
+		unsigned nearestPointIndex = 0;
+		Tuple3ub dims;
+		bool processed = false;
+		bool hasModel = false;
+	};
+
+	//the points are processed by batches
+	static const unsigned BatchSize = 256;
+	std::vector<PointQuery> queries;
+	ConjugateGradientBatch<6, double> solver;
+	try
+	{
+		queries.resize(std::min(cell.points->size(), BatchSize));
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return false;
+	}
+
+	unsigned pointCount = cell.points->size();
+	for (unsigned batchStart = 0; batchStart < pointCount; batchStart += BatchSize)
+	{
+		unsigned batchCount = std::min(BatchSize, pointCount - batchStart);
+		if (!solver.init(batchCount))
+		{
+			//not enough memory
+			return false;
+		}
+
+		//first step: look for the nearest neighbours and build the quadric systems
+		for (unsigned j = 0; j < batchCount; ++j)
+		{
+			PointQuery& query = queries[j];
+			query = PointQuery();
+
+			cell.points->getPoint(batchStart + j, nNSS.queryPoint);
+			query.queryPoint = nNSS.queryPoint;
+			if (!params->CPSet && referenceCloud->testVisibility(nNSS.queryPoint) != POINT_VISIBLE) //to build the closest point set up we must process the point whatever its visibility is!
+			{
+				continue;
+			}
+			query.processed = true;
+
+			//first, we look for the nearest point to "_queryPoint" in the reference cloud
+			double squareDistToNearestPoint = referenceOctree->findTheNearestNeighborStartingFromCell(nNSS);
+			if (!std::isfinite(squareDistToNearestPoint))
+			{
+				//not enough memory
+				return false;
+			}
+
+			//if it exists
+			if (squareDistToNearestPoint >= 0)
+			{
+				query.distance = static_cast<ScalarType>(sqrt(squareDistToNearestPoint));
+				referenceCloud->getPoint(nNSS.theNearestPointIndex, query.nearestPoint);
+
+				unsigned kNN = 0;
+				double maxSquareDist = 0;
+				if (GrabLocalModelNeighbours(*referenceOctree, *params, query.nearestPoint, nNSS_Model, kNN, maxSquareDist))
+				{
+					DgmOctreeReferenceCloud neighboursCloud(&nNSS_Model.pointsInNeighbourhood, kNN);
+					Neighbourhood Z(&neighboursCloud);
+
+					//the quadric system is only solved at the second step (with the other points of the batch)
+					Neighbourhood::QuadricSystem system;
+					if (Z.buildQuadricSystem(system))
+					{
+						solver.setSystem(j, system.tAA, system.tAb, system.X0, system.convergenceThreshold);
+						query.gravityCenter = *Z.getGravityCenter();
+						query.squaredRadius = static_cast<PointCoordinateType>(maxSquareDist);
+						query.dims = system.dims;
+						query.hasModel = true;
+					}
+				}
+			}
+			else if (nNSS.maxSearchSquareDistd > 0)
+			{
+				query.distance = static_cast<ScalarType>(sqrt(nNSS.maxSearchSquareDistd));
+			}
+
+			query.nearestPointIndex = nNSS.theNearestPointIndex;
+		}
+
+		//second step: fit all the quadrics at once
+		solver.solve(Neighbourhood::QUADRIC_MAX_ITERATION_COUNT);
+
+		//third step: compute the distances to the models
+		for (unsigned j = 0; j < batchCount; ++j)
+		{
+			const PointQuery& query = queries[j];
+			unsigned i = batchStart + j;
+
+			if (query.processed)
+			{
+				const LocalModel* lm = nullptr;
+				if (query.hasModel)
+				{
+					double X[6];
+					solver.getSolution(j, X);
+					PointCoordinateType eq[6];
+					for (unsigned k = 0; k < 6; ++k)
+					{
+						eq[k] = static_cast<PointCoordinateType>(X[k]);
+					}
+
+					lm = LocalModel::NewQuadric(eq, query.dims, query.gravityCenter, query.nearestPoint, query.squaredRadius);
+				}
+
+				SetCellPointDistance(cell, i, *params, computeSplitDistances, query.queryPoint, query.distance, query.nearestPoint, lm, &query.nearestPointIndex);
+
+				delete lm;
+				lm = nullptr;
+			}
+			else
+			{
+				cell.points->setPointScalarValue(i, NAN_VALUE);
+			}
+
+			if (nProgress && !nProgress->oneStep())
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
 //! Method used by computeCloud2MeshDistancesWithOctree
 static void ComparePointsAndTriangles(	ReferenceCloud& Yk,
 										unsigned& remainingPoints,
@@ -2772,36 +2992,64 @@ int DistanceComputationTools::computeCloud2PolylineEquation(GenericIndexedCloudP
 		assert(false);
 		return DISTANCE_COMPUTATION_RESULTS::ERROR_TOOSMALL_REFERENCEPOLYLINE;
 	}
+
+	//the closing segment is ignored (for backward compatibility)
+	PolylineSegmentIndex polylineIndex;
+	if (!polylineIndex.build(*polyline, false))
+	{
+		return DISTANCE_COMPUTATION_RESULTS::ERROR_OUT_OF_MEMORY;
+	}
+
+	return computeCloud2PolylineEquation(cloud, polylineIndex, nullptr, nullptr, rms);
+}
+
+int DistanceComputationTools::computeCloud2PolylineEquation(GenericIndexedCloudPersist* cloud,
+															const PolylineSegmentIndex& polylineIndex,
+															unsigned* nearestSegmentIndexes/*=nullptr*/,
+															double* curvilinearAbscissas/*=nullptr*/,
+															double* rms/*=nullptr*/,
+															bool multiThread/*=true*/,
+															int maxThreadCount/*=0*/)
+{
+	if (!cloud)
+	{
+		assert(false);
+		return DISTANCE_COMPUTATION_RESULTS::ERROR_NULL_COMPAREDCLOUD;
+	}
+	unsigned count = cloud->size();
+	if (count == 0)
+	{
+		return DISTANCE_COMPUTATION_RESULTS::ERROR_EMPTY_COMPAREDCLOUD;
+	}
+	if (!cloud->enableScalarField())
+	{
+		return DISTANCE_COMPUTATION_RESULTS::ERROR_ENABLE_SCALAR_FIELD_FAILURE;
+	}
+	if (!polylineIndex.isBuilt())
+	{
+		assert(false);
+		return DISTANCE_COMPUTATION_RESULTS::ERROR_TOOSMALL_REFERENCEPOLYLINE;
+	}
+
+	std::vector<ScalarType> squareDistances;
+	try
+	{
+		squareDistances.resize(count);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return DISTANCE_COMPUTATION_RESULTS::ERROR_OUT_OF_MEMORY;
+	}
+
+	//the nearest segments are searched in parallel
+	polylineIndex.findNearestSegments(*cloud, squareDistances.data(), nearestSegmentIndexes, curvilinearAbscissas, multiThread, maxThreadCount);
+
+	//but the scalar field is filled sequentially (setPointScalarValue is not thread-safe for all clouds)
 	ScalarType d = 0;
 	ScalarType dSumSq = 0;
 	for (unsigned i = 0; i < count; ++i)
 	{
-		ScalarType distSq = NAN_VALUE;
-		const CCVector3* p = cloud->getPoint(i);
-		for (unsigned j = 0; j < polyline->size() - 1; j++)
-		{
-			const CCVector3* start = polyline->getPoint(j);
-			const CCVector3* end = polyline->getPoint(j + 1);
-			CCVector3d startMinusP = (*start - *p);
-			CCVector3d endMinusP = (*end - *p);
-
-			//Rejection test
-			if (	((startMinusP.x * startMinusP.x >= distSq) && (endMinusP.x * endMinusP.x >= distSq) && GreaterThanSquareEpsilon( startMinusP.x * endMinusP.x )) ||
-					((startMinusP.y * startMinusP.y >= distSq) && (endMinusP.y * endMinusP.y >= distSq) && GreaterThanSquareEpsilon( startMinusP.y * endMinusP.y )) ||
-					((startMinusP.z * startMinusP.z >= distSq) && (endMinusP.z * endMinusP.z >= distSq) && GreaterThanSquareEpsilon( startMinusP.z * endMinusP.z ))
-					)
-			{
-				continue;
-			}
-			if (std::isnan(distSq))
-			{
-				distSq = computePoint2LineSegmentDistSquared(p, start, end);
-			}
-			else
-			{
-				distSq = std::min(distSq, computePoint2LineSegmentDistSquared(p, start, end));
-			}
-		}
+		ScalarType distSq = squareDistances[i];
 		d = sqrt(distSq);
 		dSumSq += distSq;
 		cloud->setPointScalarValue(i, d);
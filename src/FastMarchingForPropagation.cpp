@@ -8,6 +8,9 @@
 #include "ReferenceCloud.h"
 #include "ScalarFieldTools.h"
 
+//system
+#include <algorithm>
+#include <functional>
 
 using namespace CCCoreLib;
 
@@ -119,7 +122,7 @@ int FastMarchingForPropagation::step()
 					float t_new = computeT(nIndex);
 
 					if (t_new < t_old)
-						nCell->T = t_new;
+						updateTrialCell(nIndex, t_new);
 				}
 			}
 		}
@@ -132,6 +135,50 @@ int FastMarchingForPropagation::step()
 	return 1;
 }
 
+void FastMarchingForPropagation::addTrialCell(unsigned index)
+{
+	FastMarching::addTrialCell(index);
+
+	m_trialHeap.push_back({ m_theGrid[index]->T, index });
+	std::push_heap(m_trialHeap.begin(), m_trialHeap.end(), std::greater<TrialCellEntry>());
+}
+
+void FastMarchingForPropagation::updateTrialCell(unsigned index, float T)
+{
+	assert(m_theGrid[index] && m_theGrid[index]->state == Cell::TRIAL_CELL);
+	m_theGrid[index]->T = T;
+
+	//the previous entry will be skipped (lazy deletion)
+	m_trialHeap.push_back({ T, index });
+	std::push_heap(m_trialHeap.begin(), m_trialHeap.end(), std::greater<TrialCellEntry>());
+}
+
+unsigned FastMarchingForPropagation::getNearestTrialCell()
+{
+	while (!m_trialHeap.empty())
+	{
+		std::pop_heap(m_trialHeap.begin(), m_trialHeap.end(), std::greater<TrialCellEntry>());
+		TrialCellEntry entry = m_trialHeap.back();
+		m_trialHeap.pop_back();
+
+		//skip the outdated entries
+		const Cell* cell = m_theGrid[entry.index];
+		if (cell && cell->state == Cell::TRIAL_CELL && cell->T == entry.T)
+		{
+			return entry.index;
+		}
+	}
+
+	return 0; //0 = error
+}
+
+void FastMarchingForPropagation::cleanLastPropagation()
+{
+	//only the touched cells are reset (the heap keeps its capacity for the next propagation)
+	FastMarching::cleanLastPropagation();
+	m_trialHeap.clear();
+}
+
 int FastMarchingForPropagation::propagate()
 {
 	initTrialCells();
@@ -8,6 +8,7 @@
 #include <DgmOctreeReferenceCloud.h>
 #include <DistanceComputationTools.h>
 #include <GenericProgressCallback.h>
+#include <Jacobi.h>
 #include <ReferenceCloud.h>
 #include <ScalarField.h>
 #include <ScalarFieldTools.h>
@@ -111,8 +112,15 @@ GeometricalAnalysisTools::ErrorCode GeometricalAnalysisTools::ComputeCharactersi
 
 	ErrorCode result = NoError;
 
+	DgmOctree::octreeCellFunc cellFunc = &ComputeGeomCharacteristicAtLevel;
+	if (c == Feature || (c == Curvature && subOption == Neighbourhood::NORMAL_CHANGE_RATE))
+	{
+		//these characteristics only depend on the eigen decomposition of the covariance matrix
+		cellFunc = &ComputeEigenCharacteristicAtLevel;
+	}
+
 	if (octree->executeFunctionForAllCellsAtLevel(	level,
-													&ComputeGeomCharacteristicAtLevel,
+													cellFunc,
 													additionalParameters,
 													true,
 													progressCb,
@@ -294,6 +302,131 @@ bool GeometricalAnalysisTools::ComputeGeomCharacteristicAtLevel(const DgmOctree:
 	return true;
 }
 
+bool GeometricalAnalysisTools::ComputeEigenCharacteristicAtLevel(	const DgmOctree::octreeCell& cell,
+																	void** additionalParameters,
+																	NormalizedProgress* nProgress/*=nullptr*/)
+{
+	//parameters
+	GeomCharacteristic c            = *static_cast<GeomCharacteristic*>(additionalParameters[0]);
+	int subOption                   = *static_cast<Neighbourhood::CurvatureType*>(additionalParameters[1]);
+	PointCoordinateType radius      = *static_cast<PointCoordinateType*>(additionalParameters[2]);
+
+	assert(c == Feature || (c == Curvature && subOption == Neighbourhood::NORMAL_CHANGE_RATE));
+
+	//minimum number of neighbours (same as ComputeGeomCharacteristicAtLevel)
+	const unsigned minNeighborCount = (c == Feature ? 4 : 6);
+
+	//structure for nearest neighbors search
+	DgmOctree::NearestNeighboursSearchStruct nNSS;
+	nNSS.level = cell.level;
+	cell.parentOctree->getCellPos(cell.truncatedCode, cell.level, nNSS.cellPos, true);
+	cell.parentOctree->computeCellCenter(nNSS.cellPos, cell.level, nNSS.cellCenter);
+
+	unsigned n = cell.points->size(); //number of points in the current cell
+
+	//we already know some of the neighbours: the points in the current cell!
+	{
+		try
+		{
+			nNSS.pointsInNeighbourhood.resize(n);
+		}
+		catch (const std::bad_alloc&)
+		{
+			//out of memory
+			return false;
+		}
+
+		DgmOctree::NeighboursSet::iterator it = nNSS.pointsInNeighbourhood.begin();
+		for (unsigned i = 0; i < n; ++i, ++it)
+		{
+			it->point = cell.points->getPointPersistentPtr(i);
+			it->pointIndex = cell.points->getPointGlobalIndex(i);
+		}
+	}
+	nNSS.alreadyVisitedNeighbourhoodSize = 1;
+
+	//the covariance matrices are decomposed by batches
+	static const unsigned BatchSize = 64;
+	double packedCovMats[6 * BatchSize];
+	double eigValues[3 * BatchSize];
+	double eigVectors[9 * BatchSize];
+	bool success[BatchSize];
+	unsigned pointIndexes[BatchSize];
+
+	for (unsigned first = 0; first < n; first += BatchSize)
+	{
+		const unsigned last = std::min(n, first + BatchSize);
+		unsigned batchCount = 0;
+
+		//first step: compute the covariance matrix of the neighbourhood of each point
+		for (unsigned i = first; i < last; ++i)
+		{
+			cell.points->getPoint(i, nNSS.queryPoint);
+
+			//look for neighbors in a sphere
+			//warning: there may be more points at the end of nNSS.pointsInNeighbourhood than the actual nearest neighbors (neighborCount)!
+			unsigned neighborCount = cell.parentOctree->findNeighborsInASphereStartingFromCell(nNSS, radius, false);
+
+			bool validMatrix = false;
+			if (neighborCount >= minNeighborCount)
+			{
+				DgmOctreeReferenceCloud neighboursCloud(&nNSS.pointsInNeighbourhood, neighborCount);
+				Neighbourhood Z(&neighboursCloud);
+				validMatrix = Z.computePackedCovarianceMatrix(packedCovMats + 6 * batchCount);
+			}
+
+			if (validMatrix)
+			{
+				pointIndexes[batchCount++] = i;
+			}
+			else
+			{
+				cell.points->setPointScalarValue(i, NAN_VALUE);
+			}
+
+			if (nProgress && !nProgress->oneStep())
+			{
+				return false;
+			}
+		}
+
+		//second step: decompose all the matrices at once
+		Jacobi<double>::ComputeEigenValuesAndVectors3(packedCovMats, batchCount, eigValues, eigVectors, success, true);
+
+		//last step: compute the characteristic from the eigenvalues/vectors
+		for (unsigned k = 0; k < batchCount; ++k)
+		{
+			ScalarType value = NAN_VALUE;
+
+			if (success[k])
+			{
+				if (c == Feature)
+				{
+					SquareMatrix3d eigVectorsK;
+					double eigValuesK[3];
+					for (unsigned r = 0; r < 3; ++r)
+					{
+						eigValuesK[r] = eigValues[3 * k + r];
+						for (unsigned col = 0; col < 3; ++col)
+						{
+							eigVectorsK.m_values[r][col] = eigVectors[9 * k + 3 * r + col];
+						}
+					}
+					value = static_cast<ScalarType>(Neighbourhood::ComputeFeature(static_cast<Neighbourhood::GeomFeature>(subOption), eigVectorsK, eigValuesK));
+				}
+				else
+				{
+					value = Neighbourhood::ComputeNormalChangeRate(eigValues + 3 * k);
+				}
+			}
+
+			cell.points->setPointScalarValue(pointIndexes[k], value);
+		}
+	}
+
+	return true;
+}
+
 GeometricalAnalysisTools::ErrorCode GeometricalAnalysisTools::FlagDuplicatePoints(	GenericIndexedCloudPersist* cloud,
 																					double minDistanceBetweenPoints/*=1.0e-12*/,
 																					GenericProgressCallback* progressCb/*=nullptr*/,
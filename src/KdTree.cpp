@@ -5,42 +5,60 @@
 
 #include "GenericIndexedCloud.h"
 #include "GenericProgressCallback.h"
+#include "ParallelForHelper.h"
 
 //system
 #include <algorithm>
+#include <limits>
 
 using namespace CCCoreLib;
 
+//! Max depth of the tree (the tree is balanced, so this is enough for 2^32 points)
+static const unsigned KD_TREE_MAX_DEPTH = 64;
+
 KDTree::KDTree()
-	: m_root(nullptr)
-	, m_associatedCloud(nullptr)
-	, m_cellCount(0)
+	: m_associatedCloud(nullptr)
 {
 }
 
 KDTree::~KDTree()
 {
-	deleteSubTree(m_root);
 }
 
-bool KDTree::buildFromCloud(GenericIndexedCloud* cloud, GenericProgressCallback* progressCb/*=nullptr*/)
+bool KDTree::buildFromCloud(GenericIndexedCloud* cloud, GenericProgressCallback* progressCb/*=nullptr*/, bool multiThread/*=true*/, int maxThreadCount/*=0*/)
 {
 	unsigned cloudsize = cloud->size();
 
-	m_indexes.resize(0);
-	m_cellCount = 0;
+	m_nodes.resize(0);
+	m_points.resize(0);
 	m_associatedCloud = nullptr;
-	m_root = nullptr;
 
 	if (cloudsize == 0)
 		return false;
 
+	//the first levels of the tree are built sequentially, the remaining sub-trees can be built in parallel
+	unsigned splitLevels = 0;
+	{
+		std::size_t taskCount = (multiThread ? ParallelForHelper::ChunkCount(cloudsize, 65536, maxThreadCount) : 1);
+		//more tasks than necessary for a smoother progress notification
+		taskCount = std::max<std::size_t>(taskCount, progressCb ? 64 : 1);
+		while ((static_cast<std::size_t>(1) << splitLevels) < taskCount && splitLevels < 16)
+		{
+			++splitLevels;
+		}
+	}
+
+	std::vector<BuildTask> tasks;
 	try
 	{
-		m_indexes.resize(cloudsize);
+		m_nodes.resize(ComputeNodeCount(cloudsize));
+		m_points.resize(cloudsize);
+		tasks.reserve(static_cast<std::size_t>(1) << splitLevels);
 	}
-	catch (.../*const std::bad_alloc&*/) //out of memory
+	catch (const std::bad_alloc&) //out of memory
 	{
+		m_nodes.resize(0);
+		m_points.resize(0);
 		return false;
 	}
 
@@ -48,7 +66,9 @@ bool KDTree::buildFromCloud(GenericIndexedCloud* cloud, GenericProgressCallback*
 
 	for (unsigned i = 0; i < cloudsize; i++)
 	{
-		m_indexes[i] = i;
+		KdPoint& point = m_points[i];
+		cloud->getPoint(i, point.P);
+		point.index = i;
 	}
 
 	if (progressCb)
@@ -61,193 +81,191 @@ bool KDTree::buildFromCloud(GenericIndexedCloud* cloud, GenericProgressCallback*
 		progressCb->start();
 	}
 
-	m_root = buildSubTree(0, cloudsize - 1, nullptr, m_cellCount, progressCb);
+	//build the first levels
+	BuildTask rootTask;
+	rootTask.nodeIndex = 0;
+	rootTask.firstPoint = 0;
+	rootTask.pointCount = cloudsize;
+	buildSubTree(rootTask, splitLevels, &tasks);
 
-	if (progressCb)
-	{
-		progressCb->stop();
-	}
-
-	//if the tree building has failed (memory issues)
-	if (!m_root)
+	//then the remaining sub-trees
+	NormalizedProgress nProgress(progressCb, static_cast<unsigned>(tasks.size()));
+	ParallelForHelper::ForEachChunk(tasks.size(), tasks.size(), [&](std::size_t taskIndex, std::size_t, std::size_t)
 	{
-		m_associatedCloud = nullptr;
-		m_cellCount = 0;
-		return false;
-	}
+		buildSubTree(tasks[taskIndex]);
+		if (progressCb)
+		{
+			nProgress.oneStep();
+		}
+	}, multiThread, maxThreadCount);
 
-	try
-	{
-		m_indexes.resize(cloudsize);
-	}
-	catch (.../*const std::bad_alloc&*/) //out of memory
+	if (progressCb)
 	{
-		m_associatedCloud = nullptr;
-		m_cellCount = 0;
-		return false;
+		progressCb->stop();
 	}
 
 	return true;
 }
 
-
-void KDTree::deleteSubTree(KdCell *cell)
+unsigned KDTree::ComputeNodeCount(unsigned pointCount)
 {
-	if (!cell)
-		return;
-
-	deleteSubTree(cell->leSon);
-	deleteSubTree(cell->gSon);
-	delete cell;
-	assert(m_cellCount > 0);
-	m_cellCount--;
-}
+	//the number of nodes of a sub-tree only depends on its number of points 'n':
+	//f(n) = 1 if n <= MAX_POINTS_PER_LEAF, 1 + f(ceil(n/2)) + f(floor(n/2)) otherwise.
+	//As f(n) and f(n+1) only depend on f(n/2) and f(n/2 + 1), we compute them both (in log(n) steps)
+	struct NodeCounts
+	{
+		static void Compute(unsigned n, unsigned& count, unsigned& nextCount)
+		{
+			if (n + 1 <= MAX_POINTS_PER_LEAF)
+			{
+				count = nextCount = 1;
+				return;
+			}
 
-/*** Comparison functions used by the sort function (Strict ordering must be used) ***/
-static GenericIndexedCloud* s_comparisonCloud = nullptr;
+			unsigned half = n / 2;
+			unsigned halfCount = 0;
+			unsigned nextHalfCount = 0;
+			Compute(half, halfCount, nextHalfCount);
 
-//! Compares X coordinates of two points designated by their index
-static bool ComparisonX(const unsigned &a, const unsigned &b)
-{
-	return (s_comparisonCloud->getPoint(a)->x < s_comparisonCloud->getPoint(b)->x);
-}
+			if ((n & 1) == 0)
+			{
+				count = 1 + 2 * halfCount;
+				nextCount = 1 + nextHalfCount + halfCount;
+			}
+			else
+			{
+				count = 1 + nextHalfCount + halfCount;
+				nextCount = 1 + 2 * nextHalfCount;
+			}
 
-//! Compares Y coordinates of two points designated by their index
-static bool ComparisonY(const unsigned &a, const unsigned &b)
-{
-	return (s_comparisonCloud->getPoint(a)->y < s_comparisonCloud->getPoint(b)->y);
-}
+			if (n <= MAX_POINTS_PER_LEAF)
+			{
+				count = 1;
+			}
+		}
+	};
 
-//! Compares Z coordinates of two points designated by their index
-static bool ComparisonZ(const unsigned &a, const unsigned &b)
-{
-	return (s_comparisonCloud->getPoint(a)->z < s_comparisonCloud->getPoint(b)->z);
+	unsigned count = 0;
+	unsigned nextCount = 0;
+	NodeCounts::Compute(pointCount, count, nextCount);
+	return count;
 }
 
-KDTree::KdCell* KDTree::buildSubTree(unsigned first, unsigned last, KdCell* father, unsigned &nbBuildCell, GenericProgressCallback* progressCb/*=nullptr*/)
+void KDTree::buildSubTree(const BuildTask& task, unsigned splitLevels/*=0*/, std::vector<BuildTask>* deferredTasks/*=nullptr*/)
 {
-	KdCell* cell = new KdCell;
-	if (!cell)
-		return nullptr;
-	m_cellCount++;
-
-	unsigned dim = (father == nullptr ? 0 : ((father->cuttingDim + 1) % 3));
-
-	//Compute outside bounding box (have to be done before building the current cell sons)
-	cell->father = father;
-	cell->startingPointIndex = first;
-	cell->nbPoints = last - first + 1;
-	cell->cuttingDim = dim;
-	updateOutsideBoundingBox(cell);
-	if (progressCb)
+	if (deferredTasks && splitLevels == 0)
 	{
-		assert(m_indexes.size() != 0);
-		progressCb->update((m_cellCount * 100.0f) / (2 * m_indexes.size() - 1));
+		//will be built later
+		deferredTasks->push_back(task);
+		return;
 	}
 
-	//If there is only one point to insert, build a leaf
-	if (first == last)
+	assert(task.pointCount != 0);
+	KdNode& node = m_nodes[task.nodeIndex];
+	node.firstPoint = task.firstPoint;
+	node.pointCount = task.pointCount;
+	node.rightChild = 0;
+	node.cuttingDim = 0;
+	node.cuttingCoordinate = 0;
+
+	//compute the inside bounding box
+	KdPoint* points = m_points.data() + task.firstPoint;
+	node.bbMin = node.bbMax = points[0].P;
+	for (unsigned i = 1; i < task.pointCount; ++i)
 	{
-		cell->cuttingDim = 0;
-		cell->leSon = nullptr;
-		cell->gSon = nullptr;
+		const CCVector3& P = points[i].P;
+		node.bbMin.x = std::min(node.bbMin.x, P.x);
+		node.bbMin.y = std::min(node.bbMin.y, P.y);
+		node.bbMin.z = std::min(node.bbMin.z, P.z);
+		node.bbMax.x = std::max(node.bbMax.x, P.x);
+		node.bbMax.y = std::max(node.bbMax.y, P.y);
+		node.bbMax.z = std::max(node.bbMax.z, P.z);
 	}
-	else
-	{
-		//sort the remaining points considering dimension dim
-		s_comparisonCloud = m_associatedCloud; //TODO: not compatible with parallelism!!!
-		if (dim == 0)
-			sort(m_indexes.begin() + first, m_indexes.begin() + (last + 1), ComparisonX);
-		else if (dim == 1)
-			sort(m_indexes.begin() + first, m_indexes.begin() + (last + 1), ComparisonY);
-		else if (dim == 2)
-			sort(m_indexes.begin() + first, m_indexes.begin() + (last + 1), ComparisonZ);
-		else
-			assert(false);
-		//find the median point in the sorted tab
-		unsigned split = (first + last) / 2;
-		const CCVector3* P = m_associatedCloud->getPoint(m_indexes[split]);
-		cell->cuttingCoordinate = P->u[dim];
-		//recursively build the other two sub trees
-		//trap the memory issues. At this point, none of the cell sons can be set to 0. Otherwise there has been memory allocation failure.
-		cell->leSon = cell->gSon = nullptr;
-		cell->leSon = buildSubTree(first, split, cell, nbBuildCell, progressCb);
-		if (cell->leSon == nullptr)
-		{
-			deleteSubTree(cell);
-			//the tree beyond the current cell will be deleted when noticing that this cell is set to 0
-			return nullptr;
-		}
-		cell->gSon = buildSubTree(split + 1, last, cell, nbBuildCell, progressCb);
-		if (cell->gSon == nullptr)
-		{
-			deleteSubTree(cell);
-			//the tree beyond the current cell will be deleted when noticing that this cell is set to 0
-			return nullptr;
-		}
 
+	//if there are only a few points, build a leaf
+	if (task.pointCount <= MAX_POINTS_PER_LEAF)
+	{
+		return;
 	}
-	//Compute inside bounding box (have to be done once sons have been built)
-	updateInsideBoundingBox(cell);
 
-	return cell;
+	//we cut along the largest dimension
+	CCVector3 diag = node.bbMax - node.bbMin;
+	unsigned dim = (diag.x >= diag.y ? (diag.x >= diag.z ? 0 : 2) : (diag.y >= diag.z ? 1 : 2));
+
+	//find the median point (no need to sort all the points)
+	unsigned leftCount = (task.pointCount + 1) / 2;
+	std::nth_element(	points,
+						points + (leftCount - 1),
+						points + task.pointCount,
+						[dim](const KdPoint& a, const KdPoint& b) { return a.P.u[dim] < b.P.u[dim]; });
+	node.cuttingDim = dim;
+	node.cuttingCoordinate = points[leftCount - 1].P.u[dim];
+
+	//the left child is the next node, and the right one comes after the whole left sub-tree
+	BuildTask leftTask;
+	leftTask.nodeIndex = task.nodeIndex + 1;
+	leftTask.firstPoint = task.firstPoint;
+	leftTask.pointCount = leftCount;
+
+	BuildTask rightTask;
+	rightTask.nodeIndex = leftTask.nodeIndex + ComputeNodeCount(leftCount);
+	rightTask.firstPoint = task.firstPoint + leftCount;
+	rightTask.pointCount = task.pointCount - leftCount;
+
+	node.rightChild = rightTask.nodeIndex;
+
+	unsigned childSplitLevels = (splitLevels != 0 ? splitLevels - 1 : 0);
+	buildSubTree(leftTask, childSplitLevels, deferredTasks);
+	buildSubTree(rightTask, childSplitLevels, deferredTasks);
 }
 
-
 bool KDTree::findNearestNeighbour(	const PointCoordinateType* queryPoint,
 									unsigned& nearestPointIndex,
-									ScalarType maxDist)
+									ScalarType maxDist) const
 {
-	if (m_root == nullptr)
+	if (m_nodes.empty())
 		return false;
 
-	maxDist *= maxDist;
-
-	//Go down the tree to find which cell contains the query point (at most log2(N) tests where N is the total number of points in the cloud)
-	KdCell* cellPtr = m_root;
-	while (cellPtr->leSon != nullptr || cellPtr->gSon != nullptr)
-	{
-		if (queryPoint[cellPtr->cuttingDim] <= cellPtr->cuttingCoordinate)
-			cellPtr = cellPtr->leSon;
-		else
-			cellPtr = cellPtr->gSon;
-	}
-
-	//Once we've found the cell containing the query point, the nearest neighbour has great chances to lie in this cell
+	ScalarType maxSqrDist = maxDist * maxDist;
 	bool found = false;
-	for (unsigned i = 0; i < cellPtr->nbPoints; i++)
-	{
-		const CCVector3 *p = m_associatedCloud->getPoint(m_indexes[cellPtr->startingPointIndex + i]);
-		PointCoordinateType sqrdist = CCVector3::vdistance2(p->u, queryPoint);
-		if (sqrdist < maxDist)
-		{
-			maxDist = static_cast<ScalarType>(sqrdist);
-			nearestPointIndex = m_indexes[cellPtr->startingPointIndex + i];
-			found = true;
-		}
-	}
 
-	//Go up in the tree to check that neighbours cells do not contain a point closer than the one we found
-	while (cellPtr != nullptr)
+	//depth-first traversal (starting with the child on the same side as the query point, as it has great chances to contain the nearest neighbour)
+	unsigned stack[KD_TREE_MAX_DEPTH];
+	unsigned stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize != 0)
 	{
-		KdCell* prevPtr = cellPtr;
-		cellPtr = cellPtr->father;
-		if (cellPtr != nullptr)
+		unsigned nodeIndex = stack[--stackSize];
+		const KdNode& node = m_nodes[nodeIndex];
+		if (PointToNodeSquareDistance(queryPoint, node) >= maxSqrDist)
+			continue;
+
+		if (node.isLeaf())
 		{
-			ScalarType sqrdist = insidePointToCellDistance(queryPoint, cellPtr);
-			if (sqrdist >= 0 && sqrdist*sqrdist < maxDist)
+			const KdPoint* points = m_points.data() + node.firstPoint;
+			for (unsigned i = 0; i < node.pointCount; ++i)
 			{
-				KdCell* brotherPtr = (cellPtr->leSon == prevPtr ? cellPtr->gSon : cellPtr->leSon);
-				int a = checkClosestPointInSubTree(queryPoint, maxDist, brotherPtr);
-				if (a >= 0)
+				PointCoordinateType sqrDist = CCVector3::vdistance2(points[i].P.u, queryPoint);
+				if (sqrDist < maxSqrDist)
 				{
-					nearestPointIndex = a;
+					maxSqrDist = static_cast<ScalarType>(sqrDist);
+					nearestPointIndex = points[i].index;
 					found = true;
 				}
 			}
+		}
+		else
+		{
+			assert(stackSize + 2 <= KD_TREE_MAX_DEPTH);
+			if (queryPoint[node.cuttingDim] <= node.cuttingCoordinate)
+			{
+				stack[stackSize++] = node.rightChild;
+				stack[stackSize++] = nodeIndex + 1;
+			}
 			else
 			{
-				cellPtr = nullptr;
+				stack[stackSize++] = nodeIndex + 1;
+				stack[stackSize++] = node.rightChild;
 			}
 		}
 	}
@@ -256,49 +274,46 @@ bool KDTree::findNearestNeighbour(	const PointCoordinateType* queryPoint,
 }
 
 bool KDTree::findNearestNeighbourWithMaxDist(	const PointCoordinateType* queryPoint,
-												ScalarType maxDist)
+												ScalarType maxDist) const
 {
-	if (m_root == nullptr)
+	if (m_nodes.empty())
 		return false;
 
-	maxDist *= maxDist;
-
-	//Go down the tree to find which cell contains the query point (at most log2(N) tests where N is the total number of points in the cloud)
-	KdCell* cellPtr = m_root;
-	while (cellPtr->leSon != nullptr || cellPtr->gSon != nullptr)
-	{
-		if (queryPoint[cellPtr->cuttingDim] <= cellPtr->cuttingCoordinate)
-			cellPtr = cellPtr->leSon;
-		else
-			cellPtr = cellPtr->gSon;
-	}
+	ScalarType maxSqrDist = maxDist * maxDist;
 
-	//Once we've found the cell containing the query point, the nearest neighbour has great chances to lie in this cell
-	for (unsigned i = 0; i < cellPtr->nbPoints; i++)
+	//depth-first traversal (starting with the child on the same side as the query point)
+	unsigned stack[KD_TREE_MAX_DEPTH];
+	unsigned stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize != 0)
 	{
-		const CCVector3* p = m_associatedCloud->getPoint(m_indexes[cellPtr->startingPointIndex + i]);
-		PointCoordinateType sqrdist = CCVector3::vdistance2(p->u, queryPoint);
-		if (sqrdist < static_cast<PointCoordinateType>(maxDist))
-			return true;
-	}
+		unsigned nodeIndex = stack[--stackSize];
+		const KdNode& node = m_nodes[nodeIndex];
+		if (PointToNodeSquareDistance(queryPoint, node) >= maxSqrDist)
+			continue;
 
-	//Go up in the tree to check that neighbours cells do not contain a point
-	while (cellPtr != nullptr)
-	{
-		KdCell* prevPtr = cellPtr;
-		cellPtr = cellPtr->father;
-		if (cellPtr != nullptr)
+		if (node.isLeaf())
 		{
-			ScalarType sqrdist = insidePointToCellDistance(queryPoint, cellPtr);
-			if (sqrdist >= 0 && sqrdist*sqrdist < maxDist)
+			const KdPoint* points = m_points.data() + node.firstPoint;
+			for (unsigned i = 0; i < node.pointCount; ++i)
 			{
-				KdCell* brotherPtr = (cellPtr->leSon == prevPtr ? cellPtr->gSon : cellPtr->leSon);
-				if (checkDistantPointInSubTree(queryPoint, maxDist, brotherPtr))
+				PointCoordinateType sqrDist = CCVector3::vdistance2(points[i].P.u, queryPoint);
+				if (sqrDist < static_cast<PointCoordinateType>(maxSqrDist))
 					return true;
 			}
+		}
+		else
+		{
+			assert(stackSize + 2 <= KD_TREE_MAX_DEPTH);
+			if (queryPoint[node.cuttingDim] <= node.cuttingCoordinate)
+			{
+				stack[stackSize++] = node.rightChild;
+				stack[stackSize++] = nodeIndex + 1;
+			}
 			else
 			{
-				cellPtr = nullptr;
+				stack[stackSize++] = nodeIndex + 1;
+				stack[stackSize++] = node.rightChild;
 			}
 		}
 	}
@@ -309,252 +324,288 @@ bool KDTree::findNearestNeighbourWithMaxDist(	const PointCoordinateType* queryPo
 unsigned KDTree::radiusSearch(	const PointCoordinateType* queryPoint,
 								ScalarType distance,
 								ScalarType tolerance,
-								std::vector<unsigned>& pointndexes)
+								std::vector<unsigned>& pointndexes) const
 {
-	if (m_root == nullptr)
+	if (m_nodes.empty())
 	{
-		return 0;
+		return static_cast<unsigned>(pointndexes.size());
 	}
 
-	distanceScanTree(queryPoint, distance, tolerance, m_root, pointndexes);
+	const ScalarType minDist = distance - tolerance;
+	const ScalarType maxDist = distance + tolerance;
 
-	return static_cast<unsigned>(pointndexes.size());
-}
+	//depth-first traversal (the points are output in the leaves order)
+	unsigned stack[KD_TREE_MAX_DEPTH];
+	unsigned stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize != 0)
+	{
+		unsigned nodeIndex = stack[--stackSize];
+		const KdNode& node = m_nodes[nodeIndex];
 
+		ScalarType nodeMinDist = 0;
+		ScalarType nodeMaxDist = 0;
+		PointToNodeDistances(queryPoint, node, nodeMinDist, nodeMaxDist);
+		if (nodeMinDist > maxDist || nodeMaxDist < minDist)
+			continue;
 
-void KDTree::updateInsideBoundingBox(KdCell* cell)
-{
-	if (cell->leSon != nullptr && cell->gSon != nullptr)
-	{
-		cell->inbbmax.x = std::max(cell->leSon->inbbmax.x, cell->gSon->inbbmax.x);
-		cell->inbbmax.y = std::max(cell->leSon->inbbmax.y, cell->gSon->inbbmax.y);
-		cell->inbbmax.z = std::max(cell->leSon->inbbmax.z, cell->gSon->inbbmax.z);
-		cell->inbbmin.x = std::min(cell->leSon->inbbmin.x, cell->gSon->inbbmin.x);
-		cell->inbbmin.y = std::min(cell->leSon->inbbmin.y, cell->gSon->inbbmin.y);
-		cell->inbbmin.z = std::min(cell->leSon->inbbmin.z, cell->gSon->inbbmin.z);
-	}
-	else
-	{
-		const CCVector3* P = m_associatedCloud->getPoint(m_indexes[cell->startingPointIndex]);
-		cell->inbbmin = cell->inbbmax = *P;
-		for (unsigned i = 1; i < cell->nbPoints; i++)
+		if (node.isLeaf())
 		{
-			P = m_associatedCloud->getPoint(m_indexes[i + cell->startingPointIndex]);
-			cell->inbbmax.x = std::max(cell->inbbmax.x, P->x);
-			cell->inbbmax.y = std::max(cell->inbbmax.y, P->y);
-			cell->inbbmax.z = std::max(cell->inbbmax.z, P->z);
-			cell->inbbmin.x = std::min(cell->inbbmin.x, P->x);
-			cell->inbbmin.y = std::min(cell->inbbmin.y, P->y);
-			cell->inbbmin.z = std::min(cell->inbbmin.z, P->z);
+			const KdPoint* points = m_points.data() + node.firstPoint;
+			for (unsigned i = 0; i < node.pointCount; ++i)
+			{
+				PointCoordinateType dist = CCVector3::vdistance(queryPoint, points[i].P.u);
+				if (minDist <= dist && dist <= maxDist)
+					pointndexes.push_back(points[i].index);
+			}
+		}
+		else
+		{
+			assert(stackSize + 2 <= KD_TREE_MAX_DEPTH);
+			stack[stackSize++] = node.rightChild;
+			stack[stackSize++] = nodeIndex + 1;
 		}
 	}
-}
 
+	return static_cast<unsigned>(pointndexes.size());
+}
 
-void KDTree::updateOutsideBoundingBox(KdCell *cell)
+unsigned KDTree::findKNearestNeighbours(	const PointCoordinateType* queryPoint,
+											unsigned k,
+											unsigned* neighbourIndexes,
+											ScalarType* squareDistances,
+											ScalarType maxDist/*=-1*/) const
 {
-	if (cell->father == nullptr)
-	{
-		cell->boundsMask = 0;
-	}
-	else
+	if (m_nodes.empty() || k == 0)
+		return 0;
+
+	assert(neighbourIndexes && squareDistances);
+
+	//the output arrays are used as a bounded priority queue (sorted by increasing distance)
+	const ScalarType maxSqrDist = (maxDist < 0 ? std::numeric_limits<ScalarType>::max() : maxDist * maxDist);
+	ScalarType currentMaxSqrDist = maxSqrDist;
+	unsigned neighbourCount = 0;
+
+	//depth-first traversal (starting with the child on the same side as the query point)
+	unsigned stack[KD_TREE_MAX_DEPTH];
+	unsigned stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize != 0)
 	{
-		unsigned char bound = 1;
-		cell->boundsMask = cell->father->boundsMask;
-		cell->outbbmax = cell->father->outbbmax;
-		cell->outbbmin = cell->father->outbbmin;
-		const CCVector3* P = m_associatedCloud->getPoint(m_indexes[cell->startingPointIndex]);
-		//Check if this cell is its father leSon (if...) or gSon (else...)
-		if (P->u[cell->father->cuttingDim] <= cell->father->cuttingCoordinate)
+		unsigned nodeIndex = stack[--stackSize];
+		const KdNode& node = m_nodes[nodeIndex];
+		if (PointToNodeSquareDistance(queryPoint, node) >= currentMaxSqrDist)
+			continue;
+
+		if (node.isLeaf())
 		{
-			//Bounding box max point is linked to the bits [3..5] in the bounds mask
-			bound = bound << (3 + cell->father->cuttingDim);
-			cell->boundsMask = cell->boundsMask | bound;
-			cell->outbbmax.u[cell->father->cuttingDim] = cell->father->cuttingCoordinate;
+			const KdPoint* points = m_points.data() + node.firstPoint;
+			for (unsigned i = 0; i < node.pointCount; ++i)
+			{
+				ScalarType sqrDist = static_cast<ScalarType>(CCVector3::vdistance2(points[i].P.u, queryPoint));
+				if (sqrDist < currentMaxSqrDist)
+				{
+					//insert the new neighbour (the farthest one is dropped if the queue is full)
+					unsigned pos = (neighbourCount < k ? neighbourCount++ : k - 1);
+					while (pos != 0 && squareDistances[pos - 1] > sqrDist)
+					{
+						squareDistances[pos] = squareDistances[pos - 1];
+						neighbourIndexes[pos] = neighbourIndexes[pos - 1];
+						--pos;
+					}
+					squareDistances[pos] = sqrDist;
+					neighbourIndexes[pos] = points[i].index;
+
+					if (neighbourCount == k)
+					{
+						currentMaxSqrDist = squareDistances[k - 1];
+					}
+				}
+			}
 		}
 		else
 		{
-			//Bounding box min point is linked to the bits[0..2] in the bounds mask
-			bound = bound << (cell->father->cuttingDim);
-			cell->boundsMask = cell->boundsMask | bound;
-			cell->outbbmin.u[cell->father->cuttingDim] = cell->father->cuttingCoordinate;
+			assert(stackSize + 2 <= KD_TREE_MAX_DEPTH);
+			if (queryPoint[node.cuttingDim] <= node.cuttingCoordinate)
+			{
+				stack[stackSize++] = node.rightChild;
+				stack[stackSize++] = nodeIndex + 1;
+			}
+			else
+			{
+				stack[stackSize++] = nodeIndex + 1;
+				stack[stackSize++] = node.rightChild;
+			}
 		}
 	}
-}
 
-ScalarType KDTree::pointToCellSquareDistance(const PointCoordinateType* queryPoint, KdCell* cell)
-{
-	PointCoordinateType dx;
-	PointCoordinateType dy;
-	PointCoordinateType dz;
-
-	//Each d(x)(y)(z) represents the distance to the nearest bounding box plane (if the point is outside)
-	if (cell->inbbmin.x <= queryPoint[0] && queryPoint[0] <= cell->inbbmax.x)
-		dx = 0;
-	else
-		dx = std::min(std::abs(queryPoint[0] - cell->inbbmin.x), std::abs(queryPoint[0] - cell->inbbmax.x));
-
-	if (cell->inbbmin.y <= queryPoint[1] && queryPoint[1] <= cell->inbbmax.y)
-		dy = 0;
-	else
-		dy = std::min(std::abs(queryPoint[1] - cell->inbbmin.y), std::abs(queryPoint[1] - cell->inbbmax.y));
-
-	if (cell->inbbmin.z <= queryPoint[2] && queryPoint[2] <= cell->inbbmax.z)
-		dz = 0;
-	else
-		dz = std::min(std::abs(queryPoint[2] - cell->inbbmin.z), std::abs(queryPoint[2] - cell->inbbmax.z));
-
-	return static_cast<ScalarType>(dx*dx + dy * dy + dz * dz);
+	return neighbourCount;
 }
 
-void KDTree::pointToCellDistances(	const PointCoordinateType* queryPoint,
-									KdCell* cell,
-									ScalarType& min,
-									ScalarType& max)
+unsigned KDTree::findNearestNeighbours(	const CCVector3* queryPoints,
+										unsigned count,
+										ScalarType maxDist,
+										int* nearestPointIndexes,
+										ScalarType* squareDistances/*=nullptr*/,
+										bool multiThread/*=true*/,
+										int maxThreadCount/*=0*/) const
 {
-	PointCoordinateType dx;
-	PointCoordinateType dy;
-	PointCoordinateType dz;
-
-	min = sqrt(pointToCellSquareDistance(queryPoint, cell));
-	dx = std::max(std::abs(queryPoint[0] - cell->inbbmin.x), std::abs(queryPoint[0] - cell->inbbmax.x));
-	dy = std::max(std::abs(queryPoint[1] - cell->inbbmin.y), std::abs(queryPoint[1] - cell->inbbmax.y));
-	dz = std::max(std::abs(queryPoint[2] - cell->inbbmin.z), std::abs(queryPoint[2] - cell->inbbmax.z));
-	max = static_cast<ScalarType>(sqrt(dx*dx + dy * dy + dz * dz));
-}
+	if (count == 0)
+		return 0;
 
-ScalarType KDTree::insidePointToCellDistance(const PointCoordinateType* queryPoint, KdCell* cell)
-{
-	PointCoordinateType dx = -1;
-	PointCoordinateType dy = -1;
-	PointCoordinateType dz = -1;
-
-	if ((cell->boundsMask & 1) && (cell->boundsMask & 8))
-		dx = std::min(std::abs(queryPoint[0] - cell->outbbmin.x), std::abs(queryPoint[0] - cell->outbbmax.x));
-	else if (cell->boundsMask & 1)
-		dx = std::abs(queryPoint[0] - cell->outbbmin.x);
-	else if (cell->boundsMask & 8)
-		dx = std::abs(queryPoint[0] - cell->outbbmax.x);
-
-	if ((cell->boundsMask & 2) && (cell->boundsMask & 16))
-		dy = std::min(std::abs(queryPoint[1] - cell->outbbmin.y), std::abs(queryPoint[1] - cell->outbbmax.y));
-	else if (cell->boundsMask & 2)
-		dy = std::abs(queryPoint[1] - cell->outbbmin.y);
-	else if (cell->boundsMask & 16)
-		dy = std::abs(queryPoint[1] - cell->outbbmax.y);
-
-	if ((cell->boundsMask & 4) && (cell->boundsMask & 32))
-		dz = std::min(std::abs(queryPoint[2] - cell->outbbmin.z), std::abs(queryPoint[2] - cell->outbbmax.z));
-	else if (cell->boundsMask & 4)
-		dz = std::abs(queryPoint[2] - cell->outbbmin.z);
-	else if (cell->boundsMask & 32)
-		dz = std::abs(queryPoint[2] - cell->outbbmax.z);
-
-	if (dx < 0 && dy < 0 && dz < 0)
-		return -1;
-
-	PointCoordinateType max = std::max(dx, std::max(dy, dz));
-	if (dx < 0)
-		dx = max;
-	if (dy < 0)
-		dy = max;
-	if (dz < 0)
-		dz = max;
-
-	return static_cast<ScalarType>( std::min(dx, std::min(dy, dz)) );
-}
+	assert(queryPoints && nearestPointIndexes);
 
-int KDTree::checkClosestPointInSubTree(	const PointCoordinateType* queryPoint,
-										ScalarType& maxSqrDist,
-										KdCell* cell)
-{
-	if (pointToCellSquareDistance(queryPoint, cell) >= maxSqrDist)
-		return -1;
+	std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(count, 256, maxThreadCount) : 1);
+	std::vector<unsigned> chunkFoundCounts(chunkCount, 0);
 
-	if (cell->leSon == nullptr && cell->gSon == nullptr)
+	ParallelForHelper::ForEachChunk(count, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
 	{
-		int a = -1;
-		for (unsigned i = 0; i < cell->nbPoints; i++)
+		unsigned foundCount = 0;
+		for (std::size_t i = begin; i < end; ++i)
 		{
-			const CCVector3* p = m_associatedCloud->getPoint(m_indexes[cell->startingPointIndex + i]);
-			PointCoordinateType dist = CCVector3::vdistance2(p->u, queryPoint);
-			if (dist < maxSqrDist)
+			unsigned nearestPointIndex = 0;
+			ScalarType sqrDist = 0;
+			if (findKNearestNeighbours(queryPoints[i].u, 1, &nearestPointIndex, &sqrDist, maxDist))
+			{
+				nearestPointIndexes[i] = static_cast<int>(nearestPointIndex);
+				++foundCount;
+			}
+			else
+			{
+				nearestPointIndexes[i] = -1;
+				sqrDist = -1;
+			}
+			if (squareDistances)
 			{
-				a = m_indexes[cell->startingPointIndex + i];
-				maxSqrDist = static_cast<ScalarType>(dist);
+				squareDistances[i] = sqrDist;
 			}
 		}
+		chunkFoundCounts[chunkIndex] = foundCount;
+	}, multiThread, maxThreadCount);
 
-		return a;
+	unsigned foundCount = 0;
+	for (unsigned c : chunkFoundCounts)
+	{
+		foundCount += c;
 	}
-
-	int b = checkClosestPointInSubTree(queryPoint, maxSqrDist, cell->gSon);
-	if (b >= 0)
-		return b;
-
-	return checkClosestPointInSubTree(queryPoint, maxSqrDist, cell->leSon);
+	return foundCount;
 }
 
-bool KDTree::checkDistantPointInSubTree(const PointCoordinateType* queryPoint, ScalarType& maxSqrDist, KdCell* cell)
+unsigned KDTree::findNearestNeighboursWithMaxDist(	const CCVector3* queryPoints,
+													unsigned count,
+													ScalarType maxDist,
+													unsigned char* found/*=nullptr*/,
+													bool multiThread/*=true*/,
+													int maxThreadCount/*=0*/) const
 {
-	if (pointToCellSquareDistance(queryPoint, cell) >= maxSqrDist)
-		return false;
+	if (count == 0)
+		return 0;
+
+	assert(queryPoints);
+
+	std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(count, 256, maxThreadCount) : 1);
+	std::vector<unsigned> chunkFoundCounts(chunkCount, 0);
 
-	if (cell->leSon == nullptr && cell->gSon == nullptr)
+	ParallelForHelper::ForEachChunk(count, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
 	{
-		for (unsigned i = 0; i < cell->nbPoints; i++)
+		unsigned foundCount = 0;
+		for (std::size_t i = begin; i < end; ++i)
 		{
-			const CCVector3* p = m_associatedCloud->getPoint(m_indexes[cell->startingPointIndex + i]);
-			PointCoordinateType dist = CCVector3::vdistance2(p->u, queryPoint);
-			if (dist < maxSqrDist)
-				return true;
+			bool hasNeighbour = findNearestNeighbourWithMaxDist(queryPoints[i].u, maxDist);
+			if (hasNeighbour)
+			{
+				++foundCount;
+			}
+			if (found)
+			{
+				found[i] = (hasNeighbour ? 1 : 0);
+			}
 		}
-		return false;
-	}
+		chunkFoundCounts[chunkIndex] = foundCount;
+	}, multiThread, maxThreadCount);
 
-	if (checkDistantPointInSubTree(queryPoint, maxSqrDist, cell->leSon))
-		return true;
-	if (checkDistantPointInSubTree(queryPoint, maxSqrDist, cell->gSon))
-		return true;
-
-	return false;
+	unsigned foundCount = 0;
+	for (unsigned c : chunkFoundCounts)
+	{
+		foundCount += c;
+	}
+	return foundCount;
 }
 
-void KDTree::distanceScanTree(	const PointCoordinateType* queryPoint,
-								ScalarType distance,
-								ScalarType tolerance,
-								KdCell* cell,
-								std::vector<unsigned>& pointIndexes)
+bool KDTree::findKNearestNeighbours(	const CCVector3* queryPoints,
+										unsigned count,
+										unsigned k,
+										unsigned* neighbourIndexes,
+										ScalarType* squareDistances/*=nullptr*/,
+										unsigned* neighbourCounts/*=nullptr*/,
+										ScalarType maxDist/*=-1*/,
+										bool multiThread/*=true*/,
+										int maxThreadCount/*=0*/) const
 {
-	ScalarType min;
-	ScalarType max;
+	if (count == 0 || k == 0)
+		return true;
 
-	pointToCellDistances(queryPoint, cell, min, max);
+	assert(queryPoints && neighbourIndexes);
 
-	if ((min <= distance + tolerance) && (max >= distance - tolerance))
+	//if the caller doesn't want the distances, each chunk needs its own (small) buffer
+	std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(count, 256, maxThreadCount) : 1);
+	std::vector<ScalarType> chunkDistances;
+	if (!squareDistances)
 	{
-		if ((cell->leSon != nullptr) && (cell->gSon != nullptr))
+		try
 		{
-			//This case shall always happen (the other case is for leaves that contain more than one point - bucket KDtree)
-			if (cell->nbPoints == 1)
-			{
-				pointIndexes.push_back(m_indexes[cell->startingPointIndex]);
-			}
-			else
-			{
-				for (unsigned i = 0; i < cell->nbPoints; i++)
-				{
-					const CCVector3 *p = m_associatedCloud->getPoint(m_indexes[i + cell->startingPointIndex]);
-					PointCoordinateType dist = CCVector3::vdistance(queryPoint, p->u);
-					if (distance - tolerance <= dist && dist <= distance + tolerance)
-						pointIndexes.push_back(m_indexes[cell->startingPointIndex + i]);
-				}
-			}
+			chunkDistances.resize(chunkCount * k);
 		}
-		else
+		catch (const std::bad_alloc&)
 		{
-			distanceScanTree(queryPoint, distance, tolerance, cell->leSon, pointIndexes);
-			distanceScanTree(queryPoint, distance, tolerance, cell->gSon, pointIndexes);
+			//not enough memory
+			return false;
 		}
 	}
+
+	ParallelForHelper::ForEachChunk(count, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			unsigned* indexes = neighbourIndexes + i * k;
+			ScalarType* distances = (squareDistances ? squareDistances + i * k : chunkDistances.data() + chunkIndex * k);
+			unsigned neighbourCount = findKNearestNeighbours(queryPoints[i].u, k, indexes, distances, maxDist);
+			if (neighbourCounts)
+			{
+				neighbourCounts[i] = neighbourCount;
+			}
+		}
+	}, multiThread, maxThreadCount);
+
+	return true;
+}
+
+ScalarType KDTree::PointToNodeSquareDistance(const PointCoordinateType* queryPoint, const KdNode& node)
+{
+	//each d represents the distance to the nearest bounding box plane (if the point is outside)
+	PointCoordinateType sqrDist = 0;
+	for (unsigned dim = 0; dim < 3; ++dim)
+	{
+		PointCoordinateType d = 0;
+		if (queryPoint[dim] < node.bbMin.u[dim])
+			d = node.bbMin.u[dim] - queryPoint[dim];
+		else if (queryPoint[dim] > node.bbMax.u[dim])
+			d = queryPoint[dim] - node.bbMax.u[dim];
+		sqrDist += d * d;
+	}
+
+	return static_cast<ScalarType>(sqrDist);
+}
+
+void KDTree::PointToNodeDistances(	const PointCoordinateType* queryPoint,
+									const KdNode& node,
+									ScalarType& min,
+									ScalarType& max)
+{
+	min = sqrt(PointToNodeSquareDistance(queryPoint, node));
+
+	PointCoordinateType dx = std::max(std::abs(queryPoint[0] - node.bbMin.x), std::abs(queryPoint[0] - node.bbMax.x));
+	PointCoordinateType dy = std::max(std::abs(queryPoint[1] - node.bbMin.y), std::abs(queryPoint[1] - node.bbMax.y));
+	PointCoordinateType dz = std::max(std::abs(queryPoint[2] - node.bbMin.z), std::abs(queryPoint[2] - node.bbMax.z));
+	max = static_cast<ScalarType>(sqrt(dx*dx + dy * dy + dz * dz));
 }
@@ -3,11 +3,15 @@
 
 #include "../include/Kriging.h"
 
+//local
+#include "ParallelForHelper.h"
+
 //System
 #include <algorithm>
 #include <array>
 #include <assert.h>
-#include <map>
+#include <atomic>
+#include <cstdint>
 #include <random>
 #include <numeric>
 
@@ -116,143 +120,178 @@ protected:
 	Kriging::Matrix m_matrix;
 };
 
-//! Lower/upper decomposition of matrix into a lower triangular matrix and a upper triangular matrix.
-class LUDecomposition
+//! Flat (row-major) matrix solvers working in-place on pre-allocated buffers
+namespace FlatSolver
 {
-public:
-
-	//! Constructor
-	/** \warning Input matrix is decomposed in-place
+	//! In-place Cholesky decomposition of a symmetric positive-definite matrix
+	/** Only the lower triangular part is updated (A = L.L^T).
+		\return false if the matrix is not positive definite
 	**/
-	LUDecomposition(Kriging::Matrix& matrix)
-		: m_matrix(matrix)
+	static bool CholeskyDecompose(double* A, size_t n)
 	{
-		assert(matrix.size() > 0 && matrix.size() == matrix[0].size());
+		for (size_t j = 0; j < n; ++j)
+		{
+			double* Aj = A + j * n;
+			double sum = Aj[j];
+			for (size_t k = 0; k < j; ++k)
+			{
+				sum -= Aj[k] * Aj[k];
+			}
+			if (sum <= 0.0)
+			{
+				// Not positive definite matrix
+				return false;
+			}
+			double Ljj = std::sqrt(sum);
+			Aj[j] = Ljj;
+
+			for (size_t i = j + 1; i < n; ++i)
+			{
+				double* Ai = A + i * n;
+				double s = Ai[j];
+				for (size_t k = 0; k < j; ++k)
+				{
+					s -= Ai[k] * Aj[k];
+				}
+				Ai[j] = s / Ljj;
+			}
+		}
+
+		return true;
 	}
 
-	//! Decomposition into triangular matrices
-	bool decompose()
+	//! Solves L.L^T.x = b in-place (b is replaced by x)
+	static void CholeskySolve(const double* L, size_t n, double* b)
 	{
-		// Initialize the permutation vector
-		size_t n = m_matrix.size();
-
-		m_rowPermutation.reserve(n);
+		// forward substitution (L.y = b)
 		for (size_t i = 0; i < n; ++i)
 		{
-			m_rowPermutation.push_back(static_cast<int>(i));
+			const double* Li = L + i * n;
+			double sum = b[i];
+			for (size_t k = 0; k < i; ++k)
+			{
+				sum -= Li[k] * b[k];
+			}
+			b[i] = sum / Li[i];
 		}
 
-		double det = 1.0;
+		// back substitution (L^T.x = y)
+		for (size_t i = n; i-- > 0;)
+		{
+			double sum = b[i];
+			for (size_t k = i + 1; k < n; ++k)
+			{
+				sum -= L[k * n + i] * b[k];
+			}
+			b[i] = sum / L[i * n + i];
+		}
+	}
+
+	//! In-place LU decomposition with partial pivoting (rows are physically swapped)
+	/** \return false if the matrix is singular
+	**/
+	static bool LUDecompose(double* A, size_t n, size_t* rowPermutation)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			rowPermutation[i] = i;
+		}
 
-		// LU factorization
-		for (size_t p = 1; p <= n - 1; ++p)
+		for (size_t p = 0; p < n; ++p)
 		{
-			// Find pivot element
-			for (size_t i = p + 1; i <= n; ++i)
+			// find the pivot
+			size_t pivotRow = p;
+			double pivotValue = std::abs(A[p * n + p]);
+			for (size_t i = p + 1; i < n; ++i)
 			{
-				if (std::abs(m_matrix[m_rowPermutation[i - 1]][p - 1]) > std::abs(m_matrix[m_rowPermutation[p - 1]][p - 1]))
+				double value = std::abs(A[i * n + p]);
+				if (value > pivotValue)
 				{
-					// Switch the index for the p-1 pivot row if necessary
-					std::swap(m_rowPermutation[p - 1], m_rowPermutation[i - 1]);
-					det = -det;
+					pivotValue = value;
+					pivotRow = i;
 				}
 			}
 
-			if (m_matrix[m_rowPermutation[p - 1]][p - 1] == 0.0)
+			if (pivotValue == 0.0)
 			{
 				// The matrix is singular, at least to precision of algorithm
 				return false;
 			}
 
-			// Multiply the diagonal elements
-			det *= m_matrix[m_rowPermutation[p - 1]][p - 1];
-
-			// Form multiplier
-			for (size_t i = p + 1; i <= n; ++i)
+			if (pivotRow != p)
 			{
-				m_matrix[m_rowPermutation[i - 1]][p - 1] /= m_matrix[m_rowPermutation[p - 1]][p - 1];
+				std::swap_ranges(A + p * n, A + (p + 1) * n, A + pivotRow * n);
+				std::swap(rowPermutation[p], rowPermutation[pivotRow]);
+			}
 
-				// Eliminate [p-1]
-				for (size_t j = p + 1; j <= n; ++j)
+			const double* Ap = A + p * n;
+			for (size_t i = p + 1; i < n; ++i)
+			{
+				double* Ai = A + i * n;
+				double factor = (Ai[p] /= Ap[p]);
+				for (size_t j = p + 1; j < n; ++j)
 				{
-					m_matrix[m_rowPermutation[i - 1]][j - 1] -= m_matrix[m_rowPermutation[i - 1]][p - 1] * m_matrix[m_rowPermutation[p - 1]][j - 1];
+					Ai[j] -= factor * Ap[j];
 				}
 			}
 		}
 
-		det *= m_matrix[m_rowPermutation[n - 1]][n - 1];
-
-		return (det != 0.0);
+		return true;
 	}
 
-	//! Solve Ax = b. A is the input matrix.
-	Kriging::Vector solve(const Kriging::Vector& b)
+	//! Solves A.x = b with the LU decomposition of A (the solution is stored in x)
+	static void LUSolve(const double* LU, size_t n, const size_t* rowPermutation, const double* b, double* x)
 	{
-		// The decomposed matrix is comprised of both the lower and upper diagonal matrices.
-
-		// The rows of this matrix have been permutated during the decomposition process.  The
-		// m_rowPermutation indicates the proper row order.
-
-		// The lower diagonal matrix only includes elements below the diagonal with diagonal 
-		// elements set to 1.
-
-		// The upper diagonal matrix is fully specified.
-
-		// First solve Ly = Pb for y using forward substitution. P is a permutated identity matrix.
-
-		Kriging::Vector y(b.size());
-
-		for (size_t i = 0; i < y.size(); ++i)
+		// forward substitution (L.y = P.b)
+		for (size_t i = 0; i < n; ++i)
 		{
-			size_t currentRow = m_rowPermutation[i];
-
-			double sum = 0.0;
-			for (size_t j = 0; j < i; ++j)
+			const double* LUi = LU + i * n;
+			double sum = b[rowPermutation[i]];
+			for (size_t k = 0; k < i; ++k)
 			{
-				sum += (m_matrix[currentRow][j] * y[j]);
+				sum -= LUi[k] * x[k];
 			}
-
-			y[i] = (b[currentRow] - sum);
+			x[i] = sum;
 		}
 
-		// Now solve Ux = y for x using back substitution.
-		// Note that x can be solved in place using the existing y vector. No need to allocate another vector.
-		for (int i = static_cast<int>(b.size()) - 1; i >= 0; i--)
+		// back substitution (U.x = y)
+		for (size_t i = n; i-- > 0;)
 		{
-			size_t currentRow = m_rowPermutation[i];
-
-			double sum = 0.0;
-			for (int j = static_cast<int>(b.size()) - 1; j > i; j--)
+			const double* LUi = LU + i * n;
+			double sum = x[i];
+			for (size_t k = i + 1; k < n; ++k)
 			{
-				sum += (m_matrix[currentRow][j] * y[j]);
+				sum -= LUi[k] * x[k];
 			}
-
-			y[i] = (y[i] - sum) / m_matrix[currentRow][i];
+			x[i] = sum / LUi[i];
 		}
-
-		return y;
 	}
-
-protected:
-
-	// remove copy constructors/methods
-	LUDecomposition(const LUDecomposition&) = delete;
-	void operator=(const LUDecomposition&) = delete;
-
-	// Decomposed matrix
-	Kriging::Matrix& m_matrix;
-
-	// Permutation of rows during pivoting
-	std::vector<int> m_rowPermutation;
-};
+}
 
 Kriging::Kriging(const std::vector<DataPoint>& dataPoints, const RasterParameters& rasterParams)
-	: m_rasterParams(rasterParams)
-	, m_dataPoints(dataPoints)
+	: m_dataPoints(dataPoints)
+	, m_rasterParams(rasterParams)
 {
 }
 
-struct OrdinaryKrigeContext
+//! Kriging context (kd-tree, candidates and scratch buffers of the kriging system)
+/** The kriging system of 'k' candidates with 'p' drift terms is:
+
+	| C   F | | w  |   | c  |
+	| F^T 0 | | mu | = | f0 |
+
+	where C is the covariance matrix of the candidates, F the drift terms of the candidates,
+	c the covariances between the candidates and the query point and f0 its drift terms:
+	- simple kriging: p = 0 (the known mean is subtracted from the values)
+	- ordinary kriging: p = 1 (constant drift)
+	- universal kriging: p = 3 (linear drift) or 6 (quadratic drift)
+
+	As the matrix of the system doesn't depend on the query point, we use its dual form:
+	estimate = lambda^T . [c ; f0] with [C F ; F^T 0] . lambda = [v ; 0] (v being the values).
+	Once the system is factorized for a given set of candidates, each cell then only
+	costs k covariograms and a dot product.
+**/
+struct KrigeContext
 {
 	struct NFWrapper
 	{
@@ -296,29 +335,81 @@ struct OrdinaryKrigeContext
 		nanoflann::L2_Simple_Adaptor<double, NFWrapper>,
 		NFWrapper, /*dim=*/2>;
 
-	OrdinaryKrigeContext(const std::vector<DataPoint>& _dataPoints)
+	//! Factorization of the kriging system
+	enum class Factorization
+	{
+		None,		//!< not computed (or outdated)
+		Cholesky,	//!< Cholesky decomposition of the covariance block
+		LU,			//!< LU decomposition of the full (bordered) system
+		Singular	//!< the system is singular
+	};
+
+	//! Maximum number of drift terms
+	static const unsigned MaxDriftTermCount = 6;
+
+	//! Returns the number of drift terms of a given drift model
+	static unsigned DriftTermCount(Kriging::Drift drift)
+	{
+		switch (drift)
+		{
+		case Kriging::ConstantDrift:
+			return 1;
+		case Kriging::LinearDrift:
+			return 3;
+		case Kriging::QuadraticDrift:
+			return 6;
+		default:
+			assert(false);
+			break;
+		}
+		return 1;
+	}
+
+	//! Constructor
+	/** \param _dataPoints data points
+		\param _driftTermCount number of drift terms (0 = simple kriging)
+		\param _mean known mean (simple kriging only)
+	**/
+	KrigeContext(const std::vector<DataPoint>& _dataPoints, unsigned _driftTermCount, double _mean = 0.0)
 		: nfWrapper(_dataPoints)
 		, kdTree(nullptr)
+		, ownsKdTree(false)
 		, knn(0)
+		, driftTermCount(_driftTermCount)
+		, mean(_mean)
+		, driftCenter(0.0, 0.0)
+		, driftScale(1.0)
+		, reuseFactorization(true)
+		, factorization(Factorization::None)
+		, candidatesHash(0)
 	{
+		assert(driftTermCount <= MaxDriftTermCount);
 	}
 
-	~OrdinaryKrigeContext()
+	~KrigeContext()
 	{
-		delete kdTree;
+		if (ownsKdTree)
+		{
+			delete kdTree;
+		}
 		kdTree = nullptr;
 	}
 
-	bool prepare(int _knn)
+	//! Prepares the context
+	/** \param _knn number of nearest neighbors
+		\param sharedKdTree an already built kd-tree (on the same data points) that
+		can be shared by several contexts (optional). Otherwise a new kd-tree is built.
+	**/
+	bool prepare(int _knn, KdTreeType* sharedKdTree = nullptr)
 	{
-		if (_knn <= 0)
+		if (_knn <= 0 || static_cast<unsigned>(_knn) < driftTermCount)
 		{
 			assert(false);
 			return false;
 		}
 
 		size_t pointCount = nfWrapper.dataPointsRef.size();
-		if (pointCount < static_cast<size_t>(knn))
+		if (pointCount < static_cast<size_t>(_knn))
 		{
 			// not enough data points
 			return false;
@@ -331,6 +422,22 @@ struct OrdinaryKrigeContext
 			dataPointCandidates.resize(knn);
 			kdIndexes.resize(knn);
 			kdDistances.resize(knn);
+
+			// kriging system buffers
+			size_t n = static_cast<size_t>(knn);
+			size_t m = n + driftTermCount;
+			covMatrix.resize(n * n);
+			driftMatrix.resize(n * driftTermCount);
+			driftSolutions.resize(n * driftTermCount);
+			schurMatrix.resize(driftTermCount * driftTermCount);
+			borderedMatrix.resize(m * m);
+			rowPermutation.resize(m);
+			rhsVector.resize(m);
+			dualWeights.resize(m);
+
+			// neighbourhood sharing
+			candidatesSortedIndexes.resize(n);
+			sortedIndexes.resize(n);
 		}
 		catch (const std::bad_alloc&)
 		{
@@ -338,8 +445,26 @@ struct OrdinaryKrigeContext
 			return false;
 		}
 
-		// eventually, instantiate the kd-tree
-		kdTree = new KdTreeType(/*dim=*/2, nfWrapper, { /*max leaf=*/10 });
+		if (sharedKdTree)
+		{
+			// the kd-tree is only read during the queries: it can be safely shared between threads
+			kdTree = sharedKdTree;
+			ownsKdTree = false;
+		}
+		else
+		{
+			// eventually, instantiate the kd-tree
+			try
+			{
+				kdTree = new KdTreeType(/*dim=*/2, nfWrapper, { /*max leaf=*/10 });
+			}
+			catch (const std::bad_alloc&)
+			{
+				// not enough memory
+				return false;
+			}
+			ownsKdTree = true;
+		}
 
 		return true;
 	}
@@ -364,19 +489,35 @@ struct OrdinaryKrigeContext
 			return false;
 		}
 
+		if (reuseFactorization && factorization != Factorization::None && haveSameCandidates())
+		{
+			// we keep the current candidates (and their order, which matches the factorization)
+			return true;
+		}
+
 		return updateCandidates();
 	}
 
 	bool updateCandidates()
 	{
+		// the factorization (if any) is outdated
+		factorization = Factorization::None;
+
 		if (kdIndexes.size() == dataPointCandidates.size())
 		{
-			for (int i = 0; i < kdIndexes.size(); ++i)
+			for (size_t i = 0; i < kdIndexes.size(); ++i)
 			{
 				assert(kdIndexes[i] < nfWrapper.dataPointsRef.size());
 				dataPointCandidates[i] = nfWrapper.dataPointsRef[kdIndexes[i]];
 			}
 
+			if (reuseFactorization)
+			{
+				candidatesHash = HashIndexes(kdIndexes);
+				std::copy(kdIndexes.begin(), kdIndexes.end(), candidatesSortedIndexes.begin());
+				std::sort(candidatesSortedIndexes.begin(), candidatesSortedIndexes.end());
+			}
+
 			return true;
 		}
 
@@ -384,6 +525,57 @@ struct OrdinaryKrigeContext
 		return false;
 	}
 
+	//! Order-insensitive hash of a set of indexes
+	static uint64_t HashIndexes(const std::vector<size_t>& indexes)
+	{
+		uint64_t hash = 0;
+		for (size_t index : indexes)
+		{
+			// splitmix64 finalizer (the sum makes the hash independent of the order)
+			uint64_t h = static_cast<uint64_t>(index) + 0x9E3779B97F4A7C15ULL;
+			h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+			hash += (h ^ (h >> 31));
+		}
+		return hash;
+	}
+
+	//! Returns whether the last kNN query returned the same set of indexes as the current candidates
+	bool haveSameCandidates()
+	{
+		if (HashIndexes(kdIndexes) != candidatesHash)
+		{
+			return false;
+		}
+
+		// same hash: we still need to compare the sets (collisions)
+		std::copy(kdIndexes.begin(), kdIndexes.end(), sortedIndexes.begin());
+		std::sort(sortedIndexes.begin(), sortedIndexes.end());
+		return std::equal(sortedIndexes.begin(), sortedIndexes.end(), candidatesSortedIndexes.begin());
+	}
+
+	//! Returns whether the current factorization can be used with the given parameters
+	bool isFactorizationValid(const Kriging::KrigeParams& params) const
+	{
+		return	factorization != Factorization::None
+			&&	factorizationParams.model == params.model
+			&&	factorizationParams.nugget == params.nugget
+			&&	factorizationParams.sill == params.sill
+			&&	factorizationParams.range == params.range;
+	}
+
+	//! Computes the drift terms (1, x, y, x^2, x.y, y^2) of a given point
+	/** Coordinates are expressed relatively to the center of the candidates (and normalized)
+		to keep the system well conditioned.
+	**/
+	inline void computeDriftTerms(const CCVector2d& P, double* terms) const
+	{
+		double u = (P.x - driftCenter.x) / driftScale;
+		double v = (P.y - driftCenter.y) / driftScale;
+		const double allTerms[MaxDriftTermCount] = { 1.0, u, v, u * u, u * v, v * v };
+		std::copy(allTerms, allTerms + driftTermCount, terms);
+	}
+
 	NFWrapper nfWrapper;
 
 	std::vector<DataPoint> dataPointCandidates;
@@ -391,13 +583,73 @@ struct OrdinaryKrigeContext
 	std::vector<size_t>		kdIndexes;
 	std::vector<double>		kdDistances;
 	KdTreeType*				kdTree;
+	bool					ownsKdTree;
 	int						knn;
 
+	//! Number of drift terms (0 = simple kriging, 1 = ordinary kriging, 3 or 6 = universal kriging)
+	unsigned				driftTermCount;
+	//! Known mean (simple kriging only)
+	double					mean;
+	//! Center of the drift terms coordinates
+	CCVector2d				driftCenter;
+	//! Scale of the drift terms coordinates
+	double					driftScale;
+
+	// Scratch buffers for the kriging system (allocated once by 'prepare', all row-major)
+
+	//! Covariance matrix between the candidates (knn x knn), then its Cholesky factor
+	std::vector<double>		covMatrix;
+	//! Drift terms of the candidates (knn x driftTermCount)
+	std::vector<double>		driftMatrix;
+	//! Solutions of covMatrix.x = drift column (driftTermCount x knn)
+	std::vector<double>		driftSolutions;
+	//! Schur complement of the covariance block (driftTermCount x driftTermCount), then its Cholesky factor
+	std::vector<double>		schurMatrix;
+	//! Full (bordered) system, only used if the Cholesky decomposition fails
+	std::vector<double>		borderedMatrix;
+	//! Row permutation of the LU decomposition
+	std::vector<size_t>		rowPermutation;
+	//! Right-hand side of the full system
+	std::vector<double>		rhsVector;
+	//! Dual kriging weights (knn + driftTermCount)
+	std::vector<double>		dualWeights;
+
+	// Neighbourhood sharing (reuse of the factorization between cells with the same candidates)
+
+	//! Whether the factorization can be reused
+	bool					reuseFactorization;
+	//! Current factorization
+	Factorization			factorization;
+	//! Parameters used for the current factorization
+	Kriging::KrigeParams	factorizationParams;
+	//! Hash of the candidates indexes
+	uint64_t				candidatesHash;
+	//! Sorted candidates indexes
+	std::vector<size_t>		candidatesSortedIndexes;
+	//! Scratch buffer to sort the indexes of a kNN query
+	std::vector<size_t>		sortedIndexes;
+};
+
+//! Ordinary (or universal) kriging context
+struct OrdinaryKrigeContext : KrigeContext
+{
+	OrdinaryKrigeContext(const std::vector<DataPoint>& dataPoints, Kriging::Drift drift)
+		: KrigeContext(dataPoints, DriftTermCount(drift))
+	{}
 };
 
-OrdinaryKrigeContext* Kriging::createOrdinaryKrigeContext(int knn)
+//! Simple kriging context
+struct SimpleKrigeContext : KrigeContext
 {
-	OrdinaryKrigeContext* context = new OrdinaryKrigeContext(m_dataPoints);
+	SimpleKrigeContext(const std::vector<DataPoint>& dataPoints, double mean)
+		: KrigeContext(dataPoints, 0, mean)
+	{}
+};
+
+OrdinaryKrigeContext* Kriging::createOrdinaryKrigeContext(int knn, bool reuseFactorization/*=true*/, Drift drift/*=ConstantDrift*/)
+{
+	OrdinaryKrigeContext* context = new OrdinaryKrigeContext(m_dataPoints, drift);
+	context->reuseFactorization = reuseFactorization;
 	if (!context->prepare(knn))
 	{
 		delete context;
@@ -412,9 +664,67 @@ void Kriging::releaseOrdinaryKrigeContext(OrdinaryKrigeContext*& context)
 	context = nullptr;
 }
 
+SimpleKrigeContext* Kriging::createSimpleKrigeContext(int knn, double mean, bool reuseFactorization/*=true*/)
+{
+	SimpleKrigeContext* context = new SimpleKrigeContext(m_dataPoints, mean);
+	context->reuseFactorization = reuseFactorization;
+	if (!context->prepare(knn))
+	{
+		delete context;
+		context = nullptr;
+	}
+	return context;
+}
+
+void Kriging::releaseSimpleKrigeContext(SimpleKrigeContext*& context)
+{
+	delete context;
+	context = nullptr;
+}
+
 bool Kriging::ordinaryKrige(const KrigeParams& params,
 							unsigned knn,
-							std::vector<DataPoint>& output)
+							std::vector<DataPoint>& output,
+							bool multiThread/*=false*/,
+							int maxThreadCount/*=0*/)
+{
+	return universalKrige(params, ConstantDrift, knn, output, multiThread, maxThreadCount);
+}
+
+bool Kriging::universalKrige(	const KrigeParams& params,
+								Drift drift,
+								unsigned knn,
+								std::vector<DataPoint>& output,
+								bool multiThread/*=false*/,
+								int maxThreadCount/*=0*/)
+{
+	if (m_dataPoints.empty())
+	{
+		// nothing to do
+		assert(false);
+		return false;
+	}
+
+	// the main context holds the kd-tree (shared by all the workers)
+	OrdinaryKrigeContext* context = createOrdinaryKrigeContext(knn, true, drift);
+	if (!context)
+	{
+		return false;
+	}
+
+	bool success = krigeGrid(params, *context, output, multiThread, maxThreadCount);
+
+	releaseOrdinaryKrigeContext(context);
+
+	return success;
+}
+
+bool Kriging::simpleKrige(	const KrigeParams& params,
+							double mean,
+							unsigned knn,
+							std::vector<DataPoint>& output,
+							bool multiThread/*=false*/,
+							int maxThreadCount/*=0*/)
 {
 	if (m_dataPoints.empty())
 	{
@@ -423,50 +733,128 @@ bool Kriging::ordinaryKrige(const KrigeParams& params,
 		return false;
 	}
 
-	OrdinaryKrigeContext* context = createOrdinaryKrigeContext(knn);
+	// the main context holds the kd-tree (shared by all the workers)
+	SimpleKrigeContext* context = createSimpleKrigeContext(knn, mean);
 	if (!context)
 	{
 		return false;
 	}
 
-	bool success = true;
+	bool success = krigeGrid(params, *context, output, multiThread, maxThreadCount);
+
+	releaseSimpleKrigeContext(context);
+
+	return success;
+}
+
+//! Size of the (square) raster tiles processed by each worker
+static const unsigned s_krigeTileSize = 64;
+
+bool Kriging::krigeGrid(const KrigeParams& params,
+						KrigeContext& mainContext,
+						std::vector<DataPoint>& output,
+						bool multiThread,
+						int maxThreadCount)
+{
 	try
+	{
+		// the output grid is allocated once so that each worker can write its cells directly
+		output.resize(static_cast<size_t>(m_rasterParams.width) * m_rasterParams.height);
+	}
+	catch (const std::bad_alloc&)
 	{
 		output.clear();
-		output.reserve(m_rasterParams.width * m_rasterParams.height);
+		return false;
+	}
+
+	unsigned tileCountX = (m_rasterParams.width + s_krigeTileSize - 1) / s_krigeTileSize;
+	unsigned tileCountY = (m_rasterParams.height + s_krigeTileSize - 1) / s_krigeTileSize;
+	size_t tileCount = static_cast<size_t>(tileCountX) * tileCountY;
+
+	std::atomic<bool> success(true);
 
-		for (unsigned i = 0; i < m_rasterParams.width; ++i)
+	CCCoreLib::ParallelForHelper::ForEachRange(tileCount, [&](size_t begin, size_t end)
 		{
-			for (unsigned j = 0; j < m_rasterParams.height; ++j)
+			// each worker has its own context (scratch buffers)
+			KrigeContext workerContext(m_dataPoints, mainContext.driftTermCount, mainContext.mean);
+			workerContext.reuseFactorization = mainContext.reuseFactorization;
+			if (!workerContext.prepare(mainContext.knn, mainContext.kdTree))
 			{
-				CCVector2d point = m_rasterParams.toPoint(i, j);
-
-				double estimatedValue = ordinaryKrigeSingleCell(params, i, j, context);
+				success = false;
+				return;
+			}
 
-				output.push_back(DataPoint{ point.x, point.y, estimatedValue });
+			for (size_t tileIndex = begin; tileIndex < end && success; ++tileIndex)
+			{
+				krigeTile(params, static_cast<unsigned>(tileIndex), &workerContext, output);
 			}
-		}
+		},
+		multiThread, /*minChunkSize=*/1, maxThreadCount);
+
+	if (!success)
+	{
+		output.clear();
+		return false;
 	}
-	catch (const std::bad_alloc&)
+
+	return true;
+}
+
+void Kriging::krigeTile(const KrigeParams& params,
+						unsigned tileIndex,
+						KrigeContext* context,
+						std::vector<DataPoint>& output)
+{
+	assert(context);
+	assert(output.size() == static_cast<size_t>(m_rasterParams.width) * m_rasterParams.height);
+
+	unsigned tileCountY = (m_rasterParams.height + s_krigeTileSize - 1) / s_krigeTileSize;
+	unsigned iStart = (tileIndex / tileCountY) * s_krigeTileSize;
+	unsigned jStart = (tileIndex % tileCountY) * s_krigeTileSize;
+	unsigned iStop = std::min(iStart + s_krigeTileSize, m_rasterParams.width);
+	unsigned jStop = std::min(jStart + s_krigeTileSize, m_rasterParams.height);
+
+	for (unsigned i = iStart; i < iStop; ++i)
 	{
-		success = false;
+		for (unsigned j = jStart; j < jStop; ++j)
+		{
+			CCVector2d point = m_rasterParams.toPoint(i, j);
+
+			double estimatedValue = krigeSingleCell(params, i, j, context);
+
+			output[static_cast<size_t>(i) * m_rasterParams.height + j] = DataPoint{ point.x, point.y, estimatedValue };
+		}
 	}
+}
 
-	releaseOrdinaryKrigeContext(context);
+double Kriging::ordinaryKrigeSingleCell(const KrigeParams& params,
+										unsigned row,
+										unsigned col,
+										OrdinaryKrigeContext* context,
+										bool alreadyHaveCandidates/*=false*/)
+{
+	return krigeSingleCell(params, row, col, context, alreadyHaveCandidates);
+}
 
-	return success;
+double Kriging::simpleKrigeSingleCell(	const KrigeParams& params,
+										unsigned row,
+										unsigned col,
+										SimpleKrigeContext* context,
+										bool alreadyHaveCandidates/*=false*/)
+{
+	return krigeSingleCell(params, row, col, context, alreadyHaveCandidates);
 }
 
-double Kriging::ordinaryKrigeSingleCell(	const KrigeParams& params,
-											unsigned row,
-											unsigned col,
-											OrdinaryKrigeContext* context,
-											bool alreadyHaveCandidates/*=false*/)
+double Kriging::krigeSingleCell(const KrigeParams& params,
+								unsigned row,
+								unsigned col,
+								KrigeContext* context,
+								bool alreadyHaveCandidates/*=false*/)
 {
 	if (!context)
 	{
 		assert(false);
-		return false;
+		return std::numeric_limits<double>::quiet_NaN();
 	}
 
 	assert(static_cast<int>(m_dataPoints.size()) > context->knn);
@@ -483,8 +871,13 @@ double Kriging::ordinaryKrigeSingleCell(	const KrigeParams& params,
 				return std::numeric_limits<double>::quiet_NaN();
 			}
 		}
+		else
+		{
+			// the candidates may have been changed by the caller
+			context->factorization = KrigeContext::Factorization::None;
+		}
 
-		return ordinaryKrigeForPoint(point, params, context->dataPointCandidates);
+		return krigeForPoint(point, params, *context);
 	}
 	catch (const std::bad_alloc&)
 	{
@@ -494,335 +887,682 @@ double Kriging::ordinaryKrigeSingleCell(	const KrigeParams& params,
 	return std::numeric_limits<double>::quiet_NaN();
 }
 
-double Kriging::ordinaryKrigeForPoint(const CCVector2d& point, const KrigeParams& params, const std::vector<DataPoint>& dataPointCandidates)
+bool Kriging::factorizeKrigeSystem(const KrigeParams& params, KrigeContext& context) const
 {
-	// Find distances between all points and calculate covariograms
-	Matrix distanceCovariogramMatrix = calculateCovariogramMatrix(dataPointCandidates, params, true);
+	// As the covariance block C is (in general) positive definite, we first try to solve the
+	// system with the Cholesky decompositions of C and of its Schur complement S = F^T.C^-1.F:
+	//   lambda_mu = S^-1.F^T.C^-1.v
+	//   lambda_w = C^-1.v - C^-1.F.lambda_mu
+	// Otherwise we fall back to the LU decomposition of the full system.
+
+	const std::vector<DataPoint>& dataPointCandidates = context.dataPointCandidates;
+	size_t n = dataPointCandidates.size();
+	size_t p = context.driftTermCount;
+	assert(n != 0 && context.covMatrix.size() >= n * n);
+
+	context.factorizationParams = params;
+
+	// drift terms coordinates
+	context.driftCenter = CCVector2d(0.0, 0.0);
+	context.driftScale = 1.0;
+	if (p > 1)
+	{
+		for (const DataPoint& P : dataPointCandidates)
+		{
+			context.driftCenter += P;
+		}
+		context.driftCenter /= static_cast<double>(n);
+
+		double maxDelta = 0.0;
+		for (const DataPoint& P : dataPointCandidates)
+		{
+			maxDelta = std::max(maxDelta, std::max(std::abs(P.x - context.driftCenter.x), std::abs(P.y - context.driftCenter.y)));
+		}
+		if (maxDelta > 0.0)
+		{
+			context.driftScale = maxDelta;
+		}
+	}
 
-	// decompose the covariogram matrix.  Because of the Lagrange multiplier, this will not be a positive definite matrix and we will
-	// need to use LU decomposition.
-	LUDecomposition luDecomposition(distanceCovariogramMatrix);
-	if (!luDecomposition.decompose())
+	double* F = context.driftMatrix.data();
+	for (size_t i = 0; i < n; ++i)
 	{
-		return std::numeric_limits<double>::quiet_NaN();
+		context.computeDriftTerms(dataPointCandidates[i], F + i * p);
 	}
 
-	// Find distances over given points and calculate covariograms
-	Vector distanceCovariogramVector = calculateCovariogramVector(dataPointCandidates, point, params, true);
+	// simple kriging works on the residuals
+	double valueShift = (p == 0 ? context.mean : 0.0);
 
-	// Solve Ax = b, for x.  A represents the covariogram matrix of all distances and b is the covariogram vector for the current point.
-	// x will be a vector of weights.
-	Vector weights = luDecomposition.solve(distanceCovariogramVector);
-	assert(!weights.empty());
+	// Find distances between all points and calculate covariograms
+	double* C = context.covMatrix.data();
+	double covariogramAtZero = calculateCovariogram(params, 0.0);
+	for (size_t i = 0; i < n; ++i)
+	{
+		C[i * n + i] = covariogramAtZero;
 
-	// Multiply the weights by the residuals to yield estimate for this point.
-	return std::inner_product(weights.begin(), weights.end() - 1, dataPointCandidates.begin(), 0.0, std::plus<double>(), [](double weight, const DataPoint& dataPointCandidates)
+		for (size_t j = i + 1; j < n; ++j)
 		{
-			return weight * dataPointCandidates.value;
+			double distance = (dataPointCandidates[i] - dataPointCandidates[j]).norm();
+
+			double covariogram = calculateCovariogram(params, distance);
+
+			C[i * n + j] = covariogram;
+			C[j * n + i] = covariogram;
 		}
-	);
-}
+	}
 
-Kriging::Vector Kriging::calculateCovariogramVector(const std::vector<DataPoint>& dataPointCandidates, const CCVector2d& point, const KrigeParams& params, bool lagrangeMultiplier) const
-{
-	Vector distanceVector(lagrangeMultiplier ? dataPointCandidates.size() + 1 : dataPointCandidates.size(), lagrangeMultiplier ? 1.0 : 0.0);
+	double* lambda = context.dualWeights.data();
 
-	for (size_t i = 0; i < dataPointCandidates.size(); ++i)
+	if (FlatSolver::CholeskyDecompose(C, n))
 	{
-		double distance = (dataPointCandidates[i] - point).norm();
+		// alpha = C^-1.v
+		for (size_t i = 0; i < n; ++i)
+		{
+			lambda[i] = dataPointCandidates[i].value - valueShift;
+		}
+		FlatSolver::CholeskySolve(C, n, lambda);
 
-		distanceVector[i] = calculateCovariogram(params, distance);
-	}
+		if (p == 0)
+		{
+			context.factorization = KrigeContext::Factorization::Cholesky;
+			return true;
+		}
 
-	return distanceVector;
-}
+		// G = C^-1.F (stored column by column)
+		double* G = context.driftSolutions.data();
+		for (size_t k = 0; k < p; ++k)
+		{
+			double* Gk = G + k * n;
+			for (size_t i = 0; i < n; ++i)
+			{
+				Gk[i] = F[i * p + k];
+			}
+			FlatSolver::CholeskySolve(C, n, Gk);
+		}
 
-Kriging::Matrix Kriging::calculateCovariogramMatrix(const std::vector<DataPoint>& dataPointCandidates, const KrigeParams& params, bool lagrangeMultiplier) const
-{
-	Matrix distanceMatrix(lagrangeMultiplier ? dataPointCandidates.size() + 1 : dataPointCandidates.size(), Vector(lagrangeMultiplier ? dataPointCandidates.size() + 1 : dataPointCandidates.size(), lagrangeMultiplier ? 1.0 : 0.0));
+		// S = F^T.G and F^T.alpha
+		double* S = context.schurMatrix.data();
+		double* lambdaMu = lambda + n;
+		for (size_t k = 0; k < p; ++k)
+		{
+			for (size_t l = 0; l < p; ++l)
+			{
+				double sum = 0.0;
+				for (size_t i = 0; i < n; ++i)
+				{
+					sum += F[i * p + k] * G[l * n + i];
+				}
+				S[k * p + l] = sum;
+			}
+
+			double sum = 0.0;
+			for (size_t i = 0; i < n; ++i)
+			{
+				sum += F[i * p + k] * lambda[i];
+			}
+			lambdaMu[k] = sum;
+		}
 
-	for (size_t i = 0; i < dataPointCandidates.size(); ++i)
+		if (FlatSolver::CholeskyDecompose(S, p))
+		{
+			FlatSolver::CholeskySolve(S, p, lambdaMu);
+
+			for (size_t i = 0; i < n; ++i)
+			{
+				double sum = 0.0;
+				for (size_t k = 0; k < p; ++k)
+				{
+					sum += G[k * n + i] * lambdaMu[k];
+				}
+				lambda[i] -= sum;
+			}
+
+			context.factorization = KrigeContext::Factorization::Cholesky;
+			return true;
+		}
+	}
+
+	// Because of the drift terms (e.g. the Lagrange multiplier of ordinary kriging), the full matrix
+	// is not positive definite and we need to use LU decomposition.
+	size_t m = n + p;
+	double* A = context.borderedMatrix.data();
+	double* b = context.rhsVector.data();
+	for (size_t i = 0; i < n; ++i)
 	{
-		distanceMatrix[i][i] = calculateCovariogram(params, 0.0);
+		A[i * m + i] = covariogramAtZero;
 
-		for (size_t j = i + 1; j < dataPointCandidates.size(); ++j)
+		for (size_t j = i + 1; j < n; ++j)
 		{
 			double distance = (dataPointCandidates[i] - dataPointCandidates[j]).norm();
 
 			double covariogram = calculateCovariogram(params, distance);
 
-			distanceMatrix[i][j] = covariogram;
-			distanceMatrix[j][i] = distanceMatrix[i][j];
+			A[i * m + j] = covariogram;
+			A[j * m + i] = covariogram;
 		}
+
+		for (size_t k = 0; k < p; ++k)
+		{
+			A[i * m + n + k] = F[i * p + k];
+			A[(n + k) * m + i] = F[i * p + k];
+		}
+
+		b[i] = dataPointCandidates[i].value - valueShift;
+	}
+	for (size_t k = 0; k < p; ++k)
+	{
+		std::fill(A + (n + k) * m + n, A + (n + k + 1) * m, 0.0);
+		b[n + k] = 0.0;
 	}
 
-	if (lagrangeMultiplier)
+	size_t* rowPermutation = context.rowPermutation.data();
+	if (!FlatSolver::LUDecompose(A, m, rowPermutation))
 	{
-		distanceMatrix[dataPointCandidates.size()][dataPointCandidates.size()] = 0.0;
+		context.factorization = KrigeContext::Factorization::Singular;
+		return false;
 	}
 
-	return distanceMatrix;
+	FlatSolver::LUSolve(A, m, rowPermutation, b, lambda);
+
+	context.factorization = KrigeContext::Factorization::LU;
+	return true;
 }
 
-std::pair<double, double> Kriging::linearRegression(const Vector& X, const Vector& Y) const
+double Kriging::krigeForPoint(const CCVector2d& point, const KrigeParams& params, KrigeContext& context) const
 {
-	double Xmean = std::accumulate(X.begin(), X.end(), 0.0) / X.size();
-	double Ymean = std::accumulate(Y.begin(), Y.end(), 0.0) / Y.size();
+	// the factorization only depends on the candidates (and on the parameters)
+	if (!context.isFactorizationValid(params))
+	{
+		factorizeKrigeSystem(params, context);
+	}
 
-	Vector::const_iterator Xi = X.begin();
-	Vector::const_iterator Yi = Y.begin();
+	if (context.factorization == KrigeContext::Factorization::Singular)
+	{
+		return std::numeric_limits<double>::quiet_NaN();
+	}
 
-	double numerator = 0.0;
-	double denominator = 0.0;
+	const std::vector<DataPoint>& dataPointCandidates = context.dataPointCandidates;
+	size_t n = dataPointCandidates.size();
+	size_t p = context.driftTermCount;
+	const double* lambda = context.dualWeights.data();
 
-	while (Xi != X.end())
+	// simple kriging works on the residuals
+	double estimate = (p == 0 ? context.mean : 0.0);
+
+	// Find distances over given points and calculate covariograms
+	for (size_t i = 0; i < n; ++i)
 	{
-		numerator += ((*Xi - Xmean) * (*Yi - Ymean));
-		denominator += ((*Xi - Xmean) * (*Xi - Xmean));
+		double distance = (dataPointCandidates[i] - point).norm();
 
-		++Xi;
-		++Yi;
+		estimate += lambda[i] * calculateCovariogram(params, distance);
 	}
 
-	double slope = std::numeric_limits<double>::max();
-	double intercept = 0.0;
-	if (denominator > std::numeric_limits<double>::epsilon())
+	// drift terms
+	if (p != 0)
 	{
-		slope = numerator / denominator;
-		intercept = Ymean - (slope * Xmean);
+		double driftTerms[KrigeContext::MaxDriftTermCount];
+		context.computeDriftTerms(point, driftTerms);
+		for (size_t k = 0; k < p; ++k)
+		{
+			estimate += lambda[n + k] * driftTerms[k];
+		}
 	}
 
-	return { slope, intercept };
+	return estimate;
 }
 
-Kriging::KrigeParams Kriging::computeDefaultParameters() const
+bool Kriging::computeEmpiricalVariogram(	double maxLag,
+											unsigned binCount,
+											EmpiricalVariogram& variogram,
+											size_t maxSampleCount/*=10000*/,
+											bool multiThread/*=true*/) const
 {
-	// Note: Determination of sill and range are only rough estimates.
-	//       It is up to the user to interpret the empirical and model
-	//       variogram plots to assess the validity of the parameters 
-	//       used in the chosen model.
-
-	// For fixed models, range is the first distance where the sill is reached.
-
-	// For asymptotic models it would be the first distance where the semivariance
-	// reaches 95% of the sill.
-
-	// We will assume a fixed model to start.
-
-	KrigeParams estimatedParams(Model::Invalid, 0.0, 0.0, 0.0);
+	variogram.lagDistances.clear();
+	variogram.semiVariances.clear();
+	variogram.pairCounts.clear();
 
 	size_t pointCount = m_dataPoints.size();
-	if (pointCount < 2)
+	if (pointCount < 2 || binCount == 0 || !(maxLag > 0.0) || maxSampleCount < 2)
 	{
 		assert(false);
-		return estimatedParams;
+		return false;
 	}
 
-	estimatedParams.sill = 0.0;
+	//! Bin accumulator
+	struct Bin
 	{
-		double sum = 0.0;
-		double sum2 = 0.0;
-		for (const DataPoint& P : m_dataPoints)
-		{
-			sum += P.value;
-			sum2 += P.value * P.value;
-		}
-		double mean = sum / m_dataPoints.size();
-		estimatedParams.sill = ((sum2 / m_dataPoints.size()) - (mean * mean)) / 2; // semi-variance
-	}
+		double semiVarianceSum = 0.0;
+		double distanceSum = 0.0;
+		size_t count = 0;
+	};
 
-	std::multimap<double, double> semiVariogram;
-	Vector lagDistance;
-	Vector lagSemivariance;
+	std::vector<size_t> sampleIndexes;
+	std::vector<unsigned> sortedSamples;
+	std::vector<unsigned> cellStart;
+	std::vector<std::vector<Bin>> chunkBins;
 
-	static const size_t MaxPointCount = 1000;
-	bool duplicatePoints = false;
-	//estimatedParams.sill = 0.0;
-	if (pointCount <= MaxPointCount) // expensive version with an explicit computation of all possible distances!
+	try
 	{
-		for (size_t i = 0; i < pointCount; ++i)
+		// select the samples
+		sampleIndexes.resize(pointCount);
+		std::iota(sampleIndexes.begin(), sampleIndexes.end(), 0);
+		if (pointCount > maxSampleCount)
 		{
-			for (size_t j = i + 1; j < pointCount; ++j)
+			// partial Fisher-Yates shuffle (with the default seed as we want a reproducible behavior)
+			std::mt19937 gen;
+			for (size_t i = 0; i < maxSampleCount; ++i)
 			{
-				double delta = m_dataPoints[i].value - m_dataPoints[j].value;
-				double variance = delta * delta;
+				std::uniform_int_distribution<size_t> distrib(i, pointCount - 1);
+				std::swap(sampleIndexes[i], sampleIndexes[distrib(gen)]);
+			}
+			sampleIndexes.resize(maxSampleCount);
+		}
+		size_t sampleCount = sampleIndexes.size();
 
-				//estimatedParams.sill += variance;
+		// compute the samples bounding-box
+		CCVector2d minBB = m_dataPoints[sampleIndexes.front()];
+		CCVector2d maxBB = minBB;
+		for (size_t index : sampleIndexes)
+		{
+			const DataPoint& P = m_dataPoints[index];
+			minBB.x = std::min(minBB.x, P.x);
+			minBB.y = std::min(minBB.y, P.y);
+			maxBB.x = std::max(maxBB.x, P.x);
+			maxBB.y = std::max(maxBB.y, P.y);
+		}
 
-				double distance = (m_dataPoints[i] - m_dataPoints[j]).norm();
-				if (distance > std::numeric_limits<double>::epsilon()) // ignore duplicate points!
-				{
-					semiVariogram.insert({ distance, variance });
-				}
-				else
-				{
-					duplicatePoints = true;
-				}
+		// regular grid with cells as large as the lag bins (so that the cells farther than the max lag can be skipped)
+		double binWidth = maxLag / binCount;
+		double cellSize = binWidth;
+		{
+			// we don't want (much) more cells than samples
+			double area = std::max(maxBB.x - minBB.x, cellSize) * std::max(maxBB.y - minBB.y, cellSize);
+			cellSize = std::max(cellSize, std::sqrt(area / sampleCount));
+		}
+		size_t gridWidth = static_cast<size_t>((maxBB.x - minBB.x) / cellSize) + 1;
+		size_t gridHeight = static_cast<size_t>((maxBB.y - minBB.y) / cellSize) + 1;
+
+		auto cellIndexOf = [&](const DataPoint& P) -> size_t
+		{
+			size_t i = std::min(static_cast<size_t>((P.x - minBB.x) / cellSize), gridWidth - 1);
+			size_t j = std::min(static_cast<size_t>((P.y - minBB.y) / cellSize), gridHeight - 1);
+			return i + j * gridWidth;
+		};
+
+		// sort the samples by cell (counting sort)
+		cellStart.resize(gridWidth * gridHeight + 1, 0);
+		for (size_t index : sampleIndexes)
+		{
+			++cellStart[cellIndexOf(m_dataPoints[index]) + 1];
+		}
+		std::partial_sum(cellStart.begin(), cellStart.end(), cellStart.begin());
+		sortedSamples.resize(sampleCount);
+		{
+			std::vector<unsigned> cellFill(cellStart.begin(), cellStart.end() - 1);
+			for (size_t index : sampleIndexes)
+			{
+				sortedSamples[cellFill[cellIndexOf(m_dataPoints[index])]++] = static_cast<unsigned>(index);
 			}
 		}
 
-		// Rather than take the simple variance of the variable, a better estimation should be the
-		// average variance amoung all distances.
-		//estimatedParams.sill = (estimatedParams.sill / 2.0) / ((pointCount * (pointCount - 1)) / 2.0);
-		//estimatedParams.sill = estimatedParams.sill / (pointCount * (pointCount - 1));
-	}
-	else
-	{
-		std::mt19937 gen; //Standard mersenne_twister_engine seeded with default seed as we wan't a reproducible behavior
-		std::uniform_int_distribution<> distrib(1, MaxPointCount - 1);
+		size_t chunkCount = (multiThread ? CCCoreLib::ParallelForHelper::ChunkCount(sampleCount, 256) : 1);
+		chunkBins.resize(chunkCount, std::vector<Bin>(binCount));
 
-		size_t sampleCount = (MaxPointCount * (MaxPointCount - 1)) / 2;
-		size_t sqrtSampleCount = static_cast<size_t>(sqrt(sampleCount));
+		// accumulate the pairs (each pair is visited only once: same cell with a greater rank, or 'forward' neighbor cells)
+		double maxSquareLag = maxLag * maxLag;
+		static const double SquareEpsilon = std::numeric_limits<double>::epsilon() * std::numeric_limits<double>::epsilon();
+		int neighborRange = static_cast<int>(std::ceil(maxLag / cellSize));
 
-		//estimatedParams.sill = 0.0;
-		for (size_t iRand = 0; iRand < sqrtSampleCount; ++iRand)
-		{
-			int i = distrib(gen);
-			for (size_t jRand = 0; jRand < sqrtSampleCount; ++jRand)
+		CCCoreLib::ParallelForHelper::ForEachChunk(sampleCount, chunkCount, [&](size_t chunkIndex, size_t begin, size_t end)
 			{
-				int shift = distrib(gen);
-				assert(shift >= 1 && shift < static_cast<int>(MaxPointCount));
-				int j = (i + shift) % static_cast<int>(MaxPointCount);
-				assert(i != j);
-				
-				double delta = m_dataPoints[i].value - m_dataPoints[j].value;
-				double variance = (delta * delta) / 2;
-
-				//estimatedParams.sill += variance;
-
-				double distance = (m_dataPoints[i] - m_dataPoints[j]).norm();
-				if (distance > std::numeric_limits<double>::epsilon()) // ignore duplicate points!
+				std::vector<Bin>& bins = chunkBins[chunkIndex];
+
+				auto addPair = [&](const DataPoint& P, unsigned qIndex)
 				{
-					semiVariogram.insert({ distance, variance });
-				}
-				else
+					const DataPoint& Q = m_dataPoints[qIndex];
+					double squareDistance = (P - Q).norm2();
+					if (squareDistance > maxSquareLag || squareDistance <= SquareEpsilon) // ignore duplicate points!
+					{
+						return;
+					}
+					double distance = std::sqrt(squareDistance);
+					unsigned binIndex = std::min(static_cast<unsigned>(distance / binWidth), binCount - 1);
+					double delta = P.value - Q.value;
+					Bin& bin = bins[binIndex];
+					bin.semiVarianceSum += (delta * delta) / 2;
+					bin.distanceSum += distance;
+					++bin.count;
+				};
+
+				for (size_t k = begin; k < end; ++k)
 				{
-					duplicatePoints = true;
+					const DataPoint& P = m_dataPoints[sortedSamples[k]];
+					size_t cellIndex = cellIndexOf(P);
+					size_t ci = cellIndex % gridWidth;
+					size_t cj = cellIndex / gridWidth;
+
+					// same cell
+					for (unsigned l = static_cast<unsigned>(k) + 1; l < cellStart[cellIndex + 1]; ++l)
+					{
+						addPair(P, sortedSamples[l]);
+					}
+
+					// forward neighbor cells (next cells of the same row, then the next rows) closer than the max lag
+					int iMin = std::max(static_cast<int>(ci) - neighborRange, 0);
+					int iMax = std::min(static_cast<int>(ci) + neighborRange, static_cast<int>(gridWidth) - 1);
+					int jMax = std::min(static_cast<int>(cj) + neighborRange, static_cast<int>(gridHeight) - 1);
+					for (int nj = static_cast<int>(cj); nj <= jMax; ++nj)
+					{
+						double dy = std::max(std::max(minBB.y + nj * cellSize - P.y, P.y - (minBB.y + (nj + 1) * cellSize)), 0.0);
+						for (int ni = (nj == static_cast<int>(cj) ? static_cast<int>(ci) + 1 : iMin); ni <= iMax; ++ni)
+						{
+							double dx = std::max(std::max(minBB.x + ni * cellSize - P.x, P.x - (minBB.x + (ni + 1) * cellSize)), 0.0);
+							if (dx * dx + dy * dy > maxSquareLag)
+							{
+								continue;
+							}
+							size_t neighborIndex = ni + nj * gridWidth;
+							for (unsigned l = cellStart[neighborIndex]; l < cellStart[neighborIndex + 1]; ++l)
+							{
+								addPair(P, sortedSamples[l]);
+							}
+						}
+					}
 				}
-			}
-		}
+			},
+			multiThread);
 
-		// Rather than take the simple variance of the variable, a better estimation should be the
-		// average variance amoung all distances.
-		//estimatedParams.sill = (estimatedParams.sill / 2.0) / ((semiVariogram.size() * (semiVariogram.size() - 1)) / 2.0);
-		//estimatedParams.sill = estimatedParams.sill / (semiVariogram.size() * (semiVariogram.size() - 1));
+		// merge the bins
+		variogram.lagDistances.resize(binCount, 0.0);
+		variogram.semiVariances.resize(binCount, 0.0);
+		variogram.pairCounts.resize(binCount, 0);
 	}
-
-	if (duplicatePoints)
+	catch (const std::bad_alloc&)
 	{
-		//Log::Warning("Kriging", QObject::tr("Duplicate points found. Results may be biased"));
+		// not enough memory
+		return false;
 	}
 
-	// compute the data points bounding-box
-	CCVector2d minBB, maxBB;
-	for (size_t i = 0; i < pointCount; ++i)
+	for (unsigned b = 0; b < binCount; ++b)
 	{
-		const DataPoint& P = m_dataPoints[i];
-		if (i != 0)
+		Bin bin;
+		for (const std::vector<Bin>& bins : chunkBins)
 		{
-			minBB.x = std::min(minBB.x, P.x);
-			minBB.y = std::min(minBB.y, P.y);
-			maxBB.x = std::max(maxBB.x, P.x);
-			maxBB.y = std::max(maxBB.y, P.y);
+			bin.semiVarianceSum += bins[b].semiVarianceSum;
+			bin.distanceSum += bins[b].distanceSum;
+			bin.count += bins[b].count;
+		}
+
+		variogram.pairCounts[b] = bin.count;
+		if (bin.count != 0)
+		{
+			variogram.lagDistances[b] = bin.distanceSum / bin.count;
+			variogram.semiVariances[b] = bin.semiVarianceSum / bin.count;
 		}
 		else
 		{
-			minBB = maxBB = P;
+			variogram.lagDistances[b] = (b + 0.5) * (maxLag / binCount);
 		}
 	}
-	double bbDiag = (maxBB - minBB).norm();
 
-	// estimate the default lag
-	double lag = 0.0, lagBoundary = 0.0;
+	return true;
+}
+
+//! Returns the normalized shape of a variogram model (0 at the origin, 1 at the sill)
+static double VariogramShape(Kriging::Model model, double q)
+{
+	switch (model)
 	{
-		double minDistance = semiVariogram.begin()->first;
-		double maxDistance = semiVariogram.rbegin()->first;
+	case Kriging::Spherical:
+		return (q < 1.0 ? q * (1.5 - 0.5 * (q * q)) : 1.0);
+	case Kriging::Exponential:
+		return 1.0 - std::exp(-q);
+	case Kriging::Gaussian:
+		return 1.0 - std::exp(-q * q);
+	default:
+		assert(false);
+		break;
+	}
+	return std::numeric_limits<double>::quiet_NaN();
+}
 
-		lag = std::max(minDistance * 2.5, bbDiag / 1000.0); // we can't have a too small lag value!
+//! Weighted least squares fit of nugget + partialSill * shape(h / range) for a given model and range
+/** \return the weighted sum of squared residuals (or -1 if the fit failed)
+**/
+static double FitNuggetAndSill(	const Kriging::EmpiricalVariogram& variogram,
+								const std::vector<double>& weights,
+								Kriging::Model model,
+								double range,
+								double& nugget,
+								double& partialSill)
+{
+	// normal equations of the 2x2 linear problem
+	double sw = 0.0, swf = 0.0, swff = 0.0, swg = 0.0, swfg = 0.0;
+	for (size_t i = 0; i < weights.size(); ++i)
+	{
+		if (weights[i] == 0.0)
+		{
+			continue;
+		}
+		double f = VariogramShape(model, variogram.lagDistances[i] / range);
+		double g = variogram.semiVariances[i];
+		sw += weights[i];
+		swf += weights[i] * f;
+		swff += weights[i] * f * f;
+		swg += weights[i] * g;
+		swfg += weights[i] * f * g;
+	}
 
-		// Only consider points over half the distance.
-		lagBoundary = (maxDistance - minDistance) / 2.0;
+	double det = sw * swff - swf * swf;
+	if (det > std::numeric_limits<double>::epsilon() * sw * swff)
+	{
+		nugget = (swff * swg - swf * swfg) / det;
+		partialSill = (sw * swfg - swf * swg) / det;
+	}
+	else
+	{
+		nugget = -1.0; // see below
+	}
 
-		unsigned lagCount = static_cast<unsigned>(lagBoundary / lag + 0.5);
-		static const unsigned MINIMUM_LAG_COUNT = 20;
-		if (lagCount < MINIMUM_LAG_COUNT)
+	if (nugget < 0.0)
+	{
+		// constrained fit (no nugget)
+		if (swff <= 0.0)
 		{
-			lag = lagBoundary / MINIMUM_LAG_COUNT;
+			return -1.0;
 		}
+		nugget = 0.0;
+		partialSill = swfg / swff;
 	}
 
-	double lagTolerance = lag / 2.0;
-	double currentLagDistance = lagTolerance;
-	double currentVarianceSum = 0.0;
-	unsigned currentLagCount = 0;
+	if (partialSill <= 0.0)
+	{
+		return -1.0;
+	}
 
-	for (std::multimap<double, double>::const_iterator iterator = semiVariogram.begin(); iterator != semiVariogram.end() && currentLagDistance <= lagBoundary; ++iterator)
+	double residual = 0.0;
+	for (size_t i = 0; i < weights.size(); ++i)
 	{
-		if (iterator->first > currentLagDistance + lagTolerance)
+		if (weights[i] != 0.0)
 		{
-			if (currentLagCount != 0)
-			{
-				lagDistance.push_back(currentLagDistance);
-				lagSemivariance.push_back((currentVarianceSum / currentLagCount) / 2.0);
+			double delta = variogram.semiVariances[i] - (nugget + partialSill * VariogramShape(model, variogram.lagDistances[i] / range));
+			residual += weights[i] * delta * delta;
+		}
+	}
 
-				currentVarianceSum = 0.0;
-				currentLagCount = 0;
-			}
+	return residual;
+}
 
-			currentLagDistance += lag;
-		}
+Kriging::KrigeParams Kriging::FitVariogramModel(const EmpiricalVariogram& variogram, Model model/*=Invalid*/)
+{
+	KrigeParams bestParams(Model::Invalid, 0.0, 0.0, 0.0);
 
-		currentVarianceSum += iterator->second;
-		++currentLagCount;
+	size_t binCount = variogram.pairCounts.size();
+	if (variogram.lagDistances.size() != binCount || variogram.semiVariances.size() != binCount)
+	{
+		assert(false);
+		return bestParams;
 	}
 
-	// Estimated range
-	estimatedParams.range = 0.0;
+	// weights: number of pairs / squared lag distance
+	std::vector<double> weights(binCount, 0.0);
+	double minLag = std::numeric_limits<double>::max();
+	double maxLag = 0.0;
+	size_t validBinCount = 0;
+	for (size_t i = 0; i < binCount; ++i)
 	{
-		// look for the maximum peak variance
-		size_t peakVarianceIndex = 0;
-		for (size_t i = 1; i< lagSemivariance.size(); ++i)
+		double h = variogram.lagDistances[i];
+		if (variogram.pairCounts[i] != 0 && h > 0.0)
 		{
-			if (lagSemivariance[i] > lagSemivariance[peakVarianceIndex])
+			weights[i] = variogram.pairCounts[i] / (h * h);
+			minLag = std::min(minLag, h);
+			maxLag = std::max(maxLag, h);
+			++validBinCount;
+		}
+	}
+	if (validBinCount < 2)
+	{
+		return bestParams;
+	}
+
+	Model models[3] = { Spherical, Exponential, Gaussian };
+	double bestResidual = -1.0;
+
+	for (Model currentModel : models)
+	{
+		if (model != Invalid && model != currentModel)
+		{
+			continue;
+		}
+
+		// coarse (geometric) search of the range...
+		static const unsigned RangeSteps = 64;
+		double rangeMin = minLag / 2;
+		double rangeMax = maxLag * 2;
+		double ratio = std::pow(rangeMax / rangeMin, 1.0 / (RangeSteps - 1));
+
+		double modelBestRange = 0.0;
+		double modelBestResidual = -1.0;
+		double range = rangeMin;
+		for (unsigned r = 0; r < RangeSteps; ++r, range *= ratio)
+		{
+			double nugget = 0.0, partialSill = 0.0;
+			double residual = FitNuggetAndSill(variogram, weights, currentModel, range, nugget, partialSill);
+			if (residual >= 0.0 && (modelBestResidual < 0.0 || residual < modelBestResidual))
 			{
-				peakVarianceIndex = i;
+				modelBestResidual = residual;
+				modelBestRange = range;
 			}
 		}
+		if (modelBestResidual < 0.0)
+		{
+			continue;
+		}
 
-		bool foundRangeLimit = false;
-		for (size_t i = 0; i < lagSemivariance.size(); ++i)
+		// ...then refinement (golden section search between the neighbor steps)
 		{
-			double semivariance = lagSemivariance[i];
-			
-			if (semivariance > estimatedParams.sill)
+			static const double InvPhi = 0.6180339887498949;
+			double a = modelBestRange / ratio;
+			double b = modelBestRange * ratio;
+			for (unsigned iteration = 0; iteration < 32; ++iteration)
+			{
+				double c = b - (b - a) * InvPhi;
+				double d = a + (b - a) * InvPhi;
+				double nugget = 0.0, partialSill = 0.0;
+				double rc = FitNuggetAndSill(variogram, weights, currentModel, c, nugget, partialSill);
+				double rd = FitNuggetAndSill(variogram, weights, currentModel, d, nugget, partialSill);
+				if (rd < 0.0 || (rc >= 0.0 && rc < rd))
+				{
+					b = d;
+				}
+				else
+				{
+					a = c;
+				}
+			}
+			double nugget = 0.0, partialSill = 0.0;
+			double refinedRange = (a + b) / 2;
+			double residual = FitNuggetAndSill(variogram, weights, currentModel, refinedRange, nugget, partialSill);
+			if (residual >= 0.0 && residual <= modelBestResidual)
 			{
-				estimatedParams.range = (i != 0 ? (lagDistance[i - 1] + lagDistance[i]) / 2.0 : lagDistance[i]);
-				peakVarianceIndex = i;
-				foundRangeLimit = true;
-				break;
+				modelBestResidual = residual;
+				modelBestRange = refinedRange;
 			}
 		}
 
-		if (!foundRangeLimit)
+		if (bestResidual < 0.0 || modelBestResidual < bestResidual)
 		{
-			// let's use the peak instead
-			estimatedParams.range = lagDistance[peakVarianceIndex];
+			double nugget = 0.0, partialSill = 0.0;
+			FitNuggetAndSill(variogram, weights, currentModel, modelBestRange, nugget, partialSill);
+
+			bestResidual = modelBestResidual;
+			bestParams.model = currentModel;
+			bestParams.nugget = nugget;
+			bestParams.sill = nugget + partialSill;
+			bestParams.range = modelBestRange;
 		}
+	}
+
+	return bestParams;
+}
+
+Kriging::KrigeParams Kriging::computeDefaultParameters(bool multiThread/*=true*/) const
+{
+	// Note: Determination of sill and range are only rough estimates.
+	//       It is up to the user to interpret the empirical and model
+	//       variogram plots to assess the validity of the parameters 
+	//       used in the chosen model.
 
-		// we can ignore the rest of the variogram for the fitting below
-		lagSemivariance.resize(peakVarianceIndex + 1);
-		lagDistance.resize(peakVarianceIndex + 1);
+	KrigeParams estimatedParams(Model::Invalid, 0.0, 0.0, 0.0);
+
+	size_t pointCount = m_dataPoints.size();
+	if (pointCount < 2)
+	{
+		assert(false);
+		return estimatedParams;
 	}
 
-	// Estimated nugget
-	estimatedParams.nugget = 0.0;
-	if (lagDistance.size() > 1)
+	// compute the data points bounding-box and the variance
+	CCVector2d minBB = m_dataPoints.front();
+	CCVector2d maxBB = minBB;
+	double sum = 0.0;
+	double sum2 = 0.0;
+	for (const DataPoint& P : m_dataPoints)
 	{
-		auto slopeAndIntercept = linearRegression(lagDistance, lagSemivariance);
-		estimatedParams.nugget = slopeAndIntercept.second; // = intercept
+		minBB.x = std::min(minBB.x, P.x);
+		minBB.y = std::min(minBB.y, P.y);
+		maxBB.x = std::max(maxBB.x, P.x);
+		maxBB.y = std::max(maxBB.y, P.y);
+		sum += P.value;
+		sum2 += P.value * P.value;
 	}
+	double mean = sum / pointCount;
+	double variance = std::max(0.0, (sum2 / pointCount) - (mean * mean));
+	double bbDiag = (maxBB - minBB).norm();
 
-	estimatedParams.model = Model::Spherical;
+	// Only consider points over half the distance.
+	double maxLag = bbDiag / 2;
+	if (maxLag <= 0.0)
+	{
+		// all the points are at the same position
+		return estimatedParams;
+	}
+
+	static const unsigned LagCount = 20;
+	EmpiricalVariogram variogram;
+	if (computeEmpiricalVariogram(maxLag, LagCount, variogram, 10000, multiThread))
+	{
+		estimatedParams = FitVariogramModel(variogram);
+	}
+
+	if (estimatedParams.model == Model::Invalid)
+	{
+		// the fit failed (e.g. constant values): we use a basic spherical model
+		estimatedParams.model = Model::Spherical;
+		estimatedParams.nugget = 0.0;
+		estimatedParams.sill = variance;
+		estimatedParams.range = maxLag / 2;
+	}
 
 	return estimatedParams;
 }
@@ -206,13 +206,11 @@ LocalModel* LocalModel::New(LOCAL_MODEL_TYPES type,
 			const PointCoordinateType* eq = subset.getQuadric(&dims);
 			if (eq)
 			{
-				return new QuadricLocalModel(	eq,
-												dims.x,
-												dims.y,
-												dims.z,
-												*subset.getGravityCenter(), //should be ok as the quadric computation succeeded!
-												center,
-												squaredRadius);
+				return NewQuadric(	eq,
+									dims,
+									*subset.getGravityCenter(), //should be ok as the quadric computation succeeded!
+									center,
+									squaredRadius);
 			}
 		}
 			break;
@@ -221,3 +219,18 @@ LocalModel* LocalModel::New(LOCAL_MODEL_TYPES type,
 	//invalid input type or computation failed!
 	return nullptr;
 }
+
+LocalModel* LocalModel::NewQuadric(	const PointCoordinateType eq[6],
+									const Tuple3ub& dims,
+									const CCVector3& gravityCenter,
+									const CCVector3& center,
+									PointCoordinateType squaredRadius)
+{
+	return new QuadricLocalModel(	eq,
+									dims.x,
+									dims.y,
+									dims.z,
+									gravityCenter,
+									center,
+									squaredRadius);
+}
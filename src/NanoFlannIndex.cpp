@@ -0,0 +1,442 @@
+// SPDX-License-Identifier: LGPL-2.0-or-later
+// Copyright © CloudCompare Project
+
+#include "NanoFlannIndex.h"
+
+//local
+#include "GenericIndexedCloud.h"
+#include "ParallelForHelper.h"
+
+//nanoflann
+#include <nanoflann.hpp>
+
+//system
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <limits>
+#include <memory>
+
+using namespace CCCoreLib;
+
+namespace
+{
+	//! nanoflann adaptor for a packed copy of the points
+	struct PackedPointsAdaptor
+	{
+		explicit PackedPointsAdaptor(const std::vector<CCVector3>& _points) : points(_points) {}
+
+		inline size_t kdtree_get_point_count() const { return points.size(); }
+		inline PointCoordinateType kdtree_get_pt(size_t idx, size_t dim) const { return points[idx].u[dim]; }
+		template <class BBOX> bool kdtree_get_bbox(BBOX& /*bb*/) const { return false; }
+
+		const std::vector<CCVector3>& points;
+	};
+
+	//! nanoflann adaptor reading the points directly from the cloud
+	/** We use the thread-safe version of GenericIndexedCloud::getPoint.
+	**/
+	struct CloudAdaptor
+	{
+		explicit CloudAdaptor(const GenericIndexedCloud* _cloud) : cloud(_cloud) {}
+
+		inline size_t kdtree_get_point_count() const { return cloud->size(); }
+		inline PointCoordinateType kdtree_get_pt(size_t idx, size_t dim) const
+		{
+			CCVector3 P;
+			cloud->getPoint(static_cast<unsigned>(idx), P);
+			return P.u[dim];
+		}
+		template <class BBOX> bool kdtree_get_bbox(BBOX& /*bb*/) const { return false; }
+
+		const GenericIndexedCloud* cloud;
+	};
+
+	using PackedTreeType = nanoflann::KDTreeSingleIndexAdaptor<
+		nanoflann::L2_Simple_Adaptor<PointCoordinateType, PackedPointsAdaptor>,
+		PackedPointsAdaptor, /*dim=*/3, unsigned>;
+
+	using CloudTreeType = nanoflann::KDTreeSingleIndexAdaptor<
+		nanoflann::L2_Simple_Adaptor<PointCoordinateType, CloudAdaptor>,
+		CloudAdaptor, /*dim=*/3, unsigned>;
+
+	//! nanoflann result set for the k nearest neighbours (written directly in the output arrays)
+	class KNNResultSet
+	{
+	public:
+		KNNResultSet(unsigned k, unsigned* indexes, ScalarType* squareDistances, ScalarType maxSquareDistance)
+			: m_indexes(indexes)
+			, m_squareDistances(squareDistances)
+			, m_capacity(k)
+			, m_count(0)
+			, m_maxSquareDistance(maxSquareDistance)
+		{
+			assert(k != 0);
+		}
+
+		inline size_t size() const { return m_count; }
+		inline bool full() const { return m_count == m_capacity; }
+		inline PointCoordinateType worstDist() const
+		{
+			return static_cast<PointCoordinateType>(m_count < m_capacity ? m_maxSquareDistance : m_squareDistances[m_capacity - 1]);
+		}
+
+		inline bool addPoint(PointCoordinateType dist, unsigned index)
+		{
+			ScalarType sqrDist = static_cast<ScalarType>(dist);
+			if (sqrDist >= m_maxSquareDistance)
+			{
+				return true;
+			}
+			//sorted insertion
+			unsigned pos = (m_count < m_capacity ? m_count++ : m_capacity - 1);
+			while (pos != 0 && m_squareDistances[pos - 1] > sqrDist)
+			{
+				m_indexes[pos] = m_indexes[pos - 1];
+				m_squareDistances[pos] = m_squareDistances[pos - 1];
+				--pos;
+			}
+			m_indexes[pos] = index;
+			m_squareDistances[pos] = sqrDist;
+			return true;
+		}
+
+	protected:
+		unsigned* m_indexes;
+		ScalarType* m_squareDistances;
+		unsigned m_capacity;
+		unsigned m_count;
+		ScalarType m_maxSquareDistance;
+	};
+
+	//! A neighbour found by a radius search (index + squared distance)
+	using RadiusMatch = std::pair<unsigned, PointCoordinateType>;
+
+	//! nanoflann result set for radius searches
+	class RadiusResultSet
+	{
+	public:
+		RadiusResultSet(PointCoordinateType squareRadius, std::vector<RadiusMatch>& matches)
+			: m_squareRadius(squareRadius)
+			, m_matches(matches)
+		{}
+
+		inline size_t size() const { return m_matches.size(); }
+		inline bool full() const { return true; }
+		inline PointCoordinateType worstDist() const { return m_squareRadius; }
+
+		inline bool addPoint(PointCoordinateType dist, unsigned index)
+		{
+			if (dist < m_squareRadius)
+			{
+				m_matches.emplace_back(index, dist); //may throw std::bad_alloc
+			}
+			return true;
+		}
+
+	protected:
+		PointCoordinateType m_squareRadius;
+		std::vector<RadiusMatch>& m_matches;
+	};
+}
+
+struct NanoFlannIndex::Index
+{
+	Index(const GenericIndexedCloud* cloud)
+		: packedAdaptor(points)
+		, cloudAdaptor(cloud)
+	{}
+
+	//! Runs a query with a given result set
+	template <class ResultSet> void search(ResultSet& resultSet, const CCVector3& queryPoint) const
+	{
+		nanoflann::SearchParams searchParams;
+		searchParams.sorted = false; //the result sets are sorted by themselves if necessary
+		if (packedTree)
+			packedTree->findNeighbors(resultSet, queryPoint.u, searchParams);
+		else
+			cloudTree->findNeighbors(resultSet, queryPoint.u, searchParams);
+	}
+
+	//! Runs a radius search
+	void searchRadius(const CCVector3& queryPoint, PointCoordinateType radius, bool sortByDistance, std::vector<RadiusMatch>& matches) const
+	{
+		matches.clear();
+		RadiusResultSet resultSet(radius * radius, matches);
+		search(resultSet, queryPoint);
+		if (sortByDistance)
+		{
+			std::sort(matches.begin(), matches.end(), [](const RadiusMatch& a, const RadiusMatch& b) { return a.second < b.second; });
+		}
+	}
+
+	std::vector<CCVector3> points;
+	PackedPointsAdaptor packedAdaptor;
+	CloudAdaptor cloudAdaptor;
+	std::unique_ptr<PackedTreeType> packedTree;
+	std::unique_ptr<CloudTreeType> cloudTree;
+};
+
+NanoFlannIndex::NanoFlannIndex()
+	: m_index(nullptr)
+	, m_associatedCloud(nullptr)
+{
+}
+
+NanoFlannIndex::~NanoFlannIndex()
+{
+	clear();
+}
+
+void NanoFlannIndex::clear()
+{
+	delete m_index;
+	m_index = nullptr;
+	m_associatedCloud = nullptr;
+}
+
+bool NanoFlannIndex::build(GenericIndexedCloud* cloud, bool packedCopy/*=true*/, unsigned maxLeafSize/*=10*/)
+{
+	clear();
+
+	if (!cloud || cloud->size() == 0)
+	{
+		return false;
+	}
+
+	Index* index = nullptr;
+	try
+	{
+		index = new Index(cloud);
+
+		nanoflann::KDTreeSingleIndexAdaptorParams params(std::max(maxLeafSize, 1u));
+		if (packedCopy)
+		{
+			unsigned count = cloud->size();
+			index->points.resize(count);
+			for (unsigned i = 0; i < count; ++i)
+			{
+				cloud->getPoint(i, index->points[i]);
+			}
+			//the index is built by the constructor
+			index->packedTree.reset(new PackedTreeType(/*dim=*/3, index->packedAdaptor, params));
+		}
+		else
+		{
+			index->cloudTree.reset(new CloudTreeType(/*dim=*/3, index->cloudAdaptor, params));
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		delete index;
+		return false;
+	}
+
+	m_index = index;
+	m_associatedCloud = cloud;
+
+	return true;
+}
+
+unsigned NanoFlannIndex::findKNearestNeighbours(	const CCVector3& queryPoint,
+													unsigned k,
+													unsigned* neighbourIndexes,
+													ScalarType* squareDistances,
+													ScalarType maxDist/*=-1*/) const
+{
+	if (!m_index || k == 0)
+	{
+		return 0;
+	}
+	assert(neighbourIndexes && squareDistances);
+
+	const ScalarType maxSqrDist = (maxDist < 0 ? std::numeric_limits<ScalarType>::max() : maxDist * maxDist);
+	KNNResultSet resultSet(k, neighbourIndexes, squareDistances, maxSqrDist);
+	m_index->search(resultSet, queryPoint);
+
+	return static_cast<unsigned>(resultSet.size());
+}
+
+unsigned NanoFlannIndex::findPointsInRadius(	const CCVector3& queryPoint,
+												PointCoordinateType radius,
+												std::vector<unsigned>& neighbourIndexes,
+												std::vector<ScalarType>* squareDistances/*=nullptr*/,
+												bool sortByDistance/*=false*/) const
+{
+	if (!m_index)
+	{
+		return 0;
+	}
+
+	//may throw std::bad_alloc (as std::vector::push_back)
+	std::vector<RadiusMatch> matches;
+	m_index->searchRadius(queryPoint, radius, sortByDistance, matches);
+
+	neighbourIndexes.reserve(neighbourIndexes.size() + matches.size());
+	if (squareDistances)
+	{
+		squareDistances->reserve(squareDistances->size() + matches.size());
+	}
+	for (const RadiusMatch& match : matches)
+	{
+		neighbourIndexes.push_back(match.first);
+		if (squareDistances)
+		{
+			squareDistances->push_back(static_cast<ScalarType>(match.second));
+		}
+	}
+
+	return static_cast<unsigned>(matches.size());
+}
+
+bool NanoFlannIndex::findKNearestNeighbours(	const CCVector3* queryPoints,
+												unsigned count,
+												unsigned k,
+												unsigned* neighbourIndexes,
+												ScalarType* squareDistances/*=nullptr*/,
+												unsigned* neighbourCounts/*=nullptr*/,
+												ScalarType maxDist/*=-1*/,
+												bool multiThread/*=true*/,
+												int maxThreadCount/*=0*/) const
+{
+	if (!m_index)
+		return false;
+
+	if (count == 0 || k == 0)
+		return true;
+
+	assert(queryPoints && neighbourIndexes);
+
+	//if the caller doesn't want the distances, each chunk needs its own (small) buffer
+	std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(count, 256, maxThreadCount) : 1);
+	std::vector<ScalarType> chunkDistances;
+	if (!squareDistances)
+	{
+		try
+		{
+			chunkDistances.resize(chunkCount * k);
+		}
+		catch (const std::bad_alloc&)
+		{
+			//not enough memory
+			return false;
+		}
+	}
+
+	ParallelForHelper::ForEachChunk(count, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			unsigned* indexes = neighbourIndexes + i * k;
+			ScalarType* distances = (squareDistances ? squareDistances + i * k : chunkDistances.data() + chunkIndex * k);
+			unsigned neighbourCount = findKNearestNeighbours(queryPoints[i], k, indexes, distances, maxDist);
+			if (neighbourCounts)
+			{
+				neighbourCounts[i] = neighbourCount;
+			}
+		}
+	}, multiThread, maxThreadCount);
+
+	return true;
+}
+
+bool NanoFlannIndex::findPointsInRadius(	const CCVector3* queryPoints,
+											unsigned count,
+											PointCoordinateType radius,
+											std::vector<unsigned>& neighbourIndexes,
+											std::vector<unsigned>& neighbourOffsets,
+											std::vector<ScalarType>* squareDistances/*=nullptr*/,
+											bool sortByDistance/*=false*/,
+											bool multiThread/*=true*/,
+											int maxThreadCount/*=0*/) const
+{
+	if (!m_index)
+		return false;
+
+	assert(queryPoints || count == 0);
+
+	//each chunk stores its results separately (they are concatenated afterwards, in the query points order)
+	std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(count, 256, maxThreadCount) : 1);
+	std::vector< std::vector<RadiusMatch> > chunkMatches;
+	try
+	{
+		neighbourOffsets.resize(static_cast<std::size_t>(count) + 1);
+		chunkMatches.resize(chunkCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return false;
+	}
+
+	std::atomic<bool> notEnoughMemory(false);
+	ParallelForHelper::ForEachChunk(count, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
+	{
+		try
+		{
+			std::vector<RadiusMatch>& allMatches = chunkMatches[chunkIndex];
+			std::vector<RadiusMatch> matches;
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				m_index->searchRadius(queryPoints[i], radius, sortByDistance, matches);
+				//we temporarily store the number of neighbours
+				neighbourOffsets[i] = static_cast<unsigned>(matches.size());
+				allMatches.insert(allMatches.end(), matches.begin(), matches.end());
+			}
+		}
+		catch (const std::bad_alloc&)
+		{
+			notEnoughMemory = true;
+		}
+	}, multiThread, maxThreadCount);
+
+	if (notEnoughMemory)
+	{
+		return false;
+	}
+
+	//convert the counts to offsets
+	std::size_t totalCount = 0;
+	for (unsigned i = 0; i < count; ++i)
+	{
+		unsigned neighbourCount = neighbourOffsets[i];
+		neighbourOffsets[i] = static_cast<unsigned>(totalCount);
+		totalCount += neighbourCount;
+	}
+	neighbourOffsets[count] = static_cast<unsigned>(totalCount);
+
+	try
+	{
+		neighbourIndexes.resize(totalCount);
+		if (squareDistances)
+		{
+			squareDistances->resize(totalCount);
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return false;
+	}
+
+	std::size_t pos = 0;
+	for (std::vector<RadiusMatch>& matches : chunkMatches)
+	{
+		for (const RadiusMatch& match : matches)
+		{
+			neighbourIndexes[pos] = match.first;
+			if (squareDistances)
+			{
+				(*squareDistances)[pos] = static_cast<ScalarType>(match.second);
+			}
+			++pos;
+		}
+		//release memory as soon as possible
+		matches.clear();
+		matches.shrink_to_fit();
+	}
+	assert(pos == totalCount);
+
+	return true;
+}
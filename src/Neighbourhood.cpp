@@ -131,11 +131,37 @@ void Neighbourhood::computeGravityCenter()
 }
 
 SquareMatrixd Neighbourhood::computeCovarianceMatrix()
+{
+	SquareMatrix3d covMat;
+	if (!computeCovarianceMatrix(covMat))
+		return SquareMatrixd();
+
+	return covMat.toSquareMatrix();
+}
+
+bool Neighbourhood::computeCovarianceMatrix(SquareMatrix3d& covMat)
+{
+	double packedCovMat[6];
+	if (!computePackedCovarianceMatrix(packedCovMat))
+		return false;
+
+	//symmetry
+	covMat.m_values[0][0] = packedCovMat[0];
+	covMat.m_values[1][1] = packedCovMat[1];
+	covMat.m_values[2][2] = packedCovMat[2];
+	covMat.m_values[1][0] = covMat.m_values[0][1] = packedCovMat[3];
+	covMat.m_values[2][0] = covMat.m_values[0][2] = packedCovMat[4];
+	covMat.m_values[2][1] = covMat.m_values[1][2] = packedCovMat[5];
+
+	return true;
+}
+
+bool Neighbourhood::computePackedCovarianceMatrix(double packedCovMat[6])
 {
 	assert(m_associatedCloud);
 	unsigned count = (m_associatedCloud ? m_associatedCloud->size() : 0);
 	if (!count)
-		return SquareMatrixd();
+		return false;
 
 	//we get centroid
 	const CCVector3* G = getGravityCenter();
@@ -161,16 +187,14 @@ SquareMatrixd Neighbourhood::computeCovarianceMatrix()
 		mYZ += static_cast<double>(P.y)*P.z;
 	}
 
-	//symmetry
-	SquareMatrixd covMat(3);
-	covMat.m_values[0][0] = mXX/count;
-	covMat.m_values[1][1] = mYY/count;
-	covMat.m_values[2][2] = mZZ/count;
-	covMat.m_values[1][0] = covMat.m_values[0][1] = mXY/count;
-	covMat.m_values[2][0] = covMat.m_values[0][2] = mXZ/count;
-	covMat.m_values[2][1] = covMat.m_values[1][2] = mYZ/count;
-
-	return covMat;
+	packedCovMat[0] = mXX/count;
+	packedCovMat[1] = mYY/count;
+	packedCovMat[2] = mZZ/count;
+	packedCovMat[3] = mXY/count;
+	packedCovMat[4] = mXZ/count;
+	packedCovMat[5] = mYZ/count;
+
+	return true;
 }
 
 PointCoordinateType Neighbourhood::computeLargestRadius()
@@ -219,11 +243,15 @@ bool Neighbourhood::computeLeastSquareBestFittingPlane()
 	CCVector3 G(0, 0, 0);
 	if (pointCount > 3)
 	{
-		SquareMatrixd covMat = computeCovarianceMatrix();
+		SquareMatrix3d covMat;
+		if (!computeCovarianceMatrix(covMat))
+		{
+			return false;
+		}
 
 		//we determine plane normal by computing the smallest eigen value of M = 1/n * S[(p-µ)*(p-µ)']
-		SquareMatrixd eigVectors;
-		std::vector<double> eigValues;
+		SquareMatrix3d eigVectors;
+		double eigValues[3];
 		if (!Jacobi<double>::ComputeEigenValuesAndVectors(covMat, eigVectors, eigValues, true))
 		{
 			//failed to compute the eigen values!
@@ -297,11 +325,8 @@ bool Neighbourhood::computeLeastSquareBestFittingPlane()
 	return true;
 }
 
-bool Neighbourhood::computeQuadric()
+bool Neighbourhood::buildQuadricSystem(QuadricSystem& system)
 {
-	//invalidate previous quadric (if any)
-	m_structuresValidity &= (~FLAG_QUADRIC);
-
 	assert(m_associatedCloud);
 	if (!m_associatedCloud)
 		return false;
@@ -393,11 +418,9 @@ bool Neighbourhood::computeQuadric()
 		}
 	}
 
-	//conjugate gradient initialization
 	//we solve tA.A.X=tA.b
-	ConjugateGradient<6,double> cg;
-	const SquareMatrixd& tAA = cg.A();
-	double* tAb = cg.b();
+	SquareMatrixN<6, double>& tAA = system.tAA;
+	double* tAb = system.tAb;
 
 	//compute tA.A and tA.b
 	{
@@ -483,12 +506,13 @@ bool Neighbourhood::computeQuadric()
 	}
 
 	//first guess for X: plane equation (a0.x+a1.y+a2.z=a3 --> z = a3/a2 - a0/a2.x - a1/a2.y)
-	double X0[6] = {static_cast<double>(/*lsPlane[3]/lsPlane[idx.z]*/0), //DGM: warning, points have already been recentred around the gravity center! So forget about a3
-					static_cast<double>(-lsPlane[idx.x]/lsPlane[idx.z]),
-					static_cast<double>(-lsPlane[idx.y]/lsPlane[idx.z]),
-					0,
-					0,
-					0 };
+	double* X0 = system.X0;
+	X0[0] = static_cast<double>(/*lsPlane[3]/lsPlane[idx.z]*/0); //DGM: warning, points have already been recentred around the gravity center! So forget about a3
+	X0[1] = static_cast<double>(-lsPlane[idx.x]/lsPlane[idx.z]);
+	X0[2] = static_cast<double>(-lsPlane[idx.y]/lsPlane[idx.z]);
+	X0[3] = 0;
+	X0[4] = 0;
+	X0[5] = 0;
 
 	//special case: a0 = a1 = a2 = 0! //happens for perfectly flat surfaces!
 	if (X0[1] == 0 && X0[2] == 0)
@@ -496,33 +520,56 @@ bool Neighbourhood::computeQuadric()
 		X0[0] = 1.0;
 	}
 
+	system.convergenceThreshold = lmax2 * 1.0e-8;  //max. error for convergence = 1e-8 of largest cloud dimension (empirical!)
+	system.dims = idx;
+
+	return true;
+}
+
+void Neighbourhood::setQuadric(const double X[6], const Tuple3ub& dims)
+{
+	for (unsigned i=0; i<6; ++i)
+	{
+		m_quadricEquation[i] = static_cast<PointCoordinateType>(X[i]);
+	}
+	m_quadricEquationDirections = dims;
+
+	m_structuresValidity |= FLAG_QUADRIC;
+}
+
+bool Neighbourhood::computeQuadric()
+{
+	//invalidate previous quadric (if any)
+	m_structuresValidity &= (~FLAG_QUADRIC);
+
+	QuadricSystem system;
+	if (!buildQuadricSystem(system))
+		return false;
+
+	//conjugate gradient initialization
+	//we solve tA.A.X=tA.b
+	ConjugateGradient<6,double> cg;
+	cg.A() = system.tAA;
+	memcpy(cg.b(), system.tAb, sizeof(double) * 6);
+
+	double X0[6];
+	memcpy(X0, system.X0, sizeof(double) * 6);
+
 	//init. conjugate gradient
 	cg.initConjugateGradient(X0);
 
 	//conjugate gradient iterations
 	{
-		const double convergenceThreshold = lmax2 * 1.0e-8;  //max. error for convergence = 1e-8 of largest cloud dimension (empirical!)
-		for (unsigned i=0; i<1500; ++i)
+		for (unsigned i=0; i<QUADRIC_MAX_ITERATION_COUNT; ++i)
 		{
 			double lastError = cg.iterConjugateGradient(X0);
-			if (lastError < convergenceThreshold) //converged
+			if (lastError < system.convergenceThreshold) //converged
 				break;
 		}
 	}
-	//fprintf(fp,"X%i=(%f,%f,%f,%f,%f,%f)\n",i,X0[0],X0[1],X0[2],X0[3],X0[4],X0[5]);
-	//fprintf(fp,"lastError=%E/%E\n",lastError,convergenceThreshold);
-	//fclose(fp);
 
 	//output
-	{
-		for (unsigned i=0; i<6; ++i)
-		{
-			m_quadricEquation[i] = static_cast<PointCoordinateType>(X0[i]);
-		}
-		m_quadricEquationDirections = idx;
-
-		m_structuresValidity |= FLAG_QUADRIC;
-	}
+	setQuadric(X0, system.dims);
 
 	return true;
 }
@@ -776,9 +823,15 @@ ScalarType Neighbourhood::computeMomentOrder1(const CCVector3& P)
 		return NAN_VALUE;
 	}
 
-	SquareMatrixd eigVectors;
-	std::vector<double> eigValues;
-	if (!Jacobi<double>::ComputeEigenValuesAndVectors(computeCovarianceMatrix(), eigVectors, eigValues, true))
+	SquareMatrix3d covMat;
+	if (!computeCovarianceMatrix(covMat))
+	{
+		return NAN_VALUE;
+	}
+
+	SquareMatrix3d eigVectors;
+	double eigValues[3];
+	if (!Jacobi<double>::ComputeEigenValuesAndVectors(covMat, eigVectors, eigValues, true))
 	{
 		//failed to compute the eigen values
 		return NAN_VALUE;
@@ -810,14 +863,25 @@ double Neighbourhood::computeFeature(GeomFeature feature)
 		return std::numeric_limits<double>::quiet_NaN();
 	}
 
-	SquareMatrixd eigVectors;
-	std::vector<double> eigValues;
-	if (!Jacobi<double>::ComputeEigenValuesAndVectors(computeCovarianceMatrix(), eigVectors, eigValues, true))
+	SquareMatrix3d covMat;
+	if (!computeCovarianceMatrix(covMat))
+	{
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+
+	SquareMatrix3d eigVectors;
+	double eigValues[3];
+	if (!Jacobi<double>::ComputeEigenValuesAndVectors(covMat, eigVectors, eigValues, true))
 	{
 		//failed to compute the eigen values
 		return std::numeric_limits<double>::quiet_NaN();
 	}
 
+	return ComputeFeature(feature, eigVectors, eigValues);
+}
+
+double Neighbourhood::ComputeFeature(GeomFeature feature, SquareMatrix3d& eigVectors, double (&eigValues)[3])
+{
 	Jacobi<double>::SortEigenValuesAndVectors(eigVectors, eigValues); //sort the eigenvectors in decreasing order of their associated eigenvalues
 
 	//shortcuts
@@ -1002,30 +1066,21 @@ ScalarType Neighbourhood::computeCurvature(const CCVector3& P, CurvatureType cTy
 			}
 
 			//we determine plane normal by computing the smallest eigen value of M = 1/n * S[(p-µ)*(p-µ)']
-			SquareMatrixd covMat = computeCovarianceMatrix();
-			CCVector3d e(0, 0, 0);
-
-			SquareMatrixd eigVectors;
-			std::vector<double> eigValues;
-			if (!Jacobi<double>::ComputeEigenValuesAndVectors(covMat, eigVectors, eigValues, true))
+			SquareMatrix3d covMat;
+			if (!computeCovarianceMatrix(covMat))
 			{
-				//failure
 				return NAN_VALUE;
 			}
 
-			//compute curvature as the rate of change of the surface
-			e.x = eigValues[0];
-			e.y = eigValues[1];
-			e.z = eigValues[2];
-
-			const double sum = e.x + e.y + e.z; //we work with absolute values
-			if (LessThanEpsilon(sum))
+			SquareMatrix3d eigVectors;
+			double eigValues[3];
+			if (!Jacobi<double>::ComputeEigenValuesAndVectors(covMat, eigVectors, eigValues, true))
 			{
+				//failure
 				return NAN_VALUE;
 			}
 
-			const double eMin = std::min(std::min(e.x, e.y), e.z);
-			return static_cast<ScalarType>(eMin / sum);
+			return ComputeNormalChangeRate(eigValues);
 		}
 			break;
 
@@ -1035,3 +1090,16 @@ ScalarType Neighbourhood::computeCurvature(const CCVector3& P, CurvatureType cTy
 
 	return NAN_VALUE;
 }
+
+ScalarType Neighbourhood::ComputeNormalChangeRate(const double eigValues[3])
+{
+	//compute curvature as the rate of change of the surface
+	const double sum = eigValues[0] + eigValues[1] + eigValues[2]; //we work with absolute values
+	if (LessThanEpsilon(sum))
+	{
+		return NAN_VALUE;
+	}
+
+	const double eMin = std::min(std::min(eigValues[0], eigValues[1]), eigValues[2]);
+	return static_cast<ScalarType>(eMin / sum);
+}
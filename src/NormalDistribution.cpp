@@ -14,7 +14,7 @@
 #include <GenericCloud.h>
 #include <ScalarField.h>
 #include <ScalarFieldTools.h>
-
+#include "ParallelForHelper.h"
 
 using namespace CCCoreLib;
 
@@ -82,6 +82,15 @@ double NormalDistribution::computePfromZero(ScalarType x) const
 	return 0.5 * (ErrorFunction::erf(static_cast<double>(x - m_mu) / sqrt(2 * m_sigma2)) + 1.0);
 }
 
+void NormalDistribution::computeCumulativeProbabilities(const ScalarType* x, std::size_t count, double* p) const
+{
+	const double sqrt2Sigma2 = sqrt(2 * m_sigma2);
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		p[i] = 0.5 * (ErrorFunction::erf(static_cast<double>(x[i] - m_mu) / sqrt2Sigma2) + 1.0);
+	}
+}
+
 bool NormalDistribution::computeParameters(const GenericCloud* cloud)
 {
 	setValid(false);
@@ -113,34 +122,131 @@ bool NormalDistribution::computeParameters(const GenericCloud* cloud)
 	return setParameters(static_cast<ScalarType>(mean), static_cast<ScalarType>(stddev2));
 }
 
-bool NormalDistribution::computeParameters(const ScalarContainer& values)
+void NormalDistribution::Moments::merge(const Moments& other)
 {
-	setValid(false);
+	if (other.count == 0)
+	{
+		return;
+	}
+	if (count == 0)
+	{
+		*this = other;
+		return;
+	}
 
-	//compute mean and std. dev.
-	double mean = 0.0;
-	double stddev2 = 0.0;
-	unsigned counter = 0;
+	//see Chan et al., "Updating Formulae and a Pairwise Algorithm for Computing Sample Variances"
+	std::size_t totalCount = count + other.count;
+	double delta = other.mean - mean;
+	mean += delta * other.count / totalCount;
+	m2 += other.m2 + delta * delta * (static_cast<double>(count) * other.count / totalCount);
+	count = totalCount;
+}
 
-	for (ScalarType v : values)
+NormalDistribution::Moments NormalDistribution::ComputeMoments(	const ScalarType* values,
+																std::size_t count,
+																ScalarType center,
+																double maxDeviation,
+																bool multiThread,
+																int maxThreadCount)
+{
+	Moments moments;
+	if (!values || count == 0)
 	{
-		if (ScalarField::ValidValue(v))
+		return moments;
+	}
+
+	const bool filter = (maxDeviation >= 0.0);
+
+	//each chunk accumulates the sums of the values shifted by its first (valid) value
+	//(which is much faster than Welford's update and numerically equivalent in practice)
+	auto computeChunkMoments = [&](std::size_t begin, std::size_t end)
+	{
+		Moments chunkMoments;
+		double shift = 0.0;
+		double sum = 0.0;
+		double sum2 = 0.0;
+		std::size_t counter = 0;
+		for (std::size_t i = begin; i < end; ++i)
 		{
-			mean += v;
-			stddev2 += static_cast<double>(v) * v;
+			ScalarType v = values[i];
+			if (!ScalarField::ValidValue(v))
+			{
+				continue;
+			}
+			if (filter && !(static_cast<double>(std::abs(v - center)) < maxDeviation))
+			{
+				continue;
+			}
+			if (counter == 0)
+			{
+				shift = v;
+			}
+			double d = static_cast<double>(v) - shift;
+			sum += d;
+			sum2 += d * d;
 			++counter;
 		}
+
+		if (counter != 0)
+		{
+			chunkMoments.count = counter;
+			chunkMoments.mean = shift + sum / counter;
+			chunkMoments.m2 = std::max(0.0, sum2 - sum * sum / counter);
+		}
+		return chunkMoments;
+	};
+
+	std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(count, 65536, maxThreadCount) : 1);
+	if (chunkCount <= 1)
+	{
+		return computeChunkMoments(0, count);
 	}
 
-	if (counter == 0)
+	std::vector<Moments> chunkMoments;
+	try
+	{
+		chunkMoments.resize(chunkCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory: we'll process the values in a single pass
+		return computeChunkMoments(0, count);
+	}
+
+	ParallelForHelper::ForEachChunk(count, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
+	{
+		chunkMoments[chunkIndex] = computeChunkMoments(begin, end);
+	}, multiThread, maxThreadCount);
+
+	//merge the chunks in a fixed order (so that the result doesn't depend on the threads scheduling)
+	for (const Moments& m : chunkMoments)
+	{
+		moments.merge(m);
+	}
+
+	return moments;
+}
+
+bool NormalDistribution::computeParameters(const Moments& moments)
+{
+	setValid(false);
+
+	if (moments.count == 0)
 	{
 		return false;
 	}
 
-	mean /= counter;
-	stddev2 = std::abs(stddev2 / counter - mean*mean);
+	return setParameters(static_cast<ScalarType>(moments.mean), static_cast<ScalarType>(moments.variance()));
+}
 
-	return setParameters(static_cast<ScalarType>(mean), static_cast<ScalarType>(stddev2));
+bool NormalDistribution::computeParameters(const ScalarContainer& values)
+{
+	return computeParameters(ComputeMoments(values.data(), values.size(), 0, -1.0, false));
+}
+
+bool NormalDistribution::computeParameters(const ScalarField& sf, bool multiThread/*=true*/, int maxThreadCount/*=0*/)
+{
+	return computeParameters(ComputeMoments(sf.data(), sf.size(), 0, -1.0, multiThread, maxThreadCount));
 }
 
 bool NormalDistribution::computeRobustParameters(const ScalarContainer& values, double nSigma)
@@ -151,29 +257,18 @@ bool NormalDistribution::computeRobustParameters(const ScalarContainer& values,
 	//max std. deviation
 	const double maxStddev = sqrt(static_cast<double>(m_sigma2))*nSigma;
 
-	unsigned counter = 0;
-	double mean = 0.0;
-	double stddev2 = 0.0;
-
-	for (ScalarType v : values)
-	{
-		if (static_cast<double>(std::abs(v - m_mu)) < maxStddev)
-		{
-			mean += v;
-			stddev2 += static_cast<double>(v) * v;
-			++counter;
-		}
-	}
+	return computeParameters(ComputeMoments(values.data(), values.size(), m_mu, maxStddev, false));
+}
 
-	if (counter == 0)
-	{
+bool NormalDistribution::computeRobustParameters(const ScalarField& sf, double nSigma, bool multiThread/*=true*/, int maxThreadCount/*=0*/)
+{
+	if (!computeParameters(sf, multiThread, maxThreadCount))
 		return false;
-	}
 
-	mean /= counter;
-	stddev2 = std::abs(stddev2 / counter - mean*mean);
+	//max std. deviation
+	const double maxStddev = sqrt(static_cast<double>(m_sigma2))*nSigma;
 
-	return setParameters(static_cast<ScalarType>(mean), static_cast<ScalarType>(stddev2));
+	return computeParameters(ComputeMoments(sf.data(), sf.size(), m_mu, maxStddev, multiThread, maxThreadCount));
 }
 
 double NormalDistribution::computeChi2Dist(const GenericCloud* cloud, unsigned numberOfClasses, int* histo)
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: LGPL-2.0-or-later
+// Copyright © CloudCompare Project
+
+#pragma once
+
+//system
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#if defined(CC_CORE_LIB_USES_QT_CONCURRENT)
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrentMap>
+#include <QtConcurrentRun>
+#define CC_PARALLEL_FOR_SUPPORTED
+#elif defined(CC_CORE_LIB_USES_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+#include <tbb/task_arena.h>
+#define CC_PARALLEL_FOR_SUPPORTED
+#endif
+
+namespace CCCoreLib
+{
+	//! Simple 'parallel for' helpers (based on QtConcurrent or TBB, whichever is available)
+	/** Work is split into a fixed number of contiguous chunks. Each chunk is processed by a
+		single thread, and the chunk index can be used to store per-chunk results (histograms,
+		partial sums, etc.) that are merged afterwards. This keeps the results deterministic
+		whatever the backend or the actual number of threads.
+	**/
+	namespace ParallelForHelper
+	{
+		//! Returns whether parallel processing is actually supported
+		inline bool IsSupported()
+		{
+#ifdef CC_PARALLEL_FOR_SUPPORTED
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		//! Returns the (ideal) number of threads
+		/** \param maxThreadCount the maximum number of threads to use (0 = all)
+		**/
+		inline int ThreadCount(int maxThreadCount = 0)
+		{
+#if defined(CC_CORE_LIB_USES_QT_CONCURRENT)
+			int threadCount = QThread::idealThreadCount();
+#elif defined(CC_CORE_LIB_USES_TBB)
+			int threadCount = tbb::this_task_arena::max_concurrency();
+#else
+			int threadCount = 1;
+#endif
+			if (maxThreadCount > 0)
+			{
+				threadCount = std::min(threadCount, maxThreadCount);
+			}
+			return std::max(threadCount, 1);
+		}
+
+		//! Returns a suitable number of chunks to process 'count' elements
+		/** \param count number of elements
+			\param minChunkSize minimum number of elements per chunk
+			\param maxThreadCount the maximum number of threads to use (0 = all)
+			\return number of chunks (at least 1 if count > 0)
+		**/
+		inline std::size_t ChunkCount(std::size_t count, std::size_t minChunkSize, int maxThreadCount = 0)
+		{
+			if (count == 0)
+			{
+				return 0;
+			}
+			//a few chunks per thread for load balancing
+			std::size_t chunkCount = static_cast<std::size_t>(ThreadCount(maxThreadCount)) * 4;
+			chunkCount = std::min(chunkCount, (count + minChunkSize - 1) / std::max<std::size_t>(minChunkSize, 1));
+			return std::max<std::size_t>(chunkCount, 1);
+		}
+
+		//! Processes [0 ; count[ by chunks
+		/** 'func' is called once per chunk as func(chunkIndex, begin, end) with end excluded.
+			\param count number of elements
+			\param chunkCount number of chunks (see ChunkCount)
+			\param func function to call for each chunk
+			\param multiThread whether to process the chunks in parallel (if supported) or not
+			\param maxThreadCount the maximum number of threads to use (0 = all). Ignored if 'multiThread' is false or with tbb.
+		**/
+		template <typename Func> void ForEachChunk(std::size_t count, std::size_t chunkCount, Func&& func, bool multiThread = true, int maxThreadCount = 0)
+		{
+			if (count == 0 || chunkCount == 0)
+			{
+				return;
+			}
+			chunkCount = std::min(chunkCount, count);
+
+			auto processChunk = [&](std::size_t chunkIndex)
+			{
+				std::size_t begin = (count * chunkIndex) / chunkCount;
+				std::size_t end = (count * (chunkIndex + 1)) / chunkCount;
+				func(chunkIndex, begin, end);
+			};
+
+#ifdef CC_PARALLEL_FOR_SUPPORTED
+			if (multiThread && chunkCount > 1)
+			{
+#if defined(CC_CORE_LIB_USES_QT_CONCURRENT)
+				std::vector<std::size_t> chunkIndexes(chunkCount);
+				for (std::size_t i = 0; i < chunkCount; ++i)
+				{
+					chunkIndexes[i] = i;
+				}
+				if (maxThreadCount == 0)
+				{
+					maxThreadCount = QThread::idealThreadCount();
+				}
+				QThreadPool::globalInstance()->setMaxThreadCount(maxThreadCount);
+				QtConcurrent::blockingMap(chunkIndexes, [&](const std::size_t& chunkIndex) { processChunk(chunkIndex); });
+#elif defined(CC_CORE_LIB_USES_TBB)
+				(void)maxThreadCount;
+				tbb::parallel_for(static_cast<std::size_t>(0), chunkCount, [&](std::size_t chunkIndex) { processChunk(chunkIndex); });
+#endif
+				return;
+			}
+#else
+			(void)multiThread;
+			(void)maxThreadCount;
+#endif
+			for (std::size_t i = 0; i < chunkCount; ++i)
+			{
+				processChunk(i);
+			}
+		}
+
+		//! Processes [0 ; count[ by chunks (the number of chunks is automatically determined)
+		/** 'func' is called as func(begin, end) with end excluded.
+			\param count number of elements
+			\param func function to call for each chunk
+			\param multiThread whether to process the chunks in parallel (if supported) or not
+			\param minChunkSize minimum number of elements per chunk
+			\param maxThreadCount the maximum number of threads to use (0 = all). Ignored if 'multiThread' is false or with tbb.
+		**/
+		template <typename Func> void ForEachRange(std::size_t count, Func&& func, bool multiThread = true, std::size_t minChunkSize = 1024, int maxThreadCount = 0)
+		{
+			std::size_t chunkCount = (multiThread ? ChunkCount(count, minChunkSize, maxThreadCount) : 1);
+			ForEachChunk(count, chunkCount, [&](std::size_t, std::size_t begin, std::size_t end) { func(begin, end); }, multiThread, maxThreadCount);
+		}
+
+		//! Calls two functions, potentially in parallel, and waits for both of them to return
+		/** Can be called recursively (e.g. to process the two halves of a tree in parallel).
+			\param func1 first function (called as func1())
+			\param func2 second function (called as func2())
+			\param multiThread whether to call the functions in parallel (if supported) or not
+		**/
+		template <typename Func1, typename Func2> void Invoke(Func1&& func1, Func2&& func2, bool multiThread = true)
+		{
+#ifdef CC_PARALLEL_FOR_SUPPORTED
+			if (multiThread)
+			{
+#if defined(CC_CORE_LIB_USES_QT_CONCURRENT)
+				//if no thread is available, waitForFinished will run the second function in the current thread
+				QFuture<void> future = QtConcurrent::run([&]() { func2(); });
+				func1();
+				future.waitForFinished();
+#elif defined(CC_CORE_LIB_USES_TBB)
+				tbb::parallel_invoke([&]() { func1(); }, [&]() { func2(); });
+#endif
+				return;
+			}
+#else
+			(void)multiThread;
+#endif
+			func1();
+			func2();
+		}
+	}
+}
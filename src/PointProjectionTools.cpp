@@ -10,10 +10,14 @@
 #include <GenericProgressCallback.h>
 #include <Neighbourhood.h>
 #include <ParallelSort.h>
+#include "ParallelForHelper.h"
 #include <PointCloud.h>
 #include <SimpleMesh.h>
+#include <SquareMatrixN.h>
 
 //system
+#include <atomic>
+#include <functional>
 #include <set>
 
 using namespace CCCoreLib;
@@ -167,6 +171,296 @@ PointCloud* PointProjectionTools::developCloudOnCone(GenericCloud* cloud, unsign
 	return outCloud;
 }
 
+//! atan2 approximation (without branches, so that it can be vectorized)
+/** Cephes' atanf polynomial, after reduction of the argument to [0 ; tan(pi/8)].
+	Max. error: 3e-7 rad in single precision (same as std::atan2) and 1e-8 rad in double precision.
+**/
+template <typename T> static inline T FastAtan2(T y, T x)
+{
+	const T ax = std::abs(x);
+	const T ay = std::abs(y);
+	const T maxA = std::max(ax, ay);
+	const T minA = std::min(ax, ay);
+	T a = (maxA != 0 ? minA / maxA : 0);
+
+	//atan(a) = pi/4 + atan((a-1)/(a+1))
+	const bool reduced = (a > static_cast<T>(0.41421356237309504880)); //tan(pi/8)
+	a = (reduced ? (a - 1) / (a + 1) : a);
+
+	const T z = a * a;
+	T r = ((((static_cast<T>(8.05374449538e-2) * z - static_cast<T>(1.38776856032e-1)) * z + static_cast<T>(1.99777106478e-1)) * z - static_cast<T>(3.33329491539e-1)) * z) * a + a;
+	r = (reduced ? r + static_cast<T>(M_PI / 4) : r);
+
+	//back to the right octant
+	r = (ay > ax ? static_cast<T>(M_PI / 2) - r : r);
+	r = (x < 0 ? static_cast<T>(M_PI) - r : r);
+	return std::copysign(r, y);
+}
+
+namespace
+{
+	//! Development of a point cloud on a cylinder (see developCloudOnCylinder)
+	struct CylinderDevelopment
+	{
+		CCVector3 center;
+		PointCoordinateType radius;
+
+		template <unsigned char Dim> inline CCVector3 develop(const CCVector3& Q) const
+		{
+			const unsigned char Dim1 = (Dim > 0 ? Dim - 1 : 2);
+			const unsigned char Dim2 = (Dim < 2 ? Dim + 1 : 0);
+
+			CCVector3 P = Q - center;
+			PointCoordinateType u = std::sqrt(P.u[Dim1] * P.u[Dim1] + P.u[Dim2] * P.u[Dim2]);
+			PointCoordinateType lon = FastAtan2(P.u[Dim1], P.u[Dim2]);
+
+			return CCVector3(lon * radius, P.u[Dim], u - radius);
+		}
+	};
+
+	//! Development of a point cloud on a cone (see developCloudOnCone)
+	struct ConeDevelopment
+	{
+		CCVector3 center;
+		PointCoordinateType baseRadius;
+		PointCoordinateType tanAlpha;
+		PointCoordinateType q;
+
+		template <unsigned char Dim> inline CCVector3 develop(const CCVector3& Q) const
+		{
+			const unsigned char Dim1 = (Dim > 0 ? Dim - 1 : 2);
+			const unsigned char Dim2 = (Dim < 2 ? Dim + 1 : 0);
+
+			CCVector3 P = Q - center;
+			PointCoordinateType u = std::sqrt(P.u[Dim1] * P.u[Dim1] + P.u[Dim2] * P.u[Dim2]);
+			PointCoordinateType lon = FastAtan2(P.u[Dim1], P.u[Dim2]);
+
+			//projection on the cone
+			PointCoordinateType z2 = (P.u[Dim] + u * tanAlpha) * q;
+			PointCoordinateType x2 = z2 * tanAlpha;
+			//altitude
+			PointCoordinateType dX = u - x2;
+			PointCoordinateType dZ = P.u[Dim] - z2;
+			PointCoordinateType alt = std::sqrt(dX * dX + dZ * dZ);
+			//on which side of the cone surface is the point?
+			alt = (x2 * P.u[Dim] - z2 * u < 0 ? -alt : alt);
+
+			return CCVector3(lon * baseRadius, P.u[Dim] + center.u[Dim], alt);
+		}
+	};
+}
+
+//! Develops a set of points and returns their bounding-box
+template <unsigned char Dim, class Development> static BoundingBox DevelopPoints(	const Development& development,
+																					const CCVector3* input,
+																					CCVector3* output,
+																					std::size_t count)
+{
+	//the bounding-box is computed separately, so that this loop can be vectorized
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		output[i] = development.template develop<Dim>(input[i]);
+	}
+
+	BoundingBox bbox;
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		bbox.add(output[i]);
+	}
+	return bbox;
+}
+
+//! Develops a set of points and returns their bounding-box
+/** 'input' and 'output' can be the same.
+**/
+template <class Development> static BoundingBox DevelopPoints(	const Development& development,
+																unsigned char dim,
+																const CCVector3* input,
+																CCVector3* output,
+																std::size_t count)
+{
+	switch (dim)
+	{
+	case 0:
+		return DevelopPoints<0>(development, input, output, count);
+	case 1:
+		return DevelopPoints<1>(development, input, output, count);
+	default:
+		assert(dim == 2);
+		return DevelopPoints<2>(development, input, output, count);
+	}
+}
+
+//! Develops a point cloud in place (in parallel)
+template <class Development> static void DevelopCloud(	PointCloud& cloud,
+														const Development& development,
+														unsigned char dim,
+														bool multiThread,
+														int maxThreadCount)
+{
+	unsigned count = cloud.size();
+	if (count == 0)
+	{
+		return;
+	}
+
+	CCVector3* points = const_cast<CCVector3*>(cloud.getPointPersistentPtr(0));
+
+	//each chunk computes its own bounding-box
+	std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(count, 4096, maxThreadCount) : 1);
+	std::vector<BoundingBox> chunkBBoxes;
+	try
+	{
+		chunkBBoxes.resize(chunkCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory (very unlikely!): we'll do it without the chunk bounding-boxes
+		chunkCount = 1;
+	}
+
+	ParallelForHelper::ForEachChunk(count, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
+	{
+		BoundingBox bbox = DevelopPoints(development, dim, points + begin, points + begin, end - begin);
+		if (!chunkBBoxes.empty())
+		{
+			chunkBBoxes[chunkIndex] = bbox;
+		}
+	}, multiThread, maxThreadCount);
+
+	if (chunkBBoxes.empty())
+	{
+		cloud.invalidateBoundingBox();
+		return;
+	}
+
+	BoundingBox bbox;
+	for (const BoundingBox& chunkBBox : chunkBBoxes)
+	{
+		bbox += chunkBBox;
+	}
+	cloud.setBoundingBox(bbox);
+}
+
+//! Develops a point cloud and stores the result in another cloud (in parallel)
+template <class Development> static bool DevelopCloud(	const GenericIndexedCloud& cloud,
+														const Development& development,
+														unsigned char dim,
+														PointCloud& output,
+														bool multiThread,
+														int maxThreadCount)
+{
+	unsigned count = cloud.size();
+
+	std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(count, 4096, maxThreadCount) : 1);
+	std::vector<BoundingBox> chunkBBoxes;
+	try
+	{
+		if (!output.resize(count))
+		{
+			//not enough memory
+			return false;
+		}
+		output.normals().resize(0);
+		chunkBBoxes.resize(chunkCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return false;
+	}
+
+	if (count == 0)
+	{
+		output.invalidateBoundingBox();
+		return true;
+	}
+
+	CCVector3* outputPoints = const_cast<CCVector3*>(output.getPointPersistentPtr(0));
+
+	ParallelForHelper::ForEachChunk(count, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
+	{
+		//we copy the input points by small batches, so as to process them as contiguous arrays
+		static const std::size_t BATCH_SIZE = 256;
+		CCVector3 points[BATCH_SIZE];
+
+		BoundingBox bbox;
+		for (std::size_t batchStart = begin; batchStart < end; batchStart += BATCH_SIZE)
+		{
+			std::size_t batchSize = std::min(BATCH_SIZE, end - batchStart);
+			for (std::size_t i = 0; i < batchSize; ++i)
+			{
+				cloud.getPoint(static_cast<unsigned>(batchStart + i), points[i]);
+			}
+			bbox += DevelopPoints(development, dim, points, outputPoints + batchStart, batchSize);
+		}
+		chunkBBoxes[chunkIndex] = bbox;
+	}, multiThread, maxThreadCount);
+
+	BoundingBox bbox;
+	for (const BoundingBox& chunkBBox : chunkBBoxes)
+	{
+		bbox += chunkBBox;
+	}
+	output.setBoundingBox(bbox);
+
+	return true;
+}
+
+//! Returns the parameters of the development on a cone
+static ConeDevelopment GetConeDevelopment(PointCoordinateType baseRadius, float alpha, const CCVector3& center)
+{
+	//same computation as the GenericCloud version
+	const float tan_alpha = tanf( DegreesToRadians( alpha ) );
+	float q = 1.0f/(1.0f+tan_alpha*tan_alpha);
+
+	return ConeDevelopment{ center, baseRadius, tan_alpha, q };
+}
+
+void PointProjectionTools::developCloudOnCylinder(	PointCloud& cloud,
+													PointCoordinateType radius,
+													unsigned char dim,
+													const CCVector3& center,
+													bool multiThread/*=true*/,
+													int maxThreadCount/*=0*/)
+{
+	DevelopCloud(cloud, CylinderDevelopment{ center, radius }, dim, multiThread, maxThreadCount);
+}
+
+bool PointProjectionTools::developCloudOnCylinder(	const GenericIndexedCloud& cloud,
+													PointCoordinateType radius,
+													unsigned char dim,
+													const CCVector3& center,
+													PointCloud& output,
+													bool multiThread/*=true*/,
+													int maxThreadCount/*=0*/)
+{
+	return DevelopCloud(cloud, CylinderDevelopment{ center, radius }, dim, output, multiThread, maxThreadCount);
+}
+
+void PointProjectionTools::developCloudOnCone(	PointCloud& cloud,
+												unsigned char dim,
+												PointCoordinateType baseRadius,
+												float alpha,
+												const CCVector3& center,
+												bool multiThread/*=true*/,
+												int maxThreadCount/*=0*/)
+{
+	DevelopCloud(cloud, GetConeDevelopment(baseRadius, alpha, center), dim, multiThread, maxThreadCount);
+}
+
+bool PointProjectionTools::developCloudOnCone(	const GenericIndexedCloud& cloud,
+												unsigned char dim,
+												PointCoordinateType baseRadius,
+												float alpha,
+												const CCVector3& center,
+												PointCloud& output,
+												bool multiThread/*=true*/,
+												int maxThreadCount/*=0*/)
+{
+	return DevelopCloud(cloud, GetConeDevelopment(baseRadius, alpha, center), dim, output, multiThread, maxThreadCount);
+}
+
 PointCloud* PointProjectionTools::applyTransformation(GenericCloud* cloud, Transformation& trans, GenericProgressCallback* progressCb)
 {
 	assert(cloud);
@@ -257,12 +551,15 @@ PointCloud* PointProjectionTools::applyTransformation(GenericIndexedCloud* cloud
 
 	cloud->placeIteratorAtBeginning();
 
+	//fixed-size copy of the rotation (an invalid rotation is converted to identity)
+	const SquareMatrix3d R(trans.R);
+
 	for (unsigned i = 0; i < count; ++i)
 	{
 		const CCVector3* P = cloud->getPoint(i);
 
 		//P' = s*R.P+T
-		CCVector3 newP = trans.apply(*P);
+		CCVector3 newP = (trans.s * (R * (*P)) + trans.T).toPC();
 		transformedCloud->addPoint(newP);
 
 		if (withNormals)
@@ -270,7 +567,7 @@ PointCloud* PointProjectionTools::applyTransformation(GenericIndexedCloud* cloud
 			const CCVector3* N = cloud->getNormal(i);
 
 			//N' = R.N
-			CCVector3 newN = (trans.R * (*N)).toPC();
+			CCVector3 newN = (R * (*N)).toPC();
 			transformedCloud->addNormal(newN);
 		}
 
@@ -383,54 +680,238 @@ inline bool LexicographicSort(const CCVector2& a, const CCVector2& b)
 	return a.x < b.x || (a.x == b.x && a.y < b.y);
 }
 
+namespace
+{
+	//! Extreme points of a 2D set of points in 8 directions
+	/** They form a convex polygon (inside the convex hull) used to discard most of the
+		points before computing the convex hull (Akl-Toussaint heuristic).
+	**/
+	struct ExtremePoints2D
+	{
+		//! Number of directions
+		static const unsigned COUNT = 8;
+
+		//! Returns the coordinates of a given direction (in counter-clockwise order, starting from -X)
+		static inline void Direction(unsigned d, PointCoordinateType& dx, PointCoordinateType& dy)
+		{
+			static const PointCoordinateType DX[COUNT] = { -1, -1,  0,  1, 1, 1, 0, -1 };
+			static const PointCoordinateType DY[COUNT] = {  0, -1, -1, -1, 0, 1, 1,  1 };
+			dx = DX[d];
+			dy = DY[d];
+		}
+
+		ExtremePoints2D()
+			: values{}
+			, indexes{}
+			, valid(false)
+		{}
+
+		//! Updates the extreme points with the points [begin ; end[
+		void update(const std::vector<PointProjectionTools::IndexedCCVector2>& points, std::size_t begin, std::size_t end)
+		{
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				const CCVector2& P = points[i];
+				for (unsigned d = 0; d < COUNT; ++d)
+				{
+					PointCoordinateType dx = 0;
+					PointCoordinateType dy = 0;
+					Direction(d, dx, dy);
+					PointCoordinateType value = dx * P.x + dy * P.y;
+					if (!valid || value > values[d])
+					{
+						values[d] = value;
+						indexes[d] = i;
+					}
+				}
+				valid = true;
+			}
+		}
+
+		//! Merges with the extreme points of another subset
+		void merge(const ExtremePoints2D& other)
+		{
+			if (!other.valid)
+			{
+				return;
+			}
+			for (unsigned d = 0; d < COUNT; ++d)
+			{
+				if (!valid || other.values[d] > values[d])
+				{
+					values[d] = other.values[d];
+					indexes[d] = other.indexes[d];
+				}
+			}
+			valid = true;
+		}
+
+		PointCoordinateType values[COUNT];
+		std::size_t indexes[COUNT];
+		bool valid;
+	};
+
+	//! Convex polygon used to discard the points that can't be on the convex hull
+	class HullFilter2D
+	{
+	public:
+
+		//! Initializes the polygon from the extreme points (returns false if it is degenerate)
+		bool init(const std::vector<PointProjectionTools::IndexedCCVector2>& points, const ExtremePoints2D& extremePoints)
+		{
+			m_vertexCount = 0;
+			for (unsigned d = 0; d < ExtremePoints2D::COUNT; ++d)
+			{
+				const CCVector2& P = points[extremePoints.indexes[d]];
+				if (m_vertexCount != 0 && m_vertices[m_vertexCount - 1].x == P.x && m_vertices[m_vertexCount - 1].y == P.y)
+				{
+					continue;
+				}
+				m_vertices[m_vertexCount++] = CCVector2d(P.x, P.y);
+			}
+			while (m_vertexCount > 1 && m_vertices[m_vertexCount - 1].x == m_vertices[0].x && m_vertices[m_vertexCount - 1].y == m_vertices[0].y)
+			{
+				--m_vertexCount;
+			}
+			if (m_vertexCount < 3)
+			{
+				return false;
+			}
+
+			for (unsigned i = 0; i < m_vertexCount; ++i)
+			{
+				m_edges[i] = m_vertices[(i + 1) % m_vertexCount] - m_vertices[i];
+			}
+			return true;
+		}
+
+		//! Returns whether a point is strictly inside the polygon (in which case it can't be on the convex hull)
+		inline bool isInside(const CCVector2& P) const
+		{
+			//computed in double precision so as to never discard a point on the hull
+			for (unsigned i = 0; i < m_vertexCount; ++i)
+			{
+				if (m_edges[i].x * (P.y - m_vertices[i].y) - m_edges[i].y * (P.x - m_vertices[i].x) <= 0)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+	protected:
+
+		CCVector2d m_vertices[ExtremePoints2D::COUNT];
+		CCVector2d m_edges[ExtremePoints2D::COUNT];
+		unsigned m_vertexCount = 0;
+	};
+}
+
 bool PointProjectionTools::extractConvexHull2D(	std::vector<IndexedCCVector2>& points,
-												std::list<IndexedCCVector2*>& hullPoints)
+												std::vector<IndexedCCVector2*>& hullPoints,
+												bool multiThread/*=true*/)
 {
-	std::size_t n = points.size();
+	hullPoints.clear();
 
-	// Sort points lexicographically
-	ParallelSort(points.begin(), points.end(), LexicographicSort);
+	std::size_t n = points.size();
+	if (n == 0)
+	{
+		return true;
+	}
 
-	// Build lower hull
+	std::vector<IndexedCCVector2*> candidates;
+	try
 	{
-		for (std::size_t i=0; i<n; i++)
+		//look for the extreme points
+		std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(n, 65536) : 1);
+		std::vector<ExtremePoints2D> chunkExtremePoints(chunkCount);
+		ParallelForHelper::ForEachChunk(n, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
 		{
-			while (hullPoints.size() >= 2)
+			chunkExtremePoints[chunkIndex].update(points, begin, end);
+		}, multiThread);
+
+		ExtremePoints2D extremePoints;
+		for (const ExtremePoints2D& chunk : chunkExtremePoints)
+		{
+			extremePoints.merge(chunk);
+		}
+
+		//discard the points inside the polygon they form
+		HullFilter2D filter;
+		if (filter.init(points, extremePoints))
+		{
+			std::vector< std::vector<IndexedCCVector2*> > chunkCandidates(chunkCount);
+			std::atomic<bool> error(false);
+			ParallelForHelper::ForEachChunk(n, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
 			{
-				std::list<IndexedCCVector2*>::iterator itB = hullPoints.end(); --itB;
-				std::list<IndexedCCVector2*>::iterator itA = itB; --itA;
-				if ((**itB - **itA).cross(points[i] - **itA) <= 0)
+				try
 				{
-					hullPoints.pop_back();
+					std::vector<IndexedCCVector2*>& output = chunkCandidates[chunkIndex];
+					for (std::size_t i = begin; i < end; ++i)
+					{
+						if (!filter.isInside(points[i]))
+						{
+							output.push_back(&points[i]);
+						}
+					}
 				}
-				else
+				catch (const std::bad_alloc&)
 				{
-					break;
+					error = true;
 				}
+			}, multiThread);
+
+			if (error)
+			{
+				return false;
 			}
 
-			try
+			//merge the candidates in the chunks order
+			std::size_t candidateCount = 0;
+			for (const std::vector<IndexedCCVector2*>& chunk : chunkCandidates)
 			{
-				hullPoints.push_back(&points[i]);
+				candidateCount += chunk.size();
 			}
-			catch (const std::bad_alloc&)
+			candidates.reserve(candidateCount);
+			for (std::vector<IndexedCCVector2*>& chunk : chunkCandidates)
 			{
-				//not enough memory
-				return false;
+				candidates.insert(candidates.end(), chunk.begin(), chunk.end());
+				std::vector<IndexedCCVector2*>().swap(chunk);
+			}
+		}
+		else
+		{
+			candidates.resize(n);
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				candidates[i] = &points[i];
 			}
 		}
 	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return false;
+	}
+
+	// Sort the remaining points lexicographically
+	// (duplicate points are sorted by address, so that the result doesn't depend on the sort algorithm)
+	ParallelSort(candidates.begin(), candidates.end(), [](const IndexedCCVector2* a, const IndexedCCVector2* b)
+	{
+		return LexicographicSort(*a, *b) || (a->x == b->x && a->y == b->y && a < b);
+	});
 
-	// Build upper hull
+	std::size_t m = candidates.size();
+	try
 	{
-		std::size_t t = hullPoints.size()+1;
-		for (int i=static_cast<int>(n)-2; i>=0; i--)
+		// Build lower hull
+		for (std::size_t i = 0; i < m; i++)
 		{
-			while (hullPoints.size() >= t)
+			while (hullPoints.size() >= 2)
 			{
-				std::list<IndexedCCVector2*>::iterator itB = hullPoints.end(); --itB;
-				std::list<IndexedCCVector2*>::iterator itA = itB; --itA;
-				if ((**itB - **itA).cross(points[i] - **itA) <= 0)
+				const IndexedCCVector2* A = hullPoints[hullPoints.size() - 2];
+				const IndexedCCVector2* B = hullPoints.back();
+				if ((*B - *A).cross(*candidates[i] - *A) <= 0)
 				{
 					hullPoints.pop_back();
 				}
@@ -439,18 +920,34 @@ bool PointProjectionTools::extractConvexHull2D(	std::vector<IndexedCCVector2>& p
 					break;
 				}
 			}
+			hullPoints.push_back(candidates[i]);
+		}
 
-			try
-			{
-				hullPoints.push_back(&points[i]);
-			}
-			catch (const std::bad_alloc&)
+		// Build upper hull
+		std::size_t t = hullPoints.size() + 1;
+		for (int i = static_cast<int>(m) - 2; i >= 0; i--)
+		{
+			while (hullPoints.size() >= t)
 			{
-				//not enough memory
-				return false;
+				const IndexedCCVector2* A = hullPoints[hullPoints.size() - 2];
+				const IndexedCCVector2* B = hullPoints.back();
+				if ((*B - *A).cross(*candidates[i] - *A) <= 0)
+				{
+					hullPoints.pop_back();
+				}
+				else
+				{
+					break;
+				}
 			}
+			hullPoints.push_back(candidates[i]);
 		}
 	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return false;
+	}
 
 	//remove last point if it's the same as the first one
 	if (hullPoints.size() > 1
@@ -463,6 +960,28 @@ bool PointProjectionTools::extractConvexHull2D(	std::vector<IndexedCCVector2>& p
 	return true;
 }
 
+bool PointProjectionTools::extractConvexHull2D(	std::vector<IndexedCCVector2>& points,
+												std::list<IndexedCCVector2*>& hullPoints)
+{
+	std::vector<IndexedCCVector2*> hull;
+	if (!extractConvexHull2D(points, hull))
+	{
+		return false;
+	}
+
+	try
+	{
+		hullPoints.insert(hullPoints.end(), hull.begin(), hull.end());
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return false;
+	}
+
+	return true;
+}
+
 bool PointProjectionTools::segmentIntersect(const CCVector2& A, const CCVector2& B, const CCVector2& C, const CCVector2& D)
 {
 	CCVector2 AB = B-A;
@@ -522,6 +1041,7 @@ bool PointProjectionTools::segmentIntersect(const CCVector2& A, const CCVector2&
 	}
 }
 
+
 //list of already used point to avoid hull's inner loops
 enum HullPointFlags {	POINT_NOT_USED	= 0,
 						POINT_USED		= 1,
@@ -530,96 +1050,614 @@ enum HullPointFlags {	POINT_NOT_USED	= 0,
 					};
 
 using Vertex2D = PointProjectionTools::IndexedCCVector2;
-using VertexIterator = std::list<Vertex2D *>::iterator;
-using ConstVertexIterator = std::list<Vertex2D *>::const_iterator;
 
 namespace
 {
-	struct Edge
-	{
-		Edge() : nearestPointIndex(0), nearestPointSquareDist(-1.0f) {}
-
-		Edge(const VertexIterator& A, unsigned _nearestPointIndex, float _nearestPointSquareDist)
-			: itA(A)
-			, nearestPointIndex(_nearestPointIndex)
-			, nearestPointSquareDist(_nearestPointSquareDist)
-		{}
-
-		//operator
-		inline bool operator< (const Edge& e) const { return nearestPointSquareDist < e.nearestPointSquareDist; }
-
-		VertexIterator itA;
-		unsigned nearestPointIndex;
-		float nearestPointSquareDist;
-	};
-}
-
-//! Finds the nearest (available) point to an edge
-/** \return The nearest point distance (or -1 if no point was found!)
-**/
-static PointCoordinateType FindNearestCandidate(	unsigned& minIndex,
-													const VertexIterator& itA,
-													const VertexIterator& itB,
-													const std::vector<Vertex2D>& points,
-													const std::vector<HullPointFlags>& pointFlags,
-													PointCoordinateType minSquareEdgeLength,
-													PointCoordinateType maxSquareEdgeLength,
-													bool allowLongerChunks = false)
-{
-	//look for the nearest point in the input set
-	PointCoordinateType minDist2 = -1;
-	CCVector2 AB = **itB - **itA;
-	PointCoordinateType squareLengthAB = AB.norm2();
-	unsigned pointCount = static_cast<unsigned>(points.size());
-	for (unsigned i = 0; i < pointCount; ++i)
+	//! Uniform 2D grid used to speed up the concave hull extraction
+	/** Indexes the input points (to look for the nearest candidate of an edge) and
+		the hull segments (to check that new segments don't intersect the hull).
+	**/
+	class HullGrid2D
 	{
-		const Vertex2D& P = points[i];
-		if (pointFlags[P.index] != POINT_NOT_USED)
-			continue;
-
-		//skip the edge vertices!
-		if (P.index == (*itA)->index || P.index == (*itB)->index)
-			continue;
+	public:
 
-		//we only consider 'inner' points
-		CCVector2 AP = P - **itA;
-		if (AB.x * AP.y - AB.y * AP.x < 0)
+		//! Builds the grid and indexes the points
+		/** \warning May throw std::bad_alloc
+		**/
+		void init(const std::vector<Vertex2D>& points, const CCVector2& minP, const CCVector2& maxP)
 		{
-			continue;
+			//we target a few points per cell
+			static const std::size_t POINTS_PER_CELL = 4;
+			static const std::size_t MAX_CELL_COUNT = (1 << 22);
+			std::size_t targetCellCount = std::min(std::max<std::size_t>(points.size() / POINTS_PER_CELL, 1), MAX_CELL_COUNT);
+
+			CCVector2 D = maxP - minP;
+			PointCoordinateType maxSize = std::max(D.x, D.y);
+			if (maxSize <= 0)
+			{
+				maxSize = 1;
+			}
+			m_cellSize = std::sqrt(D.x * D.y / static_cast<PointCoordinateType>(targetCellCount));
+			//elongated sets of points
+			m_cellSize = std::max(m_cellSize, maxSize / static_cast<PointCoordinateType>(targetCellCount));
+			while (true)
+			{
+				m_width = static_cast<int>(D.x / m_cellSize) + 1;
+				m_height = static_cast<int>(D.y / m_cellSize) + 1;
+				if (static_cast<std::size_t>(m_width) * static_cast<std::size_t>(m_height) <= 4 * targetCellCount + 16)
+				{
+					break;
+				}
+				m_cellSize *= 2;
+			}
+			m_origin = minP;
+			m_diagonal = m_cellSize * std::sqrt(static_cast<PointCoordinateType>(m_width) * m_width + static_cast<PointCoordinateType>(m_height) * m_height);
+
+			//sort the points by cell
+			std::size_t cellCount = static_cast<std::size_t>(m_width) * m_height;
+			m_cellStarts.assign(cellCount + 1, 0);
+			for (const Vertex2D& P : points)
+			{
+				++m_cellStarts[cellIndex(P) + 1];
+			}
+			for (std::size_t i = 0; i < cellCount; ++i)
+			{
+				m_cellStarts[i + 1] += m_cellStarts[i];
+			}
+			m_cellPoints.resize(points.size());
+			std::vector<unsigned> fillCounts(m_cellStarts.begin(), m_cellStarts.end() - 1);
+			for (std::size_t i = 0; i < points.size(); ++i)
+			{
+				m_cellPoints[fillCounts[cellIndex(points[i])]++] = static_cast<unsigned>(i);
+			}
+
+			m_cellFirstSegments.assign(cellCount, static_cast<unsigned>(INVALID_INDEX));
+			m_segments.clear();
+		}
+
+		//! Returns the cell size
+		inline PointCoordinateType cellSize() const { return m_cellSize; }
+		//! Returns the length of the grid diagonal
+		inline PointCoordinateType diagonal() const { return m_diagonal; }
+
+		//! Returns the column of a given abscissa (clamped)
+		inline int cellX(PointCoordinateType x) const { return std::max(0, std::min(m_width - 1, static_cast<int>(std::floor((x - m_origin.x) / m_cellSize)))); }
+		//! Returns the row of a given ordinate (clamped)
+		inline int cellY(PointCoordinateType y) const { return std::max(0, std::min(m_height - 1, static_cast<int>(std::floor((y - m_origin.y) / m_cellSize)))); }
+		//! Returns the index of the cell containing a given point
+		inline std::size_t cellIndex(const CCVector2& P) const { return static_cast<std::size_t>(cellY(P.y)) * m_width + cellX(P.x); }
+		//! Returns the center of a given cell
+		inline CCVector2 cellCenter(int x, int y) const
+		{
+			return CCVector2(	m_origin.x + (static_cast<PointCoordinateType>(x) + static_cast<PointCoordinateType>(0.5)) * m_cellSize,
+								m_origin.y + (static_cast<PointCoordinateType>(y) + static_cast<PointCoordinateType>(0.5)) * m_cellSize);
+		}
+
+		//! Calls func(pointIndex) for all the points of a given cell
+		template <typename Func> void forEachPoint(int x, int y, Func&& func) const
+		{
+			std::size_t index = static_cast<std::size_t>(y) * m_width + x;
+			for (unsigned i = m_cellStarts[index]; i < m_cellStarts[index + 1]; ++i)
+			{
+				func(m_cellPoints[i]);
+			}
 		}
 
-		PointCoordinateType dot = AB.dot(AP); // = cos(PAB) * ||AP|| * ||AB||
-		if (dot >= 0 && dot <= squareLengthAB)
+		//! Calls func(cellIndex) for all the cells crossed by the segment AB (and their neighbours)
+		template <typename Func> void forEachSegmentCell(const CCVector2& A, const CCVector2& B, Func&& func) const
 		{
-			CCVector2 HP = AP - AB * (dot / squareLengthAB);
-			PointCoordinateType dist2 = HP.norm2();
-			if (minDist2 < 0 || dist2 < minDist2)
+			PointCoordinateType minX = std::min(A.x, B.x);
+			PointCoordinateType maxX = std::max(A.x, B.x);
+			int x0 = std::max(cellX(minX) - 1, 0);
+			int x1 = std::min(cellX(maxX) + 1, m_width - 1);
+			for (int x = x0; x <= x1; ++x)
 			{
-				//the 'nearest' point must also be a valid candidate
-				//(i.e. at least one of the created edges is smaller than the original one
-				//and we don't create too small edges!)
-				PointCoordinateType squareLengthAP = AP.norm2();
-				PointCoordinateType squareLengthBP = (P - **itB).norm2();
-				if (	squareLengthAP >= minSquareEdgeLength
-						&&	squareLengthBP >= minSquareEdgeLength
-						&&	(allowLongerChunks || (squareLengthAP < squareLengthAB || squareLengthBP < squareLengthAB))
-						)
+				//part of the segment crossing the column and its neighbours
+				PointCoordinateType y0 = std::min(A.y, B.y);
+				PointCoordinateType y1 = std::max(A.y, B.y);
+				if (A.x != B.x)
+				{
+					PointCoordinateType xStart = std::max(minX, std::min(maxX, m_origin.x + static_cast<PointCoordinateType>(x - 1) * m_cellSize));
+					PointCoordinateType xEnd = std::max(minX, std::min(maxX, m_origin.x + static_cast<PointCoordinateType>(x + 2) * m_cellSize));
+					PointCoordinateType slope = (B.y - A.y) / (B.x - A.x);
+					PointCoordinateType yStart = A.y + (xStart - A.x) * slope;
+					PointCoordinateType yEnd = A.y + (xEnd - A.x) * slope;
+					y0 = std::min(yStart, yEnd);
+					y1 = std::max(yStart, yEnd);
+				}
+
+				int cy0 = std::max(cellY(y0) - 1, 0);
+				int cy1 = std::min(cellY(y1) + 1, m_height - 1);
+				for (int y = cy0; y <= cy1; ++y)
 				{
-					minDist2 = dist2;
-					minIndex = i;
+					func(static_cast<std::size_t>(y) * m_width + x);
 				}
 			}
 		}
-	}
-	return (minDist2 < 0 ? minDist2 : minDist2/squareLengthAB);
+
+		//! Registers a hull segment
+		/** \warning May throw std::bad_alloc
+		**/
+		void addSegment(unsigned vertexA, unsigned vertexB, const CCVector2& A, const CCVector2& B)
+		{
+			forEachSegmentCell(A, B, [&](std::size_t cellIndex)
+			{
+				m_segments.push_back(Segment{ vertexA, vertexB, m_cellFirstSegments[cellIndex] });
+				m_cellFirstSegments[cellIndex] = static_cast<unsigned>(m_segments.size() - 1);
+			});
+		}
+
+		//! Calls func(vertexA, vertexB) for all the segments registered in a given cell
+		/** Segments that have been split since they were registered are also listed.
+		**/
+		template <typename Func> void forEachSegment(std::size_t cellIndex, Func&& func) const
+		{
+			for (unsigned i = m_cellFirstSegments[cellIndex]; i != INVALID_INDEX; i = m_segments[i].next)
+			{
+				func(m_segments[i].vertexA, m_segments[i].vertexB);
+			}
+		}
+
+	protected:
+
+		static const unsigned INVALID_INDEX = 0xFFFFFFFF;
+
+		//! Hull segment (linked list per cell)
+		struct Segment
+		{
+			unsigned vertexA;
+			unsigned vertexB;
+			unsigned next;
+		};
+
+		CCVector2 m_origin;
+		PointCoordinateType m_cellSize = 1;
+		PointCoordinateType m_diagonal = 0;
+		int m_width = 0;
+		int m_height = 0;
+
+		//! Position of the first point of each cell in m_cellPoints (+ total count)
+		std::vector<unsigned> m_cellStarts;
+		//! Points indexes sorted by cell
+		std::vector<unsigned> m_cellPoints;
+		//! First segment of each cell
+		std::vector<unsigned> m_cellFirstSegments;
+		//! Segments
+		std::vector<Segment> m_segments;
+	};
+
+	//! Concave hull extraction
+	/** The hull is stored as a ring of vertices (each vertex points to the next one).
+		The edges to process are stored in an ordered set (the edge with the nearest
+		candidate first, then by insertion order). When a point is inserted in the hull,
+		the edges that had it as nearest candidate are re-evaluated right away, so that
+		the edges are processed in the same order as the original implementation.
+	**/
+	class ConcaveHull2D
+	{
+	public:
+
+		ConcaveHull2D(	std::vector<Vertex2D>& points,
+						std::vector<HullPointFlags>& pointFlags,
+						PointCoordinateType minSquareEdgeLength,
+						PointCoordinateType maxSquareEdgeLength)
+			: m_points(points)
+			, m_pointFlags(pointFlags)
+			, m_minSquareEdgeLength(minSquareEdgeLength)
+			, m_maxSquareEdgeLength(maxSquareEdgeLength)
+			, m_stamp(0)
+			, m_edgeCount(0)
+		{}
+
+		//! Initializes the ring with the convex hull
+		/** \warning May throw std::bad_alloc
+		**/
+		void init(const std::vector<Vertex2D*>& convexHull, const CCVector2& minP, const CCVector2& maxP)
+		{
+			m_grid.init(m_points, minP, maxP);
+
+			std::size_t vertexCount = convexHull.size();
+			m_vertexPoints.resize(vertexCount);
+			m_vertexNext.resize(vertexCount);
+			m_vertexStamps.resize(vertexCount, 0);
+			m_vertexEdges.resize(vertexCount, m_edges.end());
+			for (std::size_t i = 0; i < vertexCount; ++i)
+			{
+				m_vertexPoints[i] = static_cast<unsigned>(convexHull[i] - m_points.data());
+				m_vertexNext[i] = static_cast<unsigned>((i + 1) % vertexCount);
+			}
+			for (std::size_t i = 0; i < vertexCount; ++i)
+			{
+				m_grid.addSegment(static_cast<unsigned>(i), m_vertexNext[i], vertex(static_cast<unsigned>(i)), vertex(m_vertexNext[i]));
+			}
+		}
+
+		//! Refines the hull until nothing changes
+		/** \warning May throw std::bad_alloc
+		**/
+		void process()
+		{
+			unsigned step = 0;
+			bool somethingHasChanged = true;
+			while (somethingHasChanged)
+			{
+				somethingHasChanged = false;
+				++step;
+
+				//build the initial edge list & flag the current hull points
+				m_edges.clear();
+				std::fill(m_vertexEdges.begin(), m_vertexEdges.end(), m_edges.end());
+				m_candidateFirstLinks.assign(m_points.size(), static_cast<unsigned>(INVALID_LINK));
+				m_candidateLinks.clear();
+				unsigned vertexA = 0;
+				do
+				{
+					unsigned vertexB = m_vertexNext[vertexA];
+
+					//we will only process the edges that are longer than the maximum specified length
+					if ((vertex(vertexB) - vertex(vertexA)).norm2() > m_maxSquareEdgeLength)
+					{
+						pushEdge(vertexA, step > 1);
+					}
+
+					m_pointFlags[vertex(vertexA).index] = POINT_USED;
+					vertexA = vertexB;
+				}
+				while (vertexA != 0);
+
+				while (!m_edges.empty())
+				{
+					//current edge (AB)
+					//this should be the edge with the nearest 'candidate'
+					Edge e = *m_edges.begin();
+					m_edges.erase(m_edges.begin());
+					m_vertexEdges[e.vertexA] = m_edges.end();
+
+					unsigned vertexB = m_vertexNext[e.vertexA];
+
+					//nearest point
+					const Vertex2D& P = m_points[e.pointIndex];
+					if (m_pointFlags[P.index] != POINT_NOT_USED)
+					{
+						//DGM: in fact it happens!
+						break;
+					}
+
+					//last check: the new segments must not intersect with the actual hull!
+					if (intersectsHull(e.vertexA, vertexB, P))
+					{
+						continue;
+					}
+
+					//add point to concave hull
+					unsigned vertexP = static_cast<unsigned>(m_vertexPoints.size());
+					m_vertexPoints.push_back(e.pointIndex);
+					m_vertexNext.push_back(vertexB);
+					m_vertexStamps.push_back(0);
+					m_vertexEdges.push_back(m_edges.end());
+					m_vertexNext[e.vertexA] = vertexP;
+					m_grid.addSegment(e.vertexA, vertexP, vertex(e.vertexA), P);
+					m_grid.addSegment(vertexP, vertexB, P, vertex(vertexB));
+
+					//we won't use P anymore!
+					m_pointFlags[P.index] = POINT_USED;
+
+					somethingHasChanged = true;
+
+					//update all edges that were having 'P' as their nearest candidate as well
+					updateCandidateEdges(e.pointIndex);
+
+					//we'll inspect the two new segments later (if necessary)
+					if ((P - vertex(e.vertexA)).norm2() > m_maxSquareEdgeLength)
+					{
+						pushEdge(e.vertexA, false);
+					}
+					if ((vertex(vertexB) - P).norm2() > m_maxSquareEdgeLength)
+					{
+						pushEdge(vertexP, false);
+					}
+				}
+			}
+		}
+
+		//! Returns the hull points (in the same order as the input convex hull)
+		/** \warning May throw std::bad_alloc
+		**/
+		void getHull(std::vector<Vertex2D*>& hullPoints) const
+		{
+			hullPoints.clear();
+			hullPoints.reserve(m_vertexPoints.size());
+			unsigned vertexIndex = 0;
+			do
+			{
+				hullPoints.push_back(&m_points[m_vertexPoints[vertexIndex]]);
+				vertexIndex = m_vertexNext[vertexIndex];
+			}
+			while (vertexIndex != 0);
+		}
+
+	protected:
+
+		//! Edge to process (defined by its first vertex)
+		struct Edge
+		{
+			PointCoordinateType nearestPointSquareDist;
+			unsigned order; //insertion order (for edges with the same distance)
+			unsigned vertexA;
+			unsigned pointIndex; //nearest candidate
+
+			inline bool operator< (const Edge& e) const
+			{
+				return nearestPointSquareDist < e.nearestPointSquareDist || (nearestPointSquareDist == e.nearestPointSquareDist && order < e.order);
+			}
+		};
+
+		using EdgeSet = std::set<Edge>;
+
+		//! Link of the list of the edges having a given nearest candidate
+		struct CandidateLink
+		{
+			unsigned vertexA;
+			unsigned next;
+		};
+
+		static const unsigned INVALID_LINK = 0xFFFFFFFF;
+
+		//! Returns the point associated to a given vertex
+		inline const Vertex2D& vertex(unsigned vertexIndex) const { return m_points[m_vertexPoints[vertexIndex]]; }
+
+		//! Looks for the nearest candidate of an edge and pushes the edge in the set (if a candidate is found)
+		/** \warning May throw std::bad_alloc
+		**/
+		void pushEdge(unsigned vertexA, bool allowLongerChunks)
+		{
+			unsigned nearestPointIndex = 0;
+			PointCoordinateType minSquareDist = findNearestCandidate(nearestPointIndex, vertexA, m_vertexNext[vertexA], allowLongerChunks);
+			if (minSquareDist >= 0)
+			{
+				m_vertexEdges[vertexA] = m_edges.insert(Edge{ minSquareDist, m_edgeCount++, vertexA, nearestPointIndex }).first;
+				m_candidateLinks.push_back(CandidateLink{ vertexA, m_candidateFirstLinks[nearestPointIndex] });
+				m_candidateFirstLinks[nearestPointIndex] = static_cast<unsigned>(m_candidateLinks.size() - 1);
+			}
+		}
+
+		//! Re-evaluates the edges having a given point (just inserted in the hull) as nearest candidate
+		/** \warning May throw std::bad_alloc
+		**/
+		void updateCandidateEdges(unsigned pointIndex)
+		{
+			if (m_edges.empty())
+			{
+				return;
+			}
+
+			std::vector<EdgeSet::iterator> removed;
+			for (unsigned link = m_candidateFirstLinks[pointIndex]; link != INVALID_LINK; link = m_candidateLinks[link].next)
+			{
+				EdgeSet::iterator it = m_vertexEdges[m_candidateLinks[link].vertexA];
+				if (it != m_edges.end() && it->pointIndex == pointIndex)
+				{
+					removed.push_back(it);
+				}
+			}
+			if (removed.empty())
+			{
+				return;
+			}
+
+			//we process the edges in the set order
+			std::sort(removed.begin(), removed.end(), [](const EdgeSet::iterator& a, const EdgeSet::iterator& b) { return *a < *b; });
+			removed.erase(std::unique(removed.begin(), removed.end()), removed.end());
+
+			//the original implementation never updated the second edge of the set if the first one was updated
+			//(the edge is then left with an invalid candidate, which stops the current step when it is processed)
+			if (removed.size() > 1 && removed[0] == m_edges.begin() && removed[1] == std::next(m_edges.begin()))
+			{
+				removed.erase(removed.begin() + 1);
+			}
+
+			std::vector<unsigned> vertices;
+			vertices.reserve(removed.size());
+			for (EdgeSet::iterator it : removed)
+			{
+				vertices.push_back(it->vertexA);
+				m_vertexEdges[it->vertexA] = m_edges.end();
+				m_edges.erase(it);
+			}
+
+			//put them back with their new candidate
+			for (unsigned vertexA : vertices)
+			{
+				pushEdge(vertexA, false);
+			}
+		}
+
+		//! Finds the nearest (available) point to an edge
+		/** The search area (the band of points on the inner side of the edge that project
+			inside the edge) is progressively enlarged until the nearest point is found.
+			\return The nearest point distance (or -1 if no point was found!)
+		**/
+		PointCoordinateType findNearestCandidate(unsigned& minIndex, unsigned vertexA, unsigned vertexB, bool allowLongerChunks) const
+		{
+			const Vertex2D& A = vertex(vertexA);
+			const Vertex2D& B = vertex(vertexB);
+
+			PointCoordinateType minDist2 = -1;
+			CCVector2 AB = B - A;
+			PointCoordinateType squareLengthAB = AB.norm2();
+			PointCoordinateType lengthAB = std::sqrt(squareLengthAB);
+			if (lengthAB == 0)
+			{
+				return minDist2;
+			}
+			CCVector2 u = AB / lengthAB;
+			CCVector2 n(-u.y, u.x); //towards the inner side
+
+			auto testPoint = [&](unsigned i)
+			{
+				const Vertex2D& P = m_points[i];
+				if (m_pointFlags[P.index] != POINT_NOT_USED)
+					return;
+
+				//skip the edge vertices!
+				if (P.index == A.index || P.index == B.index)
+					return;
+
+				//we only consider 'inner' points
+				CCVector2 AP = P - A;
+				if (AB.x * AP.y - AB.y * AP.x < 0)
+				{
+					return;
+				}
+
+				PointCoordinateType dot = AB.dot(AP); // = cos(PAB) * ||AP|| * ||AB||
+				if (dot >= 0 && dot <= squareLengthAB)
+				{
+					CCVector2 HP = AP - AB * (dot / squareLengthAB);
+					PointCoordinateType dist2 = HP.norm2();
+					//for equal distances, we keep the first point in lexicographic order
+					//(as the exhaustive search did on the sorted points)
+					if (minDist2 < 0 || dist2 < minDist2 || (dist2 == minDist2 && LexicographicSort(P, m_points[minIndex])))
+					{
+						//the 'nearest' point must also be a valid candidate
+						//(i.e. at least one of the created edges is smaller than the original one
+						//and we don't create too small edges!)
+						PointCoordinateType squareLengthAP = AP.norm2();
+						PointCoordinateType squareLengthBP = (P - B).norm2();
+						if (	squareLengthAP >= m_minSquareEdgeLength
+							&&	squareLengthBP >= m_minSquareEdgeLength
+							&&	(allowLongerChunks || (squareLengthAP < squareLengthAB || squareLengthBP < squareLengthAB))
+							)
+						{
+							minDist2 = dist2;
+							minIndex = i;
+						}
+					}
+				}
+			};
+
+			PointCoordinateType margin = m_grid.cellSize();
+			PointCoordinateType width = m_grid.cellSize();
+			while (true)
+			{
+				//bounding box of the search area
+				CCVector2 C = A + n * width;
+				CCVector2 D = B + n * width;
+				int x0 = m_grid.cellX(std::min(std::min(A.x, B.x), std::min(C.x, D.x)) - margin);
+				int x1 = m_grid.cellX(std::max(std::max(A.x, B.x), std::max(C.x, D.x)) + margin);
+				int y0 = m_grid.cellY(std::min(std::min(A.y, B.y), std::min(C.y, D.y)) - margin);
+				int y1 = m_grid.cellY(std::max(std::max(A.y, B.y), std::max(C.y, D.y)) + margin);
+
+				for (int y = y0; y <= y1; ++y)
+				{
+					for (int x = x0; x <= x1; ++x)
+					{
+						//skip the cells that are too far from the search area
+						CCVector2 AC = m_grid.cellCenter(x, y) - A;
+						PointCoordinateType s = u.dot(AC);
+						PointCoordinateType t = n.dot(AC);
+						if (s < -margin || s > lengthAB + margin || t < -margin || t > width + margin)
+						{
+							continue;
+						}
+						m_grid.forEachPoint(x, y, testPoint);
+					}
+				}
+
+				//all the points closer than 'width' have been tested
+				if ((minDist2 >= 0 && minDist2 <= width * width) || width >= m_grid.diagonal())
+				{
+					break;
+				}
+				width *= 2;
+			}
+
+			return (minDist2 < 0 ? minDist2 : minDist2 / squareLengthAB);
+		}
+
+		//! Checks whether the segments AP and PB would intersect the current hull
+		bool intersectsHull(unsigned vertexA, unsigned vertexB, const Vertex2D& P)
+		{
+			const Vertex2D& A = vertex(vertexA);
+			const Vertex2D& B = vertex(vertexB);
+
+			bool intersect = false;
+			auto testSegment = [&](const Vertex2D& C, const Vertex2D& D)
+			{
+				++m_stamp;
+				m_grid.forEachSegmentCell(C, D, [&](std::size_t cellIndex)
+				{
+					if (intersect)
+					{
+						return;
+					}
+					m_grid.forEachSegment(cellIndex, [&](unsigned vertexI, unsigned vertexJ)
+					{
+						//skip the segments that have been split since then (and the ones already tested)
+						if (intersect || m_vertexNext[vertexI] != vertexJ || m_vertexStamps[vertexI] == m_stamp)
+						{
+							return;
+						}
+						m_vertexStamps[vertexI] = m_stamp;
+
+						const Vertex2D& I = vertex(vertexI);
+						const Vertex2D& J = vertex(vertexJ);
+						if (	I.index != C.index && J.index != C.index && I.index != D.index && J.index != D.index
+							&&	PointProjectionTools::segmentIntersect(I, J, C, D))
+						{
+							intersect = true;
+						}
+					});
+				});
+			};
+
+			testSegment(A, P);
+			if (!intersect)
+			{
+				testSegment(P, B);
+			}
+
+			return intersect;
+		}
+
+	protected:
+
+		std::vector<Vertex2D>& m_points;
+		std::vector<HullPointFlags>& m_pointFlags;
+		PointCoordinateType m_minSquareEdgeLength;
+		PointCoordinateType m_maxSquareEdgeLength;
+
+		//! Grid (points and hull segments)
+		HullGrid2D m_grid;
+
+		//! Point index of each hull vertex
+		std::vector<unsigned> m_vertexPoints;
+		//! Next vertex of each hull vertex
+		std::vector<unsigned> m_vertexNext;
+		//! Last time each vertex segment was tested (see intersectsHull)
+		std::vector<unsigned> m_vertexStamps;
+		unsigned m_stamp;
+
+		//! Edges to process
+		EdgeSet m_edges;
+		//! Number of edges pushed so far (insertion order)
+		unsigned m_edgeCount;
+		//! Position of the edge of each vertex in the set (or m_edges.end())
+		std::vector<EdgeSet::iterator> m_vertexEdges;
+		//! First link of the list of the edges having each point as nearest candidate
+		std::vector<unsigned> m_candidateFirstLinks;
+		//! Lists of the edges having a given nearest candidate (some links may be outdated)
+		std::vector<CandidateLink> m_candidateLinks;
+	};
 }
 
 bool PointProjectionTools::extractConcaveHull2D(std::vector<IndexedCCVector2>& points,
-												std::list<IndexedCCVector2*>& hullPoints,
-												PointCoordinateType maxSquareEdgeLength/*=0*/)
+												std::vector<IndexedCCVector2*>& hullPoints,
+												PointCoordinateType maxSquareEdgeLength/*=0*/,
+												bool multiThread/*=true*/)
 {
 	//first compute the Convex hull
-	if (!extractConvexHull2D(points, hullPoints))
+	if (!extractConvexHull2D(points, hullPoints, multiThread))
 		return false;
 
 	//do we really need to compute the concave hull?
@@ -641,9 +1679,9 @@ bool PointProjectionTools::extractConcaveHull2D(std::vector<IndexedCCVector2>& p
 
 	//hack: compute the theoretical 'minimal' edge length
 	PointCoordinateType minSquareEdgeLength = 0;
+	CCVector2 minP;
+	CCVector2 maxP;
 	{
-		CCVector2 minP;
-		CCVector2 maxP;
 		for (std::size_t i = 0; i < pointCount; ++i)
 		{
 			const IndexedCCVector2& P = points[i];
@@ -663,15 +1701,20 @@ bool PointProjectionTools::extractConcaveHull2D(std::vector<IndexedCCVector2>& p
 		minSquareEdgeLength = std::min(minSquareEdgeLength, maxSquareEdgeLength / 10);
 
 		//we remove very small edges
-		for (std::list<IndexedCCVector2*>::iterator itA = hullPoints.begin(); itA != hullPoints.end(); ++itA)
+		for (std::size_t a = 0; a < hullPoints.size(); ++a)
 		{
-			std::list<IndexedCCVector2*>::iterator itB = itA; ++itB;
-			if (itB == hullPoints.end())
-				itB = hullPoints.begin();
-			if ((**itB-**itA).norm2() < minSquareEdgeLength)
+			std::size_t b = a + 1;
+			if (b == hullPoints.size())
+				b = 0;
+			if ((*hullPoints[b] - *hullPoints[a]).norm2() < minSquareEdgeLength)
 			{
-				pointFlags[(*itB)->index] = POINT_FROZEN;
-				hullPoints.erase(itB);
+				pointFlags[hullPoints[b]->index] = POINT_FROZEN;
+				hullPoints.erase(hullPoints.begin() + b);
+				if (b == 0)
+				{
+					//'a' was the last vertex
+					break;
+				}
 			}
 		}
 
@@ -683,235 +1726,237 @@ bool PointProjectionTools::extractConcaveHull2D(std::vector<IndexedCCVector2>& p
 	}
 
 	//we repeat the process until nothing changes!
-	//Warning: high STL containers usage ahead ;)
-	unsigned step = 0;
-	bool somethingHasChanged = true;
-	while (somethingHasChanged)
+	try
 	{
-		try
-		{
-			somethingHasChanged = false;
-			++step;
-
-			////reset point flags
-			//for (std::size_t i=0; i<pointCount; ++i)
-			//{
-			//	if (pointFlags[i] != POINT_FROZEN)
-			//		pointFlags[i] = POINT_NOT_USED;
-			//}
+		ConcaveHull2D concaveHull(points, pointFlags, minSquareEdgeLength, maxSquareEdgeLength);
+		concaveHull.init(hullPoints, minP, maxP);
+		concaveHull.process();
+		concaveHull.getHull(hullPoints);
+	}
+	catch (...)
+	{
+		//not enough memory
+		return false;
+	}
 
-			//build the initial edge list & flag the convex hull points
-			std::multiset<Edge> edges;
-			{
-				for (std::list<IndexedCCVector2*>::iterator itA = hullPoints.begin(); itA != hullPoints.end(); ++itA)
-				{
-					std::list<IndexedCCVector2*>::iterator itB = itA; ++itB;
-					if (itB == hullPoints.end())
-						itB = hullPoints.begin();
+	return true;
+}
 
-					//we will only process the edges that are longer than the maximum specified length
-					if ((**itB - **itA).norm2() > maxSquareEdgeLength)
-					{
-						unsigned nearestPointIndex = 0;
-						PointCoordinateType minSquareDist = FindNearestCandidate(
-																nearestPointIndex,
-																itA,
-																itB,
-																points,
-																pointFlags,
-																minSquareEdgeLength,
-																maxSquareEdgeLength,
-																step > 1);
-
-						if (minSquareDist >= 0)
-						{
-							Edge e(itA, nearestPointIndex, minSquareDist);
-							edges.insert(e);
-						}
-					}
+bool PointProjectionTools::extractConcaveHull2D(std::vector<IndexedCCVector2>& points,
+												std::list<IndexedCCVector2*>& hullPoints,
+												PointCoordinateType maxSquareEdgeLength/*=0*/)
+{
+	std::vector<IndexedCCVector2*> hull;
+	if (!extractConcaveHull2D(points, hull, maxSquareEdgeLength))
+	{
+		return false;
+	}
 
-					pointFlags[(*itA)->index] = POINT_USED;
-				}
-			}
+	try
+	{
+		hullPoints.insert(hullPoints.end(), hull.begin(), hull.end());
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return false;
+	}
 
-			while (!edges.empty())
-			{
-				//current edge (AB)
-				//this should be the edge with the nearest 'candidate'
-				Edge e = *edges.begin();
-				edges.erase(edges.begin());
+	return true;
+}
 
-				VertexIterator itA = e.itA;
-				VertexIterator itB = itA; ++itB;
-				if (itB == hullPoints.end())
-					itB = hullPoints.begin();
+void PointProjectionTools::Transformation::apply(GenericIndexedCloudPersist& cloud) const
+{
+	//fixed-size copy of the rotation (an invalid rotation is converted to identity)
+	const SquareMatrix3d R3(R);
 
-				//nearest point
-				const Vertex2D& P = points[e.nearestPointIndex];
-				if (pointFlags[P.index] != POINT_NOT_USED)
-				{
-					//assert(false); //DGM: in fact it happens!
-					break;
-				}
+	for (unsigned i = 0; i < cloud.size(); ++i)
+	{
+		CCVector3* P = const_cast<CCVector3*>(cloud.getPoint(i));
+		*P = (s * (R3 * (*P)) + T).toPC();
+	}
 
-				//check that we don't create too small edges!
-				//CCVector2 AP = (P-**itA);
-				//CCVector2 PB = (**itB-P);
-				//PointCoordinateType squareLengthAP = (P-**itA).norm2();
-				//PointCoordinateType squareLengthPB = (**itB-P).norm2();
-				////at least one of the new segments must be smaller than the initial one!
-				//assert( squareLengthAP < e.squareLength || squareLengthPB < e.squareLength );
-				//if (squareLengthAP < minSquareEdgeLength || squareLengthPB < minSquareEdgeLength)
-				//{
-				//	pointFlags[P.index] = POINT_IGNORED;
-				//	edges.push(e); //retest the edge!
-				//}
-
-				//last check: the new segments must not intersect with the actual hull!
-				bool intersect = false;
-				//if (false)
-				{
-					for (VertexIterator itJ = hullPoints.begin(), itI = itJ++; itI != hullPoints.end(); ++itI, ++itJ)
-					{
-						if (itJ == hullPoints.end())
-							itJ = hullPoints.begin();
+	if (cloud.normalsAvailable())
+	{
+		for (unsigned i = 0; i < cloud.size(); ++i)
+		{
+			CCVector3* N = const_cast<CCVector3*>(cloud.getNormal(i));
+			*N = (R3 * (*N)).toPC();
+		}
+	}
+}
 
-						if (	((*itI)->index != (*itA)->index && (*itJ)->index != (*itA)->index && PointProjectionTools::segmentIntersect(**itI,**itJ,**itA,P))
-								||	((*itI)->index != (*itB)->index && (*itJ)->index != (*itB)->index && PointProjectionTools::segmentIntersect(**itI,**itJ,P,**itB)) )
-						{
-							intersect = true;
-							break;
-						}
-					}
-				}
+//! Transformation coefficients stored in plain arrays (see TransformPoints)
+struct TransformationCoefs
+{
+	explicit TransformationCoefs(const PointProjectionTools::Transformation& trans)
+		: R(trans.R) //an invalid rotation is converted to identity
+		, T(trans.T)
+		, s(trans.s)
+	{}
+
+	SquareMatrix3d R;
+	CCVector3d T;
+	double s;
+};
+
+//! Transforms a set of points (and normals) and returns their bounding-box
+/** Same computation as Transformation::apply. 'input' and 'output' can be the same.
+**/
+static BoundingBox TransformPoints(	const TransformationCoefs& coefs,
+									const CCVector3* input,
+									CCVector3* output,
+									const CCVector3* inputNormals,
+									CCVector3* outputNormals,
+									std::size_t count)
+{
+	const double (&R)[3][3] = coefs.R.m_values;
 
-				if (!intersect)
-				{
-					//add point to concave hull
-					VertexIterator itP = hullPoints.insert(itB == hullPoints.begin() ? hullPoints.end() : itB, &points[e.nearestPointIndex]);
+	BoundingBox bbox;
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		//P' = s*R.P+T
+		const CCVector3& P = input[i];
+		CCVector3 newP(	static_cast<PointCoordinateType>(coefs.s * (R[0][0] * P.x + R[0][1] * P.y + R[0][2] * P.z) + coefs.T.x),
+						static_cast<PointCoordinateType>(coefs.s * (R[1][0] * P.x + R[1][1] * P.y + R[1][2] * P.z) + coefs.T.y),
+						static_cast<PointCoordinateType>(coefs.s * (R[2][0] * P.x + R[2][1] * P.y + R[2][2] * P.z) + coefs.T.z) );
+		output[i] = newP;
+		bbox.add(newP);
+	}
 
-					//we won't use P anymore!
-					pointFlags[P.index] = POINT_USED;
+	if (inputNormals)
+	{
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			//N' = R.N
+			const CCVector3& N = inputNormals[i];
+			outputNormals[i] = CCVector3(	static_cast<PointCoordinateType>(R[0][0] * N.x + R[0][1] * N.y + R[0][2] * N.z),
+											static_cast<PointCoordinateType>(R[1][0] * N.x + R[1][1] * N.y + R[1][2] * N.z),
+											static_cast<PointCoordinateType>(R[2][0] * N.x + R[2][1] * N.y + R[2][2] * N.z) );
+		}
+	}
 
-					somethingHasChanged = true;
+	return bbox;
+}
 
-					//update all edges that were having 'P' as their nearest candidate as well
-					if (!edges.empty())
-					{
-						std::vector<VertexIterator> removed;
-						std::multiset<Edge>::const_iterator lastValidIt = edges.end();
-						for (std::multiset<Edge>::const_iterator it = edges.begin(); it != edges.end(); ++it)
-						{
-							if ((*it).nearestPointIndex == e.nearestPointIndex)
-							{
-								//we'll have to put them back afterwards!
-								removed.push_back((*it).itA);
-
-								edges.erase(it);
-								if (edges.empty())
-									break;
-								if (lastValidIt != edges.end())
-									it = lastValidIt;
-								else
-									it = edges.begin();
-							}
-							else
-							{
-								lastValidIt = it;
-							}
-						}
+void PointProjectionTools::applyTransformation(	PointCloud& cloud,
+													const Transformation& trans,
+													bool multiThread/*=true*/,
+													int maxThreadCount/*=0*/)
+{
+	unsigned count = cloud.size();
+	if (count == 0)
+	{
+		return;
+	}
 
-						//update the removed edges info and put them back in the main list
-						for (std::size_t i = 0; i < removed.size(); ++i)
-						{
-							VertexIterator itC = removed[i];
-							VertexIterator itD = itC; ++itD;
-							if (itD == hullPoints.end())
-								itD = hullPoints.begin();
-
-							unsigned nearestPointIndex = 0;
-							PointCoordinateType minSquareDist = FindNearestCandidate(
-																	nearestPointIndex,
-																	itC,
-																	itD,
-																	points,
-																	pointFlags,
-																	minSquareEdgeLength,
-																	maxSquareEdgeLength);
-
-							if (minSquareDist >= 0)
-							{
-								Edge newEdge(itC, nearestPointIndex, minSquareDist);
-								edges.insert(newEdge);
-							}
-						}
-					}
+	TransformationCoefs coefs(trans);
+	CCVector3* points = const_cast<CCVector3*>(cloud.getPointPersistentPtr(0));
+	CCVector3* normals = (cloud.normalsAvailable() ? cloud.normals().data() : nullptr);
 
-					//we'll inspect the two new segments later (if necessary)
-					if ((P - **itA).norm2() > maxSquareEdgeLength)
-					{
-						unsigned nearestPointIndex = 0;
-						PointCoordinateType minSquareDist = FindNearestCandidate(
-																nearestPointIndex,
-																itA,
-																itP,
-																points,
-																pointFlags,
-																minSquareEdgeLength,
-																maxSquareEdgeLength);
-
-						if (minSquareDist >= 0)
-						{
-							Edge newEdge(itA, nearestPointIndex, minSquareDist);
-							edges.insert(newEdge);
-						}
-					}
+	//each chunk computes its own bounding-box
+	std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(count, 4096, maxThreadCount) : 1);
+	std::vector<BoundingBox> chunkBBoxes;
+	try
+	{
+		chunkBBoxes.resize(chunkCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory (very unlikely!): we'll do it without the chunk bounding-boxes
+		chunkCount = 1;
+	}
 
-					if ((**itB-P).norm2() > maxSquareEdgeLength)
-					{
-						unsigned nearestPointIndex = 0;
-						PointCoordinateType minSquareDist = FindNearestCandidate(
-																nearestPointIndex,
-																itP,
-																itB,
-																points,
-																pointFlags,
-																minSquareEdgeLength,
-																maxSquareEdgeLength);
-
-						if (minSquareDist >= 0)
-						{
-							Edge newEdge(itP, nearestPointIndex, minSquareDist);
-							edges.insert(newEdge);
-						}
-					}
-				}
-			}
-		}
-		catch (...)
+	ParallelForHelper::ForEachChunk(count, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
+	{
+		BoundingBox bbox = TransformPoints(coefs, points + begin, points + begin, normals ? normals + begin : nullptr, normals ? normals + begin : nullptr, end - begin);
+		if (!chunkBBoxes.empty())
 		{
-			//not enough memory
-			return false;
+			chunkBBoxes[chunkIndex] = bbox;
 		}
+	}, multiThread, maxThreadCount);
+
+	if (chunkBBoxes.empty())
+	{
+		cloud.invalidateBoundingBox();
+		return;
 	}
 
-	return true;
+	BoundingBox bbox;
+	for (const BoundingBox& chunkBBox : chunkBBoxes)
+	{
+		bbox += chunkBBox;
+	}
+	cloud.setBoundingBox(bbox);
 }
 
-void PointProjectionTools::Transformation::apply(GenericIndexedCloudPersist& cloud) const
+bool PointProjectionTools::applyTransformation(	const GenericIndexedCloud& cloud,
+												const Transformation& trans,
+												PointCloud& output,
+												bool multiThread/*=true*/,
+												int maxThreadCount/*=0*/)
 {
-	for (unsigned i = 0; i < cloud.size(); ++i)
+	unsigned count = cloud.size();
+	bool withNormals = cloud.normalsAvailable();
+
+	std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(count, 4096, maxThreadCount) : 1);
+	std::vector<BoundingBox> chunkBBoxes;
+	try
 	{
-		CCVector3* P = const_cast<CCVector3*>(cloud.getPoint(i));
-		*P = apply(*P);
+		if (!output.resize(count))
+		{
+			//not enough memory
+			return false;
+		}
+		output.normals().resize(withNormals ? count : 0);
+		chunkBBoxes.resize(chunkCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return false;
 	}
 
-	if (cloud.normalsAvailable())
+	if (count == 0)
 	{
-		for (unsigned i = 0; i < cloud.size(); ++i)
+		output.invalidateBoundingBox();
+		return true;
+	}
+
+	TransformationCoefs coefs(trans);
+	CCVector3* outputPoints = const_cast<CCVector3*>(output.getPointPersistentPtr(0));
+	CCVector3* outputNormals = (withNormals ? output.normals().data() : nullptr);
+
+	ParallelForHelper::ForEachChunk(count, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
+	{
+		//we copy the input points by small batches, so as to process them as contiguous arrays
+		static const std::size_t BATCH_SIZE = 256;
+		CCVector3 points[BATCH_SIZE];
+		CCVector3 normals[BATCH_SIZE];
+
+		BoundingBox bbox;
+		for (std::size_t batchStart = begin; batchStart < end; batchStart += BATCH_SIZE)
 		{
-			CCVector3* N = const_cast<CCVector3*>(cloud.getNormal(i));
-			*N = (R * (*N)).toPC();
+			std::size_t batchSize = std::min(BATCH_SIZE, end - batchStart);
+			for (std::size_t i = 0; i < batchSize; ++i)
+			{
+				cloud.getPoint(static_cast<unsigned>(batchStart + i), points[i]);
+				if (withNormals)
+				{
+					normals[i] = *cloud.getNormal(static_cast<unsigned>(batchStart + i));
+				}
+			}
+			bbox += TransformPoints(coefs, points, outputPoints + batchStart, withNormals ? normals : nullptr, withNormals ? outputNormals + batchStart : nullptr, batchSize);
 		}
+		chunkBBoxes[chunkIndex] = bbox;
+	}, multiThread, maxThreadCount);
+
+	BoundingBox bbox;
+	for (const BoundingBox& chunkBBox : chunkBBoxes)
+	{
+		bbox += chunkBBox;
 	}
+	output.setBoundingBox(bbox);
+
+	return true;
 }
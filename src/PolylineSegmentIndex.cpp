@@ -0,0 +1,264 @@
+// SPDX-License-Identifier: LGPL-2.0-or-later
+// Copyright © CloudCompare Project
+
+#include "PolylineSegmentIndex.h"
+
+//local
+#include "DistanceComputationTools.h"
+#include "GenericIndexedCloud.h"
+#include "ParallelForHelper.h"
+#include "Polyline.h"
+
+//system
+#include <cassert>
+#include <limits>
+
+using namespace CCCoreLib;
+
+PolylineSegmentIndex::PolylineSegmentIndex()
+{
+}
+
+void PolylineSegmentIndex::clear()
+{
+	m_vertices.clear();
+	m_abscissas.clear();
+	m_nodes.clear();
+	m_segmentIndexes.clear();
+}
+
+bool PolylineSegmentIndex::build(const Polyline& polyline, bool useClosingSegment/*=true*/, unsigned maxLeafSize/*=4*/)
+{
+	clear();
+
+	unsigned vertexCount = polyline.size();
+	if (vertexCount < 2)
+	{
+		return false;
+	}
+	bool closed = (useClosingSegment && polyline.isClosed());
+	unsigned segmentCount = (closed ? vertexCount : vertexCount - 1);
+
+	std::vector<CCVector3> centers;
+	try
+	{
+		m_vertices.resize(segmentCount + 1);
+		m_abscissas.resize(segmentCount + 1);
+		m_segmentIndexes.resize(segmentCount);
+		centers.resize(segmentCount);
+		//a balanced binary tree has less than 2 * (number of leaves) nodes
+		m_nodes.reserve(2 * ((segmentCount + std::max(maxLeafSize, 1u) - 1) / std::max(maxLeafSize, 1u)));
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		clear();
+		return false;
+	}
+
+	for (unsigned i = 0; i < vertexCount; ++i)
+	{
+		polyline.getPoint(i, m_vertices[i]);
+	}
+	if (closed)
+	{
+		m_vertices.back() = m_vertices.front();
+	}
+
+	m_abscissas[0] = 0.0;
+	for (unsigned i = 0; i < segmentCount; ++i)
+	{
+		m_abscissas[i + 1] = m_abscissas[i] + (m_vertices[i + 1] - m_vertices[i]).normd();
+		centers[i] = (m_vertices[i] + m_vertices[i + 1]) / 2;
+		m_segmentIndexes[i] = i;
+	}
+
+	try
+	{
+		buildNode(0, segmentCount, centers, std::max(maxLeafSize, 1u));
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		clear();
+		return false;
+	}
+
+	return true;
+}
+
+unsigned PolylineSegmentIndex::buildNode(unsigned begin, unsigned end, const std::vector<CCVector3>& centers, unsigned maxLeafSize)
+{
+	assert(begin < end);
+
+	unsigned nodeIndex = static_cast<unsigned>(m_nodes.size());
+	m_nodes.emplace_back(); //may throw std::bad_alloc
+
+	//bounding-box of the segments and of their centers
+	CCVector3 bbMin = m_vertices[m_segmentIndexes[begin]];
+	CCVector3 bbMax = bbMin;
+	CCVector3 centersMin = centers[m_segmentIndexes[begin]];
+	CCVector3 centersMax = centersMin;
+	for (unsigned i = begin; i < end; ++i)
+	{
+		unsigned segmentIndex = m_segmentIndexes[i];
+		const CCVector3& A = m_vertices[segmentIndex];
+		const CCVector3& B = m_vertices[segmentIndex + 1];
+		const CCVector3& C = centers[segmentIndex];
+		for (unsigned char d = 0; d < 3; ++d)
+		{
+			bbMin.u[d] = std::min(bbMin.u[d], std::min(A.u[d], B.u[d]));
+			bbMax.u[d] = std::max(bbMax.u[d], std::max(A.u[d], B.u[d]));
+			centersMin.u[d] = std::min(centersMin.u[d], C.u[d]);
+			centersMax.u[d] = std::max(centersMax.u[d], C.u[d]);
+		}
+	}
+	m_nodes[nodeIndex].bbMin = bbMin;
+	m_nodes[nodeIndex].bbMax = bbMax;
+
+	unsigned count = end - begin;
+	if (count <= maxLeafSize)
+	{
+		m_nodes[nodeIndex].rightOrFirst = begin;
+		m_nodes[nodeIndex].count = count;
+		return nodeIndex;
+	}
+
+	//split the segments at the median of their centers along the largest dimension
+	CCVector3 extent = centersMax - centersMin;
+	unsigned char splitDim = (extent.x >= extent.y ? (extent.x >= extent.z ? 0 : 2) : (extent.y >= extent.z ? 1 : 2));
+	unsigned mid = begin + count / 2;
+	std::nth_element(	m_segmentIndexes.begin() + begin,
+						m_segmentIndexes.begin() + mid,
+						m_segmentIndexes.begin() + end,
+						[&](unsigned a, unsigned b) { return centers[a].u[splitDim] < centers[b].u[splitDim]; });
+
+	buildNode(begin, mid, centers, maxLeafSize); //left child = nodeIndex + 1
+	unsigned rightIndex = buildNode(mid, end, centers, maxLeafSize);
+
+	m_nodes[nodeIndex].rightOrFirst = rightIndex;
+	m_nodes[nodeIndex].count = 0;
+	return nodeIndex;
+}
+
+bool PolylineSegmentIndex::findNearestSegment(	const CCVector3& queryPoint,
+												ScalarType& squareDistance,
+												unsigned* segmentIndex/*=nullptr*/,
+												double* curvilinearAbscissa/*=nullptr*/) const
+{
+	if (m_nodes.empty())
+	{
+		return false;
+	}
+
+	ScalarType bestSquareDist = std::numeric_limits<ScalarType>::infinity();
+	unsigned bestIndex = 0;
+
+	//nodes to visit, with the distance to their bounding-box
+	//(the tree is balanced so its depth is less than 32)
+	struct StackItem
+	{
+		unsigned nodeIndex;
+		PointCoordinateType squareDist;
+	};
+	StackItem stack[64];
+	unsigned stackSize = 0;
+	stack[stackSize++] = { 0, SquareDistToNode(queryPoint, m_nodes[0]) };
+
+	while (stackSize != 0)
+	{
+		const StackItem item = stack[--stackSize];
+		if (item.squareDist > bestSquareDist)
+		{
+			//this node can't contain a closer segment
+			continue;
+		}
+
+		const Node& node = m_nodes[item.nodeIndex];
+		if (node.count != 0)
+		{
+			//leaf
+			for (unsigned i = node.rightOrFirst; i < node.rightOrFirst + node.count; ++i)
+			{
+				unsigned index = m_segmentIndexes[i];
+				ScalarType squareDist = DistanceComputationTools::computePoint2LineSegmentDistSquared(&queryPoint, &m_vertices[index], &m_vertices[index + 1]);
+				//in case of equality, we keep the first segment (for the sake of reproducibility)
+				if (squareDist < bestSquareDist || (squareDist == bestSquareDist && index < bestIndex))
+				{
+					bestSquareDist = squareDist;
+					bestIndex = index;
+				}
+			}
+		}
+		else
+		{
+			//inner node: we visit the closest child first
+			unsigned leftIndex = item.nodeIndex + 1;
+			unsigned rightIndex = node.rightOrFirst;
+			PointCoordinateType leftSquareDist = SquareDistToNode(queryPoint, m_nodes[leftIndex]);
+			PointCoordinateType rightSquareDist = SquareDistToNode(queryPoint, m_nodes[rightIndex]);
+			assert(stackSize + 2 <= 64);
+			if (leftSquareDist <= rightSquareDist)
+			{
+				stack[stackSize++] = { rightIndex, rightSquareDist };
+				stack[stackSize++] = { leftIndex, leftSquareDist };
+			}
+			else
+			{
+				stack[stackSize++] = { leftIndex, leftSquareDist };
+				stack[stackSize++] = { rightIndex, rightSquareDist };
+			}
+		}
+	}
+
+	squareDistance = bestSquareDist;
+	if (segmentIndex)
+	{
+		*segmentIndex = bestIndex;
+	}
+	if (curvilinearAbscissa)
+	{
+		//same projection as DistanceComputationTools::computePoint2LineSegmentDistSquared
+		const CCVector3& start = m_vertices[bestIndex];
+		const CCVector3& end = m_vertices[bestIndex + 1];
+		CCVector3 line = end - start;
+		PointCoordinateType t = line.dot(queryPoint - start);
+		PointCoordinateType normSq = line.norm2();
+		if (normSq != 0)
+		{
+			t /= normSq;
+		}
+		t = std::max(std::min(t, static_cast<PointCoordinateType>(1)), static_cast<PointCoordinateType>(0));
+		*curvilinearAbscissa = m_abscissas[bestIndex] + t * (m_abscissas[bestIndex + 1] - m_abscissas[bestIndex]);
+	}
+
+	return true;
+}
+
+bool PolylineSegmentIndex::findNearestSegments(	const GenericIndexedCloud& cloud,
+												ScalarType* squareDistances,
+												unsigned* segmentIndexes/*=nullptr*/,
+												double* curvilinearAbscissas/*=nullptr*/,
+												bool multiThread/*=true*/,
+												int maxThreadCount/*=0*/) const
+{
+	if (m_nodes.empty() || !squareDistances)
+	{
+		return false;
+	}
+
+	ParallelForHelper::ForEachRange(cloud.size(), [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			CCVector3 P;
+			cloud.getPoint(static_cast<unsigned>(i), P);
+			findNearestSegment(	P,
+								squareDistances[i],
+								segmentIndexes ? segmentIndexes + i : nullptr,
+								curvilinearAbscissas ? curvilinearAbscissas + i : nullptr);
+		}
+	}, multiThread, 256, maxThreadCount);
+
+	return true;
+}
@@ -19,6 +19,7 @@
 #include <PointCloud.h>
 #include <ReferenceCloud.h>
 #include <ScalarFieldTools.h>
+#include <SquareMatrixN.h>
 
 //system
 #include <ctime>
@@ -851,9 +852,8 @@ ICPRegistrationTools::RESULT_TYPE ICPRegistrationTools::Register(	GenericIndexed
 		}
 		else
 		{
-			//we simply have to rotate the existing temporary cloud
-			currentTrans.apply(*data.rotatedCloud);
-			data.rotatedCloud->invalidateBoundingBox(); //invalidate bb
+			//we simply have to rotate the existing temporary cloud (its bounding-box is updated as well)
+			PointProjectionTools::applyTransformation(*data.rotatedCloud, currentTrans, true, params.maxThreadCount);
 
 			//DGM: warning, we must manually invalidate the ReferenceCloud bbox after rotation!
 			data.cloud->invalidateBoundingBox();
@@ -1197,13 +1197,16 @@ bool RegistrationTools::RegistrationProcedure(	GenericCloud* P, //data
 			X->placeIteratorAtBeginning();
 			P->placeIteratorAtBeginning();
 
+			//fixed-size copy of the rotation
+			const SquareMatrix3d R(trans.R);
+
 			unsigned count = X->size();
 			assert(P->size() == count);
 			for (unsigned i = 0; i < count; ++i)
 			{
 				//'a' refers to the data 'A' (moving) = P
 				//'b' refers to the model 'B' (not moving) = X
-				CCVector3d a_tilde = trans.R * (*(P->getNextPoint()) - Gp);	// a_tilde_i = R * (a_i - a_mean)
+				CCVector3d a_tilde = R * (*(P->getNextPoint()) - Gp);	// a_tilde_i = R * (a_i - a_mean)
 				CCVector3d b_tilde = (*(X->getNextPoint()) - Gx);			// b_tilde_j =     (b_j - b_mean)
 
 				acc_num += b_tilde.dot(a_tilde);
@@ -1381,20 +1384,49 @@ unsigned FPCSRegistrationTools::ComputeRegistrationScore(	KDTree *modelTree,
 															ScalarType delta,
 															const ScaledTransformation& dataToModel)
 {
-	CCVector3 Q;
-	unsigned score = 0;
-
 	unsigned count = dataCloud->size();
-	for (unsigned i = 0; i < count; ++i)
+
+	//fixed-size copy of the rotation (an invalid rotation is converted to identity)
+	const SquareMatrix3d R(dataToModel.R);
+
+	//The points are transformed and checked by blocks (to limit the memory footprint).
+	//If the block buffer can't be allocated, a small buffer on the stack is used instead
+	//(the blocks are then too small to be processed in parallel, but the result is the same)
+	static const unsigned MaxBlockSize = 65536;
+	static const unsigned StackBlockSize = 256;
+	CCVector3 stackBlock[StackBlockSize];
+	std::vector<CCVector3> heapBlock;
+	CCVector3* block = stackBlock;
+	unsigned blockSize = StackBlockSize;
+	if (count > StackBlockSize)
+	{
+		try
+		{
+			heapBlock.resize(std::min(count, MaxBlockSize));
+			block = heapBlock.data();
+			blockSize = static_cast<unsigned>(heapBlock.size());
+		}
+		catch (const std::bad_alloc&)
+		{
+			//not enough memory: we keep the stack buffer
+		}
+	}
+
+	unsigned score = 0;
+	for (unsigned start = 0; start < count; start += blockSize)
 	{
-		dataCloud->getPoint(i, Q);
+		unsigned blockCount = std::min(blockSize, count - start);
+
 		//Apply rigid transform to each point
-		Q = (dataToModel.R * Q + dataToModel.T).toPC();
-		//Check if there is a point in the model cloud that is close enough to q
-		if (modelTree->findNearestNeighbourWithMaxDist(Q.u, delta))
+		for (unsigned i = 0; i < blockCount; ++i)
 		{
-			++score;
+			CCVector3& Q = block[i];
+			dataCloud->getPoint(start + i, Q);
+			Q = (R * Q + dataToModel.T).toPC();
 		}
+
+		//Check (in parallel) if there is a point in the model cloud that is close enough to each transformed point
+		score += modelTree->findNearestNeighboursWithMaxDist(block, blockCount, delta);
 	}
 
 	return score;
@@ -1797,6 +1829,7 @@ bool FPCSRegistrationTools::FilterCandidates(	GenericIndexedCloud *modelCloud,
 	std::vector<ScaledTransformation> tarray;
 	PointCloud referenceBaseCloud;
 	PointCloud dataBaseCloud;
+	PointCloud transformedBaseCloud; //reused for each candidate (see below)
 
 	unsigned candidatesCount = static_cast<unsigned>(candidates.size());
 	if (candidatesCount == 0)
@@ -1864,15 +1897,13 @@ bool FPCSRegistrationTools::FilterCandidates(	GenericIndexedCloud *modelCloud,
 			if (filter)
 			{
 				float score = 0;
-				GenericIndexedCloud* b = PointProjectionTools::applyTransformation(&dataBaseCloud, t);
-				if (!b)
+				if (!PointProjectionTools::applyTransformation(dataBaseCloud, t, transformedBaseCloud, false))
 					return false; //not enough memory
 				for (unsigned j=0; j<4; j++)
 				{
-					const CCVector3* q = b->getPoint(j);
+					const CCVector3* q = transformedBaseCloud.getPoint(j);
 					score += static_cast<float>((*q - *(p[j])).norm());
 				}
-				delete b;
 				scores.push_back(score);
 				sortedscores.push_back(score);
 			}
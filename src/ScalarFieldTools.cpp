@@ -71,7 +71,7 @@ int ScalarFieldTools::computeScalarFieldGradient(	GenericIndexedCloudPersist* th
 	//if the IN and OUT scalar fields are the same
 	if (sameInAndOutScalarField)
 	{
-		if (!theGradientNorms->reserveSafe(theCloud->size())) //not enough memory
+		if (!theGradientNorms->resizeSafe(theCloud->size())) //not enough memory
 		{
 			if (!theCloudOctree)
 				delete theOctree;
@@ -110,6 +110,14 @@ int ScalarFieldTools::computeScalarFieldGradient(	GenericIndexedCloudPersist* th
 		//something went wrong
 		result = -5;
 	}
+	else if (_theGradientNorms)
+	{
+		//the gradient norms can now replace the input values
+		for (unsigned i = 0; i < theCloud->size(); ++i)
+		{
+			theCloud->setPointScalarValue(i, _theGradientNorms->getValue(i));
+		}
+	}
 
 	if (!theCloudOctree)
 	{
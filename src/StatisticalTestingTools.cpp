@@ -11,16 +11,19 @@
 #include <NormalDistribution.h>
 #include <ReferenceCloud.h>
 #include <ScalarField.h>
+#include "ParallelForHelper.h"
 
 //system
-#include <list>
+#include <algorithm>
+#include <functional>
+#include <queue>
 
 using namespace CCCoreLib;
 
 //! Max computable Chi2 distance
 static double CHI2_MAX = 1e7;
 
-//! An element of a double-chained-list structure (used by computeAdaptativeChi2Dist)
+//! A class of the empirical distribution (used by computeAdaptativeChi2Dist)
 struct Chi2Class
 {
 
@@ -34,8 +37,418 @@ struct Chi2Class
 
 };
 
-//! An ordered list of Chi2 classes
-using Chi2ClassList = std::list<Chi2Class>;
+//! Computes the theoretical probabilities of the regular classes of an histogram
+/** The cumulative probabilities of all the class boundaries are computed in a single batch.
+	\param distrib the theoretical distribution
+	\param minV the histogram min value
+	\param dV the histogram width
+	\param numberOfClasses the number of classes
+	\param[out] classProbabilities the probability of each class (should be of size 'numberOfClasses')
+	\return success
+**/
+static bool ComputeClassProbabilities(const GenericDistribution* distrib, ScalarType minV, ScalarType dV, unsigned numberOfClasses, double* classProbabilities)
+{
+	std::vector<ScalarType> boundaries;
+	std::vector<double> cumulativeProbabilities;
+	try
+	{
+		boundaries.resize(numberOfClasses + 1);
+		cumulativeProbabilities.resize(numberOfClasses + 1);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return false;
+	}
+
+	boundaries[0] = minV;
+	for (unsigned k = 1; k <= numberOfClasses; ++k)
+	{
+		boundaries[k] = minV + (k * dV) / numberOfClasses;
+	}
+
+	distrib->computeCumulativeProbabilities(boundaries.data(), boundaries.size(), cumulativeProbabilities.data());
+
+	for (unsigned k = 0; k < numberOfClasses; ++k)
+	{
+		classProbabilities[k] = cumulativeProbabilities[k + 1] - cumulativeProbabilities[k];
+	}
+
+	return true;
+}
+
+//! Computes the Chi2 distance from an histogram (with or without classes compression)
+/** \param distrib the theoretical distribution
+	\param histo the (regular) classes of the histogram
+	\param numberOfClasses the number of (regular) classes
+	\param histoBefore the number of values below the histogram min value
+	\param histoAfter the number of values above the histogram max value
+	\param numberOfValidValues the total number of (valid) values
+	\param minV the histogram min value
+	\param dV the histogram width
+	\param noClassCompression whether to skip the classes compression or not
+	\param[out] npis [optional] the theoretical number of elements of each (regular) class
+	\param[out] finalNumberOfClasses the final number of classes
+	\return the Chi2 distance (or -1.0 if an error occurred)
+**/
+static double ComputeChi2DistFromHistogram(	const GenericDistribution* distrib,
+											const unsigned* histo,
+											unsigned numberOfClasses,
+											unsigned histoBefore,
+											unsigned histoAfter,
+											unsigned numberOfValidValues,
+											ScalarType minV,
+											ScalarType dV,
+											bool noClassCompression,
+											double* npis,
+											unsigned& finalNumberOfClasses)
+{
+	//we build up the list of classes ('before', regular classes, 'after')
+	std::vector<Chi2Class> classes;
+	std::vector<double> classProbabilities;
+	try
+	{
+		classes.reserve(numberOfClasses + 2);
+		classProbabilities.resize(numberOfClasses);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory!
+		return -1.0;
+	}
+
+	if (!ComputeClassProbabilities(distrib, minV, dV, numberOfClasses, classProbabilities.data()))
+	{
+		//not enough memory!
+		return -1.0;
+	}
+
+	if (histoBefore)
+	{
+		classes.emplace_back(1.0e-6, static_cast<int>(histoBefore));
+	}
+	for (unsigned k = 0; k < numberOfClasses; ++k)
+	{
+		classes.emplace_back(classProbabilities[k], static_cast<int>(histo[k]));
+		if (npis)
+			npis[k] = classProbabilities[k] * numberOfValidValues;
+	}
+	if (histoAfter)
+	{
+		classes.emplace_back(1.0e-6, static_cast<int>(histoAfter));
+	}
+
+	//the remaining classes are chained (by index)
+	const unsigned classCount = static_cast<unsigned>(classes.size());
+	const unsigned NoClass = classCount;
+	std::vector<unsigned> previousClass;
+	std::vector<unsigned> nextClass;
+	try
+	{
+		previousClass.resize(classCount);
+		nextClass.resize(classCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory!
+		return -1.0;
+	}
+	for (unsigned i = 0; i < classCount; ++i)
+	{
+		previousClass[i] = (i != 0 ? i - 1 : NoClass);
+		nextClass[i] = i + 1; //NoClass for the last one
+	}
+	unsigned firstClass = 0;
+	unsigned remainingClassCount = classCount;
+
+	//classes compression
+	if (!noClassCompression && classCount > 2)
+	{
+		//lowest acceptable value: "K/n" (K=5 generally, but it could be 3 or 1 at the tail!)
+		double minPi = 5.0 / numberOfValidValues;
+
+		//candidate classes, sorted by increasing probability (and then by position, so that
+		//we always merge the first of the smallest classes, as a linear search would do)
+		struct Candidate
+		{
+			double pi;
+			unsigned index;
+			unsigned version;
+
+			bool operator>(const Candidate& other) const
+			{
+				return pi > other.pi || (pi == other.pi && index > other.index);
+			}
+		};
+
+		std::vector<unsigned> classVersion;
+		std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates;
+		try
+		{
+			classVersion.resize(classCount, 0);
+			for (unsigned i = 0; i < classCount; ++i)
+			{
+				candidates.push({ classes[i].pi, i, 0 });
+			}
+		}
+		catch (const std::bad_alloc&)
+		{
+			//not enough memory!
+			return -1.0;
+		}
+
+		while (remainingClassCount > 2)
+		{
+			//we look for the smallest class (smallest "npi")
+			Candidate smallest = candidates.top();
+			candidates.pop();
+			if (smallest.version != classVersion[smallest.index])
+			{
+				//outdated candidate (the class has been merged or removed since then)
+				continue;
+			}
+
+			if (smallest.pi >= minPi) //all classes are bigger than the minimum requirement
+				break;
+
+			//otherwise we must merge the smallest class with its neighbor (to make the classes repartition more equilibrated)
+			unsigned minIndex = smallest.index;
+			unsigned predIndex = previousClass[minIndex];
+			unsigned nextIndex = nextClass[minIndex];
+			unsigned neighbourIndex = nextIndex;
+			if (predIndex != NoClass)
+			{
+				neighbourIndex = (nextIndex != NoClass && classes[nextIndex].pi < classes[predIndex].pi ? nextIndex : predIndex);
+			}
+
+			classes[neighbourIndex].pi += classes[minIndex].pi;
+			classes[neighbourIndex].n += classes[minIndex].n;
+
+			//we can remove the current class
+			classVersion[minIndex] = std::numeric_limits<unsigned>::max();
+			if (predIndex != NoClass)
+				nextClass[predIndex] = nextIndex;
+			else
+				firstClass = nextIndex;
+			if (nextIndex != NoClass)
+				previousClass[nextIndex] = predIndex;
+			--remainingClassCount;
+
+			//the neighbour class must be re-inserted with its new probability
+			++classVersion[neighbourIndex];
+			candidates.push({ classes[neighbourIndex].pi, neighbourIndex, classVersion[neighbourIndex] });
+		}
+	}
+
+	//we compute the Chi2 distance with the remaining classes
+	double D2 = 0.0;
+	{
+		for (unsigned i = firstClass; i != NoClass; i = nextClass[i])
+		{
+			const Chi2Class& klass = classes[i];
+			double npi = klass.pi * numberOfValidValues;
+			if (npi != 0.0)
+			{
+				double temp = static_cast<double>(klass.n) - npi;
+				D2 += temp*(temp/npi);
+				if (D2 >= CHI2_MAX)
+				{
+					D2 = CHI2_MAX;
+					break;
+				}
+			}
+			else
+			{
+				D2 = CHI2_MAX;
+				break;
+			}
+		}
+	}
+
+	finalNumberOfClasses = remainingClassCount;
+
+	return D2;
+}
+
+//! Histogram of the scalar values of a set of neighbours, with fixed boundaries (used by computeLocalChi2DistAtLevel)
+/** The histogram is updated incrementally when moving from one neighbourhood to the next
+	(only the points that enter or leave the neighbourhood are considered). It gives the same
+	result as computeAdaptativeChi2Dist without classes compression.
+**/
+class SlidingChi2Histogram
+{
+public:
+
+	//! Default constructor
+	SlidingChi2Histogram()
+		: m_cloud(nullptr)
+		, m_numberOfClasses(0)
+		, m_minV(0)
+		, m_maxV(0)
+		, m_dV(0)
+		, m_numberOfValidValues(0)
+	{}
+
+	//! Initializes the histogram
+	bool init(const GenericCloud* cloud, unsigned numberOfClasses, ScalarType minV, ScalarType maxV, unsigned maxNeighbourCount)
+	{
+		m_cloud = cloud;
+		m_numberOfClasses = numberOfClasses;
+		m_minV = minV;
+		m_maxV = maxV;
+		m_dV = maxV - minV;
+		m_numberOfValidValues = 0;
+		assert(GreaterThanEpsilon(m_dV));
+
+		try
+		{
+			//classes + 'before' + 'after'
+			m_counts.assign(numberOfClasses + 2, 0);
+			m_indexes.clear();
+			m_indexes.reserve(maxNeighbourCount);
+			m_newIndexes.reserve(maxNeighbourCount);
+		}
+		catch (const std::bad_alloc&)
+		{
+			//not enough memory
+			return false;
+		}
+		return true;
+	}
+
+	//! Updates the histogram with a new set of neighbours
+	void update(const DgmOctree::NeighboursSet& neighbours, unsigned count)
+	{
+		assert(count <= neighbours.size());
+		m_newIndexes.resize(count);
+		for (unsigned j = 0; j < count; ++j)
+		{
+			m_newIndexes[j] = neighbours[j].pointIndex;
+		}
+		std::sort(m_newIndexes.begin(), m_newIndexes.end());
+
+		//we only process the points that have left or entered the neighbourhood
+		std::vector<unsigned>::const_iterator itOld = m_indexes.begin();
+		std::vector<unsigned>::const_iterator itNew = m_newIndexes.begin();
+		while (itOld != m_indexes.end() || itNew != m_newIndexes.end())
+		{
+			if (itNew == m_newIndexes.end() || (itOld != m_indexes.end() && *itOld < *itNew))
+			{
+				addValue(m_cloud->getPointScalarValue(*itOld), -1);
+				++itOld;
+			}
+			else if (itOld == m_indexes.end() || *itNew < *itOld)
+			{
+				addValue(m_cloud->getPointScalarValue(*itNew), 1);
+				++itNew;
+			}
+			else
+			{
+				++itOld;
+				++itNew;
+			}
+		}
+
+		std::swap(m_indexes, m_newIndexes);
+	}
+
+	//! Computes the Chi2 distance
+	/** \param classProbabilities the theoretical probability of each class
+		\return the Chi2 distance (or -1.0 if there's no valid value, or -2.0 if there are less than 2 classes)
+	**/
+	double computeChi2Dist(const double* classProbabilities) const
+	{
+		//same early returns as computeAdaptativeChi2Dist
+		if (m_numberOfValidValues == 0)
+		{
+			return -1.0;
+		}
+		if (m_numberOfClasses < 2)
+		{
+			return -2.0;
+		}
+
+		//same order as the classes of computeAdaptativeChi2Dist: 'before', regular classes, 'after'
+		double D2 = 0.0;
+		for (unsigned k = 0; k < m_numberOfClasses + 2; ++k)
+		{
+			double pi = 0.0;
+			if (k == 0 || k == m_numberOfClasses + 1)
+			{
+				if (m_counts[k] == 0)
+				{
+					continue;
+				}
+				pi = 1.0e-6;
+			}
+			else
+			{
+				pi = classProbabilities[k - 1];
+			}
+
+			double npi = pi * m_numberOfValidValues;
+			if (npi != 0.0)
+			{
+				double temp = static_cast<double>(m_counts[k]) - npi;
+				D2 += temp*(temp/npi);
+				if (D2 >= CHI2_MAX)
+				{
+					return CHI2_MAX;
+				}
+			}
+			else
+			{
+				return CHI2_MAX;
+			}
+		}
+
+		return D2;
+	}
+
+protected:
+
+	//! Adds (or removes) a value
+	inline void addValue(ScalarType V, int delta)
+	{
+		if (!ScalarField::ValidValue(V))
+		{
+			return;
+		}
+
+		unsigned k = 0;
+		int bin = static_cast<int>(floor((V - m_minV) * static_cast<ScalarType>(m_numberOfClasses) / m_dV));
+		if (bin < 0)
+		{
+			k = 0; //before
+		}
+		else if (bin >= static_cast<int>(m_numberOfClasses))
+		{
+			k = (V > m_maxV ? m_numberOfClasses + 1 : m_numberOfClasses); //after or last class
+		}
+		else
+		{
+			k = static_cast<unsigned>(bin) + 1;
+		}
+
+		m_counts[k] += delta;
+		m_numberOfValidValues += delta;
+	}
+
+	//! Associated cloud (to read the scalar values)
+	const GenericCloud* m_cloud;
+	//! Number of (regular) classes
+	unsigned m_numberOfClasses;
+	//! Histogram boundaries
+	ScalarType m_minV, m_maxV, m_dV;
+	//! Number of elements per class (including the 'before' and 'after' classes)
+	std::vector<unsigned> m_counts;
+	//! Number of valid values
+	unsigned m_numberOfValidValues;
+	//! Current neighbours (sorted indexes)
+	std::vector<unsigned> m_indexes;
+	//! New neighbours (sorted indexes)
+	std::vector<unsigned> m_newIndexes;
+};
 
 double StatisticalTestingTools::computeAdaptativeChi2Dist(	const GenericDistribution* distrib,
 															const GenericCloud* cloud,
@@ -100,11 +513,20 @@ double StatisticalTestingTools::computeAdaptativeChi2Dist(	const GenericDistribu
 	}
 
 	//try to allocate the histogram values array (if necessary)
-	unsigned* histo = (histoValues ? histoValues : new unsigned[numberOfClasses]);
+	std::vector<unsigned> localHisto;
+	unsigned* histo = histoValues;
 	if (!histo)
 	{
-		//not enough memory
-		return -1.0;
+		try
+		{
+			localHisto.resize(numberOfClasses);
+		}
+		catch (const std::bad_alloc&)
+		{
+			//not enough memory
+			return -1.0;
+		}
+		histo = localHisto.data();
 	}
 	memset(histo, 0, sizeof(unsigned)*numberOfClasses);
 
@@ -143,131 +565,217 @@ double StatisticalTestingTools::computeAdaptativeChi2Dist(	const GenericDistribu
 		histo[0] = n;
 	}
 
-	//we build up the list of classes
-	Chi2ClassList classes;
-	//before?
-	{
-		if (histoBefore)
-		{
-			try
-			{
-				classes.emplace_back(1.0e-6, static_cast<int>(histoBefore));
-			}
-			catch (const std::bad_alloc&)
-			{
-				//not enough memory!
-				return -1.0;
-			}
-		}
-		double p1 = distrib->computePfromZero(minV);
-		for (unsigned k = 1; k <= numberOfClasses; ++k)
-		{
-			double p2 = distrib->computePfromZero(minV + (k * dV) / numberOfClasses);
+	return ComputeChi2DistFromHistogram(distrib, histo, numberOfClasses, histoBefore, histoAfter, numberOfValidValues, minV, dV, noClassCompression, npis, finalNumberOfClasses);
+}
 
-			//add the class to the chain
-			Chi2Class currentClass;
-			currentClass.n = histo[k - 1];
-			currentClass.pi = p2 - p1;
-			if (npis)
-				npis[k - 1] = currentClass.pi * numberOfValidValues;
+double StatisticalTestingTools::computeAdaptativeChi2Dist(	const GenericDistribution* distrib,
+															const ScalarField& sf,
+															unsigned numberOfClasses,
+															unsigned& finalNumberOfClasses,
+															bool noClassCompression/*=false*/,
+															const ScalarType* histoMin/*=nullptr*/,
+															const ScalarType* histoMax/*=nullptr*/,
+															unsigned* histoValues/*=nullptr*/,
+															double* npis/*=nullptr*/,
+															bool multiThread/*=true*/,
+															int maxThreadCount/*=0*/)
+{
+	assert(distrib);
+	const std::size_t n = sf.size();
 
-			try
-			{
-				classes.push_back(currentClass);
-			}
-			catch (const std::bad_alloc&)
+	if (n == 0 || !distrib->isValid())
+		return -1.0;
+
+	const ScalarType* values = sf.data();
+	const std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(n, 65536, maxThreadCount) : 1);
+
+	//per-chunk bounds and number of valid values
+	struct ChunkStats
+	{
+		ScalarType minV = 0;
+		ScalarType maxV = 0;
+		unsigned count = 0;
+	};
+	std::vector<ChunkStats> chunkStats;
+	try
+	{
+		chunkStats.resize(chunkCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory
+		return -1.0;
+	}
+
+	//compute min and max (valid) values
+	//(not necessary if the histogram boundaries and the number of classes are fixed: we'll count the valid values while binning them)
+	ScalarType minV = 0;
+	ScalarType maxV = 0;
+	unsigned numberOfValidValues = 0;
+	const bool fixedHistogram = (histoMin && histoMax && numberOfClasses != 0);
+	if (!fixedHistogram)
+	{
+		ParallelForHelper::ForEachChunk(n, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
+		{
+			ChunkStats& stats = chunkStats[chunkIndex];
+			for (std::size_t i = begin; i < end; ++i)
 			{
-				//not enough memory!
-				return -1.0;
+				ScalarType V = values[i];
+				if (ScalarField::ValidValue(V))
+				{
+					if (stats.count == 0)
+					{
+						stats.minV = stats.maxV = V;
+					}
+					else if (V > stats.maxV)
+					{
+						stats.maxV = V;
+					}
+					else if (V < stats.minV)
+					{
+						stats.minV = V;
+					}
+					++stats.count;
+				}
 			}
+		}, multiThread, maxThreadCount);
 
-			p1 = p2; //next intervale
-		}
-		if (histoAfter)
+		for (const ChunkStats& stats : chunkStats)
 		{
-			try
+			if (stats.count == 0)
+				continue;
+			if (numberOfValidValues == 0)
 			{
-				classes.emplace_back(1.0e-6, static_cast<int>(histoAfter));
+				minV = stats.minV;
+				maxV = stats.maxV;
 			}
-			catch (const std::bad_alloc&)
+			else
 			{
-				//not enough memory!
-				return -1.0;
+				minV = std::min(minV, stats.minV);
+				maxV = std::max(maxV, stats.maxV);
 			}
+			numberOfValidValues += stats.count;
 		}
+
+		if (numberOfValidValues == 0)
+			return -1.0;
 	}
 
-	//classes compression
-	if (!noClassCompression)
+	if (histoMin)
+		minV = *histoMin;
+	if (histoMax)
+		maxV = *histoMax;
+
+	//shall we automatically compute the number of classes?
+	if (numberOfClasses == 0)
 	{
-		//lowest acceptable value: "K/n" (K=5 generally, but it could be 3 or 1 at the tail!)
-		double minPi = 5.0 / numberOfValidValues;
+		numberOfClasses = static_cast<unsigned>(ceil(sqrt(static_cast<double>(numberOfValidValues))));
+	}
+	if (numberOfClasses < 2)
+	{
+		return -2.0; //not enough points/classes
+	}
 
-		while (classes.size() > 2)
+	//try to allocate the histogram values array (if necessary)
+	std::vector<unsigned> localHisto;
+	unsigned* histo = histoValues;
+	if (!histo)
+	{
+		try
 		{
-			//we look for the smallest class (smallest "npi")
-			Chi2ClassList::iterator it = classes.begin();
-			Chi2ClassList::iterator minIt = it;
-			for (; it != classes.end(); ++it)
-				if (it->pi < minIt->pi)
-					minIt = it;
+			localHisto.resize(numberOfClasses);
+		}
+		catch (const std::bad_alloc&)
+		{
+			//not enough memory
+			return -1.0;
+		}
+		histo = localHisto.data();
+	}
+	memset(histo, 0, sizeof(unsigned)*numberOfClasses);
 
-			if (minIt->pi >= minPi) //all classes are bigger than the minimum requirement
-				break;
+	//accumulate histogram (each chunk has its own histogram: 'before', regular classes, 'after')
+	ScalarType dV = maxV - minV;
+	unsigned histoBefore = 0;
+	unsigned histoAfter = 0;
+	if ( GreaterThanEpsilon( dV ) )
+	{
+		const std::size_t chunkHistoSize = static_cast<std::size_t>(numberOfClasses) + 2;
+		std::vector<unsigned> chunkHistos;
+		try
+		{
+			chunkHistos.resize(chunkCount * chunkHistoSize, 0);
+		}
+		catch (const std::bad_alloc&)
+		{
+			//not enough memory
+			return -1.0;
+		}
 
-			//otherwise we must merge the smallest class with its neighbor (to make the classes repartition more equilibrated)
-			Chi2ClassList::iterator smallestIt;
+		ParallelForHelper::ForEachChunk(n, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
+		{
+			unsigned* chunkHisto = chunkHistos.data() + chunkIndex * chunkHistoSize;
+			unsigned validCount = 0;
+			for (std::size_t i = begin; i < end; ++i)
 			{
-				Chi2ClassList::iterator nextIt = minIt; ++nextIt;
-				if (minIt == classes.begin())
-				{
-					smallestIt = nextIt;
-				}
-				else
+				ScalarType V = values[i];
+				if (ScalarField::ValidValue(V))
 				{
-					Chi2ClassList::iterator predIt = minIt; --predIt;
-					smallestIt = (nextIt != classes.end() && nextIt->pi < predIt->pi ? nextIt : predIt);
+					int bin = static_cast<int>(floor((V - minV) * static_cast<ScalarType>(numberOfClasses) / dV));
+					if (bin < 0)
+					{
+						chunkHisto[0]++;
+					}
+					else if (bin >= static_cast<int>(numberOfClasses))
+					{
+						if (V > maxV)
+							chunkHisto[numberOfClasses + 1]++;
+						else
+							chunkHisto[numberOfClasses]++;
+					}
+					else
+					{
+						chunkHisto[bin + 1]++;
+					}
+					++validCount;
 				}
 			}
+			chunkStats[chunkIndex].count = validCount;
+		}, multiThread, maxThreadCount);
 
-			smallestIt->pi += minIt->pi;
-			smallestIt->n += minIt->n;
-
-			//we can remove the current class
-			classes.erase(minIt);
-		}
-	}
-
-	//we compute the Chi2 distance with the remaining classes
-	double D2 = 0.0;
-	{
-		for (auto & klass : classes)
+		//merge the chunks histograms
+		for (std::size_t c = 0; c < chunkCount; ++c)
 		{
-			double npi = klass.pi * numberOfValidValues;
-			if (npi != 0.0)
+			const unsigned* chunkHisto = chunkHistos.data() + c * chunkHistoSize;
+			histoBefore += chunkHisto[0];
+			for (unsigned k = 0; k < numberOfClasses; ++k)
 			{
-				double temp = static_cast<double>(klass.n) - npi;
-				D2 += temp*(temp/npi);
-				if (D2 >= CHI2_MAX)
-				{
-					D2 = CHI2_MAX;
-					break;
-				}
+				histo[k] += chunkHisto[k + 1];
 			}
-			else
+			histoAfter += chunkHisto[numberOfClasses + 1];
+		}
+
+		if (fixedHistogram)
+		{
+			for (const ChunkStats& stats : chunkStats)
 			{
-				D2 = CHI2_MAX;
-				break;
+				numberOfValidValues += stats.count;
 			}
 		}
 	}
+	else
+	{
+		if (fixedHistogram)
+		{
+			numberOfValidValues = static_cast<unsigned>(sf.countValidValues());
+		}
+		histo[0] = static_cast<unsigned>(n);
+	}
 
-	if (!histoValues)
-		delete[] histo;
-
-	finalNumberOfClasses = static_cast<unsigned>(classes.size());
+	if (numberOfValidValues == 0)
+		return -1.0;
 
-	return D2;
+	return ComputeChi2DistFromHistogram(distrib, histo, numberOfClasses, histoBefore, histoAfter, numberOfValidValues, minV, dV, noClassCompression, npis, finalNumberOfClasses);
 }
 
 double StatisticalTestingTools::computeChi2Fractile(double p, int d)
@@ -285,7 +793,9 @@ double StatisticalTestingTools::testCloudWithStatisticalModel(const GenericDistr
 															  unsigned numberOfNeighbours,
 															  double pTrust,
 															  GenericProgressCallback* progressCb/*=nullptr*/,
-															  DgmOctree* inputOctree/*=nullptr*/)
+															  DgmOctree* inputOctree/*=nullptr*/,
+															  bool multiThread/*=true*/,
+															  int maxThreadCount/*=0*/)
 {
 	assert(theCloud);
 
@@ -315,20 +825,6 @@ double StatisticalTestingTools::testCloudWithStatisticalModel(const GenericDistr
 
 	unsigned numberOfChi2Classes = static_cast<unsigned>(ceil(sqrt(static_cast<double>(numberOfNeighbours))));
 
-	//Chi2 hisogram values
-	std::vector<unsigned> histoValues;
-	try
-	{
-		histoValues.resize(numberOfChi2Classes);
-	}
-	catch (const std::bad_alloc&)
-	{
-		//not enough memory
-		if (!inputOctree)
-			delete theOctree;
-		return -3.0;
-	}
-
 	ScalarType* histoMin = nullptr;
 	ScalarType customHistoMin = 0;
 	ScalarType* histoMax = nullptr;
@@ -350,11 +846,38 @@ double StatisticalTestingTools::testCloudWithStatisticalModel(const GenericDistr
 		histoMin = &customHistoMin;
 	}
 
+	//if the histogram boundaries are fixed, the theoretical probabilities of the classes are the same for all the points
+	//(degenerate cases, e.g. less than 2 classes, are left to computeAdaptativeChi2Dist)
+	std::vector<double> classProbabilities;
+	if (histoMin && histoMax && GreaterThanEpsilon(*histoMax - *histoMin) && numberOfChi2Classes >= 2)
+	{
+		try
+		{
+			classProbabilities.resize(numberOfChi2Classes);
+		}
+		catch (const std::bad_alloc&)
+		{
+			//not enough memory
+			if (!inputOctree)
+				delete theOctree;
+			return -3.0;
+		}
+
+		//same computation as in computeAdaptativeChi2Dist
+		if (!ComputeClassProbabilities(distrib, *histoMin, *histoMax - *histoMin, numberOfChi2Classes, classProbabilities.data()))
+		{
+			//not enough memory
+			if (!inputOctree)
+				delete theOctree;
+			return -3.0;
+		}
+	}
+
 	//additional parameters for local process
 	void* additionalParameters[] = {	reinterpret_cast<void*>(const_cast<GenericDistribution*>(distrib)),
 										reinterpret_cast<void*>(&numberOfNeighbours),
 										reinterpret_cast<void*>(&numberOfChi2Classes),
-										reinterpret_cast<void*>(histoValues.data()),
+										reinterpret_cast<void*>(classProbabilities.empty() ? nullptr : classProbabilities.data()),
 										reinterpret_cast<void*>(histoMin),
 										reinterpret_cast<void*>(histoMax) };
 
@@ -366,9 +889,10 @@ double StatisticalTestingTools::testCloudWithStatisticalModel(const GenericDistr
 																additionalParameters,
 																numberOfNeighbours/2,
 																numberOfNeighbours*3,
-																true,
+																multiThread,
 																progressCb,
-																"Statistical Test") != 0) //success
+																"Statistical Test",
+																maxThreadCount) != 0) //success
 	{
 		if (!progressCb || !progressCb->isCancelRequested())
 		{
@@ -392,7 +916,7 @@ bool StatisticalTestingTools::computeLocalChi2DistAtLevel(	const DgmOctree::octr
 	GenericDistribution* statModel		= reinterpret_cast<GenericDistribution*>(additionalParameters[0]);
 	unsigned numberOfNeighbours         = *reinterpret_cast<unsigned*>(additionalParameters[1]);
 	unsigned numberOfChi2Classes		= *reinterpret_cast<unsigned*>(additionalParameters[2]);
-	unsigned* histoValues				= reinterpret_cast<unsigned*>(additionalParameters[3]);
+	const double* classProbabilities	= reinterpret_cast<const double*>(additionalParameters[3]);
 	ScalarType* histoMin				= reinterpret_cast<ScalarType*>(additionalParameters[4]);
 	ScalarType* histoMax				= reinterpret_cast<ScalarType*>(additionalParameters[5]);
 
@@ -425,11 +949,36 @@ bool StatisticalTestingTools::computeLocalChi2DistAtLevel(	const DgmOctree::octr
 		nNSS.alreadyVisitedNeighbourhoodSize = 1;
 	}
 
+	//the buffers below are local to the current cell (i.e. to the current thread)
 	ReferenceCloud neighboursCloud(cell.points->getAssociatedCloud());
-	if (!neighboursCloud.reserve(numberOfNeighbours))
+	std::vector<unsigned> histoValues;
+	SlidingChi2Histogram slidingHisto;
+	if (classProbabilities)
 	{
-		//not enough memory!
-		return false;
+		//the histogram boundaries are fixed: we can update the histogram incrementally
+		assert(histoMin && histoMax);
+		if (!slidingHisto.init(cell.points->getAssociatedCloud(), numberOfChi2Classes, *histoMin, *histoMax, numberOfNeighbours))
+		{
+			//not enough memory!
+			return false;
+		}
+	}
+	else
+	{
+		if (!neighboursCloud.reserve(numberOfNeighbours))
+		{
+			//not enough memory!
+			return false;
+		}
+		try
+		{
+			histoValues.resize(numberOfChi2Classes);
+		}
+		catch (const std::bad_alloc&)
+		{
+			//not enough memory!
+			return false;
+		}
 	}
 
 	for (unsigned i = 0; i < n; ++i)
@@ -445,15 +994,24 @@ bool StatisticalTestingTools::computeLocalChi2DistAtLevel(	const DgmOctree::octr
 			if (k > numberOfNeighbours)
 				k = numberOfNeighbours;
 
-			neighboursCloud.clear();
-			for (unsigned j = 0; j < k; ++j)
-				neighboursCloud.addPointIndex(nNSS.pointsInNeighbourhood[j].pointIndex);
+			double Chi2Dist = -1.0;
+			if (classProbabilities)
+			{
+				slidingHisto.update(nNSS.pointsInNeighbourhood, k);
+				Chi2Dist = static_cast<ScalarType>(slidingHisto.computeChi2Dist(classProbabilities));
+			}
+			else
+			{
+				neighboursCloud.clear();
+				for (unsigned j = 0; j < k; ++j)
+					neighboursCloud.addPointIndex(nNSS.pointsInNeighbourhood[j].pointIndex);
 
-			unsigned finalNumberOfChi2Classes = 0;
-			//LAZY VERSION (approximate test)
-			double Chi2Dist = static_cast<ScalarType>(computeAdaptativeChi2Dist(statModel, &neighboursCloud, numberOfChi2Classes, finalNumberOfChi2Classes, true, histoMin, histoMax, histoValues));
-			//STRICT VERSION (ultra-precise test)
-			//double Chi2Dist = static_cast<ScalarType>(computeAdaptativeChi2Dist(statModel, &neighboursCloud, numberOfChi2Classes, finalNumberOfChi2Classes, false, histoMin, histoMax, histoValues));
+				unsigned finalNumberOfChi2Classes = 0;
+				//LAZY VERSION (approximate test)
+				Chi2Dist = static_cast<ScalarType>(computeAdaptativeChi2Dist(statModel, &neighboursCloud, numberOfChi2Classes, finalNumberOfChi2Classes, true, histoMin, histoMax, histoValues.data()));
+				//STRICT VERSION (ultra-precise test)
+				//Chi2Dist = static_cast<ScalarType>(computeAdaptativeChi2Dist(statModel, &neighboursCloud, numberOfChi2Classes, finalNumberOfChi2Classes, false, histoMin, histoMax, histoValues.data()));
+			}
 
 			D = (Chi2Dist >= 0.0 ? static_cast<ScalarType>(sqrt(Chi2Dist)) : NAN_VALUE);
 		}
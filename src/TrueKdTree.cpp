@@ -4,15 +4,18 @@
 #include "TrueKdTree.h"
 
 //local
+#include "GenericIndexedCloudPersist.h"
 #include "GenericProgressCallback.h"
-#include "Neighbourhood.h"
-#include "ParallelSort.h"
+#include "Jacobi.h"
+#include "ParallelForHelper.h"
+
+//system
+#include <algorithm>
 
 using namespace CCCoreLib;
 
 TrueKdTree::TrueKdTree(GenericIndexedCloudPersist* cloud)
-	: m_root(nullptr)
-	, m_associatedCloud(cloud)
+	: m_associatedCloud(cloud)
 	, m_maxError(0.0)
 	, m_errorMeasure(DistanceComputationTools::RMS)
 	, m_minPointCountPerCell(3)
@@ -28,227 +31,404 @@ TrueKdTree::~TrueKdTree()
 
 void TrueKdTree::clear()
 {
-	if (m_root)
-	{
-		delete m_root;
-		m_root = nullptr;
-	}
+	m_nodes.clear();
+	m_nodes.shrink_to_fit();
+	m_leaves.clear();
+	m_leaves.shrink_to_fit();
+	m_pointIndexes.clear();
+	m_pointIndexes.shrink_to_fit();
 }
 
-//shared structure used to sort the points along a single dimension (see TrueKdTree::split)
-static std::vector<PointCoordinateType> s_sortedCoordsForSplit;
-static GenericProgressCallback* s_progressCb = nullptr;
-static unsigned s_lastProgressCount = 0;
-static unsigned s_totalProgressCount = 0;
-static unsigned s_lastProgress = 0;
+//! Minimum number of points to process the two halves of a node in parallel
+static const unsigned MIN_POINT_COUNT_FOR_PARALLEL_SPLIT = 4096;
 
-static void InitProgress(GenericProgressCallback* progressCb, unsigned totalCount)
+struct TrueKdTree::BuildContext
 {
-	s_progressCb = totalCount ? progressCb : nullptr;
-	s_totalProgressCount = totalCount;
-	s_lastProgressCount = 0;
-	s_lastProgress = 0;
+	//! Indexes of the points (partitioned in place by the split process)
+	std::vector<unsigned> indexes;
+	//! Progress notification (thread-safe)
+	NormalizedProgress* progress = nullptr;
+	//! Whether the sub-trees can be built in parallel
+	bool multiThread = false;
+	//! Maximum depth at which the sub-trees are built in parallel
+	unsigned parallelDepth = 0;
+};
 
-	if (s_progressCb)
+//! Computes the least squares best fitting plane of a subset of points
+/** Same as Neighbourhood::getLSPlane, without the intermediate ReferenceCloud.
+	\return false if the plane can't be computed (less than 3 points, or aligned points)
+**/
+static bool ComputeLSPlane(const GenericIndexedCloudPersist& cloud, const unsigned* indexes, unsigned count, PointCoordinateType planeEquation[4])
+{
+	//we need at least 3 points to compute a plane
+	if (count < 3)
 	{
-		if (progressCb->textCanBeEdited())
-		{
-			s_progressCb->setMethodTitle("Kd-tree computation");
-			char info[32];
-			snprintf(info, 32, "Points: %u", totalCount);
-			s_progressCb->setInfo(info);
-		}
-		s_progressCb->start();
+		return false;
 	}
-}
 
-static inline void UpdateProgress(unsigned increment)
-{
-	if (s_progressCb)
+	CCVector3 N;
+	CCVector3 G;
+	if (count > 3)
 	{
-		assert(s_totalProgressCount != 0);
-		s_lastProgressCount += increment;
-		float fPercent = static_cast<float>(s_lastProgressCount) / s_totalProgressCount * 100.0f;
-		unsigned uiPercent = static_cast<unsigned>(fPercent);
-		if (uiPercent > s_lastProgress)
+		//gravity center
+		CCVector3d Psum(0, 0, 0);
+		for (unsigned i = 0; i < count; ++i)
 		{
-			s_progressCb->update(fPercent);
-			s_lastProgress = uiPercent;
+			const CCVector3* P = cloud.getPointPersistentPtr(indexes[i]);
+			Psum.x += P->x;
+			Psum.y += P->y;
+			Psum.z += P->z;
 		}
+		G = CCVector3(	static_cast<PointCoordinateType>(Psum.x / count),
+						static_cast<PointCoordinateType>(Psum.y / count),
+						static_cast<PointCoordinateType>(Psum.z / count) );
+
+		//covariance matrix
+		double mXX = 0.0;
+		double mYY = 0.0;
+		double mZZ = 0.0;
+		double mXY = 0.0;
+		double mXZ = 0.0;
+		double mYZ = 0.0;
+		for (unsigned i = 0; i < count; ++i)
+		{
+			const CCVector3 P = *cloud.getPointPersistentPtr(indexes[i]) - G;
+
+			mXX += static_cast<double>(P.x)*P.x;
+			mYY += static_cast<double>(P.y)*P.y;
+			mZZ += static_cast<double>(P.z)*P.z;
+			mXY += static_cast<double>(P.x)*P.y;
+			mXZ += static_cast<double>(P.x)*P.z;
+			mYZ += static_cast<double>(P.y)*P.z;
+		}
+
+		SquareMatrix3d covMat;
+		covMat.m_values[0][0] = mXX / count;
+		covMat.m_values[1][1] = mYY / count;
+		covMat.m_values[2][2] = mZZ / count;
+		covMat.m_values[1][0] = covMat.m_values[0][1] = mXY / count;
+		covMat.m_values[2][0] = covMat.m_values[0][2] = mXZ / count;
+		covMat.m_values[2][1] = covMat.m_values[1][2] = mYZ / count;
+
+		//the smallest eigen vector corresponds to the "least square best fitting plane" normal
+		SquareMatrix3d eigVectors;
+		double eigValues[3];
+		if (!Jacobi<double>::ComputeEigenValuesAndVectors(covMat, eigVectors, eigValues, true))
+		{
+			//failed to compute the eigen values!
+			return false;
+		}
+
+		CCVector3d vec(0, 0, 1);
+		double minEigValue = 0;
+		Jacobi<double>::GetMinEigenValueAndVector(eigVectors, eigValues, minEigValue, vec.u);
+		N = vec.toPC();
 	}
+	else
+	{
+		//we simply compute the normal of the 3 points by cross product!
+		//(the points are taken in their original order, as the orientation of the normal depends on it)
+		unsigned sortedIndexes[3] = { indexes[0], indexes[1], indexes[2] };
+		std::sort(sortedIndexes, sortedIndexes + 3);
+		const CCVector3* A = cloud.getPointPersistentPtr(sortedIndexes[0]);
+		const CCVector3* B = cloud.getPointPersistentPtr(sortedIndexes[1]);
+		const CCVector3* C = cloud.getPointPersistentPtr(sortedIndexes[2]);
+		N = (*B - *A).cross(*C - *A);
+		G = *A;
+	}
+
+	if (LessThanSquareEpsilon(N.norm2()))
+	{
+		//this means that the points are colinear!
+		return false;
+	}
+	N.normalize();
+
+	planeEquation[0] = N.x;
+	planeEquation[1] = N.y;
+	planeEquation[2] = N.z;
+	planeEquation[3] = G.dot(N);
+
+	return true;
 }
 
-TrueKdTree::BaseNode* TrueKdTree::split(ReferenceCloud* subset)
+//! Computes the distance between a subset of points and a plane
+/** Same as DistanceComputationTools::ComputeCloud2PlaneDistance, without the intermediate ReferenceCloud.
+	\warning the plane normal must be unit
+**/
+static ScalarType ComputePlaneError(const GenericIndexedCloudPersist& cloud,
+									const unsigned* indexes,
+									unsigned count,
+									const PointCoordinateType planeEquation[4],
+									DistanceComputationTools::ERROR_MEASURES errorMeasure)
 {
-	assert(subset); //subset will always be taken care of by this method
-
-	unsigned count = subset->size();
+	if (count == 0)
+	{
+		return 0;
+	}
 
-	const PointCoordinateType* planeEquation = Neighbourhood(subset).getLSPlane();
-	if (!planeEquation)
+	switch (errorMeasure)
+	{
+	case DistanceComputationTools::RMS:
 	{
-		//an error occurred during LS plane computation?! (maybe the (3) points are aligned)
-		//we return an invalid Leaf (so as the above level understands that it's not a memory issue)
-		delete subset;
-		PointCoordinateType fakePlaneEquation[4] = { 0,0,0,0 };
-		return new Leaf(nullptr, fakePlaneEquation, static_cast<ScalarType>(-1));
+		double dSumSq = 0.0;
+		for (unsigned i = 0; i < count; ++i)
+		{
+			const CCVector3* P = cloud.getPointPersistentPtr(indexes[i]);
+			double d = CCVector3::vdotd(P->u, planeEquation) - planeEquation[3];
+			dSumSq += d * d;
+		}
+		return static_cast<ScalarType>(sqrt(dSumSq / count));
 	}
 
-	//we always split sets larger than a given size
-	ScalarType error = -1;
-	if (count < m_maxPointCountPerCell || count < 2 * m_minPointCountPerCell)
+	case DistanceComputationTools::MAX_DIST_68_PERCENT:
+	case DistanceComputationTools::MAX_DIST_95_PERCENT:
+	case DistanceComputationTools::MAX_DIST_99_PERCENT:
 	{
-		assert(std::abs(CCVector3(planeEquation).norm2() - 1.0) < 1.0e-6);
-		error = (count > 3 ? DistanceComputationTools::ComputeCloud2PlaneDistance(subset, planeEquation, m_errorMeasure) : 0);
+		float percent = (errorMeasure == DistanceComputationTools::MAX_DIST_68_PERCENT ? 0.32f : errorMeasure == DistanceComputationTools::MAX_DIST_95_PERCENT ? 0.05f : 0.01f);
 
-		//we can't split cells with less than twice the minimum number of points per cell! (and min >= 3 so as to fit a plane)
-		bool isLeaf = (error <= m_maxError || count < 2 * m_minPointCountPerCell);
-		if (isLeaf)
+		//we search the max @ 'percent'% (to avoid outliers)
+		std::vector<PointCoordinateType> distances(count); //may throw std::bad_alloc
+		for (unsigned i = 0; i < count; ++i)
 		{
-			UpdateProgress(count);
-			//the Leaf class takes ownership of the subset!
-			return new Leaf(subset, planeEquation, error);
+			const CCVector3* P = cloud.getPointPersistentPtr(indexes[i]);
+			distances[i] = std::abs(CCVector3::vdot(P->u, planeEquation) - planeEquation[3]);
 		}
+		std::size_t tailSize = static_cast<std::size_t>(ceil(static_cast<float>(count) * percent));
+		tailSize = std::max<std::size_t>(std::min<std::size_t>(tailSize, count), 1);
+		std::nth_element(distances.begin(), distances.begin() + (count - tailSize), distances.end());
+		return static_cast<ScalarType>(distances[count - tailSize]);
 	}
 
-	/*** proceed with a 'standard' binary partition ***/
-
-	//find the subset largest dimension
-	uint8_t splitDim = X_DIM;
+	case DistanceComputationTools::MAX_DIST:
 	{
-		//compute the subset bounding-box
-		CCVector3 cellBB;
+		PointCoordinateType maxDist = 0;
+		for (unsigned i = 0; i < count; ++i)
 		{
-			CCVector3 bbMin;
-			CCVector3 bbMax;
-			subset->getBoundingBox(bbMin, bbMax);
-			cellBB = bbMax - bbMin;
+			const CCVector3* P = cloud.getPointPersistentPtr(indexes[i]);
+			PointCoordinateType d = std::abs(CCVector3::vdot(P->u, planeEquation) - planeEquation[3]);
+			maxDist = std::max(d, maxDist);
 		}
-
-		if (cellBB.y > cellBB.x)
-			splitDim = Y_DIM;
-		if (cellBB.z > cellBB.u[splitDim])
-			splitDim = Z_DIM;
+		return static_cast<ScalarType>(maxDist);
 	}
 
-	//find the median by sorting the coordinates of the points along the split dimension
-	assert(s_sortedCoordsForSplit.size() >= static_cast<std::size_t>(count));
-	for (unsigned i = 0; i < count; ++i)
-	{
-		const CCVector3* P = subset->getPoint(i);
-		s_sortedCoordsForSplit[i] = P->u[splitDim];
+	default:
+		assert(false);
+		return -1;
 	}
+}
 
-	ParallelSort(s_sortedCoordsForSplit.begin(), s_sortedCoordsForSplit.begin() + count);
+void TrueKdTree::addLeaf(BuildContext& context, SubTree& tree, unsigned firstIndex, unsigned count, const PointCoordinateType planeEquation[], ScalarType error) const
+{
+	//we keep the points in their original order
+	unsigned* indexes = context.indexes.data() + firstIndex;
+	std::sort(indexes, indexes + count);
+
+	Node node;
+	node.splitValue = 0;
+	node.parent = INVALID_INDEX;
+	node.child = static_cast<unsigned>(tree.leaves.size());
+	node.type = LEAF_TYPE;
+	node.splitDim = X_DIM;
+
+	Leaf leaf;
+	leaf.firstIndex = firstIndex;
+	leaf.pointCount = count;
+	memcpy(leaf.planeEq, planeEquation, sizeof(PointCoordinateType) * 4);
+	leaf.error = error;
+	leaf.userData = 0;
+
+	//may throw std::bad_alloc
+	tree.leaves.push_back(leaf);
+	tree.nodes.push_back(node);
+
+	context.progress->steps(count);
+}
 
-	unsigned splitCount = count / 2;
-	assert(splitCount >= 3); //count >= 6 (see above)
+TrueKdTree::SplitResult TrueKdTree::split(BuildContext& context, SubTree& tree, unsigned firstIndex, unsigned count, unsigned depth) const
+{
+	unsigned* indexes = context.indexes.data() + firstIndex;
 
-	//we must check that the split value is really the first one with this value, and that the smallest subset after the split will have at least 2 or 3 points
-	if (splitCount >= 3 && s_sortedCoordsForSplit[splitCount - 1] == s_sortedCoordsForSplit[splitCount])
+	try
 	{
-		if (s_sortedCoordsForSplit[2] != s_sortedCoordsForSplit[splitCount]) //is it worth looking for the split value backward? (we want to keep at least 3 points in the smallest cell)
+		PointCoordinateType planeEquation[4];
+		if (!ComputeLSPlane(*m_associatedCloud, indexes, count, planeEquation))
 		{
-			while (s_sortedCoordsForSplit[splitCount - 1] == s_sortedCoordsForSplit[splitCount])
+			//an error occurred during LS plane computation?! (maybe the (3) points are aligned)
+			//(the above level will become a leaf)
+			return SPLIT_INVALID_PLANE;
+		}
+
+		//we always split sets larger than a given size
+		ScalarType error = -1;
+		if (count < m_maxPointCountPerCell || count < 2 * m_minPointCountPerCell)
+		{
+			error = (count > 3 ? ComputePlaneError(*m_associatedCloud, indexes, count, planeEquation, m_errorMeasure) : 0);
+
+			//we can't split cells with less than twice the minimum number of points per cell! (and min >= 3 so as to fit a plane)
+			bool isLeaf = (error <= m_maxError || count < 2 * m_minPointCountPerCell);
+			if (isLeaf)
 			{
-				--splitCount;
+				addLeaf(context, tree, firstIndex, count, planeEquation, error);
+				return SPLIT_OK;
 			}
 		}
-		else if (s_sortedCoordsForSplit[count - 3] != s_sortedCoordsForSplit[splitCount]) //is it worth looking for the split value forward? (same thing, we want to keep at least 2 points in the smallest cell)
+
+		/*** proceed with a 'standard' binary partition ***/
+
+		//find the subset largest dimension
+		uint8_t splitDim = X_DIM;
 		{
-			do
+			//compute the subset bounding-box
+			CCVector3 bbMin = *m_associatedCloud->getPointPersistentPtr(indexes[0]);
+			CCVector3 bbMax = bbMin;
+			for (unsigned i = 1; i < count; ++i)
 			{
-				++splitCount;
+				const CCVector3* P = m_associatedCloud->getPointPersistentPtr(indexes[i]);
+				for (unsigned char d = 0; d < 3; ++d)
+				{
+					bbMin.u[d] = std::min(bbMin.u[d], P->u[d]);
+					bbMax.u[d] = std::max(bbMax.u[d], P->u[d]);
+				}
 			}
-			while (s_sortedCoordsForSplit[splitCount] == s_sortedCoordsForSplit[splitCount - 1]);
+			CCVector3 cellBB = bbMax - bbMin;
+
+			if (cellBB.y > cellBB.x)
+				splitDim = Y_DIM;
+			if (cellBB.z > cellBB.u[splitDim])
+				splitDim = Z_DIM;
 		}
-		else //in fact we can't split this cell!
+
+		auto coord = [&](unsigned index) { return m_associatedCloud->getPointPersistentPtr(index)->u[splitDim]; };
+
+		//find the median (the indexes are partitioned so that the first 'splitCount' ones are below it)
+		unsigned splitCount = count / 2;
+		assert(splitCount >= 3); //count >= 6 (see above)
+		std::nth_element(indexes, indexes + splitCount, indexes + count, [&](unsigned a, unsigned b) { return coord(a) < coord(b); });
+		PointCoordinateType splitCoord = coord(indexes[splitCount]);
+
+		//we must check that the split value is really the first one with this value, and that the smallest subset after the split will have at least 2 or 3 points
+		unsigned lessCount = static_cast<unsigned>(std::partition(indexes, indexes + splitCount, [&](unsigned index) { return coord(index) < splitCoord; }) - indexes);
+		if (lessCount != splitCount)
 		{
-			UpdateProgress(count);
-			if (error < 0)
-				error = (count != 3 ? DistanceComputationTools::ComputeCloud2PlaneDistance(subset, planeEquation, m_errorMeasure) : 0);
-			//the Leaf class takes ownership of the subset!
-			return new Leaf(subset, planeEquation, error);
+			if (lessCount >= 3) //is it worth looking for the split value backward? (we want to keep at least 3 points in the smallest cell)
+			{
+				splitCount = lessCount;
+			}
+			else
+			{
+				//is it worth looking for the split value forward? (same thing, we want to keep at least 2 points in the smallest cell)
+				unsigned lessOrEqualCount = static_cast<unsigned>(std::partition(indexes + splitCount + 1, indexes + count, [&](unsigned index) { return coord(index) <= splitCoord; }) - indexes);
+				if (count - lessOrEqualCount >= 3)
+				{
+					splitCount = lessOrEqualCount;
+					splitCoord = coord(indexes[splitCount]);
+					for (unsigned i = splitCount + 1; i < count; ++i)
+					{
+						splitCoord = std::min(splitCoord, coord(indexes[i]));
+					}
+				}
+				else //in fact we can't split this cell!
+				{
+					if (error < 0)
+						error = (count != 3 ? ComputePlaneError(*m_associatedCloud, indexes, count, planeEquation, m_errorMeasure) : 0);
+					addLeaf(context, tree, firstIndex, count, planeEquation, error);
+					return SPLIT_OK;
+				}
+			}
 		}
-	}
 
-	PointCoordinateType splitCoord = s_sortedCoordsForSplit[splitCount]; //splitCount >= 2
+		unsigned nodeIndex = static_cast<unsigned>(tree.nodes.size());
+		std::size_t leafCount = tree.leaves.size();
+		{
+			Node node;
+			node.splitValue = splitCoord;
+			node.parent = INVALID_INDEX;
+			node.child = 0; //see below
+			node.type = NODE_TYPE;
+			node.splitDim = splitDim;
+			tree.nodes.push_back(node);
+		}
 
-	ReferenceCloud* leftSubset = new ReferenceCloud(subset->getAssociatedCloud());
-	ReferenceCloud* rightSubset = new ReferenceCloud(subset->getAssociatedCloud());
-	if (!leftSubset->reserve(splitCount) || !rightSubset->reserve(count - splitCount))
-	{
-		//not enough memory!
-		delete leftSubset;
-		delete rightSubset;
-		delete subset;
-		return nullptr;
-	}
+		//process subsets
+		SplitResult leftResult = SPLIT_OK;
+		SplitResult rightResult = SPLIT_OK;
+		unsigned rightChildIndex = 0;
+		if (context.multiThread && depth < context.parallelDepth && count >= MIN_POINT_COUNT_FOR_PARALLEL_SPLIT)
+		{
+			//the right sub-tree is built in parallel in its own structure, and appended afterwards
+			SubTree rightTree;
+			ParallelForHelper::Invoke(	[&]() { leftResult = split(context, tree, firstIndex, splitCount, depth + 1); },
+										[&]() { rightResult = split(context, rightTree, firstIndex + splitCount, count - splitCount, depth + 1); });
 
-	//fill subsets
-	for (unsigned i = 0; i < count; ++i)
-	{
-		const CCVector3* P = subset->getPoint(i);
-		(P->u[splitDim] < splitCoord ? leftSubset : rightSubset)->addPointIndex(subset->getPointGlobalIndex(i));
-	}
+			if (leftResult == SPLIT_OK && rightResult == SPLIT_OK)
+			{
+				rightChildIndex = static_cast<unsigned>(tree.nodes.size());
+				unsigned leafOffset = static_cast<unsigned>(tree.leaves.size());
+				for (Node& node : rightTree.nodes)
+				{
+					if (node.parent != INVALID_INDEX)
+						node.parent += rightChildIndex;
+					node.child += (node.isLeaf() ? leafOffset : rightChildIndex);
+				}
+				tree.nodes.insert(tree.nodes.end(), rightTree.nodes.begin(), rightTree.nodes.end());
+				tree.leaves.insert(tree.leaves.end(), rightTree.leaves.begin(), rightTree.leaves.end());
+			}
+		}
+		else
+		{
+			leftResult = split(context, tree, firstIndex, splitCount, depth + 1);
+			if (leftResult == SPLIT_OK)
+			{
+				rightChildIndex = static_cast<unsigned>(tree.nodes.size());
+				rightResult = split(context, tree, firstIndex + splitCount, count - splitCount, depth + 1);
+			}
+		}
 
-	//process subsets (if any)
-	BaseNode* leftChild = split(leftSubset);
-	if (!leftChild)
-	{
-		delete subset;
-		delete rightSubset;
-		return nullptr;
-	}
+		if (leftResult == SPLIT_NOT_ENOUGH_MEMORY || rightResult == SPLIT_NOT_ENOUGH_MEMORY)
+		{
+			return SPLIT_NOT_ENOUGH_MEMORY;
+		}
 
-	BaseNode* rightChild = split(rightSubset);
-	if (!rightChild)
-	{
-		delete subset;
-		delete leftChild;
-		return nullptr;
-	}
+		if (leftResult == SPLIT_INVALID_PLANE || rightResult == SPLIT_INVALID_PLANE)
+		{
+			//at least one of the subsets couldn't be fitted with a plane!
+			tree.nodes.resize(nodeIndex);
+			tree.leaves.resize(leafCount);
 
-	if (	(leftChild->isLeaf()  && static_cast<Leaf*>(leftChild)->points == nullptr)
-		||	(rightChild->isLeaf() && static_cast<Leaf*>(rightChild)->points == nullptr) )
-	{
-		//at least one of the subsets couldn't be fitted with a plane!
-		delete leftChild;
-		delete rightChild;
-
-		//this node will become a leaf!
-		UpdateProgress(count);
-		//the Leaf class takes ownership of the subset!
-		return new Leaf(subset, planeEquation, error);
-	}
+			//this node will become a leaf!
+			if (error < 0)
+				error = ComputePlaneError(*m_associatedCloud, indexes, count, planeEquation, m_errorMeasure);
+			addLeaf(context, tree, firstIndex, count, planeEquation, error);
+			return SPLIT_OK;
+		}
 
-	//we can now delete the subset
-	delete subset;
-	subset = nullptr;
+		tree.nodes[nodeIndex].child = rightChildIndex;
+		tree.nodes[nodeIndex + 1].parent = nodeIndex;
+		tree.nodes[rightChildIndex].parent = nodeIndex;
 
-	Node* node = new Node;
+		return SPLIT_OK;
+	}
+	catch (const std::bad_alloc&)
 	{
-		node->leftChild = leftChild;
-		leftChild->parent = node;
-		node->rightChild = rightChild;
-		rightChild->parent = node;
-		node->splitDim = splitDim;
-		node->splitValue = splitCoord;
+		//not enough memory!
+		return SPLIT_NOT_ENOUGH_MEMORY;
 	}
-	return node;
 }
 
 bool TrueKdTree::build(	double maxError,
 						DistanceComputationTools::ERROR_MEASURES errorMeasure/*=DistanceComputationTools::RMS*/,
 						unsigned minPointCountPerCell/*=3*/,
 						unsigned maxPointCountPerCell/*=0*/,
-						GenericProgressCallback* progressCb/*=nullptr*/)
+						GenericProgressCallback* progressCb/*=nullptr*/,
+						bool multiThread/*=true*/,
+						int maxThreadCount/*=0*/)
 {
 	if (!m_associatedCloud)
 		return false;
 
 	//tree already computed! (call clear before)
-	if (m_root)
+	if (!m_nodes.empty())
 		return false;
 
 	unsigned count = m_associatedCloud->size();
@@ -257,83 +437,149 @@ bool TrueKdTree::build(	double maxError,
 		return false;
 	}
 
-	//structures used to sort the points along the 3 dimensions
+	//initial 'subset' to start recursion
+	BuildContext context;
 	try
 	{
-		s_sortedCoordsForSplit.resize(count);
+		context.indexes.resize(count);
 	}
 	catch (const std::bad_alloc&)
 	{
 		//not enough memory!
 		return false;
 	}
+	for (unsigned i = 0; i < count; ++i)
+	{
+		context.indexes[i] = i;
+	}
 
-	//initial 'subset' to start recursion
-	ReferenceCloud* subset = new ReferenceCloud(m_associatedCloud);
-	if (!subset->addPointIndex(0, count))
+	if (progressCb)
 	{
-		//not enough memory
-		delete subset;
-		return false;
+		if (progressCb->textCanBeEdited())
+		{
+			progressCb->setMethodTitle("Kd-tree computation");
+			char info[32];
+			snprintf(info, 32, "Points: %u", count);
+			progressCb->setInfo(info);
+		}
+		progressCb->start();
 	}
+	NormalizedProgress nProgress(progressCb, count);
+	context.progress = &nProgress;
 
-	InitProgress(progressCb,count);
+	//the sub-trees are built in parallel down to a depth that gives a few tasks per thread
+	context.multiThread = (multiThread && ParallelForHelper::IsSupported());
+	if (context.multiThread)
+	{
+		int threadCount = ParallelForHelper::ThreadCount(maxThreadCount);
+		while ((1 << context.parallelDepth) < threadCount)
+		{
+			++context.parallelDepth;
+		}
+		if (maxThreadCount <= 0)
+		{
+			context.parallelDepth += 2;
+		}
+	}
 
 	//launch recursive process
 	m_maxError = maxError;
 	m_minPointCountPerCell = std::max<unsigned>(3, minPointCountPerCell);
 	m_maxPointCountPerCell = std::max<unsigned>(2 * minPointCountPerCell, maxPointCountPerCell); //the max number of point per cell can't be < 2*min
 	m_errorMeasure = errorMeasure;
-	m_root = split(subset);
+	SubTree tree;
+	if (split(context, tree, 0, count, 0) != SPLIT_OK)
+	{
+		//not enough memory, or no plane could be fitted to the whole cloud
+		return false;
+	}
 
-	//clear static structure
-	s_sortedCoordsForSplit.clear();
+	m_nodes = std::move(tree.nodes);
+	m_leaves = std::move(tree.leaves);
+	m_pointIndexes = std::move(context.indexes);
 
-	return (m_root != nullptr);
+	return true;
 }
 
-//! Recursive visitor for TrueKdTree::getLeaves
-class GetLeavesVisitor
+bool TrueKdTree::getLeaves(LeafVector& leaves) const
 {
-public:
-
-	explicit GetLeavesVisitor(TrueKdTree::LeafVector& leaves) : m_leaves(&leaves) {}
+	if (m_leaves.empty())
+		return false;
 
-	void visit(TrueKdTree::BaseNode* node)
+	try
 	{
-		if (!node)
-			return;
-
-		if (node->isNode())
-		{
-			visit(static_cast<TrueKdTree::Node*>(node)->leftChild);
-			visit(static_cast<TrueKdTree::Node*>(node)->rightChild);
-		}
-		else //if (node->isLeaf())
+		leaves.reserve(leaves.size() + m_leaves.size());
+		for (const Leaf& leaf : m_leaves)
 		{
-			assert(m_leaves);
-			m_leaves->push_back(static_cast<TrueKdTree::Leaf*>(node));
+			//the caller is allowed to modify the leaves (e.g. their 'userData')
+			leaves.push_back(const_cast<Leaf*>(&leaf));
 		}
 	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
 
-protected:
-	TrueKdTree::LeafVector* m_leaves;
+	return true;
+}
 
-};
+bool TrueKdTree::getLeafPoints(const Leaf& leaf, ReferenceCloud& subset) const
+{
+	subset.clear();
+	if (!subset.resize(leaf.pointCount))
+	{
+		//not enough memory
+		return false;
+	}
 
-bool TrueKdTree::getLeaves(LeafVector& leaves) const
+	const unsigned* indexes = getLeafPointIndexes(leaf);
+	for (unsigned i = 0; i < leaf.pointCount; ++i)
+	{
+		subset.setPointIndex(i, indexes[i]);
+	}
+
+	return true;
+}
+
+unsigned TrueKdTree::findLeaf(const CCVector3& P) const
+{
+	if (m_nodes.empty())
+		return INVALID_INDEX;
+
+	//same criterion as the split process (the points below the split value are on the left)
+	unsigned nodeIndex = 0;
+	while (m_nodes[nodeIndex].isNode())
+	{
+		const Node& node = m_nodes[nodeIndex];
+		nodeIndex = (P.u[node.splitDim] < node.splitValue ? nodeIndex + 1 : node.child);
+	}
+
+	return m_nodes[nodeIndex].child;
+}
+
+bool TrueKdTree::getPointLeafIndexes(std::vector<unsigned>& pointLeafIndexes) const
 {
-	if (!m_root)
+	if (m_leaves.empty())
 		return false;
 
 	try
 	{
-		GetLeavesVisitor(leaves).visit(m_root);
+		pointLeafIndexes.resize(m_associatedCloud->size());
 	}
 	catch (const std::bad_alloc&)
 	{
 		return false;
 	}
 
+	for (std::size_t i = 0; i < m_leaves.size(); ++i)
+	{
+		const Leaf& leaf = m_leaves[i];
+		const unsigned* indexes = getLeafPointIndexes(leaf);
+		for (unsigned j = 0; j < leaf.pointCount; ++j)
+		{
+			pointLeafIndexes[indexes[j]] = static_cast<unsigned>(i);
+		}
+	}
+
 	return true;
 }
@@ -13,12 +13,52 @@
 #include <GenericCloud.h>
 #include <ScalarField.h>
 #include <ScalarFieldTools.h>
+#include "ParallelForHelper.h"
 
 //System
 #include <cstring>
 
 using namespace CCCoreLib;
 
+//! Computes partial results by chunks (in parallel if requested) and merges them in a fixed order
+/** The result doesn't depend on the threads scheduling.
+**/
+template <typename T, typename ChunkFunc, typename MergeFunc> static T ReduceByChunks(	std::size_t count,
+																						ChunkFunc&& computeChunk,
+																						MergeFunc&& merge,
+																						bool multiThread,
+																						int maxThreadCount)
+{
+	std::size_t chunkCount = (multiThread ? ParallelForHelper::ChunkCount(count, 16384, maxThreadCount) : 1);
+	if (chunkCount <= 1)
+	{
+		return computeChunk(0, count);
+	}
+
+	std::vector<T> partialResults;
+	try
+	{
+		partialResults.resize(chunkCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not enough memory: we'll process the values in a single pass
+		return computeChunk(0, count);
+	}
+
+	ParallelForHelper::ForEachChunk(count, chunkCount, [&](std::size_t chunkIndex, std::size_t begin, std::size_t end)
+	{
+		partialResults[chunkIndex] = computeChunk(begin, end);
+	}, multiThread, maxThreadCount);
+
+	T result = partialResults.front();
+	for (std::size_t i = 1; i < chunkCount; ++i)
+	{
+		merge(result, partialResults[i]);
+	}
+	return result;
+}
+
 //GAMMA function
 static double Gamma_cc(double x)
 {
@@ -155,72 +195,124 @@ bool WeibullDistribution::setParameters(ScalarType a, ScalarType b, ScalarType v
 };
 
 bool WeibullDistribution::computeParameters(const ScalarContainer& values)
+{
+	return computeParameters(values.data(), values.size(), false);
+}
+
+bool WeibullDistribution::computeParameters(const ScalarField& sf, bool multiThread/*=true*/, int maxThreadCount/*=0*/)
+{
+	return computeParameters(sf.data(), sf.size(), multiThread, maxThreadCount);
+}
+
+bool WeibullDistribution::computeParameters(const ScalarType* values, std::size_t n, bool multiThread/*=true*/, int maxThreadCount/*=0*/)
 {
 	setValid(false);
 
-	size_t n = values.size();
-	if (n == 0)
+	if (!values || n == 0)
 		return false;
 
 	//we look for the maximum value of the SF so as to avoid overflow
-	ScalarType minValue = 0;
-	ScalarType maxValue = 0;
-	bool firstValue = true;
-	for (ScalarType s : values)
+	struct MinMax
 	{
-		if (!ScalarField::ValidValue(s))
-			continue;
+		ScalarType minValue = 0;
+		ScalarType maxValue = 0;
+		bool isValid = false;
+	};
 
-		if (firstValue)
+	MinMax bounds = ReduceByChunks<MinMax>(n,
+		[values](std::size_t begin, std::size_t end)
 		{
-			minValue = maxValue = s;
-			firstValue = false;
-		}
-		else
+			MinMax chunkBounds;
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				ScalarType s = values[i];
+				if (!ScalarField::ValidValue(s))
+					continue;
+
+				if (!chunkBounds.isValid)
+				{
+					chunkBounds.minValue = chunkBounds.maxValue = s;
+					chunkBounds.isValid = true;
+				}
+				else if (s < chunkBounds.minValue)
+				{
+					chunkBounds.minValue = s;
+				}
+				else if (s > chunkBounds.maxValue)
+				{
+					chunkBounds.maxValue = s;
+				}
+			}
+			return chunkBounds;
+		},
+		[](MinMax& bounds, const MinMax& chunkBounds)
 		{
-			if (s < minValue)
-				minValue = s;
-			else if (s > maxValue)
-				maxValue = s;
-		}
-	}
+			if (!chunkBounds.isValid)
+				return;
+			if (!bounds.isValid)
+			{
+				bounds = chunkBounds;
+				return;
+			}
+			bounds.minValue = std::min(bounds.minValue, chunkBounds.minValue);
+			bounds.maxValue = std::max(bounds.maxValue, chunkBounds.maxValue);
+		},
+		multiThread, maxThreadCount);
 
-	if (firstValue)
+	if (!bounds.isValid)
 	{
 		//sf is only composed of NAN values?!
 		return false;
 	}
 
-	double valueRange = maxValue - minValue;
+	const ScalarType minValue = bounds.minValue;
+	double valueRange = bounds.maxValue - minValue;
 	if (valueRange < std::numeric_limits<ScalarType>::epsilon())
 	{
 		return false;
 	}
 
-	double a = FindGRoot(values, minValue, valueRange);
+	double a = FindGRoot(values, n, minValue, valueRange, multiThread, maxThreadCount);
 	if (a < 0.0)
 		return false;
 
 	//we can compute b
-	double b = 0;
-	unsigned counter = 0;
-	for (size_t i = 0; i < n; ++i)
+	struct PartialSum
 	{
-		ScalarType v = values[i];
-		if (ScalarField::ValidValue(v)) //we ignore NaN values
+		double sum = 0.0;
+		std::size_t counter = 0;
+	};
+
+	PartialSum b = ReduceByChunks<PartialSum>(n,
+		[&](std::size_t begin, std::size_t end)
 		{
-			if (v >= minValue)
+			PartialSum chunkSum;
+			for (std::size_t i = begin; i < end; ++i)
 			{
-				b += pow((static_cast<double>(v) - minValue) / valueRange, a);
-				++counter;
+				ScalarType v = values[i];
+				if (ScalarField::ValidValue(v)) //we ignore NaN values
+				{
+					if (v >= minValue)
+					{
+						chunkSum.sum += pow((static_cast<double>(v) - minValue) / valueRange, a);
+						++chunkSum.counter;
+					}
+				}
 			}
-		}
-	}
-	if (counter == 0)
+			return chunkSum;
+		},
+		[](PartialSum& sum, const PartialSum& chunkSum)
+		{
+			sum.sum += chunkSum.sum;
+			sum.counter += chunkSum.counter;
+		},
+		multiThread, maxThreadCount);
+
+	if (b.counter == 0)
 		return false;
 
 	return setParameters(	static_cast<ScalarType>(a),
-							static_cast<ScalarType>(valueRange * pow(b / counter, 1.0 / a)),
+							static_cast<ScalarType>(valueRange * pow(b.sum / b.counter, 1.0 / a)),
 							minValue );
 }
 
@@ -239,6 +331,15 @@ double WeibullDistribution::computePfromZero(ScalarType x) const
 	return (x <= m_valueShift ? 0.0 : 1.0 - exp(-pow(static_cast<double>(x - m_valueShift) / m_b, static_cast<double>(m_a))));
 }
 
+void WeibullDistribution::computeCumulativeProbabilities(const ScalarType* x, std::size_t count, double* p) const
+{
+	const double a = static_cast<double>(m_a);
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		p[i] = (x[i] <= m_valueShift ? 0.0 : 1.0 - exp(-pow(static_cast<double>(x[i] - m_valueShift) / m_b, a)));
+	}
+}
+
 double WeibullDistribution::computeP(ScalarType x1, ScalarType x2) const
 {
 	if (x1 < m_valueShift)
@@ -250,68 +351,88 @@ double WeibullDistribution::computeP(ScalarType x1, ScalarType x2) const
 	return exp(-pow(static_cast<double>(x1 - m_valueShift) / m_b, static_cast<double>(m_a))) - exp(-pow(static_cast<double>(x2 - m_valueShift) / m_b, static_cast<double>(m_a)));
 }
 
-double WeibullDistribution::ComputeG(const ScalarContainer& values, double r, ScalarType valueShift, double valueRange)
+double WeibullDistribution::ComputeG(const ScalarType* values, std::size_t n, double r, ScalarType valueShift, double valueRange, bool multiThread/*=false*/, int maxThreadCount/*=0*/)
 {
-	size_t n = values.size();
-
 	//a & n should be strictly positive!
 	if (r <= 0.0 || n == 0)
 		return 1.0; //a positive value means that ComputeG failed
 
-	double p = 0;
-	double q = 0;
-	double s = 0;
-	unsigned counter = 0;
-	unsigned zeroValues = 0;
-
-	for (unsigned i = 0; i < n; ++i)
+	//mergeable partial sums
+	struct GSums
 	{
-		ScalarType v = values[i];
-		if (ScalarField::ValidValue(v)) //we ignore NaN values
-		{
-			double v0 = static_cast<double>(v) - valueShift;
-			if ( GreaterThanEpsilon( v0 ) )
-			{
-				double ln_v = log(v0);
-				double v_a = pow(v0 / valueRange, r);
+		double p = 0.0;
+		double q = 0.0;
+		double s = 0.0;
+		std::size_t counter = 0;
+		std::size_t zeroValues = 0;
+	};
 
-				s += ln_v;
-				q += v_a;
-				p += v_a*ln_v;
+	//(v0 / valueRange)^r = exp(r * (ln(v0) - ln(valueRange))) so that we only need one log and one exp per value
+	const double logRange = log(valueRange);
 
-				++counter;
-			}
-			else
+	GSums sums = ReduceByChunks<GSums>(n,
+		[&](std::size_t begin, std::size_t end)
+		{
+			GSums chunkSums;
+			for (std::size_t i = begin; i < end; ++i)
 			{
-				++zeroValues;
+				ScalarType v = values[i];
+				if (ScalarField::ValidValue(v)) //we ignore NaN values
+				{
+					double v0 = static_cast<double>(v) - valueShift;
+					if ( GreaterThanEpsilon( v0 ) )
+					{
+						double ln_v = log(v0);
+						double v_a = exp(r * (ln_v - logRange));
+
+						chunkSums.s += ln_v;
+						chunkSums.q += v_a;
+						chunkSums.p += v_a*ln_v;
+
+						++chunkSums.counter;
+					}
+					else
+					{
+						++chunkSums.zeroValues;
+					}
+				}
 			}
-		}
-	}
-
-	if (zeroValues)
+			return chunkSums;
+		},
+		[](GSums& sums, const GSums& chunkSums)
+		{
+			sums.p += chunkSums.p;
+			sums.q += chunkSums.q;
+			sums.s += chunkSums.s;
+			sums.counter += chunkSums.counter;
+			sums.zeroValues += chunkSums.zeroValues;
+		},
+		multiThread, maxThreadCount);
+
+	if (sums.zeroValues)
 	{
-		const double ln_v = log(ZERO_TOLERANCE_D) * zeroValues;
+		const double ln_v = log(ZERO_TOLERANCE_D) * sums.zeroValues;
 		const double v_a = pow(ZERO_TOLERANCE_D / valueRange, static_cast<double>(r));
-		s += ln_v;
-		q += v_a * zeroValues;
-		p += ln_v * v_a;
-		counter += zeroValues;
+		sums.s += ln_v;
+		sums.q += v_a * sums.zeroValues;
+		sums.p += ln_v * v_a;
+		sums.counter += sums.zeroValues;
 	}
 
-	if (counter == 0)
+	if (sums.counter == 0)
 	{
 		return 1.0; //a positive value will make ComputeG fail
 	}
 
-	return (p / q - s / counter) * r - 1.0;
+	return (sums.p / sums.q - sums.s / sums.counter) * r - 1.0;
 }
 
-double WeibullDistribution::FindGRoot(const ScalarContainer& values, ScalarType valueShift, double valueRange)
+double WeibullDistribution::FindGRoot(const ScalarType* values, std::size_t n, ScalarType valueShift, double valueRange, bool multiThread/*=false*/, int maxThreadCount/*=0*/)
 {
 	double r = -1.0;
 	double aMin = 1.0;
 	double aMax = 1.0;
-	double v = ComputeG(values, aMin, valueShift, valueRange);
+	double v = ComputeG(values, n, aMin, valueShift, valueRange, multiThread, maxThreadCount);
 	double vMin = v;
 	double vMax = v;
 
@@ -319,7 +440,7 @@ double WeibullDistribution::FindGRoot(const ScalarContainer& values, ScalarType
 	while (vMin > 0 && GreaterThanEpsilon(aMin))
 	{
 		aMin /= 10;
-		vMin = ComputeG(values, aMin, valueShift, valueRange);
+		vMin = ComputeG(values, n, aMin, valueShift, valueRange, multiThread, maxThreadCount);
 	}
 
 	if (LessThanEpsilon(std::abs(vMin)))
@@ -335,7 +456,7 @@ double WeibullDistribution::FindGRoot(const ScalarContainer& values, ScalarType
 	while (vMax < 0 && aMax < 1.0e3)
 	{
 		aMax *= 2; //tends to become huge quickly as we compute x^a!!!!
-		vMax = ComputeG(values, aMax, valueShift, valueRange);
+		vMax = ComputeG(values, n, aMax, valueShift, valueRange, multiThread, maxThreadCount);
 	}
 
 	if (LessThanEpsilon(std::abs(vMax)))
@@ -352,7 +473,7 @@ double WeibullDistribution::FindGRoot(const ScalarContainer& values, ScalarType
 	{
 		r = (aMin + aMax) / 2;
 		double old_v = v;
-		v = ComputeG(values, r, valueShift, valueRange);
+		v = ComputeG(values, n, r, valueShift, valueRange, multiThread, maxThreadCount);
 
 		if (LessThanEpsilon(std::abs(old_v - v)))
 			return r;